@@ -118,18 +118,14 @@ ScreenController::ScreenController(QWidget *parent)
     usbMonitor = new USBMonitor(this);
     connect(usbMonitor, &USBMonitor::usbDeviceInserted, this, [](const USBDevice &device) {
         qDebug() << "USB inserted:" << device.description;
-        // Auto-attach to VM if running
-        if (VMManager::instance().isVMRunning()) {
-            VMManager::instance().attachUSBDevice(device.vendorId, device.productId);
-        }
+        // Auto-attach to VM now, or as soon as it is running
+        VMManager::instance().attachUSBDevice(device);
     });
     
     connect(usbMonitor, &USBMonitor::usbDeviceRemoved, this, [](const USBDevice &device) {
         qDebug() << "USB removed:" << device.identifier();
-        // Auto-detach from VM
-        if (VMManager::instance().isVMRunning()) {
-            VMManager::instance().detachUSBDevice(device.vendorId, device.productId);
-        }
+        // Auto-detach from VM (or drop a still-pending attach)
+        VMManager::instance().detachUSBDevice(device);
     });
     
     // Start monitoring USB devices
@@ -7,6 +7,7 @@
 #include <QDir>
 #include <QStandardPaths>
 #include <QDateTime>
+#include <QThread>
 
 DatabaseManager &DatabaseManager::instance()
 {
@@ -37,6 +38,7 @@ bool DatabaseManager::initialize(const QString &path)
         QSqlDatabase::removeDatabase("sandrive_connection");
     }
 
+    databasePath = dbPath;
     QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "sandrive_connection");
     db.setDatabaseName(dbPath);
     if (!db.open()) {
@@ -74,6 +76,60 @@ bool DatabaseManager::ensureTables(QString *error)
         return false;
     }
 
+    // scans table: one row per scan run
+    if (!q.exec("CREATE TABLE IF NOT EXISTS scans (id INTEGER PRIMARY KEY AUTOINCREMENT, kind TEXT NOT NULL, started_at TEXT NOT NULL, finished_at TEXT, user TEXT NOT NULL, root TEXT NOT NULL, files INTEGER DEFAULT 0, bytes INTEGER DEFAULT 0, errors INTEGER DEFAULT 0, duration_ms INTEGER DEFAULT 0, status TEXT)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+
+    // scan_files table: digests of every file a scan read
+    if (!q.exec("CREATE TABLE IF NOT EXISTS scan_files (id INTEGER PRIMARY KEY AUTOINCREMENT, scan_id INTEGER NOT NULL, path TEXT NOT NULL, size INTEGER, sha256 TEXT, sha1 TEXT, md5 TEXT, file_type TEXT, entropy REAL, known_bad INTEGER DEFAULT 0, error TEXT)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+    if (!q.exec("CREATE INDEX IF NOT EXISTS idx_scan_files_scan ON scan_files (scan_id)")
+        || !q.exec("CREATE INDEX IF NOT EXISTS idx_scan_files_sha256 ON scan_files (sha256)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+
+    // scan_hits table: signatures the detailed scan found in a scan_files row
+    if (!q.exec("CREATE TABLE IF NOT EXISTS scan_hits (id INTEGER PRIMARY KEY AUTOINCREMENT, scan_id INTEGER NOT NULL, file_id INTEGER NOT NULL, signature TEXT NOT NULL, offset INTEGER)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+    if (!q.exec("CREATE INDEX IF NOT EXISTS idx_scan_hits_scan ON scan_hits (scan_id)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+
+    // entropy_regions table: packed or encrypted stretches of an executable scan_files row
+    if (!q.exec("CREATE TABLE IF NOT EXISTS entropy_regions (id INTEGER PRIMARY KEY AUTOINCREMENT, scan_id INTEGER NOT NULL, file_id INTEGER NOT NULL, offset INTEGER, length INTEGER, entropy REAL)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+    if (!q.exec("CREATE INDEX IF NOT EXISTS idx_entropy_regions_scan ON entropy_regions (scan_id)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+
+    // scan_cache table: last verdict per file of each identified drive
+    if (!q.exec("CREATE TABLE IF NOT EXISTS scan_cache (volume TEXT NOT NULL, path TEXT NOT NULL, size INTEGER, mtime_ns INTEGER, inode INTEGER, ruleset TEXT NOT NULL, sha256 TEXT, sha1 TEXT, md5 TEXT, file_type TEXT, entropy REAL, high_entropy TEXT, hits TEXT, rules TEXT, error TEXT, updated_at TEXT, PRIMARY KEY (volume, path))")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+
+    // rule_hits table: detection rules whose condition held for a scan_files row
+    if (!q.exec("CREATE TABLE IF NOT EXISTS rule_hits (id INTEGER PRIMARY KEY AUTOINCREMENT, scan_id INTEGER NOT NULL, file_id INTEGER NOT NULL, rule TEXT NOT NULL)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+    if (!q.exec("CREATE INDEX IF NOT EXISTS idx_rule_hits_scan ON rule_hits (scan_id)")
+        || !q.exec("CREATE INDEX IF NOT EXISTS idx_rule_hits_rule ON rule_hits (rule)")) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+
     return true;
 }
 
@@ -287,3 +343,236 @@ bool DatabaseManager::deleteReport(int reportId, QString *error)
     }
     return q.numRowsAffected() > 0;
 }
+
+int DatabaseManager::startScan(const QString &kind, const QString &root, const QString &user, QString *error)
+{
+    QSqlDatabase db = QSqlDatabase::database("sandrive_connection");
+    QSqlQuery q(db);
+    q.prepare("INSERT INTO scans (kind, started_at, user, root, status) VALUES (:k, :ts, :u, :r, 'running')");
+    q.bindValue(":k", kind);
+    q.bindValue(":ts", QDateTime::currentDateTime().toString(Qt::ISODate));
+    q.bindValue(":u", user);
+    q.bindValue(":r", root);
+    if (!q.exec()) {
+        if (error) *error = q.lastError().text();
+        return -1;
+    }
+    return q.lastInsertId().toInt();
+}
+
+bool DatabaseManager::addScanFiles(int scanId, const QList<QVariantMap> &files, QString *error)
+{
+    QSqlDatabase db = QSqlDatabase::database("sandrive_connection");
+
+    // One transaction per batch; per-row commits would dominate on SD cards
+    db.transaction();
+    QSqlQuery q(db);
+    q.prepare("INSERT INTO scan_files (scan_id, path, size, sha256, sha1, md5, file_type, entropy, known_bad, error) VALUES (:s, :p, :sz, :h256, :h1, :md5, :ft, :en, :kb, :e)");
+    QSqlQuery hitQuery(db);
+    hitQuery.prepare("INSERT INTO scan_hits (scan_id, file_id, signature, offset) VALUES (:s, :f, :sig, :o)");
+    QSqlQuery ruleQuery(db);
+    ruleQuery.prepare("INSERT INTO rule_hits (scan_id, file_id, rule) VALUES (:s, :f, :r)");
+    QSqlQuery regionQuery(db);
+    regionQuery.prepare("INSERT INTO entropy_regions (scan_id, file_id, offset, length, entropy) VALUES (:s, :f, :o, :l, :en)");
+    for (const QVariantMap &file : files) {
+        q.bindValue(":s", scanId);
+        q.bindValue(":p", file["path"]);
+        q.bindValue(":sz", file["size"]);
+        q.bindValue(":h256", file["sha256"]);
+        q.bindValue(":h1", file["sha1"]);
+        q.bindValue(":md5", file["md5"]);
+        q.bindValue(":ft", file["file_type"]);
+        q.bindValue(":en", file["entropy"]);
+        q.bindValue(":kb", file["known_bad"].toBool() ? 1 : 0);
+        q.bindValue(":e", file["error"]);
+        if (!q.exec()) {
+            if (error) *error = q.lastError().text();
+            db.rollback();
+            return false;
+        }
+
+        const QVariantList hits = file["hits"].toList();
+        const QStringList rules = file["rules"].toStringList();
+        const QVariantList regions = file["high_entropy"].toList();
+        if (hits.isEmpty() && rules.isEmpty() && regions.isEmpty()) {
+            continue;
+        }
+        QVariant fileId = q.lastInsertId();
+        for (const QVariant &hit : hits) {
+            QVariantMap h = hit.toMap();
+            hitQuery.bindValue(":s", scanId);
+            hitQuery.bindValue(":f", fileId);
+            hitQuery.bindValue(":sig", h["signature"]);
+            hitQuery.bindValue(":o", h["offset"]);
+            if (!hitQuery.exec()) {
+                if (error) *error = hitQuery.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+        for (const QString &rule : rules) {
+            ruleQuery.bindValue(":s", scanId);
+            ruleQuery.bindValue(":f", fileId);
+            ruleQuery.bindValue(":r", rule);
+            if (!ruleQuery.exec()) {
+                if (error) *error = ruleQuery.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+        for (const QVariant &region : regions) {
+            QVariantMap r = region.toMap();
+            regionQuery.bindValue(":s", scanId);
+            regionQuery.bindValue(":f", fileId);
+            regionQuery.bindValue(":o", r["offset"]);
+            regionQuery.bindValue(":l", r["length"]);
+            regionQuery.bindValue(":en", r["entropy"]);
+            if (!regionQuery.exec()) {
+                if (error) *error = regionQuery.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+    }
+    if (!db.commit()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::finishScan(int scanId, const QVariantMap &stats, QString *error)
+{
+    QSqlDatabase db = QSqlDatabase::database("sandrive_connection");
+    QSqlQuery q(db);
+    q.prepare("UPDATE scans SET finished_at = :ts, files = :f, bytes = :b, errors = :e, duration_ms = :d, status = :st WHERE id = :id");
+    q.bindValue(":ts", QDateTime::currentDateTime().toString(Qt::ISODate));
+    q.bindValue(":f", stats["files"]);
+    q.bindValue(":b", stats["bytes"]);
+    q.bindValue(":e", stats["errors"]);
+    q.bindValue(":d", stats["duration_ms"]);
+    q.bindValue(":st", stats["status"]);
+    q.bindValue(":id", scanId);
+    if (!q.exec()) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+bool DatabaseManager::readScanCache(const QString &volume, const QString &ruleset,
+                                    const std::function<void(const QVariantMap &)> &visit, QString *error)
+{
+    if (QThread::currentThread() == thread()) {
+        QSqlDatabase db = QSqlDatabase::database("sandrive_connection");
+        return readScanCache(db, volume, ruleset, visit, error);
+    }
+
+    // A connection belongs to the thread that opened it; a scan being
+    // prepared in the background reads through its own for the call
+    QString name = QString("sandrive_reader_%1").arg(quintptr(QThread::currentThreadId()));
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", name);
+        db.setDatabaseName(databasePath);
+        if (!db.open()) {
+            if (error) *error = db.lastError().text();
+        } else {
+            ok = readScanCache(db, volume, ruleset, visit, error);
+            db.close();
+        }
+    }
+    QSqlDatabase::removeDatabase(name);
+    return ok;
+}
+
+bool DatabaseManager::readScanCache(QSqlDatabase &db, const QString &volume, const QString &ruleset,
+                                    const std::function<void(const QVariantMap &)> &visit, QString *error)
+{
+    QSqlQuery q(db);
+    q.setForwardOnly(true);
+    if (ruleset.isEmpty()) {
+        q.prepare("SELECT path, size, mtime_ns, inode, ruleset, sha256, sha1, md5, file_type, entropy, high_entropy, hits, rules, error FROM scan_cache WHERE volume = :v");
+    } else {
+        q.prepare("SELECT path, size, mtime_ns, inode, ruleset, sha256, sha1, md5, file_type, entropy, high_entropy, hits, rules, error FROM scan_cache WHERE volume = :v AND ruleset = :r");
+        q.bindValue(":r", ruleset);
+    }
+    q.bindValue(":v", volume);
+    if (!q.exec()) {
+        if (error) *error = q.lastError().text();
+        return false;
+    }
+    while (q.next()) {
+        QVariantMap row;
+        row["path"] = q.value(0);
+        row["size"] = q.value(1);
+        row["mtime_ns"] = q.value(2);
+        row["inode"] = q.value(3);
+        row["ruleset"] = q.value(4);
+        row["sha256"] = q.value(5);
+        row["sha1"] = q.value(6);
+        row["md5"] = q.value(7);
+        row["file_type"] = q.value(8);
+        row["entropy"] = q.value(9);
+        row["high_entropy"] = q.value(10);
+        row["hits"] = q.value(11);
+        row["rules"] = q.value(12);
+        row["error"] = q.value(13);
+        visit(row);
+    }
+    return true;
+}
+
+bool DatabaseManager::storeScanCache(const QString &volume, const QList<QVariantMap> &rows, QString *error)
+{
+    QSqlDatabase db = QSqlDatabase::database("sandrive_connection");
+
+    db.transaction();
+    QSqlQuery q(db);
+    q.prepare("INSERT OR REPLACE INTO scan_cache (volume, path, size, mtime_ns, inode, ruleset, sha256, sha1, md5, file_type, entropy, high_entropy, hits, rules, error, updated_at) "
+              "VALUES (:v, :p, :sz, :mt, :ino, :r, :h256, :h1, :md5, :ft, :en, :he, :hits, :rules, :e, :ts)");
+    // Archive members ("file//member") of a rescanned file are replaced as a set;
+    // the range covers every path starting with "file//" ('0' follows '/')
+    QSqlQuery dropMembers(db);
+    dropMembers.prepare("DELETE FROM scan_cache WHERE volume = :v AND path >= :lo AND path < :hi");
+    QString now = QDateTime::currentDateTime().toString(Qt::ISODate);
+    for (const QVariantMap &row : rows) {
+        QString path = row["path"].toString();
+        if (!path.contains("//")) {
+            dropMembers.bindValue(":v", volume);
+            dropMembers.bindValue(":lo", path + "//");
+            dropMembers.bindValue(":hi", path + "/0");
+            if (!dropMembers.exec()) {
+                if (error) *error = dropMembers.lastError().text();
+                db.rollback();
+                return false;
+            }
+        }
+        q.bindValue(":v", volume);
+        q.bindValue(":p", row["path"]);
+        q.bindValue(":sz", row["size"]);
+        q.bindValue(":mt", row["mtime_ns"]);
+        q.bindValue(":ino", row["inode"]);
+        q.bindValue(":r", row["ruleset"]);
+        q.bindValue(":h256", row["sha256"]);
+        q.bindValue(":h1", row["sha1"]);
+        q.bindValue(":md5", row["md5"]);
+        q.bindValue(":ft", row["file_type"]);
+        q.bindValue(":en", row["entropy"]);
+        q.bindValue(":he", row["high_entropy"]);
+        q.bindValue(":hits", row["hits"]);
+        q.bindValue(":rules", row["rules"]);
+        q.bindValue(":e", row["error"]);
+        q.bindValue(":ts", now);
+        if (!q.exec()) {
+            if (error) *error = q.lastError().text();
+            db.rollback();
+            return false;
+        }
+    }
+    if (!db.commit()) {
+        if (error) *error = db.lastError().text();
+        return false;
+    }
+    return true;
+}
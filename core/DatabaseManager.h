@@ -4,8 +4,12 @@
 #include <QObject>
 #include <QString>
 #include <QStringList>
+#include <QVariantMap>
+#include <functional>
 #include "AuthManager.h"
 
+class QSqlDatabase;
+
 class DatabaseManager : public QObject
 {
     Q_OBJECT
@@ -29,9 +33,31 @@ public:
     QList<QVariantMap> listReports();
     bool deleteReport(int reportId, QString *error = nullptr);
 
+    // Scan results: one scans row per run, one scan_files row per file, one
+    // scan_hits row per signature match, one rule_hits row per matching rule
+    // and one entropy_regions row per high-entropy region (file maps may
+    // carry "hits", a list of {signature, offset} maps, "rules", a list of
+    // rule names, "high_entropy", a list of {offset, length, entropy} maps,
+    // "file_type", "entropy" and "known_bad")
+    int startScan(const QString &kind, const QString &root, const QString &user, QString *error = nullptr);
+    bool addScanFiles(int scanId, const QList<QVariantMap> &files, QString *error = nullptr);
+    bool finishScan(int scanId, const QVariantMap &stats, QString *error = nullptr);
+
+    // Rescan cache: one scan_cache row per file or archive member of an identified drive (see
+    // ScanCache for the row layout). Rows are streamed to visit since a
+    // drive can hold millions of files; an empty ruleset reads them all.
+    // Reading may happen on any thread.
+    bool readScanCache(const QString &volume, const QString &ruleset,
+                       const std::function<void(const QVariantMap &)> &visit, QString *error = nullptr);
+    bool storeScanCache(const QString &volume, const QList<QVariantMap> &rows, QString *error = nullptr);
+
 private:
     explicit DatabaseManager(QObject *parent = nullptr);
     bool ensureTables(QString *error = nullptr);
+    bool readScanCache(QSqlDatabase &db, const QString &volume, const QString &ruleset,
+                       const std::function<void(const QVariantMap &)> &visit, QString *error);
+
+    QString databasePath;
 
     // non-copyable
     DatabaseManager(const DatabaseManager &) = delete;
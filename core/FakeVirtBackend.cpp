@@ -0,0 +1,129 @@
+#include "FakeVirtBackend.h"
+#include <QTimer>
+
+FakeVirtBackend::FakeVirtBackend(QObject *parent)
+    : FakeVirtBackend(std::make_shared<Domain>(), parent)
+{
+}
+
+FakeVirtBackend::FakeVirtBackend(std::shared_ptr<Domain> domain, QObject *parent)
+    : VirtBackend(parent)
+    , domain(std::move(domain))
+    , latencyMs(0)
+{
+}
+
+VirtBackend::Factory FakeVirtBackend::peerFactory() const
+{
+    std::shared_ptr<Domain> shared = domain;
+    int latency = latencyMs;
+    return [shared, latency](QObject *parent) -> VirtBackend * {
+        FakeVirtBackend *peer = new FakeVirtBackend(shared, parent);
+        peer->setLatency(latency);
+        return peer;
+    };
+}
+
+void FakeVirtBackend::setResponse(const QString &verb, const VirtResult &result)
+{
+    responses.insert(verb, result);
+}
+
+void FakeVirtBackend::clearResponse(const QString &verb)
+{
+    responses.remove(verb);
+}
+
+void FakeVirtBackend::setHandler(Handler h)
+{
+    handler = std::move(h);
+}
+
+void FakeVirtBackend::execute(const QStringList &command, Callback done, int timeoutMs)
+{
+    VirtResult result = respond(command);
+    // Latency past the timeout plays a command that never answers
+    if (latencyMs > timeoutMs) {
+        result = VirtResult();
+        result.error = "virsh command timed out";
+    }
+    // Always deliver asynchronously so callers see the same ordering as the real backend
+    QTimer::singleShot(qMin(latencyMs, timeoutMs), this, [done, result]() {
+        done(result);
+    });
+}
+
+bool FakeVirtBackend::watchDomain(const QString &domain)
+{
+    watchedDomain = domain;
+    QTimer::singleShot(0, this, [this]() {
+        emit eventStreamStarted(watchedDomain);
+    });
+    return true;
+}
+
+void FakeVirtBackend::injectEvent(const QString &event)
+{
+    if (watchedDomain.isEmpty()) {
+        return;
+    }
+    QTimer::singleShot(latencyMs, this, [this, event]() {
+        emit domainEvent(watchedDomain, event);
+    });
+}
+
+VirtResult FakeVirtBackend::respond(const QStringList &command)
+{
+    log << command;
+
+    if (handler) {
+        return handler(command);
+    }
+
+    QString verb = command.value(0);
+    if (responses.contains(verb)) {
+        return responses.value(verb);
+    }
+
+    return simulate(command);
+}
+
+VirtResult FakeVirtBackend::simulate(const QStringList &command)
+{
+    VirtResult result;
+    result.ok = true;
+
+    QString verb = command.value(0);
+    if (verb == "domstate") {
+        result.output = domain->running ? "running" : "shut off";
+    } else if (verb == "start" || verb == "restore") {
+        if (domain->running.exchange(true)) {
+            result.ok = false;
+            result.error = "error: Requested operation is not valid: domain is already active";
+        } else {
+            result.output = "Domain '" + command.value(1) + "' started";
+            injectEvent(verb == "restore" ? "Resumed" : "Started");
+        }
+    } else if (verb == "shutdown" || verb == "destroy") {
+        if (domain->running.exchange(false)) {
+            injectEvent("Stopped");
+        }
+        result.output = "Domain '" + command.value(1) + "' is being shutdown";
+    } else if (verb == "domifaddr") {
+        result.output = " Name       MAC address          Protocol     Address\n"
+                        "-------------------------------------------------------------------------------\n";
+        if (domain->running) {
+            result.output += " vnet0      52:54:00:12:34:56    ipv4         192.168.122.50/24";
+        }
+    } else if (verb == "attach-device" || verb == "detach-device") {
+        if (!domain->running) {
+            result.ok = false;
+            result.error = "error: Requested operation is not valid: domain is not running";
+        } else {
+            result.output = verb == "attach-device" ? "Device attached successfully"
+                                                    : "Device detached successfully";
+        }
+    }
+
+    return result;
+}
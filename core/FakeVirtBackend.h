@@ -0,0 +1,60 @@
+#ifndef FAKEVIRTBACKEND_H
+#define FAKEVIRTBACKEND_H
+
+#include "VirtBackend.h"
+#include <QHash>
+#include <QList>
+#include <atomic>
+#include <memory>
+
+// In-process stand-in for libvirt. By default it simulates a single domain
+// (start/shutdown/domstate/domifaddr/attach-device, plus lifecycle events);
+// tests can script any verb with setResponse() or setHandler() and inspect
+// commandLog(). Peers from peerFactory() share the simulated domain but keep
+// their own scripting and log.
+class FakeVirtBackend : public VirtBackend
+{
+    Q_OBJECT
+
+public:
+    using Handler = std::function<VirtResult(const QStringList &command)>;
+
+    explicit FakeVirtBackend(QObject *parent = nullptr);
+
+    void execute(const QStringList &command, Callback done, int timeoutMs = DefaultTimeoutMs) override;
+    QString name() const override { return "fake"; }
+    Factory peerFactory() const override;
+    bool watchDomain(const QString &domain) override;
+
+    // Scripting
+    void setResponse(const QString &verb, const VirtResult &result);
+    void clearResponse(const QString &verb);
+    void setHandler(Handler handler);
+    void setLatency(int ms) { latencyMs = ms; }
+    void setDomainRunning(bool running) { domain->running = running; }
+    bool isDomainRunning() const { return domain->running; }
+    // Deliver a lifecycle event for the watched domain as libvirt would
+    void injectEvent(const QString &event);
+
+    QList<QStringList> commandLog() const { return log; }
+    void clearLog() { log.clear(); }
+
+private:
+    struct Domain {
+        std::atomic<bool> running{false};
+    };
+
+    FakeVirtBackend(std::shared_ptr<Domain> domain, QObject *parent);
+
+    std::shared_ptr<Domain> domain;
+    QHash<QString, VirtResult> responses;
+    Handler handler;
+    QList<QStringList> log;
+    int latencyMs;
+    QString watchedDomain;
+
+    VirtResult respond(const QStringList &command);
+    VirtResult simulate(const QStringList &command);
+};
+
+#endif // FAKEVIRTBACKEND_H
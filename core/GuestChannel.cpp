@@ -0,0 +1,254 @@
+#include "GuestChannel.h"
+#include <QtEndian>
+#include <QDebug>
+
+namespace GuestProtocol {
+
+QByteArray encode(FrameType type, const QByteArray &payload)
+{
+    QByteArray frame;
+    frame.reserve(HeaderSize + payload.size());
+    frame.append('S');
+    frame.append('D');
+    frame.append(char(type));
+    frame.append(char(0));
+    char length[4];
+    qToBigEndian<quint32>(quint32(payload.size()), length);
+    frame.append(length, 4);
+    frame.append(payload);
+    return frame;
+}
+
+void FrameDecoder::feed(const QByteArray &data)
+{
+    buffer.append(data);
+}
+
+bool FrameDecoder::next(Frame &frame)
+{
+    for (;;) {
+        // Resynchronise on the magic, discarding anything before it
+        int magic = buffer.indexOf("SD");
+        if (magic < 0) {
+            // Keep a trailing 'S' that may be the first half of the magic
+            int keep = buffer.endsWith('S') ? 1 : 0;
+            dropped += buffer.size() - keep;
+            buffer = buffer.right(keep);
+            return false;
+        }
+        if (magic > 0) {
+            dropped += magic;
+            buffer.remove(0, magic);
+        }
+
+        if (buffer.size() < HeaderSize) {
+            return false;
+        }
+
+        quint32 length = qFromBigEndian<quint32>(buffer.constData() + 4);
+        if (length > MaxPayload) {
+            // Not a real header; skip this magic and look for the next one
+            dropped += 2;
+            buffer.remove(0, 2);
+            continue;
+        }
+        if (quint32(buffer.size()) < HeaderSize + length) {
+            return false;
+        }
+
+        frame.type = FrameType(quint8(buffer.at(2)));
+        frame.payload = buffer.mid(HeaderSize, int(length));
+        buffer.remove(0, HeaderSize + int(length));
+        return true;
+    }
+}
+
+} // namespace GuestProtocol
+
+using namespace GuestProtocol;
+
+GuestChannel::GuestChannel(QObject *parent)
+    : QObject(parent)
+    , socket(nullptr)
+    , helloSeen(false)
+{
+    // Until the agent answers, re-open the socket and repeat the handshake
+    retryTimer.setInterval(500);
+    connect(&retryTimer, &QTimer::timeout, this, &GuestChannel::tryConnect);
+
+    deadlineTimer.setSingleShot(true);
+    connect(&deadlineTimer, &QTimer::timeout, this, [this]() {
+        if (helloSeen) {
+            return;
+        }
+        qDebug() << "Guest agent did not answer on" << socketPath;
+        close();
+        emit connectTimedOut();
+    });
+}
+
+GuestChannel::~GuestChannel()
+{
+    close();
+}
+
+void GuestChannel::resetSocket()
+{
+    if (socket) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+        socket = nullptr;
+    }
+    decoder.reset();
+}
+
+void GuestChannel::connectToSocket(const QString &path, int timeoutMs)
+{
+    close();
+    socketPath = path;
+    deadlineTimer.start(timeoutMs);
+    retryTimer.start();
+    tryConnect();
+}
+
+void GuestChannel::tryConnect()
+{
+    if (helloSeen) {
+        retryTimer.stop();
+        return;
+    }
+
+    // QEMU accepts the connection as soon as the domain runs, long before the
+    // agent is up, so the socket may well be open already
+    if (socket && socket->state() == QLocalSocket::ConnectedState) {
+        send(Hello, "host");
+        return;
+    }
+
+    resetSocket();
+    socket = new QLocalSocket(this);
+    connect(socket, &QLocalSocket::readyRead, this, &GuestChannel::onReadyRead);
+    connect(socket, &QLocalSocket::disconnected, this, &GuestChannel::onSocketDisconnected);
+    connect(socket, &QLocalSocket::connected, this, [this]() {
+        send(Hello, "host");
+    });
+    socket->connectToServer(socketPath);
+}
+
+bool GuestChannel::adoptDescriptor(qintptr fd)
+{
+    close();
+    socket = new QLocalSocket(this);
+    connect(socket, &QLocalSocket::readyRead, this, &GuestChannel::onReadyRead);
+    connect(socket, &QLocalSocket::disconnected, this, &GuestChannel::onSocketDisconnected);
+    if (!socket->setSocketDescriptor(fd)) {
+        resetSocket();
+        return false;
+    }
+    send(Hello, "host");
+    return true;
+}
+
+void GuestChannel::close()
+{
+    retryTimer.stop();
+    deadlineTimer.stop();
+    resetSocket();
+    helloSeen = false;
+    version.clear();
+}
+
+void GuestChannel::send(FrameType type, const QByteArray &payload)
+{
+    if (!socket || socket->state() != QLocalSocket::ConnectedState) {
+        return;
+    }
+    socket->write(encode(type, payload));
+}
+
+void GuestChannel::openConsole()
+{
+    send(ConsoleOpen);
+}
+
+bool GuestChannel::sendConsoleInput(const QByteArray &data)
+{
+    if (!helloSeen) {
+        return false;
+    }
+    // Stay well under the agent's frame limit
+    for (int offset = 0; offset < data.size(); offset += 64 * 1024) {
+        send(ConsoleInput, data.mid(offset, 64 * 1024));
+    }
+    return true;
+}
+
+void GuestChannel::sendControl(const QString &command)
+{
+    send(Control, command.toUtf8());
+}
+
+void GuestChannel::ping()
+{
+    send(Ping);
+}
+
+void GuestChannel::onReadyRead()
+{
+    decoder.feed(socket->readAll());
+
+    Frame frame;
+    while (socket && decoder.next(frame)) {
+        handleFrame(frame);
+    }
+}
+
+void GuestChannel::handleFrame(const Frame &frame)
+{
+    switch (frame.type) {
+    case Hello:
+        if (!helloSeen) {
+            helloSeen = true;
+            version = QString::fromUtf8(frame.payload);
+            retryTimer.stop();
+            deadlineTimer.stop();
+            qDebug() << "Guest agent ready:" << version;
+            emit ready(version);
+        }
+        break;
+    case ConsoleOutput:
+        emit consoleOutput(frame.payload);
+        break;
+    case ConsoleClosed:
+        emit consoleClosed(frame.payload.toInt());
+        break;
+    case ControlResult: {
+        int space = frame.payload.indexOf(' ');
+        int status = frame.payload.left(space < 0 ? frame.payload.size() : space).toInt();
+        QString output = space < 0 ? QString() : QString::fromUtf8(frame.payload.mid(space + 1));
+        emit controlResult(status, output);
+        break;
+    }
+    case Ping:
+        send(Pong);
+        break;
+    case Pong:
+        emit pong();
+        break;
+    default:
+        qDebug() << "Ignoring guest frame type" << int(frame.type);
+        break;
+    }
+}
+
+void GuestChannel::onSocketDisconnected()
+{
+    bool wasReady = helloSeen;
+    helloSeen = false;
+    if (wasReady) {
+        retryTimer.stop();
+        emit disconnected();
+    }
+    // Before the handshake the retry timer simply reconnects
+}
@@ -0,0 +1,107 @@
+#ifndef GUESTCHANNEL_H
+#define GUESTCHANNEL_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QLocalSocket>
+#include <QTimer>
+
+// Framed protocol spoken with guest/sdui-agent.py over a virtio-serial port.
+//
+//   'S' 'D' | type (u8) | reserved (u8) | length (u32, big endian) | payload
+//
+// The magic lets the decoder resynchronise after stale bytes, which the port
+// can hold when either side reconnects.
+namespace GuestProtocol {
+
+enum FrameType : quint8 {
+    Hello = 0x01,          // guest -> host, payload: agent version
+    ConsoleOpen = 0x02,    // host -> guest, spawn the interactive shell
+    ConsoleInput = 0x03,   // host -> guest, raw bytes for the shell
+    ConsoleOutput = 0x04,  // guest -> host, raw bytes from the shell
+    ConsoleClosed = 0x05,  // guest -> host, payload: exit status as text
+    Control = 0x06,        // host -> guest, payload: control command ("sync", "poweroff", ...)
+    ControlResult = 0x07,  // guest -> host, payload: "<status> <output>"
+    Ping = 0x08,
+    Pong = 0x09
+};
+
+const int HeaderSize = 8;
+const quint32 MaxPayload = 1u << 20;
+
+QByteArray encode(FrameType type, const QByteArray &payload = QByteArray());
+
+struct Frame {
+    FrameType type;
+    QByteArray payload;
+};
+
+class FrameDecoder
+{
+public:
+    void feed(const QByteArray &data);
+    // Pops the next complete frame; returns false when more bytes are needed
+    bool next(Frame &frame);
+    void reset() { buffer.clear(); }
+    qint64 droppedBytes() const { return dropped; }
+
+private:
+    QByteArray buffer;
+    qint64 dropped = 0;
+};
+
+} // namespace GuestProtocol
+
+// Host end of the guest agent channel. Connects to the unix socket libvirt
+// binds for the virtio-serial port, or adopts an already-connected socket
+// descriptor (e.g. one end of a socketpair standing in for the guest).
+class GuestChannel : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit GuestChannel(QObject *parent = nullptr);
+    ~GuestChannel();
+
+    // Keep retrying the socket until the agent says hello or timeoutMs passes
+    void connectToSocket(const QString &path, int timeoutMs = 20000);
+    bool adoptDescriptor(qintptr fd);
+    void close();
+
+    bool isReady() const { return helloSeen; }
+    QString agentVersion() const { return version; }
+
+    void openConsole();
+    bool sendConsoleInput(const QByteArray &data);
+    void sendControl(const QString &command);
+    void ping();
+
+signals:
+    void ready(const QString &agentVersion);
+    void consoleOutput(const QByteArray &data);
+    void consoleClosed(int exitStatus);
+    void controlResult(int status, const QString &output);
+    void pong();
+    void connectTimedOut();
+    void disconnected();
+
+private slots:
+    void onReadyRead();
+    void onSocketDisconnected();
+    void tryConnect();
+
+private:
+    QLocalSocket *socket;
+    GuestProtocol::FrameDecoder decoder;
+    QString socketPath;
+    QTimer retryTimer;
+    QTimer deadlineTimer;
+    QString version;
+    bool helloSeen;
+
+    void send(GuestProtocol::FrameType type, const QByteArray &payload = QByteArray());
+    void handleFrame(const GuestProtocol::Frame &frame);
+    void resetSocket();
+};
+
+#endif // GUESTCHANNEL_H
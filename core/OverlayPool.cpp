@@ -0,0 +1,157 @@
+#include "OverlayPool.h"
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QtEndian>
+#include <QThreadPool>
+#include <QDateTime>
+#include <QDebug>
+
+namespace {
+
+// The backing file named in a qcow2 header, empty when there is none
+QString qcow2BackingFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    QByteArray header = file.read(20);
+    if (header.size() < 20 || !header.startsWith("QFI\xfb")) {
+        return QString();
+    }
+    const uchar *h = reinterpret_cast<const uchar *>(header.constData());
+    quint64 offset = qFromBigEndian<quint64>(h + 8);
+    quint32 size = qFromBigEndian<quint32>(h + 16);
+    if (offset == 0 || size == 0 || size > 1023 || !file.seek(qint64(offset))) {
+        return QString();
+    }
+    return QString::fromUtf8(file.read(size));
+}
+
+} // namespace
+
+OverlayPool::OverlayPool(const QString &backingImage, const QString &poolDir, const QString &prefix,
+                         int targetSize, QObject *parent)
+    : QObject(parent)
+    , backing(backingImage)
+    , dir(poolDir)
+    , prefix(prefix)
+    , targetSize(targetSize)
+    , serial(0)
+    , creating(nullptr)
+{
+}
+
+OverlayPool::~OverlayPool()
+{
+    if (creating) {
+        creating->disconnect();
+        creating->kill();
+        creating->waitForFinished(500);
+        QFile::remove(creatingPath);
+    }
+}
+
+void OverlayPool::start()
+{
+    QDir poolDir(dir);
+    if (!poolDir.exists() && !poolDir.mkpath(".")) {
+        qWarning() << "Cannot create overlay pool directory:" << dir;
+        return;
+    }
+
+    // Finished overlays carry the final name; half-written ones still end in .part
+    const QStringList leftovers = poolDir.entryList(QStringList() << prefix + "-*.qcow2.part", QDir::Files);
+    for (const QString &name : leftovers) {
+        discardAsync(poolDir.filePath(name));
+    }
+    const QStringList existing = poolDir.entryList(QStringList() << prefix + "-*.qcow2", QDir::Files, QDir::Name);
+    for (const QString &name : existing) {
+        QString path = poolDir.filePath(name);
+        if (isCurrent(path)) {
+            ready << path;
+        } else {
+            qDebug() << "Discarding overlay of an older image:" << path;
+            discardAsync(path);
+        }
+    }
+
+    qDebug() << "Overlay pool" << prefix << "adopted" << ready.size() << "overlay(s)";
+    fill();
+}
+
+QString OverlayPool::take()
+{
+    QString path = ready.isEmpty() ? QString() : ready.takeFirst();
+    fill();
+    return path;
+}
+
+void OverlayPool::fill()
+{
+    if (creating || ready.size() >= targetSize || !QFile::exists(backing)) {
+        return;
+    }
+
+    QString name = QString("%1-%2-%3.qcow2")
+                       .arg(prefix)
+                       .arg(QDateTime::currentMSecsSinceEpoch())
+                       .arg(serial++);
+    QString finalPath = QDir(dir).filePath(name);
+    creatingPath = finalPath + ".part";
+
+    creating = new QProcess(this);
+    connect(creating, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [this, finalPath](int exitCode, QProcess::ExitStatus exitStatus) {
+        QProcess *proc = creating;
+        creating = nullptr;
+        proc->deleteLater();
+
+        if (exitStatus != QProcess::NormalExit || exitCode != 0
+            || !QFile::rename(creatingPath, finalPath)) {
+            qWarning() << "Failed to create overlay:" << proc->readAllStandardError();
+            QFile::remove(creatingPath);
+            return;
+        }
+
+        ready << finalPath;
+        emit overlayReady(ready.size());
+        fill();
+    });
+    connect(creating, &QProcess::errorOccurred, this, [this](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart || !creating) {
+            return;
+        }
+        qWarning() << "qemu-img unavailable; overlay pool disabled";
+        creating->deleteLater();
+        creating = nullptr;
+    });
+
+    creating->start("qemu-img", QStringList() << "create" << "-q" << "-f" << "qcow2" << "-F" << "qcow2"
+                                << "-b" << backing << creatingPath);
+}
+
+// Setup may have frozen a new image since the overlay was made; its
+// clusters would then be read through a different disk
+bool OverlayPool::isCurrent(const QString &overlay) const
+{
+    QString named = qcow2BackingFile(overlay);
+    if (named.isEmpty()) {
+        return false;
+    }
+    QFileInfo actual(QDir(dir).absoluteFilePath(named));
+    QFileInfo expected(backing);
+    return actual.exists() && actual.canonicalFilePath() == expected.canonicalFilePath()
+        && QFileInfo(overlay).lastModified() >= expected.lastModified();
+}
+
+void OverlayPool::discardAsync(const QString &path)
+{
+    // Removing a well-used qcow2 can take a while on slow storage
+    QThreadPool::globalInstance()->start([path]() {
+        if (!QFile::remove(path)) {
+            qWarning() << "Failed to discard overlay:" << path;
+        }
+    });
+}
@@ -0,0 +1,51 @@
+#ifndef OVERLAYPOOL_H
+#define OVERLAYPOOL_H
+
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+
+// Keeps a few ready-made copy-on-write qcow2 overlays of one backing image
+// so a session can claim a clean disk with a rename instead of waiting on
+// `qemu-img create`. Overlays are created one at a time in the background.
+class OverlayPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    OverlayPool(const QString &backingImage, const QString &poolDir, const QString &prefix,
+                int targetSize = 2, QObject *parent = nullptr);
+    ~OverlayPool();
+
+    // Adopt overlays left from a previous run (those still on top of the
+    // current backing image) and start filling
+    void start();
+
+    // Returns a ready overlay path (ownership passes to the caller) or an
+    // empty string when the pool is drained; a refill is scheduled either way
+    QString take();
+
+    int readyCount() const { return ready.size(); }
+    QString backingImage() const { return backing; }
+
+    // Delete a used overlay on a worker thread
+    static void discardAsync(const QString &path);
+
+signals:
+    void overlayReady(int readyCount);
+
+private:
+    QString backing;
+    QString dir;
+    QString prefix;
+    int targetSize;
+    int serial;
+    QStringList ready;
+    QProcess *creating;
+    QString creatingPath;
+
+    void fill();
+    bool isCurrent(const QString &overlay) const;
+};
+
+#endif // OVERLAYPOOL_H
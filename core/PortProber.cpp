@@ -0,0 +1,142 @@
+#include "PortProber.h"
+#include <QtMath>
+#include <QDebug>
+#include <algorithm>
+
+PortProber::PortProber(QObject *parent)
+    : QObject(parent)
+    , port(0)
+    , socket(nullptr)
+    , attemptStartMs(0)
+    , initialDelayMs(50)
+    , maxDelayMs(1000)
+    , backoffFactor(2.0)
+    , attemptTimeoutMs(1000)
+    , active(false)
+{
+    attemptTimer.setSingleShot(true);
+    connect(&attemptTimer, &QTimer::timeout, this, [this]() {
+        finishAttempt(false, "connect timed out");
+    });
+
+    backoffTimer.setSingleShot(true);
+    connect(&backoffTimer, &QTimer::timeout, this, &PortProber::attemptConnect);
+
+    deadlineTimer.setSingleShot(true);
+    connect(&deadlineTimer, &QTimer::timeout, this, [this]() {
+        if (!active) {
+            return;
+        }
+        qDebug() << "Port" << host << port << "still closed after" << summary();
+        int count = history.size();
+        cancel();
+        emit deadlineExceeded(host, port, count);
+    });
+}
+
+void PortProber::setBackoff(int initialMs, int maxMs, double factor)
+{
+    initialDelayMs = initialMs;
+    maxDelayMs = maxMs;
+    backoffFactor = factor;
+}
+
+void PortProber::start(const QString &targetHost, quint16 targetPort, int deadlineMs)
+{
+    cancel();
+    host = targetHost;
+    port = targetPort;
+    history.clear();
+    active = true;
+    clock.start();
+    deadlineTimer.start(deadlineMs);
+    attemptConnect();
+}
+
+void PortProber::cancel()
+{
+    active = false;
+    attemptTimer.stop();
+    backoffTimer.stop();
+    deadlineTimer.stop();
+    dropSocket();
+}
+
+void PortProber::dropSocket()
+{
+    if (socket) {
+        socket->disconnect(this);
+        socket->abort();
+        socket->deleteLater();
+        socket = nullptr;
+    }
+}
+
+void PortProber::attemptConnect()
+{
+    if (!active) {
+        return;
+    }
+
+    socket = new QTcpSocket(this);
+    connect(socket, &QTcpSocket::connected, this, [this]() {
+        finishAttempt(true, QString());
+    });
+    connect(socket, &QAbstractSocket::errorOccurred, this, [this](QAbstractSocket::SocketError) {
+        finishAttempt(false, socket->errorString());
+    });
+
+    attemptStartMs = clock.elapsed();
+    attemptTimer.start(attemptTimeoutMs);
+    socket->connectToHost(host, port);
+}
+
+void PortProber::finishAttempt(bool open, const QString &error)
+{
+    if (!active || !socket) {
+        return;
+    }
+    attemptTimer.stop();
+    dropSocket();
+
+    qint64 now = clock.elapsed();
+    history.append({int(history.size()) + 1, attemptStartMs, now - attemptStartMs, open, error});
+
+    if (open) {
+        active = false;
+        deadlineTimer.stop();
+        emit portOpen(host, port, now);
+        return;
+    }
+
+    // Never sleep past the deadline; its timer ends the probe
+    backoffTimer.start(nextDelayMs());
+}
+
+int PortProber::nextDelayMs() const
+{
+    double delay = initialDelayMs * qPow(backoffFactor, qMax(0, int(history.size()) - 1));
+    return int(qMin(delay, double(maxDelayMs)));
+}
+
+QString PortProber::summary() const
+{
+    if (history.isEmpty()) {
+        return "0 attempts";
+    }
+    qint64 minLatency = history.first().latencyMs;
+    qint64 maxLatency = minLatency;
+    qint64 total = 0;
+    for (const Attempt &a : history) {
+        minLatency = std::min(minLatency, a.latencyMs);
+        maxLatency = std::max(maxLatency, a.latencyMs);
+        total += a.latencyMs;
+    }
+    return QString("%1 attempts in %2 ms, connect latency min/avg/max %3/%4/%5 ms, last: %6")
+        .arg(history.size())
+        .arg(clock.elapsed())
+        .arg(minLatency)
+        .arg(total / history.size())
+        .arg(maxLatency)
+        .arg(history.last().open ? QString("open") : history.last().error);
+}
@@ -0,0 +1,68 @@
+#ifndef PORTPROBER_H
+#define PORTPROBER_H
+
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QVector>
+
+// Waits for a TCP port to accept connections without forking anything.
+// Attempts are plain non-blocking QTcpSocket connects spaced by an
+// exponential backoff, so a refused port is retried within milliseconds
+// while an unreachable host is not hammered.
+class PortProber : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Attempt {
+        int number;
+        qint64 startedMs;  // since start()
+        qint64 latencyMs;  // until connected, refused or timed out
+        bool open;
+        QString error;
+    };
+
+    explicit PortProber(QObject *parent = nullptr);
+
+    // Delay before attempt n+1 is initialMs * factor^n, capped at maxMs
+    void setBackoff(int initialMs, int maxMs, double factor = 2.0);
+    // Longest a single connect may hang (e.g. SYNs to a guest without network)
+    void setAttemptTimeout(int ms) { attemptTimeoutMs = ms; }
+
+    void start(const QString &host, quint16 port, int deadlineMs);
+    void cancel();
+    bool isActive() const { return active; }
+
+    const QVector<Attempt> &attempts() const { return history; }
+    qint64 elapsedMs() const { return clock.isValid() ? clock.elapsed() : 0; }
+    QString summary() const;
+
+signals:
+    void portOpen(const QString &host, quint16 port, qint64 elapsedMs);
+    void deadlineExceeded(const QString &host, quint16 port, int attemptCount);
+
+private:
+    QString host;
+    quint16 port;
+    QTcpSocket *socket;
+    QTimer attemptTimer;   // per-attempt connect timeout
+    QTimer backoffTimer;   // delay before the next attempt
+    QTimer deadlineTimer;  // overall deadline
+    QElapsedTimer clock;
+    qint64 attemptStartMs;
+    QVector<Attempt> history;
+    int initialDelayMs;
+    int maxDelayMs;
+    double backoffFactor;
+    int attemptTimeoutMs;
+    bool active;
+
+    void attemptConnect();
+    void finishAttempt(bool open, const QString &error);
+    void dropSocket();
+    int nextDelayMs() const;
+};
+
+#endif // PORTPROBER_H
@@ -0,0 +1,112 @@
+#include "SysfsUSBEnumerator.h"
+#include <QDir>
+#include <QFile>
+#include <QHash>
+
+SysfsUSBEnumerator::SysfsUSBEnumerator(const QString &root)
+    : sysRoot(root)
+{
+}
+
+QString SysfsUSBEnumerator::defaultRoot()
+{
+    QString root = qEnvironmentVariable("SDUI_SYSFS_ROOT");
+    return root.isEmpty() ? "/sys" : root;
+}
+
+QString SysfsUSBEnumerator::readAttribute(const QString &dir, const char *name)
+{
+    // sysfs attributes are tiny; one read returns the whole value
+    QFile file(dir + "/" + name);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QString::fromUtf8(file.read(256)).trimmed();
+}
+
+bool SysfsUSBEnumerator::readDeviceDir(const QString &dir, const QString &name, USBDevice *device) const
+{
+    device->vendorId = readAttribute(dir, "idVendor");
+    device->productId = readAttribute(dir, "idProduct");
+    if (device->vendorId.isEmpty() || device->productId.isEmpty()) {
+        return false;
+    }
+
+    // Same zero-padded form lsusb prints
+    device->bus = readAttribute(dir, "busnum").rightJustified(3, '0');
+    device->device = readAttribute(dir, "devnum").rightJustified(3, '0');
+    device->serial = readAttribute(dir, "serial");
+    device->portPath = name;
+    device->deviceClass = readAttribute(dir, "bDeviceClass").toInt(nullptr, 16);
+
+    QString manufacturer = readAttribute(dir, "manufacturer");
+    QString product = readAttribute(dir, "product");
+    device->description = QString("%1 %2").arg(manufacturer, product).trimmed();
+    if (device->description.isEmpty()) {
+        device->description = device->usbId();
+    }
+    return true;
+}
+
+QList<USBDevice> SysfsUSBEnumerator::enumerate() const
+{
+    QList<USBDevice> devices;
+    QDir busDir(sysRoot + "/bus/usb/devices");
+
+    // Devices are named "1-1.2" (or "usb1" for root hubs); their interfaces
+    // "1-1.2:1.0". The entries are symlinks into /sys/devices.
+    const QStringList entries = busDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+
+    QHash<QString, QList<USBInterface>> interfaces;
+    for (const QString &name : entries) {
+        QString path = busDir.filePath(name);
+        int colon = name.indexOf(':');
+        if (colon > 0) {
+            USBInterface iface;
+            if (readInterfaceDir(path, &iface)) {
+                interfaces[name.left(colon)].append(iface);
+            }
+            continue;
+        }
+
+        USBDevice device;
+        if (readDeviceDir(path, name, &device)) {
+            devices.append(device);
+        }
+    }
+
+    for (USBDevice &device : devices) {
+        device.interfaces = interfaces.value(device.portPath);
+    }
+    return devices;
+}
+
+bool SysfsUSBEnumerator::readDevice(const QString &devPath, USBDevice *device) const
+{
+    QString dir = sysRoot + devPath;
+    QString name = devPath.section('/', -1);
+    if (!readDeviceDir(dir, name, device)) {
+        return false;
+    }
+
+    // Interfaces live in subdirectories named "<name>:<config>.<n>"; at
+    // hotplug "add" time they may not have been created yet
+    const QStringList interfaces = QDir(dir).entryList(QStringList() << name + ":*", QDir::Dirs, QDir::Name);
+    device->interfaces.clear();
+    for (const QString &ifaceName : interfaces) {
+        USBInterface iface;
+        if (readInterfaceDir(dir + "/" + ifaceName, &iface)) {
+            device->interfaces.append(iface);
+        }
+    }
+    return true;
+}
+
+bool SysfsUSBEnumerator::readInterfaceDir(const QString &dir, USBInterface *iface)
+{
+    bool ok = false;
+    iface->interfaceClass = readAttribute(dir, "bInterfaceClass").toInt(&ok, 16);
+    iface->subClass = readAttribute(dir, "bInterfaceSubClass").toInt(nullptr, 16);
+    iface->protocol = readAttribute(dir, "bInterfaceProtocol").toInt(nullptr, 16);
+    return ok;
+}
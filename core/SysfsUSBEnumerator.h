@@ -0,0 +1,34 @@
+#ifndef SYSFSUSBENUMERATOR_H
+#define SYSFSUSBENUMERATOR_H
+
+#include "USBDevice.h"
+#include <QList>
+#include <QString>
+
+// Lists USB devices straight from sysfs (<root>/bus/usb/devices) in one pass,
+// without spawning lsusb. The root defaults to /sys and can be redirected
+// with SDUI_SYSFS_ROOT so tests and benchmarks can use a synthetic tree.
+class SysfsUSBEnumerator
+{
+public:
+    explicit SysfsUSBEnumerator(const QString &root = defaultRoot());
+
+    static QString defaultRoot();
+    QString root() const { return sysRoot; }
+
+    // Every device (hubs included) with its interfaces filled in
+    QList<USBDevice> enumerate() const;
+
+    // A single device from its DEVPATH as reported by a uevent, e.g.
+    // "/devices/pci0000:00/0000:00:14.0/usb1/1-1"
+    bool readDevice(const QString &devPath, USBDevice *device) const;
+
+private:
+    QString sysRoot;
+
+    bool readDeviceDir(const QString &dir, const QString &name, USBDevice *device) const;
+    static QString readAttribute(const QString &dir, const char *name);
+    static bool readInterfaceDir(const QString &dir, USBInterface *iface);
+};
+
+#endif // SYSFSUSBENUMERATOR_H
@@ -0,0 +1,216 @@
+#include "USBClassifier.h"
+#include <QDebug>
+
+namespace {
+
+struct CategoryName {
+    const char *name;
+    quint32 bits;
+};
+
+const CategoryName kCategoryNames[] = {
+    { "storage",   USBClassifier::Storage },
+    { "hid",       USBClassifier::HID },
+    { "keyboard",  USBClassifier::Keyboard },
+    { "mouse",     USBClassifier::Mouse },
+    { "hub",       USBClassifier::Hub },
+    { "audio",     USBClassifier::Audio },
+    { "video",     USBClassifier::Video },
+    { "comm",      USBClassifier::Comm },
+    { "wireless",  USBClassifier::Wireless },
+    { "printer",   USBClassifier::Printer },
+    { "imaging",   USBClassifier::Imaging },
+    { "smartcard", USBClassifier::SmartCard },
+    { "vendor",    USBClassifier::Vendor },
+    { "other",     USBClassifier::Other },
+    { "unknown",   USBClassifier::Unknown },
+    { "*",         USBClassifier::Any },
+};
+
+// USB-IF base class codes
+quint32 categoryForClass(int cls, int subClass, int protocol)
+{
+    switch (cls) {
+    case 0x01: return USBClassifier::Audio;
+    case 0x02: return USBClassifier::Comm;
+    case 0x03:
+        // Boot interface subclass 1: protocol 1 keyboard, 2 mouse
+        if (subClass == 1 && protocol == 1) {
+            return USBClassifier::HID | USBClassifier::Keyboard;
+        }
+        if (subClass == 1 && protocol == 2) {
+            return USBClassifier::HID | USBClassifier::Mouse;
+        }
+        return USBClassifier::HID;
+    case 0x06: return USBClassifier::Imaging;
+    case 0x07: return USBClassifier::Printer;
+    case 0x08: return USBClassifier::Storage;
+    case 0x09: return USBClassifier::Hub;
+    case 0x0a: return USBClassifier::Comm;
+    case 0x0b: return USBClassifier::SmartCard;
+    case 0x0e: return USBClassifier::Video;
+    case 0xe0: return USBClassifier::Wireless;
+    case 0xff: return USBClassifier::Vendor;
+    default:   return USBClassifier::Other;
+    }
+}
+
+} // namespace
+
+USBClassifier& USBClassifier::instance()
+{
+    static USBClassifier instance;
+    return instance;
+}
+
+USBClassifier::USBClassifier()
+{
+    QString text = qEnvironmentVariable("SDUI_USB_POLICY");
+    QString error;
+    if (!text.isEmpty()) {
+        rules = parsePolicy(text, &error);
+        if (!error.isEmpty()) {
+            qWarning() << "Ignoring SDUI_USB_POLICY:" << error;
+        }
+    }
+    if (rules.isEmpty()) {
+        rules = parsePolicy(defaultPolicyText());
+    }
+    qDebug() << "USB passthrough policy:" << policyText();
+}
+
+QString USBClassifier::defaultPolicyText()
+{
+    return "deny:hub,hid; attach:storage; deny:*";
+}
+
+quint32 USBClassifier::classify(const USBDevice &device)
+{
+    if (device.interfaces.isEmpty()) {
+        // Without interfaces only a specific device class says anything
+        // (0x00 defers to the interfaces, 0xef is "miscellaneous")
+        if (device.deviceClass != 0 && device.deviceClass != 0xef) {
+            return categoryForClass(device.deviceClass, 0, 0);
+        }
+        return Unknown;
+    }
+
+    quint32 categories = device.deviceClass == 0x09 ? quint32(Hub) : 0;
+    for (const USBInterface &iface : device.interfaces) {
+        categories |= categoryForClass(iface.interfaceClass, iface.subClass, iface.protocol);
+    }
+    return categories;
+}
+
+USBClassifier::Verdict USBClassifier::evaluate(quint32 categories) const
+{
+    for (const Rule &rule : rules) {
+        if (rule.categories & categories) {
+            return rule.verdict;
+        }
+    }
+    return Verdict::Deny;
+}
+
+USBClassifier::Verdict USBClassifier::verdictFor(const USBDevice &device)
+{
+    // Same port and serial but another model means another device
+    QString key = device.identifier() + "|" + device.usbId();
+    auto it = cache.constFind(key);
+    if (it != cache.constEnd()) {
+        return it.value();
+    }
+
+    quint32 categories = classify(device);
+    Verdict verdict = evaluate(categories);
+    qDebug() << "USB" << device.identifier() << "is" << categoryNames(categories)
+             << "->" << (verdict == Verdict::Attach ? "attach" : "deny");
+
+    // Unknown means the interfaces were not readable yet; decide again next time
+    if (categories != Unknown) {
+        cache.insert(key, verdict);
+    }
+    return verdict;
+}
+
+void USBClassifier::forget(const USBDevice &device)
+{
+    cache.remove(device.identifier() + "|" + device.usbId());
+}
+
+void USBClassifier::setPolicy(const QList<Rule> &newRules)
+{
+    rules = newRules;
+    cache.clear();
+}
+
+QList<USBClassifier::Rule> USBClassifier::parsePolicy(const QString &text, QString *error)
+{
+    // "action:category,category; action:category; ..."
+    QList<Rule> parsed;
+    const QStringList clauses = text.split(';', Qt::SkipEmptyParts);
+    for (const QString &clause : clauses) {
+        QString action = clause.section(':', 0, 0).trimmed().toLower();
+        QString names = clause.section(':', 1);
+
+        Rule rule;
+        if (action == "attach") {
+            rule.verdict = Verdict::Attach;
+        } else if (action == "deny") {
+            rule.verdict = Verdict::Deny;
+        } else {
+            if (error) {
+                *error = "unknown action '" + action + "'";
+            }
+            return QList<Rule>();
+        }
+
+        rule.categories = 0;
+        const QStringList categories = names.split(',', Qt::SkipEmptyParts);
+        for (const QString &raw : categories) {
+            QString name = raw.trimmed().toLower();
+            quint32 bits = 0;
+            for (const CategoryName &entry : kCategoryNames) {
+                if (name == entry.name) {
+                    bits = entry.bits;
+                    break;
+                }
+            }
+            if (!bits) {
+                if (error) {
+                    *error = "unknown category '" + name + "'";
+                }
+                return QList<Rule>();
+            }
+            rule.categories |= bits;
+        }
+        if (rule.categories) {
+            parsed.append(rule);
+        }
+    }
+    return parsed;
+}
+
+QString USBClassifier::categoryNames(quint32 categories)
+{
+    if (categories == Any) {
+        return "*";
+    }
+    QStringList names;
+    for (const CategoryName &entry : kCategoryNames) {
+        if (entry.bits != Any && (categories & entry.bits)) {
+            names << entry.name;
+        }
+    }
+    return names.join(',');
+}
+
+QString USBClassifier::policyText() const
+{
+    QStringList clauses;
+    for (const Rule &rule : rules) {
+        clauses << QString("%1:%2").arg(rule.verdict == Verdict::Attach ? "attach" : "deny",
+                                        categoryNames(rule.categories));
+    }
+    return clauses.join("; ");
+}
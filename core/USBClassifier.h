@@ -0,0 +1,81 @@
+#ifndef USBCLASSIFIER_H
+#define USBCLASSIFIER_H
+
+#include "USBDevice.h"
+#include <QHash>
+#include <QList>
+#include <QString>
+
+// Decides which USB devices are passed through to the VM. A device is
+// classified once from its interface class/subclass/protocol triples, and
+// the verdict is cached by identity (port path + serial) until the device
+// is removed, so repeated inserts never reach libvirt for devices the
+// policy rejects.
+//
+// The policy is an ordered rule list; the first rule naming any of the
+// device's categories decides. The default,
+//
+//     deny:hub,hid; attach:storage; deny:*
+//
+// keeps the kiosk's own keyboard and touch controller (HID) on the host and
+// refuses combined storage+HID devices. SDUI_USB_POLICY overrides it.
+class USBClassifier
+{
+public:
+    enum Category : quint32 {
+        Storage   = 1u << 0,
+        HID       = 1u << 1,
+        Keyboard  = 1u << 2,   // HID boot keyboard
+        Mouse     = 1u << 3,   // HID boot mouse
+        Hub       = 1u << 4,
+        Audio     = 1u << 5,
+        Video     = 1u << 6,
+        Comm      = 1u << 7,   // CDC control/data, incl. network adapters
+        Wireless  = 1u << 8,   // Bluetooth and other radio controllers
+        Printer   = 1u << 9,
+        Imaging   = 1u << 10,
+        SmartCard = 1u << 11,
+        Vendor    = 1u << 12,
+        Other     = 1u << 13,
+        Unknown   = 1u << 14,  // interfaces not readable (yet)
+        Any       = 0xffffffffu
+    };
+
+    enum class Verdict { Attach, Deny };
+
+    struct Rule {
+        quint32 categories;
+        Verdict verdict;
+    };
+
+    static USBClassifier& instance();
+
+    // Category bits of every interface (or the device class when set)
+    static quint32 classify(const USBDevice &device);
+
+    // Cached policy decision for this physical device
+    Verdict verdictFor(const USBDevice &device);
+    bool shouldAttach(const USBDevice &device) { return verdictFor(device) == Verdict::Attach; }
+    // Unplugged: whatever comes next on its port is classified afresh
+    void forget(const USBDevice &device);
+
+    // Replaces the rules and drops cached verdicts
+    void setPolicy(const QList<Rule> &rules);
+    QString policyText() const;
+
+    static QString defaultPolicyText();
+    static QList<Rule> parsePolicy(const QString &text, QString *error = nullptr);
+    static QString categoryNames(quint32 categories);
+
+private:
+    USBClassifier();
+    USBClassifier(const USBClassifier&) = delete;
+    USBClassifier& operator=(const USBClassifier&) = delete;
+
+    QList<Rule> rules;
+    QHash<QString, Verdict> cache;
+
+    Verdict evaluate(quint32 categories) const;
+};
+
+#endif // USBCLASSIFIER_H
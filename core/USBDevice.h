@@ -0,0 +1,50 @@
+#ifndef USBDEVICE_H
+#define USBDEVICE_H
+
+#include <QString>
+#include <QList>
+
+struct USBInterface {
+    int interfaceClass = 0;     // bInterfaceClass, e.g. 0x08 mass storage, 0x03 HID
+    int subClass = 0;           // bInterfaceSubClass
+    int protocol = 0;           // bInterfaceProtocol
+};
+
+struct USBDevice {
+    QString vendorId;
+    QString productId;
+    QString bus;
+    QString device;
+    QString description;
+    QString serial;
+    QString portPath;             // sysfs name: bus-port[.port...], e.g. "1-1.2"
+    int deviceClass = 0;          // bDeviceClass; 0 means "see interfaces"
+    QList<USBInterface> interfaces;  // every interface of the active configuration
+    
+    // Identity of one physical device: where it is plugged in plus its serial
+    // (or its model when it has none), so identical models on different
+    // ports stay distinct
+    QString identifier() const {
+        if (portPath.isEmpty()) {
+            return usbId();
+        }
+        return QString("%1#%2").arg(portPath, serial.isEmpty() ? usbId() : serial);
+    }
+
+    // Still the same plug-in: the kernel gives every enumeration a new device
+    // number, so a serial-less stick swapped for one of the same model on the
+    // same port is told apart too
+    bool sameDevice(const USBDevice &other) const {
+        if (identifier() != other.identifier() || usbId() != other.usbId()) {
+            return false;
+        }
+        return bus.isEmpty() || other.bus.isEmpty() || (bus == other.bus && device == other.device);
+    }
+
+    // Model only, e.g. "0781:5567"
+    QString usbId() const {
+        return QString("%1:%2").arg(vendorId, productId);
+    }
+};
+
+#endif // USBDEVICE_H
@@ -1,10 +1,20 @@
 #include "USBMonitor.h"
+#include "SysfsUSBEnumerator.h"
 #include <QDebug>
-#include <QRegularExpression>
+#include <QHash>
+
+#ifdef Q_OS_LINUX
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
 
 USBMonitor::USBMonitor(QObject *parent)
     : QObject(parent)
     , pollTimer(new QTimer(this))
+    , ueventSocket(-1)
+    , ueventNotifier(nullptr)
 {
     connect(pollTimer, &QTimer::timeout, this, &USBMonitor::checkUSBDevices);
 }
@@ -21,85 +31,239 @@ void USBMonitor::startMonitoring()
     // Initial scan
     QList<USBDevice> devices = getConnectedUSBDevices();
     for (const USBDevice &device : devices) {
-        connectedDevices.insert(device.identifier());
+        connectedDevices.insert(device.portPath, device);
     }
     
-    // Poll every 2 seconds for changes
+    // Prefer kernel uevents; poll every 2 seconds only if they are unavailable
+    if (openUeventSocket()) {
+        qDebug() << "USB monitoring via kernel uevents";
+        return;
+    }
+    qDebug() << "Kernel uevents unavailable; polling sysfs";
     pollTimer->start(2000);
 }
 
 void USBMonitor::stopMonitoring()
 {
     pollTimer->stop();
+    closeUeventSocket();
+}
+
+bool USBMonitor::openUeventSocket()
+{
+#ifdef Q_OS_LINUX
+    if (ueventSocket >= 0) {
+        return true;
+    }
+
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) {
+        return false;
+    }
+
+    // Group 1 carries the kernel's own messages, which need no udev daemon
+    struct sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    ueventSocket = fd;
+    ueventNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+    connect(ueventNotifier, &QSocketNotifier::activated, this, &USBMonitor::readUevents);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void USBMonitor::closeUeventSocket()
+{
+#ifdef Q_OS_LINUX
+    if (ueventNotifier) {
+        ueventNotifier->setEnabled(false);
+        ueventNotifier->deleteLater();
+        ueventNotifier = nullptr;
+    }
+    if (ueventSocket >= 0) {
+        ::close(ueventSocket);
+        ueventSocket = -1;
+    }
+#endif
+}
+
+void USBMonitor::readUevents()
+{
+#ifdef Q_OS_LINUX
+    char buffer[8192];
+    for (;;) {
+        ssize_t length = recv(ueventSocket, buffer, sizeof(buffer), 0);
+        if (length > 0) {
+            handleUevent(QByteArray(buffer, int(length)));
+            continue;
+        }
+        if (length < 0 && errno == ENOBUFS) {
+            // The kernel dropped events while we were busy; rescan to catch up
+            qDebug() << "Uevent buffer overrun; rescanning USB devices";
+            checkUSBDevices();
+            continue;
+        }
+        // EAGAIN: drained
+        return;
+    }
+#endif
+}
+
+void USBMonitor::handleUevent(const QByteArray &message)
+{
+    // "ACTION@DEVPATH\0KEY=VALUE\0KEY=VALUE\0..."
+    const QList<QByteArray> fields = message.split('\0');
+    QHash<QByteArray, QByteArray> env;
+    for (const QByteArray &field : fields) {
+        int eq = field.indexOf('=');
+        if (eq > 0) {
+            env.insert(field.left(eq), field.mid(eq + 1));
+        }
+    }
+
+    // Whole devices only; their interfaces arrive as separate usb_interface events
+    if (env.value("SUBSYSTEM") != "usb" || env.value("DEVTYPE") != "usb_device") {
+        return;
+    }
+    QByteArray action = env.value("ACTION");
+    if (action != "add" && action != "bind" && action != "remove") {
+        return;
+    }
+
+    // PRODUCT=vid/pid/bcdDevice in unpadded hex, e.g. "46d/c52b/1201"
+    QList<QByteArray> product = env.value("PRODUCT").split('/');
+    if (product.size() < 2) {
+        return;
+    }
+    QString devPath = QString::fromLatin1(env.value("DEVPATH"));
+    QString portPath = devPath.section('/', -1);
+
+    if (action == "bind") {
+        // The device is configured and its interfaces exist now
+        if (pendingAdds.contains(portPath)) {
+            completeAdd(portPath);
+        }
+        return;
+    }
+
+    if (action == "remove") {
+        pendingAdds.remove(portPath);
+
+        // The sysfs node is gone; report the device as it was seen on insert
+        auto it = connectedDevices.find(portPath);
+        if (it != connectedDevices.end()) {
+            USBDevice device = it.value();
+            connectedDevices.erase(it);
+            qDebug() << "USB device removed:" << device.identifier();
+            emit usbDeviceRemoved(device);
+        }
+        return;
+    }
+
+    USBDevice device;
+    device.vendorId = QString::fromLatin1(product[0]).rightJustified(4, '0');
+    device.productId = QString::fromLatin1(product[1]).rightJustified(4, '0');
+    device.bus = QString::fromLatin1(env.value("BUSNUM"));
+    device.device = QString::fromLatin1(env.value("DEVNUM"));
+
+    // Skip hubs (class 9), as the scan does
+    if (env.value("TYPE").startsWith("9/")) {
+        return;
+    }
+
+    // Serial, port path and strings come from the device's sysfs node
+    if (!SysfsUSBEnumerator().readDevice(devPath, &device)) {
+        device.portPath = portPath;
+        device.description = device.usbId();
+    }
+
+    // "add" precedes configuration, so the interfaces the passthrough policy
+    // looks at usually do not exist yet. Report the device on "bind", or
+    // after a second on kernels that do not send bind events.
+    if (device.interfaces.isEmpty()) {
+        pendingAdds.insert(portPath, devPath);
+        QTimer::singleShot(1000, this, [this, portPath]() {
+            if (pendingAdds.contains(portPath)) {
+                completeAdd(portPath);
+            }
+        });
+        return;
+    }
+
+    reportInserted(device);
+}
+
+void USBMonitor::completeAdd(const QString &portPath)
+{
+    QString devPath = pendingAdds.take(portPath);
+    USBDevice device;
+    if (SysfsUSBEnumerator().readDevice(devPath, &device)) {
+        reportInserted(device);
+    }
+}
+
+void USBMonitor::reportInserted(const USBDevice &device)
+{
+    QString portPath = device.portPath;
+    auto it = connectedDevices.constFind(portPath);
+    if (it != connectedDevices.constEnd() && it->sameDevice(device)) {
+        return;
+    }
+    if (it != connectedDevices.constEnd()) {
+        // Missed the remove of whatever was on this port before
+        emit usbDeviceRemoved(it.value());
+    }
+    connectedDevices.insert(portPath, device);
+    qDebug() << "USB device inserted:" << device.description << "at" << portPath;
+    emit usbDeviceInserted(device);
 }
 
 void USBMonitor::checkUSBDevices()
 {
     QList<USBDevice> currentDevices = getConnectedUSBDevices();
-    QSet<QString> currentIds;
-    
-    // Build set of current device IDs
+    QHash<QString, USBDevice> current;
     for (const USBDevice &device : currentDevices) {
-        currentIds.insert(device.identifier());
+        current.insert(device.portPath, device);
     }
     
-    // Check for new devices (inserted)
-    for (const USBDevice &device : currentDevices) {
-        if (!connectedDevices.contains(device.identifier())) {
-            qDebug() << "USB device inserted:" << device.description;
-            emit usbDeviceInserted(device);
+    // Check for removed devices, including a different device now on the same port
+    for (auto it = connectedDevices.constBegin(); it != connectedDevices.constEnd(); ++it) {
+        auto now = current.constFind(it.key());
+        if (now == current.constEnd() || !now->sameDevice(it.value())) {
+            qDebug() << "USB device removed:" << it->identifier();
+            emit usbDeviceRemoved(it.value());
         }
     }
     
-    // Check for removed devices
-    QSet<QString> removed = connectedDevices - currentIds;
-    for (const QString &id : removed) {
-        qDebug() << "USB device removed:" << id;
-        // Create a minimal device object for the removed signal
-        USBDevice device;
-        QStringList parts = id.split(':');
-        if (parts.size() == 2) {
-            device.vendorId = parts[0];
-            device.productId = parts[1];
+    // Check for new devices (inserted)
+    for (const USBDevice &device : currentDevices) {
+        auto before = connectedDevices.constFind(device.portPath);
+        if (before == connectedDevices.constEnd() || !before->sameDevice(device)) {
+            qDebug() << "USB device inserted:" << device.description << "at" << device.portPath;
+            emit usbDeviceInserted(device);
         }
-        emit usbDeviceRemoved(device);
     }
     
     // Update tracked devices
-    connectedDevices = currentIds;
+    connectedDevices = current;
 }
 
 QList<USBDevice> USBMonitor::getConnectedUSBDevices()
 {
     QList<USBDevice> devices;
-    
-    QProcess lsusb;
-    lsusb.start("lsusb");
-    lsusb.waitForFinished(3000);
-    
-    QString output = lsusb.readAllStandardOutput();
-    QStringList lines = output.split('\n', Qt::SkipEmptyParts);
-    
-    // Parse lsusb output: Bus 001 Device 002: ID 046d:c52b Logitech, Inc. Unifying Receiver
-    QRegularExpression re("Bus (\\d+) Device (\\d+): ID ([0-9a-f]+):([0-9a-f]+) (.+)");
-    
-    for (const QString &line : lines) {
-        QRegularExpressionMatch match = re.match(line);
-        if (match.hasMatch()) {
-            USBDevice device;
-            device.bus = match.captured(1);
-            device.device = match.captured(2);
-            device.vendorId = match.captured(3);
-            device.productId = match.captured(4);
-            device.description = match.captured(5).trimmed();
-            
-            // Skip USB hubs and root hubs
-            if (!device.description.contains("Hub", Qt::CaseInsensitive) &&
-                !device.description.contains("Linux Foundation", Qt::CaseInsensitive)) {
-                devices.append(device);
-            }
+    const QList<USBDevice> all = SysfsUSBEnumerator().enumerate();
+    for (const USBDevice &device : all) {
+        // Skip USB hubs and root hubs
+        if (device.deviceClass != 9) {
+            devices.append(device);
         }
     }
-    
     return devices;
 }
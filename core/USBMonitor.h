@@ -2,22 +2,11 @@
 #define USBMONITOR_H
 
 #include <QObject>
-#include <QProcess>
 #include <QTimer>
-#include <QSet>
+#include <QHash>
 #include <QString>
-
-struct USBDevice {
-    QString vendorId;
-    QString productId;
-    QString bus;
-    QString device;
-    QString description;
-    
-    QString identifier() const {
-        return QString("%1:%2").arg(vendorId, productId);
-    }
-};
+#include <QSocketNotifier>
+#include "USBDevice.h"
 
 class USBMonitor : public QObject
 {
@@ -36,12 +25,23 @@ signals:
 
 private slots:
     void checkUSBDevices();
+    void readUevents();
 
 private:
     QTimer *pollTimer;
-    QSet<QString> connectedDevices;  // Track currently connected USB IDs
+    QHash<QString, USBDevice> connectedDevices;  // Currently connected, by port path
+
+    // Kernel hotplug events; sysfs polling is only used when this is unavailable
+    int ueventSocket;
+    QSocketNotifier *ueventNotifier;
+    QHash<QString, QString> pendingAdds;  // port path -> DEVPATH, waiting for interfaces
     
     QList<USBDevice> getConnectedUSBDevices();
+    bool openUeventSocket();
+    void closeUeventSocket();
+    void handleUevent(const QByteArray &message);
+    void completeAdd(const QString &portPath);
+    void reportInserted(const USBDevice &device);
 };
 
 #endif // USBMONITOR_H
@@ -0,0 +1,264 @@
+#include "USBPassthroughQueue.h"
+#include <QTemporaryFile>
+#include <QCoreApplication>
+#include <QDebug>
+#include <memory>
+
+#ifdef Q_OS_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Holds an XML document at a path virsh can open for the lifetime of one
+// command. On Linux this is an anonymous memfd reached via /proc/<pid>/fd, so
+// nothing touches the filesystem; elsewhere it falls back to a temp file.
+class StagedXml
+{
+public:
+    explicit StagedXml(const QByteArray &xml)
+    {
+#if defined(Q_OS_LINUX) && defined(MFD_CLOEXEC)
+        fd = memfd_create("sdui-hostdev", MFD_CLOEXEC);
+        if (fd >= 0) {
+            if (::write(fd, xml.constData(), size_t(xml.size())) == xml.size()) {
+                filePath = QString("/proc/%1/fd/%2").arg(QCoreApplication::applicationPid()).arg(fd);
+                return;
+            }
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+        if (file.open() && file.write(xml) == xml.size() && file.flush()) {
+            filePath = file.fileName();
+        }
+    }
+
+    ~StagedXml()
+    {
+#ifdef Q_OS_LINUX
+        if (fd >= 0) {
+            ::close(fd);
+        }
+#endif
+    }
+
+    QString path() const { return filePath; }
+
+private:
+    int fd = -1;
+    QTemporaryFile file;
+    QString filePath;
+};
+
+} // namespace
+
+USBPassthroughWorker::USBPassthroughWorker(const QString &domain, VirtBackend::Factory openConnection)
+    : domain(domain)
+    , openConnection(std::move(openConnection))
+    , backend(nullptr)
+    , coalesceTimer(this)   // parented so moveToThread takes it along
+    , running(false)
+{
+}
+
+void USBPassthroughWorker::init()
+{
+    // Created here so its processes and timers belong to the passthrough thread
+    backend = openConnection(this);
+
+    // A short settle window lets plug/unplug bursts collapse before acting
+    coalesceTimer.setSingleShot(true);
+    coalesceTimer.setInterval(100);
+    connect(&coalesceTimer, &QTimer::timeout, this, &USBPassthroughWorker::flush);
+}
+
+void USBPassthroughWorker::request(const QString &key, const QString &vendorId, const QString &productId,
+                                   int bus, int deviceNumber, bool attach)
+{
+    if (!attach && !devices.contains(key)) {
+        return;
+    }
+
+    DeviceState &device = devices[key];
+    device.vendorId = vendorId;
+    device.productId = productId;
+    device.bus = bus;
+    device.device = deviceNumber;
+    device.wanted = attach;
+
+    if (!coalesceTimer.isActive()) {
+        coalesceTimer.start();
+    }
+}
+
+void USBPassthroughWorker::setDomainRunning(bool isRunning)
+{
+    if (running == isRunning) {
+        return;
+    }
+    running = isRunning;
+
+    if (!running) {
+        // Hostdevs go away with the domain; keep only what should come back
+        for (auto it = devices.begin(); it != devices.end(); ) {
+            it->attached = false;
+            if (!it->wanted && !it->inFlight) {
+                it = devices.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        return;
+    }
+
+    coalesceTimer.stop();
+    flush();
+}
+
+void USBPassthroughWorker::flush()
+{
+    if (!running || !backend) {
+        return;
+    }
+
+    int issued = 0;
+    for (auto it = devices.begin(); it != devices.end(); ) {
+        DeviceState &device = it.value();
+        if (device.inFlight) {
+            ++it;
+            continue;
+        }
+        if (device.wanted == device.attached && !device.moved()) {
+            // Nothing to do, and nothing to remember once it is detached
+            if (device.attached) {
+                ++it;
+            } else {
+                it = devices.erase(it);
+            }
+            continue;
+        }
+        issue(it.key(), device);
+        ++issued;
+        ++it;
+    }
+
+    // The session pipelines these; they are not waited on one by one
+    if (issued > 1) {
+        qDebug() << "USB passthrough batch:" << issued << "device operation(s)";
+    }
+}
+
+void USBPassthroughWorker::issue(const QString &key, DeviceState &device)
+{
+    // A detach names the hostdev that was attached, wherever the device is now
+    bool attach = !device.attached;
+    bool replug = device.wanted && device.attached;
+    int bus = attach ? device.bus : device.attachedBus;
+    int deviceNumber = attach ? device.device : device.attachedDevice;
+    auto xml = std::make_shared<StagedXml>(
+        USBPassthroughQueue::hostdevXml(device.vendorId, device.productId, bus, deviceNumber));
+    if (xml->path().isEmpty()) {
+        device.wanted = device.attached;
+        emit deviceFailed(key, attach, "cannot stage hostdev XML");
+        return;
+    }
+
+    device.inFlight = true;
+    QStringList command;
+    command << (attach ? "attach-device" : "detach-device") << domain << xml->path();
+
+    backend->execute(command, [this, key, attach, replug, bus, deviceNumber, xml](const VirtResult &result) {
+        auto it = devices.find(key);
+        if (it == devices.end()) {
+            return;
+        }
+        DeviceState &device = it.value();
+        device.inFlight = false;
+
+        if (result.ok) {
+            device.attached = attach;
+            device.attachedBus = bus;
+            device.attachedDevice = deviceNumber;
+            if (attach) {
+                emit deviceAttached(key);
+            } else {
+                emit deviceDetached(key);
+            }
+        } else if (replug) {
+            // The old address left the host with the unplug; attach the new
+            // one regardless
+            device.attached = false;
+            emit deviceFailed(key, attach, result.error);
+        } else {
+            // Give up on this change rather than retrying in a loop
+            device.wanted = device.attached;
+            emit deviceFailed(key, attach, result.error);
+        }
+
+        // Requests that arrived meanwhile may have changed what is wanted
+        flush();
+    });
+}
+
+USBPassthroughQueue::USBPassthroughQueue(const QString &domain, VirtBackend::Factory openConnection, QObject *parent)
+    : QObject(parent)
+    , worker(new USBPassthroughWorker(domain, std::move(openConnection)))
+{
+    thread.setObjectName("usb-passthrough");
+    worker->moveToThread(&thread);
+    connect(&thread, &QThread::started, worker, &USBPassthroughWorker::init);
+    connect(&thread, &QThread::finished, worker, &QObject::deleteLater);
+
+    connect(worker, &USBPassthroughWorker::deviceAttached, this, &USBPassthroughQueue::deviceAttached);
+    connect(worker, &USBPassthroughWorker::deviceDetached, this, &USBPassthroughQueue::deviceDetached);
+    connect(worker, &USBPassthroughWorker::deviceFailed, this, &USBPassthroughQueue::deviceFailed);
+
+    thread.start();
+}
+
+USBPassthroughQueue::~USBPassthroughQueue()
+{
+    thread.quit();
+    thread.wait();
+}
+
+static void postRequest(USBPassthroughWorker *worker, const USBDevice &device, bool attach)
+{
+    QMetaObject::invokeMethod(worker, "request", Qt::QueuedConnection,
+                              Q_ARG(QString, device.identifier()),
+                              Q_ARG(QString, device.vendorId), Q_ARG(QString, device.productId),
+                              Q_ARG(int, device.bus.toInt()), Q_ARG(int, device.device.toInt()),
+                              Q_ARG(bool, attach));
+}
+
+void USBPassthroughQueue::attach(const USBDevice &device)
+{
+    postRequest(worker, device, true);
+}
+
+void USBPassthroughQueue::detach(const USBDevice &device)
+{
+    postRequest(worker, device, false);
+}
+
+void USBPassthroughQueue::setDomainRunning(bool running)
+{
+    QMetaObject::invokeMethod(worker, "setDomainRunning", Qt::QueuedConnection, Q_ARG(bool, running));
+}
+
+QByteArray USBPassthroughQueue::hostdevXml(const QString &vendorId, const QString &productId, int bus, int device)
+{
+    // vendor/product alone would match every unit of the model; the address
+    // pins the one physical device (libvirt checks both)
+    return QString(
+        "<hostdev mode='subsystem' type='usb'>\n"
+        "  <source>\n"
+        "    <vendor id='0x%1'/>\n"
+        "    <product id='0x%2'/>\n"
+        "    <address bus='%3' device='%4'/>\n"
+        "  </source>\n"
+        "</hostdev>\n"
+    ).arg(vendorId, productId).arg(bus).arg(device).toUtf8();
+}
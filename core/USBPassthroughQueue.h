@@ -0,0 +1,93 @@
+#ifndef USBPASSTHROUGHQUEUE_H
+#define USBPASSTHROUGHQUEUE_H
+
+#include <QObject>
+#include <QThread>
+#include <QHash>
+#include <QTimer>
+#include "USBDevice.h"
+#include "VirtBackend.h"
+
+// Runs on the passthrough thread with its own libvirt connection, opened
+// through the GUI-thread backend's peer factory. Tracks the wanted vs.
+// actual attachment of every device and only issues the commands needed to
+// reconcile them, so a plug/unplug pair that arrives before it is acted on
+// cancels out. A device replugged meanwhile comes back at a new address, so
+// its old hostdev is detached and the new one attached.
+class USBPassthroughWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    USBPassthroughWorker(const QString &domain, VirtBackend::Factory openConnection);
+
+public slots:
+    void init();
+    void request(const QString &key, const QString &vendorId, const QString &productId,
+                 int bus, int device, bool attach);
+    void setDomainRunning(bool running);
+
+signals:
+    void deviceAttached(const QString &key);
+    void deviceDetached(const QString &key);
+    void deviceFailed(const QString &key, bool attach, const QString &error);
+
+private:
+    struct DeviceState {
+        QString vendorId;
+        QString productId;
+        int bus = 0;              // address of the device as last seen
+        int device = 0;
+        int attachedBus = 0;      // address of the hostdev in the guest
+        int attachedDevice = 0;
+        bool wanted = false;
+        bool attached = false;
+        bool inFlight = false;
+
+        bool moved() const { return attached && (bus != attachedBus || device != attachedDevice); }
+    };
+
+    QString domain;
+    VirtBackend::Factory openConnection;
+    VirtBackend *backend;
+    QHash<QString, DeviceState> devices;  // by USBDevice::identifier()
+    QTimer coalesceTimer;
+    bool running;
+
+    void flush();
+    void issue(const QString &key, DeviceState &device);
+};
+
+// GUI-thread front end of the passthrough queue. Calls return immediately;
+// results come back as queued signals. Attach requests made while the VM is
+// down are kept and sent in one batch when the domain reaches Running.
+class USBPassthroughQueue : public QObject
+{
+    Q_OBJECT
+
+public:
+    // openConnection is usually the GUI-thread backend's peerFactory()
+    USBPassthroughQueue(const QString &domain, VirtBackend::Factory openConnection, QObject *parent = nullptr);
+    ~USBPassthroughQueue();
+
+    // Devices are tracked by USBDevice::identifier(), so several units of
+    // the same model are passed through independently
+    void attach(const USBDevice &device);
+    void detach(const USBDevice &device);
+    void setDomainRunning(bool running);
+
+    // <hostdev> element selecting one device by its bus/device address,
+    // built in memory
+    static QByteArray hostdevXml(const QString &vendorId, const QString &productId, int bus, int device);
+
+signals:
+    void deviceAttached(const QString &key);
+    void deviceDetached(const QString &key);
+    void deviceFailed(const QString &key, bool attach, const QString &error);
+
+private:
+    QThread thread;
+    USBPassthroughWorker *worker;
+};
+
+#endif // USBPASSTHROUGHQUEUE_H
@@ -1,21 +1,151 @@
 #include "VMManager.h"
+#include "VirtBackend.h"
+#include "LogManager.h"
+#include "OverlayPool.h"
+#include "GuestChannel.h"
+#include "PortProber.h"
+#include "USBPassthroughQueue.h"
+#include "USBClassifier.h"
 #include <QStandardPaths>
 #include <QDir>
 #include <QFile>
 #include <QDebug>
-#include <QThread>
 #include <QRegularExpression>
+#include <QDateTime>
+
+namespace {
+const int kStartTimeoutMs = 120000;
+const int kRestoreTimeoutMs = 300000;
+// A guest that ignores the ACPI request is powered off after this long
+const int kShutdownGraceMs = 60000;
+// A failed power-off is retried, while the domain state is still polled
+const int kDestroyRetryMs = 5000;
+}
 
 VMManager::VMManager()
     : virshProcess(nullptr)
+    , guestChannel(new GuestChannel(this))
+    , sshProber(new PortProber(this))
+    , usbQueue(nullptr)
+    , stepProcess(nullptr)
+    , backend(VirtBackend::create(this))
+    , stepGeneration(0)
     , vmName("sdui-debian")
+    , attempt(0)
+    , m_lifecycleState(LifecycleState::Stopped)
+    , m_domainState(DomainState::Unknown)
+    , coldPool(nullptr)
+    , warmPool(nullptr)
 {
     // VM is managed by libvirt system daemon
+    retryTimer.setSingleShot(true);
+    connect(&retryTimer, &QTimer::timeout, this, [this]() {
+        if (m_lifecycleState == LifecycleState::AwaitingIP) {
+            requestAddress();
+        }
+    });
+
+    // sshd readiness: fast retries while the port refuses, capped at 1 s
+    sshProber->setBackoff(50, 1000);
+    sshProber->setAttemptTimeout(1000);
+    connect(sshProber, &PortProber::portOpen, this, [this](const QString &, quint16, qint64 elapsedMs) {
+        if (m_lifecycleState != LifecycleState::AwaitingSSH) {
+            return;
+        }
+        qDebug() << "SSH port open after" << elapsedMs << "ms:" << sshProber->summary();
+        LogManager::instance().log(LogManager::INFO, "system",
+            "VM SSH readiness: " + sshProber->summary());
+        startConsole();
+    });
+    connect(sshProber, &PortProber::deadlineExceeded, this, [this]() {
+        if (m_lifecycleState != LifecycleState::AwaitingSSH) {
+            return;
+        }
+        failSession("SSH service not ready. Try connecting again.",
+                    "\nSSH port not responding after 20s. Wait a moment and retry.\n");
+    });
+
+    // Guest agent channel: console bytes flow as soon as the guest kernel is up
+    connect(guestChannel, &GuestChannel::ready, this, [this](const QString &agentVersion) {
+        if (m_lifecycleState != LifecycleState::AwaitingAgent) {
+            return;
+        }
+        guestChannel->openConsole();
+        onConsoleConnected("guest agent (" + agentVersion + ")");
+    });
+    connect(guestChannel, &GuestChannel::connectTimedOut, this, [this]() {
+        if (m_lifecycleState != LifecycleState::AwaitingAgent) {
+            return;
+        }
+        emit progress("Guest agent not answering; falling back to SSH.");
+        requestAddress();
+    });
+    connect(guestChannel, &GuestChannel::consoleOutput, this, [this](const QByteArray &data) {
+        emit vmOutputReady(QString::fromUtf8(data));
+    });
+    auto channelClosed = [this]() {
+        if (m_lifecycleState != LifecycleState::Connected || virshProcess) {
+            return;
+        }
+        emit vmOutputReady("\n[Connection closed]\n");
+        guestChannel->close();
+        setLifecycleState(LifecycleState::Stopped);
+    };
+    connect(guestChannel, &GuestChannel::consoleClosed, this, channelClosed);
+    connect(guestChannel, &GuestChannel::disconnected, this, channelClosed);
+
+    // USB passthrough runs on its own thread and libvirt connection to the
+    // same hypervisor (the same simulated domain under SDUI_VIRT_BACKEND=fake)
+    usbQueue = new USBPassthroughQueue(vmName, backend->peerFactory(), this);
+    connect(usbQueue, &USBPassthroughQueue::deviceAttached, this, [this](const QString &key) {
+        qDebug() << "USB device" << key << "attached successfully";
+        emit vmOutputReady(QString("\n[USB Device %1 connected to VM]\n").arg(key));
+    });
+    connect(usbQueue, &USBPassthroughQueue::deviceDetached, this, [this](const QString &key) {
+        qDebug() << "USB device" << key << "detached";
+        emit vmOutputReady(QString("\n[USB Device %1 disconnected from VM]\n").arg(key));
+    });
+    connect(usbQueue, &USBPassthroughQueue::deviceFailed, this,
+            [](const QString &key, bool attach, const QString &error) {
+        qDebug() << "Failed to" << (attach ? "attach" : "detach") << "USB device" << key << "-" << error;
+    });
+
+    // Domain state is cached here and pushed to the UI; prefer libvirt events
+    connect(backend, &VirtBackend::domainEvent, this, &VMManager::onDomainEvent);
+    connect(backend, &VirtBackend::eventStreamStarted, this, &VMManager::refreshDomainState);
+
+    statePollTimer.setInterval(10000);
+    connect(&statePollTimer, &QTimer::timeout, this, &VMManager::refreshDomainState);
+
+    stopPollTimer.setInterval(1000);
+    connect(&stopPollTimer, &QTimer::timeout, this, &VMManager::refreshDomainState);
+    stopDeadline.setSingleShot(true);
+    connect(&stopDeadline, &QTimer::timeout, this, &VMManager::forceStop);
+
+    setupOverlayPools();
+
+    if (!backend->watchDomain(vmName)) {
+        qDebug() << "No domain event stream; polling VM state every"
+                 << statePollTimer.interval() / 1000 << "s";
+        statePollTimer.start();
+        refreshDomainState();
+    }
 }
 
 VMManager::~VMManager()
 {
-    stopVM();
+    // The event loop is gone by now, so fall back to fire-and-forget cleanup
+    abortStep();
+    if (virshProcess) {
+        virshProcess->disconnect();
+        virshProcess->kill();
+        virshProcess->waitForFinished(500);
+        delete virshProcess;
+        virshProcess = nullptr;
+    }
+    if (m_lifecycleState != LifecycleState::Stopped) {
+        QProcess::startDetached("virsh", QStringList() << "--connect" << "qemu:///system" << "shutdown" << vmName);
+    }
 }
 
 VMManager& VMManager::instance()
@@ -29,86 +159,483 @@ void VMManager::setupPaths()
     // Not needed - libvirt manages paths
 }
 
+void VMManager::setupOverlayPools()
+{
+    QString poolDir = "/var/lib/libvirt/images/sdui/pool";
+
+    // Keep two disks ready for the mode we expect to boot in and one for the fallback
+    bool warm = warmImageAvailable();
+    if (QFile::exists(getBaseImagePath())) {
+        coldPool = new OverlayPool(getBaseImagePath(), poolDir, "cold", warm ? 1 : 2, this);
+        coldPool->start();
+    }
+    if (warm) {
+        warmPool = new OverlayPool(getWarmDiskPath(), poolDir, "warm", 2, this);
+        warmPool->start();
+    }
+}
+
 QString VMManager::getBaseImagePath() const
+{
+    return "/var/lib/libvirt/images/sdui/sdui-base.qcow2";
+}
+
+QString VMManager::getSessionDiskPath() const
 {
     return "/var/lib/libvirt/images/sdui/sdui-debian.qcow2";
 }
 
-bool VMManager::baseImageExists() const
+bool VMManager::sessionOverlaysEnabled() const
+{
+    // Older setups without golden images boot one persistent disk; never discard it
+    return QFile::exists(getBaseImagePath()) || warmImageAvailable();
+}
+
+QString VMManager::getAgentSocketPath() const
+{
+    QString path = qEnvironmentVariable("SDUI_AGENT_SOCKET");
+    return path.isEmpty() ? "/var/lib/libvirt/images/sdui/agent.sock" : path;
+}
+
+bool VMManager::isConsoleConnected() const
+{
+    return guestChannel->isReady()
+        || (virshProcess && virshProcess->state() == QProcess::Running);
+}
+
+bool VMManager::sendConsoleInput(const QByteArray &data)
+{
+    if (guestChannel->isReady()) {
+        return guestChannel->sendConsoleInput(data);
+    }
+    if (virshProcess && virshProcess->state() == QProcess::Running) {
+        return virshProcess->write(data) == data.size();
+    }
+    return false;
+}
+
+QString VMManager::getWarmSnapshotPath() const
 {
-    // Check if VM exists in libvirt
-    QProcess check;
-    check.start("virsh", QStringList() << "--connect" << "qemu:///system" << "domstate" << vmName);
-    check.waitForFinished(3000);
-    return check.exitCode() == 0;
+    return "/var/lib/libvirt/images/sdui/sdui-warm.sav";
 }
 
-QString VMManager::createUserOverlay()
+QString VMManager::getWarmDiskPath() const
 {
-    // Libvirt handles disk management
-    return getBaseImagePath();
+    return "/var/lib/libvirt/images/sdui/sdui-warm.qcow2";
+}
+
+bool VMManager::warmImageAvailable() const
+{
+    // SDUI_VM_BOOT=cold forces a cold boot, e.g. to compare timings
+    if (qEnvironmentVariable("SDUI_VM_BOOT").toLower() == "cold") {
+        return false;
+    }
+    return QFile::exists(getWarmSnapshotPath()) && QFile::exists(getWarmDiskPath());
+}
+
+void VMManager::prepareSessionDisk(const QString &backing, std::function<void(bool ok)> done)
+{
+    // Already holding an untouched overlay from the last teardown
+    if (freshDiskBacking == backing && QFile::exists(getSessionDiskPath())) {
+        done(true);
+        return;
+    }
+
+    retireSessionDisk();
+
+    OverlayPool *pool = (warmPool && warmPool->backingImage() == backing) ? warmPool
+                      : (coldPool && coldPool->backingImage() == backing) ? coldPool
+                      : nullptr;
+    QString overlay = pool ? pool->take() : QString();
+    if (!overlay.isEmpty() && QFile::rename(overlay, getSessionDiskPath())) {
+        freshDiskBacking = backing;
+        done(true);
+        return;
+    }
+
+    // Pool drained: create one now
+    emit progress("Creating session disk...");
+    runStep("qemu-img", QStringList() << "create" << "-q" << "-f" << "qcow2" << "-F" << "qcow2"
+                        << "-b" << backing << getSessionDiskPath(), 10000,
+            [this, backing, done](int exitCode, const QString &, const QString &err) {
+        if (exitCode != 0) {
+            qWarning() << "Failed to create session overlay:" << err;
+            done(false);
+            return;
+        }
+        freshDiskBacking = backing;
+        done(true);
+    });
+}
+
+void VMManager::retireSessionDisk()
+{
+    freshDiskBacking.clear();
+    QString disk = getSessionDiskPath();
+    if (!sessionOverlaysEnabled() || !QFile::exists(disk)) {
+        return;
+    }
+
+    // Rename is instant; the actual delete happens off the UI thread
+    QString retired = QString("%1.retired-%2").arg(disk).arg(QDateTime::currentMSecsSinceEpoch());
+    if (QFile::rename(disk, retired)) {
+        OverlayPool::discardAsync(retired);
+    } else {
+        qWarning() << "Could not retire session disk" << disk;
+    }
+}
+
+void VMManager::recycleSessionDisk()
+{
+    if (!sessionOverlaysEnabled()) {
+        return;
+    }
+
+    // Throw away everything the last drive touched and stage a clean disk
+    retireSessionDisk();
+    OverlayPool *pool = warmImageAvailable() ? warmPool : coldPool;
+    if (!pool) {
+        return;
+    }
+    QString overlay = pool->take();
+    if (!overlay.isEmpty() && QFile::rename(overlay, getSessionDiskPath())) {
+        freshDiskBacking = pool->backingImage();
+        qDebug() << "Session disk recycled";
+    }
+}
+
+bool VMManager::isTransitioning() const
+{
+    return m_lifecycleState == LifecycleState::Starting
+        || m_lifecycleState == LifecycleState::AwaitingAgent
+        || m_lifecycleState == LifecycleState::AwaitingIP
+        || m_lifecycleState == LifecycleState::AwaitingSSH
+        || m_lifecycleState == LifecycleState::Stopping;
+}
+
+void VMManager::setLifecycleState(LifecycleState state)
+{
+    if (m_lifecycleState == state) {
+        return;
+    }
+    m_lifecycleState = state;
+    emit lifecycleStateChanged(state);
+}
+
+void VMManager::setDomainState(DomainState state)
+{
+    if (m_domainState != state) {
+        DomainState previous = m_domainState;
+        m_domainState = state;
+        usbQueue->setDomainRunning(state == DomainState::Running);
+
+        if (state == DomainState::Running) {
+            freshDiskBacking.clear();
+        } else if (previous == DomainState::Running
+                   && (state == DomainState::ShutOff || state == DomainState::Crashed)) {
+            recycleSessionDisk();
+        }
+
+        emit stateChanged(state);
+    }
+
+    // Checked on repeats too: polling reports "shut off" over and over
+    if (m_lifecycleState == LifecycleState::Stopping
+        && (state == DomainState::ShutOff || state == DomainState::Crashed || state == DomainState::Undefined)) {
+        finishStop();
+    }
+}
+
+void VMManager::applyDomainStateText(const QString &text)
+{
+    // virsh domstate output
+    QString state = text.trimmed();
+    if (state == "running" || state == "in shutdown") {
+        setDomainState(DomainState::Running);
+    } else if (state == "paused" || state == "pmsuspended") {
+        setDomainState(DomainState::Paused);
+    } else if (state == "shut off") {
+        setDomainState(DomainState::ShutOff);
+    } else if (state == "crashed") {
+        setDomainState(DomainState::Crashed);
+    } else {
+        setDomainState(DomainState::Unknown);
+    }
+}
+
+void VMManager::onDomainEvent(const QString &domain, const QString &event)
+{
+    if (domain != vmName) {
+        return;
+    }
+
+    qDebug() << "Domain event:" << event;
+    if (event == "Started" || event == "Resumed") {
+        setDomainState(DomainState::Running);
+    } else if (event == "Suspended" || event == "PMSuspended") {
+        setDomainState(DomainState::Paused);
+    } else if (event == "Stopped") {
+        setDomainState(DomainState::ShutOff);
+    } else if (event == "Crashed") {
+        setDomainState(DomainState::Crashed);
+    } else if (event == "Undefined") {
+        setDomainState(DomainState::Undefined);
+    } else if (event == "Defined") {
+        setDomainState(DomainState::ShutOff);
+    }
+}
+
+void VMManager::refreshDomainState()
+{
+    backend->execute(QStringList() << "domstate" << vmName, [this](const VirtResult &result) {
+        if (!result.ok) {
+            setDomainState(result.error.contains("failed to get domain") ? DomainState::Undefined
+                                                                         : DomainState::Unknown);
+            return;
+        }
+        applyDomainStateText(result.output);
+    });
+}
+
+void VMManager::runStep(const QString &program, const QStringList &args, int timeoutMs, StepCallback done)
+{
+    abortStep();
+
+    QProcess *proc = new QProcess(this);
+    stepProcess = proc;
+
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            proc, [this, proc, done](int exitCode, QProcess::ExitStatus exitStatus) {
+        QString out = proc->readAllStandardOutput();
+        QString err = proc->readAllStandardError();
+        stepProcess = nullptr;
+        proc->deleteLater();
+        done(exitStatus == QProcess::NormalExit ? exitCode : -1, out, err);
+    });
+
+    connect(proc, &QProcess::errorOccurred, proc, [this, proc, done](QProcess::ProcessError error) {
+        // Only a failed launch skips the finished() signal
+        if (error != QProcess::FailedToStart) {
+            return;
+        }
+        QString err = proc->errorString();
+        stepProcess = nullptr;
+        proc->deleteLater();
+        done(-1, QString(), err);
+    });
+
+    // Watchdog replaces the old waitForFinished(timeout) calls
+    QTimer::singleShot(timeoutMs, proc, [proc]() {
+        qDebug() << "Step timed out:" << proc->program() << proc->arguments();
+        proc->kill();
+    });
+
+    proc->start(program, args);
+}
+
+void VMManager::runVirsh(const QStringList &command, StepCallback done, int timeoutMs)
+{
+    abortStep();
+
+    quint64 generation = stepGeneration;
+    backend->execute(command, [this, generation, done](const VirtResult &result) {
+        if (generation != stepGeneration) {
+            return;
+        }
+        done(result.ok ? 0 : 1, result.output, result.error);
+    }, timeoutMs);
+}
+
+void VMManager::abortStep()
+{
+    ++stepGeneration;
+    if (!stepProcess) {
+        return;
+    }
+    QProcess *proc = stepProcess;
+    stepProcess = nullptr;
+    proc->disconnect();
+    if (proc->state() == QProcess::NotRunning) {
+        proc->deleteLater();
+        return;
+    }
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            proc, &QObject::deleteLater);
+    proc->kill();
+}
+
+void VMManager::failSession(const QString &error, const QString &hint)
+{
+    retryTimer.stop();
+    sshProber->cancel();
+    emit vmError(error);
+    if (!hint.isEmpty()) {
+        emit vmOutputReady(hint);
+    }
+    setLifecycleState(LifecycleState::Stopped);
 }
 
 bool VMManager::startVM()
 {
-    if (isVMRunning()) {
+    if (m_lifecycleState == LifecycleState::Connected) {
+        qDebug() << "Console already connected";
+        return true;
+    }
+    if (m_lifecycleState != LifecycleState::Stopped) {
+        qDebug() << "VM start already in progress";
+        return true;
+    }
+
+    attempt = 0;
+    vmIP.clear();
+    bootMode = "running";
+    sessionTimer.start();
+    setLifecycleState(LifecycleState::Starting);
+    emit progress("Checking VM state...");
+
+    runVirsh(QStringList() << "domstate" << vmName,
+             [this](int exitCode, const QString &out, const QString &) {
+        onDomainState(exitCode, out);
+    });
+
+    return true;
+}
+
+void VMManager::onDomainState(int exitCode, const QString &out)
+{
+    // domstate fails when the domain is not defined in libvirt
+    if (exitCode != 0) {
+        setDomainState(DomainState::Undefined);
+        failSession("VM '" + vmName + "' not found. Run setup script first.");
+        return;
+    }
+    applyDomainStateText(out);
+
+    if (out.trimmed() == "running") {
         qDebug() << "VM is already running";
         // Start console connection anyway
-        startConsole();
-        return true;
+        connectConsole();
+        return;
     }
-    
-    // Check if VM exists in libvirt
-    if (!baseImageExists()) {
-        emit vmError("VM '" + vmName + "' not found. Run setup script first.");
-        return false;
+
+    if (warmImageAvailable()) {
+        warmStart();
+    } else {
+        coldStart();
     }
-    
-    // Start the VM using virsh
-    QProcess startProcess;
-    startProcess.start("virsh", QStringList() << "--connect" << "qemu:///system" << "start" << vmName);
-    startProcess.waitForFinished(5000);
-    
-    if (startProcess.exitCode() != 0) {
-        QString error = startProcess.readAllStandardError();
-        if (!error.contains("already active")) {
-            emit vmError("Failed to start VM: " + error);
-            return false;
+}
+
+void VMManager::warmStart()
+{
+    bootMode = "warm";
+    emit progress("Restoring warm VM snapshot...");
+
+    // The snapshot's memory expects exactly the frozen warm disk, so every
+    // session starts from a fresh overlay on top of it
+    prepareSessionDisk(getWarmDiskPath(), [this](bool ok) {
+        if (!ok) {
+            emit progress("Warm image unusable; cold booting instead.");
+            coldStart();
+            return;
         }
+
+        // Loading a large memory image can take minutes on slow storage
+        runVirsh(QStringList() << "restore" << getWarmSnapshotPath() << "--running",
+                 [this](int exitCode, const QString &, const QString &err) {
+            if (exitCode != 0) {
+                qWarning() << "Warm restore failed:" << err;
+                emit progress("Warm restore failed; cold booting instead.");
+                coldStart();
+                return;
+            }
+            qDebug() << "VM restored from warm snapshot";
+            setDomainState(DomainState::Running);
+            emit vmStarted();
+            connectConsole();
+        }, kRestoreTimeoutMs);
+    });
+}
+
+void VMManager::coldStart()
+{
+    bootMode = "cold";
+
+    if (!QFile::exists(getBaseImagePath())) {
+        // Legacy layout: boot the persistent disk as-is
+        bootCold();
+        return;
     }
-    
-    // Confirm VM is actually running
-    if (isVMRunning()) {
+
+    prepareSessionDisk(getBaseImagePath(), [this](bool ok) {
+        if (!ok) {
+            failSession("Failed to prepare a clean session disk.");
+            return;
+        }
+        bootCold();
+    });
+}
+
+void VMManager::bootCold()
+{
+    // Start the VM using virsh
+    emit progress("Starting VM...");
+    runVirsh(QStringList() << "start" << vmName,
+             [this](int exitCode, const QString &, const QString &err) {
+        if (exitCode != 0 && !err.contains("already active")) {
+            failSession("Failed to start VM: " + err);
+            return;
+        }
         qDebug() << "VM started successfully";
+        // The Started event normally beats this reply; set it anyway for pollers
+        setDomainState(DomainState::Running);
         emit vmStarted();
-    } else {
-        qDebug() << "VM start requested; waiting for state...";
+        connectConsole();
+    }, kStartTimeoutMs);
+}
+
+void VMManager::connectConsole()
+{
+    // Domains defined with the virtio-serial channel expose its socket while
+    // running; older ones only offer the network/SSH path
+    QString socketPath = getAgentSocketPath();
+    if (!QFile::exists(socketPath)) {
+        requestAddress();
+        return;
     }
-    
-    // Connect to console
-    startConsole();
-    
-    return true;
+
+    setLifecycleState(LifecycleState::AwaitingAgent);
+    emit progress("Waiting for guest agent...");
+    guestChannel->connectToSocket(socketPath, 20000);
 }
 
-void VMManager::startConsole()
+void VMManager::onConsoleConnected(const QString &via)
 {
-    if (virshProcess) {
-        delete virshProcess;
+    setLifecycleState(LifecycleState::Connected);
+    emit vmOutputReady("Connected to VM via " + via + "\n");
+    emit vmOutputReady("Logged in as debian\n\n");
+
+    // Time-to-shell per boot mode, so warm and cold starts can be compared
+    qint64 elapsed = sessionTimer.elapsed();
+    qDebug() << "VM time-to-shell:" << elapsed << "ms (" << bootMode << ")";
+    LogManager::instance().log(LogManager::INFO, "system",
+        QString("VM time-to-shell: %1 ms (%2 start, %3)").arg(elapsed).arg(bootMode, via));
+    emit sessionReady(bootMode, elapsed);
+}
+
+void VMManager::requestAddress()
+{
+    if (m_lifecycleState != LifecycleState::AwaitingIP) {
+        attempt = 0;
+        setLifecycleState(LifecycleState::AwaitingIP);
+        emit progress("Waiting for VM network address...");
     }
-    
-    // Get VM IP address with retries
-    QString vmIP;
-    for (int attempt = 0; attempt < 10; attempt++) {
-        QProcess ipCheck;
-        ipCheck.start("virsh", QStringList() << "--connect" << "qemu:///system" << "domifaddr" << vmName);
-        ipCheck.waitForFinished(3000);
-        QString ipOutput = ipCheck.readAllStandardOutput();
-        
+
+    runVirsh(QStringList() << "domifaddr" << vmName,
+             [this](int, const QString &ipOutput, const QString &) {
         QStringList lines = ipOutput.split('\n');
         for (const QString &line : lines) {
             if (line.contains("ipv4")) {
-                QRegularExpression re("(\\d+\\.\\d+\\.\\d+\\.\\d+)");
+                static const QRegularExpression re("(\\d+\\.\\d+\\.\\d+\\.\\d+)");
                 QRegularExpressionMatch match = re.match(line);
                 if (match.hasMatch()) {
                     vmIP = match.captured(1);
@@ -116,213 +643,211 @@ void VMManager::startConsole()
                 }
             }
         }
-        
+
         if (!vmIP.isEmpty()) {
-            break;
+            probeSSH();
+            return;
         }
-        QThread::sleep(2);
-    }
-    
-    if (vmIP.isEmpty()) {
-        emit vmError("VM starting... Wait 30 seconds for cloud-init to finish.");
-        emit vmOutputReady("\nVM is booting. Cloud-init takes 30-90 seconds on first boot.\n");
-        emit vmOutputReady("Click 'Start VM' again in a moment to connect.\n");
-        return;
-    }
-    
-    // Wait for SSH port to be reachable using timeout + nc
-    bool sshReady = false;
-    for (int attempt = 0; attempt < 20; attempt++) {
-        QProcess portCheck;
-        portCheck.start("sh", QStringList() << "-c" << QString("timeout 1 bash -c 'echo > /dev/tcp/%1/22' 2>/dev/null").arg(vmIP));
-        portCheck.waitForFinished(2000);
-        if (portCheck.exitCode() == 0) {
-            sshReady = true;
-            break;
+
+        if (++attempt < 10) {
+            retryTimer.start(2000);
+            return;
         }
-        QThread::sleep(1);
-    }
-    
-    if (!sshReady) {
-        emit vmError("SSH service not ready. Try connecting again.");
-        emit vmOutputReady("\nSSH port not responding after 20s. Wait a moment and retry.\n");
-        return;
+
+        failSession("VM starting... Wait 30 seconds for cloud-init to finish.",
+                    "\nVM is booting. Cloud-init takes 30-90 seconds on first boot.\n"
+                    "Click 'Start VM' again in a moment to connect.\n");
+    });
+}
+
+void VMManager::probeSSH()
+{
+    setLifecycleState(LifecycleState::AwaitingSSH);
+    emit progress("Waiting for SSH on " + vmIP + "...");
+    sshProber->start(vmIP, 22, 20000);
+}
+
+void VMManager::startConsole()
+{
+    if (virshProcess) {
+        virshProcess->disconnect();
+        virshProcess->kill();
+        virshProcess->deleteLater();
+        virshProcess = nullptr;
     }
-    
+
     // Create SSH process with sshpass for automatic login
-    virshProcess = new QProcess(this);
-    virshProcess->setProcessChannelMode(QProcess::MergedChannels);
-    
+    QProcess *proc = new QProcess(this);
+    virshProcess = proc;
+    proc->setProcessChannelMode(QProcess::MergedChannels);
+
     // Connect signals
-    connect(virshProcess, &QProcess::readyReadStandardOutput, this, [this]() {
-        QString output = virshProcess->readAllStandardOutput();
+    connect(proc, &QProcess::readyReadStandardOutput, this, [this, proc]() {
+        QString output = proc->readAllStandardOutput();
         emit vmOutputReady(output);
     });
-    
-    connect(virshProcess, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
-            this, [this](int exitCode, QProcess::ExitStatus exitStatus) {
+
+    connect(proc, &QProcess::started, this, [this]() {
+        onConsoleConnected("SSH at " + vmIP);
+    });
+
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [this, proc](int exitCode, QProcess::ExitStatus) {
         qDebug() << "SSH disconnected with code:" << exitCode;
         emit vmOutputReady("\n[Connection closed]\n");
+        if (virshProcess == proc) {
+            virshProcess = nullptr;
+            proc->deleteLater();
+        }
+        if (m_lifecycleState == LifecycleState::Connected) {
+            setLifecycleState(LifecycleState::Stopped);
+        }
+    });
+
+    connect(proc, &QProcess::errorOccurred, this, [this, proc](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart) {
+            return;
+        }
+        if (virshProcess == proc) {
+            virshProcess = nullptr;
+        }
+        proc->deleteLater();
+        failSession("Failed to connect SSH: " + proc->errorString(),
+                    "\nSSH not ready yet. Wait and try again.\n");
     });
-    
+
     // Start SSH with sshpass for auto-login
     // Launch bash with interactive mode
     QStringList sshArgs;
-    sshArgs << "-p" << "debian" 
+    sshArgs << "-p" << "debian"
             << "ssh"
             << "-o" << "StrictHostKeyChecking=no"
             << "-o" << "UserKnownHostsFile=/dev/null"
             << "-o" << "LogLevel=ERROR"
             << "debian@" + vmIP
             << "bash -i";  // Interactive bash shell
-    
-    virshProcess->start("sshpass", sshArgs);
-    
-    if (!virshProcess->waitForStarted(5000)) {
-        emit vmError("Failed to connect SSH: " + virshProcess->errorString());
-        emit vmOutputReady("\nSSH not ready yet. Wait and try again.\n");
-        delete virshProcess;
-        virshProcess = nullptr;
+
+    proc->start("sshpass", sshArgs);
+}
+
+void VMManager::cancel()
+{
+    if (m_lifecycleState == LifecycleState::Stopped
+        || m_lifecycleState == LifecycleState::Connected
+        || m_lifecycleState == LifecycleState::Stopping) {
         return;
     }
-    
-    emit vmOutputReady("Connected to VM at " + vmIP + "\n");
-    emit vmOutputReady("Logged in as debian\n\n");
+
+    // Abandons the console attempt; a domain that already booted keeps running
+    qDebug() << "Cancelling VM start";
+    abortStep();
+    guestChannel->close();
+    sshProber->cancel();
+    retryTimer.stop();
+    emit progress("Start cancelled.");
+    setLifecycleState(LifecycleState::Stopped);
 }
 
 void VMManager::stopVM()
 {
+    if (m_lifecycleState == LifecycleState::Stopping) {
+        return;
+    }
+
     qDebug() << "Stopping VM...";
-    
-    // Disconnect console first
+    abortStep();
+    retryTimer.stop();
+    setLifecycleState(LifecycleState::Stopping);
+    emit progress("Stopping VM...");
+    guestChannel->close();
+    sshProber->cancel();
+
+    // Disconnect console first; let it exit in the background
     if (virshProcess) {
-        virshProcess->terminate();
-        virshProcess->waitForFinished(1000);
-        delete virshProcess;
+        QProcess *proc = virshProcess;
         virshProcess = nullptr;
+        proc->disconnect();
+        connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+                proc, &QObject::deleteLater);
+        QTimer::singleShot(1000, proc, &QProcess::kill);
+        proc->terminate();
     }
-    
-    // Shutdown the VM gracefully
-    QProcess shutdownProcess;
-    shutdownProcess.start("virsh", QStringList() << "--connect" << "qemu:///system" << "shutdown" << vmName);
-    shutdownProcess.waitForFinished(3000);
-    
-    emit vmStopped();
+
+    // virsh shutdown only queues the ACPI request; Stopping lasts until the
+    // domain is reported shut off
+    runVirsh(QStringList() << "shutdown" << vmName,
+             [this](int exitCode, const QString &, const QString &err) {
+        if (exitCode != 0) {
+            if (err.contains("not running")) {
+                setDomainState(DomainState::ShutOff);
+                finishStop();
+                return;
+            }
+            qWarning() << "Shutdown request failed:" << err;
+            forceStop();
+            return;
+        }
+        if (m_lifecycleState == LifecycleState::Stopping) {
+            stopPollTimer.start();
+            stopDeadline.start(kShutdownGraceMs);
+            refreshDomainState();
+        }
+    });
 }
 
-bool VMManager::isVMRunning() const
+void VMManager::forceStop()
 {
-    QProcess check;
-    check.start("virsh", QStringList() << "--connect" << "qemu:///system" << "domstate" << vmName);
-    check.waitForFinished(2000);
-    
-    QString state = check.readAllStandardOutput().trimmed();
-    return state == "running";
+    if (m_lifecycleState != LifecycleState::Stopping) {
+        return;
+    }
+    stopPollTimer.stop();
+    stopDeadline.stop();
+    emit progress("VM not shutting down; powering it off...");
+    runVirsh(QStringList() << "destroy" << vmName,
+             [this](int exitCode, const QString &, const QString &err) {
+        if (exitCode != 0 && !err.contains("not running")) {
+            // Still running as far as we know: stay in Stopping, keep polling
+            // (a shut off domain ends it) and try again
+            qWarning() << "Failed to power off VM:" << err;
+            emit vmError("Failed to stop VM: " + err);
+            if (m_lifecycleState == LifecycleState::Stopping) {
+                stopPollTimer.start();
+                stopDeadline.start(kDestroyRetryMs);
+                refreshDomainState();
+            }
+            return;
+        }
+        setDomainState(DomainState::ShutOff);
+        finishStop();
+    });
 }
 
-bool VMManager::attachUSBDevice(const QString &vendorId, const QString &productId)
+void VMManager::finishStop()
 {
-    if (!isVMRunning()) {
-        qDebug() << "Cannot attach USB: VM is not running";
-        return false;
-    }
-    
-    // Create XML for USB device passthrough
-    QString usbXML = QString(
-        "<hostdev mode='subsystem' type='usb'>\n"
-        "  <source>\n"
-        "    <vendor id='0x%1'/>\n"
-        "    <product id='0x%2'/>\n"
-        "  </source>\n"
-        "</hostdev>\n"
-    ).arg(vendorId, productId);
-    
-    // Write XML to temporary file
-    QProcess mktemp;
-    mktemp.start("mktemp");
-    mktemp.waitForFinished(1000);
-    QString tmpFile = mktemp.readAllStandardOutput().trimmed();
-    
-    if (tmpFile.isEmpty()) {
-        qDebug() << "Failed to create temp file for USB XML";
-        return false;
-    }
-    
-    QFile file(tmpFile);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        qDebug() << "Failed to write USB XML";
-        return false;
-    }
-    file.write(usbXML.toUtf8());
-    file.close();
-    
-    // Attach device using virsh
-    QProcess attach;
-    attach.start("virsh", QStringList() << "--connect" << "qemu:///system" 
-                 << "attach-device" << vmName << tmpFile);
-    attach.waitForFinished(5000);
-    
-    int exitCode = attach.exitCode();
-    QString output = attach.readAllStandardOutput();
-    QString error = attach.readAllStandardError();
-    
-    // Clean up temp file
-    QFile::remove(tmpFile);
-    
-    if (exitCode == 0) {
-        qDebug() << "USB device" << vendorId << ":" << productId << "attached successfully";
-        emit vmOutputReady(QString("\n[USB Device %1:%2 connected to VM]\n").arg(vendorId, productId));
-        return true;
-    } else {
-        qDebug() << "Failed to attach USB device:" << error;
-        return false;
+    if (m_lifecycleState != LifecycleState::Stopping) {
+        return;
     }
+    stopPollTimer.stop();
+    stopDeadline.stop();
+    setLifecycleState(LifecycleState::Stopped);
+    emit vmStopped();
 }
 
-bool VMManager::detachUSBDevice(const QString &vendorId, const QString &productId)
+void VMManager::attachUSBDevice(const USBDevice &device)
 {
-    if (!isVMRunning()) {
-        return false;
-    }
-    
-    // Create same XML structure for detach
-    QString usbXML = QString(
-        "<hostdev mode='subsystem' type='usb'>\n"
-        "  <source>\n"
-        "    <vendor id='0x%1'/>\n"
-        "    <product id='0x%2'/>\n"
-        "  </source>\n"
-        "</hostdev>\n"
-    ).arg(vendorId, productId);
-    
-    QProcess mktemp;
-    mktemp.start("mktemp");
-    mktemp.waitForFinished(1000);
-    QString tmpFile = mktemp.readAllStandardOutput().trimmed();
-    
-    if (tmpFile.isEmpty()) {
-        return false;
-    }
-    
-    QFile file(tmpFile);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        return false;
-    }
-    file.write(usbXML.toUtf8());
-    file.close();
-    
-    QProcess detach;
-    detach.start("virsh", QStringList() << "--connect" << "qemu:///system" 
-                 << "detach-device" << vmName << tmpFile);
-    detach.waitForFinished(5000);
-    
-    QFile::remove(tmpFile);
-    
-    if (detach.exitCode() == 0) {
-        qDebug() << "USB device" << vendorId << ":" << productId << "detached";
-        emit vmOutputReady(QString("\n[USB Device %1:%2 disconnected from VM]\n").arg(vendorId, productId));
-        return true;
+    // Policy verdicts are cached per device, so rejected devices never cost
+    // a libvirt round trip
+    if (!USBClassifier::instance().shouldAttach(device)) {
+        qDebug() << "USB device" << device.identifier() << "kept on the host by policy";
+        return;
     }
-    
-    return false;
+
+    // Queued; sent as soon as the domain is running
+    usbQueue->attach(device);
+}
+
+void VMManager::detachUSBDevice(const USBDevice &device)
+{
+    USBClassifier::instance().forget(device);
+    usbQueue->detach(device);
 }
@@ -4,35 +4,90 @@
 #include <QObject>
 #include <QProcess>
 #include <QString>
+#include <QStringList>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <functional>
+#include "USBDevice.h"
+#include "VirtBackend.h"
+
+class OverlayPool;
+class GuestChannel;
+class PortProber;
+class USBPassthroughQueue;
 
 class VMManager : public QObject
 {
     Q_OBJECT
 
 public:
+    // Console session lifecycle. Every transition is driven by QProcess
+    // signals or timers so nothing here ever blocks the UI thread.
+    enum class LifecycleState {
+        Stopped,      // no session in progress
+        Starting,     // checking the domain / issuing virsh start
+        AwaitingAgent,// waiting for the guest agent on the virtio-serial channel
+        AwaitingIP,   // polling domifaddr for a DHCP lease (SSH fallback)
+        AwaitingSSH,  // probing the guest's SSH port
+        Connected,    // interactive shell is attached
+        Stopping      // console torn down, waiting for the domain to shut off
+    };
+    Q_ENUM(LifecycleState)
+
+    // Last known libvirt domain state, kept current by lifecycle events
+    enum class DomainState {
+        Unknown,
+        Undefined,
+        ShutOff,
+        Running,
+        Paused,
+        Crashed
+    };
+    Q_ENUM(DomainState)
+
     static VMManager& instance();
 
-    // VM lifecycle management
+    // VM lifecycle management (asynchronous; watch lifecycleStateChanged)
     bool startVM();
     void stopVM();
-    bool isVMRunning() const;
-    
+    void cancel();
+    bool isVMRunning() const { return m_domainState == DomainState::Running; }
+    DomainState domainState() const { return m_domainState; }
+    LifecycleState lifecycleState() const { return m_lifecycleState; }
+    bool isTransitioning() const;
+
     // VM configuration
-    QString getBaseImagePath() const;
-    bool baseImageExists() const;
-    
-    // USB device passthrough
-    bool attachUSBDevice(const QString &vendorId, const QString &productId);
-    bool detachUSBDevice(const QString &vendorId, const QString &productId);
-    
+    QString getBaseImagePath() const;       // golden cold-boot image
+    QString getSessionDiskPath() const;     // the disk the domain boots from
+
+    // Warm start: restore a booted, SSH-ready memory snapshot made by setup-vm.sh
+    QString getWarmSnapshotPath() const;
+    QString getWarmDiskPath() const;
+    bool warmImageAvailable() const;
+
+    // USB device passthrough; attaches requested while the VM is down are
+    // held and applied in one batch once it is running
+    void attachUSBDevice(const USBDevice &device);
+    void detachUSBDevice(const USBDevice &device);
+
     // Get virsh console process for output/input
     QProcess* getVirshProcess() const { return virshProcess; }
 
+    // Console I/O over whichever transport is attached (guest agent or SSH)
+    bool isConsoleConnected() const;
+    bool sendConsoleInput(const QByteArray &data);
+    QString getAgentSocketPath() const;
+
 signals:
     void vmStarted();
     void vmStopped();
     void vmOutputReady(const QString &output);
     void vmError(const QString &error);
+    void lifecycleStateChanged(VMManager::LifecycleState state);
+    void stateChanged(VMManager::DomainState state);
+    void progress(const QString &message);
+    // bootMode is "warm", "cold" or "running" (console attached to a live VM)
+    void sessionReady(const QString &bootMode, qint64 timeToShellMs);
 
 private:
     VMManager();
@@ -40,12 +95,62 @@ private:
     VMManager(const VMManager&) = delete;
     VMManager& operator=(const VMManager&) = delete;
 
+    using StepCallback = std::function<void(int exitCode, const QString &out, const QString &err)>;
+
     QProcess *virshProcess;
+    GuestChannel *guestChannel; // virtio-serial console, preferred over SSH
+    PortProber *sshProber;      // in-process readiness check for the guest sshd
+    USBPassthroughQueue *usbQueue;
+    QProcess *stepProcess;      // the single in-flight helper command
+    VirtBackend *backend;       // persistent libvirt connection
+    quint64 stepGeneration;     // bumps on abort so stale virsh replies are dropped
+    QTimer retryTimer;
+    QElapsedTimer sessionTimer;
+    QString bootMode;
     QString vmName;
-    
+    QString vmIP;
+    int attempt;
+    LifecycleState m_lifecycleState;
+    DomainState m_domainState;
+    QTimer statePollTimer;      // fallback when the backend has no event stream
+    QTimer stopPollTimer;       // domstate while a shutdown is pending
+    QTimer stopDeadline;        // then virsh destroy
+
+    // Disposable per-session disks: each session runs on a fresh overlay of a
+    // golden image, handed out by a pool and discarded in the background
+    OverlayPool *coldPool;
+    OverlayPool *warmPool;
+    QString freshDiskBacking;   // backing of the unused overlay in place, if any
+
     void setupPaths();
-    QString createUserOverlay();
+    void setupOverlayPools();
+    bool sessionOverlaysEnabled() const;
+    void prepareSessionDisk(const QString &backing, std::function<void(bool ok)> done);
+    void retireSessionDisk();
+    void recycleSessionDisk();
+
+    void setLifecycleState(LifecycleState state);
+    void runStep(const QString &program, const QStringList &args, int timeoutMs, StepCallback done);
+    void runVirsh(const QStringList &command, StepCallback done, int timeoutMs = VirtBackend::DefaultTimeoutMs);
+    void abortStep();
+    void failSession(const QString &error, const QString &hint = QString());
+
+    void onDomainState(int exitCode, const QString &out);
+    void coldStart();
+    void bootCold();
+    void warmStart();
+    void connectConsole();
+    void onConsoleConnected(const QString &via);
+    void requestAddress();
+    void probeSSH();
     void startConsole();
+    void forceStop();
+    void finishStop();
+
+    void setDomainState(DomainState state);
+    void applyDomainStateText(const QString &text);
+    void onDomainEvent(const QString &domain, const QString &event);
+    void refreshDomainState();
 };
 
 #endif // VMMANAGER_H
@@ -0,0 +1,351 @@
+#include "VirshSessionBackend.h"
+#include <QRegularExpression>
+#include <QDebug>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace {
+const char *kPrompt = "virsh # ";
+const char *kMarkerPrefix = "__SDUI_END_";
+// A timed-out command virsh is running still silent after this much longer
+// wedged the session
+const int kWedgedMs = 300000;
+// Abandoned commands still queued behind the running one have no deadline
+const qint64 kNoDeadline = std::numeric_limits<qint64>::max();
+}
+
+VirshSessionBackend::VirshSessionBackend(const QString &uri, QObject *parent)
+    : VirtBackend(parent)
+    , uri(uri)
+    , session(nullptr)
+    , nextId(1)
+    , eventProcess(nullptr)
+{
+    clock.start();
+    responseTimer.setSingleShot(true);
+    connect(&responseTimer, &QTimer::timeout, this, &VirshSessionBackend::onResponseTimeout);
+
+    // Back off before reconnecting the event stream (e.g. libvirtd restarting)
+    eventRestartTimer.setSingleShot(true);
+    eventRestartTimer.setInterval(5000);
+    connect(&eventRestartTimer, &QTimer::timeout, this, &VirshSessionBackend::startEventStream);
+}
+
+VirshSessionBackend::~VirshSessionBackend()
+{
+    if (eventProcess) {
+        eventProcess->disconnect();
+        eventProcess->kill();
+        eventProcess->waitForFinished(500);
+    }
+    if (session) {
+        session->disconnect();
+        session->write("quit\n");
+        session->closeWriteChannel();
+        if (!session->waitForFinished(500)) {
+            session->kill();
+            session->waitForFinished(500);
+        }
+    }
+}
+
+VirtBackend::Factory VirshSessionBackend::peerFactory() const
+{
+    QString target = uri;
+    return [target](QObject *parent) -> VirtBackend * {
+        return new VirshSessionBackend(target, parent);
+    };
+}
+
+bool VirshSessionBackend::ensureSession()
+{
+    if (session && session->state() != QProcess::NotRunning) {
+        return true;
+    }
+
+    if (session) {
+        session->deleteLater();
+        session = nullptr;
+    }
+
+    buffer.clear();
+    session = new QProcess(this);
+    // Errors must stay ordered relative to the end markers
+    session->setProcessChannelMode(QProcess::MergedChannels);
+    connect(session, &QProcess::readyReadStandardOutput, this, &VirshSessionBackend::onReadyRead);
+    connect(session, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, &VirshSessionBackend::onSessionFinished);
+    QProcess *proc = session;
+    connect(proc, &QProcess::started, this, [this, proc]() {
+        if (proc != session) {
+            return;
+        }
+        qDebug() << "Opened persistent virsh session on" << uri;
+        for (const Pending &p : pending) {
+            send(p);
+        }
+    });
+    connect(proc, &QProcess::errorOccurred, this, [this, proc](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart || proc != session) {
+            return;
+        }
+        qWarning() << "Failed to start virsh session:" << proc->errorString();
+        session = nullptr;
+        proc->deleteLater();
+        buffer.clear();
+        failAll("virsh is not available");
+    });
+
+    // Commands queue until it has started; the GUI thread never waits on it.
+    // A failure may be reported from start() itself
+    session->start("virsh", QStringList() << "--connect" << uri << "--quiet");
+    return session != nullptr;
+}
+
+void VirshSessionBackend::send(const Pending &p)
+{
+    session->write((p.commandLine + "\necho " + p.marker + "\n").toUtf8());
+}
+
+QString VirshSessionBackend::quoteArg(const QString &arg)
+{
+    static const QRegularExpression plain("^[A-Za-z0-9_./:=,@+-]+$");
+    if (plain.match(arg).hasMatch()) {
+        return arg;
+    }
+    QString escaped = arg;
+    escaped.replace('\\', "\\\\");
+    escaped.replace('"', "\\\"");
+    return '"' + escaped + '"';
+}
+
+void VirshSessionBackend::execute(const QStringList &command, Callback done, int timeoutMs)
+{
+    if (!ensureSession()) {
+        VirtResult result;
+        result.error = "virsh is not available";
+        done(result);
+        return;
+    }
+
+    Pending p;
+    p.id = nextId++;
+    QStringList quoted;
+    for (const QString &arg : command) {
+        quoted << quoteArg(arg);
+    }
+    p.commandLine = quoted.join(' ');
+    p.marker = QString("%1%2__").arg(kMarkerPrefix).arg(p.id);
+    p.done = std::move(done);
+    p.timeoutMs = timeoutMs;
+    // Time spent queued behind other commands counts
+    p.deadline = clock.elapsed() + timeoutMs;
+    p.abandoned = false;
+
+    // Commands are pipelined; virsh runs them in order so markers arrive in order
+    if (session->state() == QProcess::Running) {
+        send(p);
+    }
+    pending.enqueue(p);
+    armResponseTimer();
+}
+
+// Fires at the earliest deadline of the queue
+void VirshSessionBackend::armResponseTimer()
+{
+    qint64 next = kNoDeadline;
+    for (const Pending &p : pending) {
+        next = std::min(next, p.deadline);
+    }
+    if (next == kNoDeadline) {
+        responseTimer.stop();
+        return;
+    }
+    responseTimer.start(int(std::max<qint64>(0, next - clock.elapsed())));
+}
+
+void VirshSessionBackend::onReadyRead()
+{
+    buffer.append(session->readAllStandardOutput());
+
+    int newline;
+    while ((newline = buffer.indexOf('\n')) >= 0) {
+        QString line = QString::fromUtf8(buffer.left(newline));
+        buffer.remove(0, newline + 1);
+        processLine(line);
+    }
+}
+
+void VirshSessionBackend::processLine(QString line)
+{
+    // Interactive virsh prefixes the next prompt to whatever it prints
+    while (line.startsWith(kPrompt)) {
+        line.remove(0, int(strlen(kPrompt)));
+    }
+    if (line.endsWith('\r')) {
+        line.chop(1);
+    }
+
+    if (pending.isEmpty()) {
+        return;
+    }
+
+    Pending &front = pending.head();
+
+    // Skip echoed input lines when virsh runs with readline on a pipe
+    if (line == front.commandLine || line.startsWith(QString("echo ") + kMarkerPrefix)) {
+        return;
+    }
+
+    if (line.trimmed() == front.marker) {
+        Pending done = pending.dequeue();
+        // An abandoned command virsh starts now gets the wedge check
+        if (!pending.isEmpty() && pending.head().abandoned) {
+            pending.head().deadline = clock.elapsed() + kWedgedMs;
+        }
+        armResponseTimer();
+        if (done.abandoned) {
+            return;
+        }
+
+        VirtResult result;
+        result.ok = done.errorLines.isEmpty();
+        result.output = done.outputLines.join('\n');
+        result.error = done.errorLines.join('\n');
+        done.done(result);
+        return;
+    }
+
+    if (line.startsWith("error:")) {
+        front.errorLines << line;
+    } else {
+        front.outputLines << line;
+    }
+}
+
+void VirshSessionBackend::failAll(const QString &error)
+{
+    responseTimer.stop();
+    QQueue<Pending> failed;
+    failed.swap(pending);
+    for (const Pending &p : failed) {
+        if (p.abandoned) {
+            continue;
+        }
+        VirtResult result;
+        result.error = error;
+        p.done(result);
+    }
+}
+
+void VirshSessionBackend::onSessionFinished(int exitCode, QProcess::ExitStatus exitStatus)
+{
+    qWarning() << "virsh session exited:" << exitCode << exitStatus;
+    buffer.clear();
+    failAll("virsh session closed");
+    // ensureSession() reopens it on the next command
+}
+
+void VirshSessionBackend::onResponseTimeout()
+{
+    qint64 now = clock.elapsed();
+    if (!pending.isEmpty() && pending.head().abandoned && pending.head().deadline <= now) {
+        qWarning() << "virsh session stopped responding; restarting";
+        if (session) {
+            session->disconnect();
+            session->kill();
+            session->deleteLater();
+            session = nullptr;
+        }
+        buffer.clear();
+        failAll("virsh session stopped responding");
+        return;
+    }
+
+    // Only commands past their own deadline fail; the session keeps running
+    // them and the others still get their answers
+    QList<Callback> expired;
+    for (int i = 0; i < pending.size(); ++i) {
+        Pending &p = pending[i];
+        if (p.abandoned || p.deadline > now) {
+            continue;
+        }
+        qWarning() << "virsh command timed out after" << p.timeoutMs << "ms:" << p.commandLine;
+        p.abandoned = true;
+        p.deadline = i == 0 ? now + kWedgedMs : kNoDeadline;
+        expired.append(std::move(p.done));
+        p.done = Callback();
+    }
+    armResponseTimer();
+
+    // Callbacks may queue commands, so they run once the queue is settled
+    for (const Callback &done : expired) {
+        VirtResult result;
+        result.error = "virsh command timed out";
+        done(result);
+    }
+}
+
+bool VirshSessionBackend::watchDomain(const QString &domain)
+{
+    watchedDomain = domain;
+    startEventStream();
+    return eventProcess != nullptr;
+}
+
+void VirshSessionBackend::startEventStream()
+{
+    if (eventProcess) {
+        eventProcess->disconnect();
+        eventProcess->kill();
+        eventProcess->deleteLater();
+        eventProcess = nullptr;
+    }
+    eventBuffer.clear();
+
+    QProcess *proc = new QProcess(this);
+    eventProcess = proc;
+    proc->setProcessChannelMode(QProcess::MergedChannels);
+    connect(proc, &QProcess::readyReadStandardOutput, this, &VirshSessionBackend::onEventOutput);
+    connect(proc, &QProcess::started, this, [this]() {
+        emit eventStreamStarted(watchedDomain);
+    });
+    connect(proc, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished),
+            this, [this](int exitCode, QProcess::ExitStatus) {
+        qWarning() << "virsh event stream exited:" << exitCode;
+        eventRestartTimer.start();
+    });
+    // finished() does not follow a failed start; retry from here instead
+    connect(proc, &QProcess::errorOccurred, this, [this, proc](QProcess::ProcessError error) {
+        if (error != QProcess::FailedToStart || proc != eventProcess) {
+            return;
+        }
+        qWarning() << "Failed to start virsh event stream:" << proc->errorString();
+        eventProcess = nullptr;
+        proc->deleteLater();
+        eventRestartTimer.start();
+    });
+
+    proc->start("virsh", QStringList() << "--connect" << uri << "event"
+                << "--domain" << watchedDomain << "--event" << "lifecycle" << "--loop");
+}
+
+void VirshSessionBackend::onEventOutput()
+{
+    eventBuffer.append(eventProcess->readAllStandardOutput());
+
+    // event 'lifecycle' for domain 'sdui-debian': Started Booted
+    static const QRegularExpression re("event 'lifecycle' for domain '([^']+)': (\\w+)");
+
+    int newline;
+    while ((newline = eventBuffer.indexOf('\n')) >= 0) {
+        QString line = QString::fromUtf8(eventBuffer.left(newline));
+        eventBuffer.remove(0, newline + 1);
+
+        QRegularExpressionMatch match = re.match(line);
+        if (match.hasMatch()) {
+            emit domainEvent(match.captured(1), match.captured(2));
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef VIRSHSESSIONBACKEND_H
+#define VIRSHSESSIONBACKEND_H
+
+#include "VirtBackend.h"
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QQueue>
+#include <QTimer>
+
+// Keeps one interactive `virsh --connect qemu:///system` process alive and
+// pipelines commands into it. Each command is followed by an `echo` of a
+// unique marker so responses can be split without closing the session.
+// Domain lifecycle events come from a second long-lived `virsh event` process.
+class VirshSessionBackend : public VirtBackend
+{
+    Q_OBJECT
+
+public:
+    explicit VirshSessionBackend(const QString &uri = "qemu:///system", QObject *parent = nullptr);
+    ~VirshSessionBackend();
+
+    void execute(const QStringList &command, Callback done, int timeoutMs = DefaultTimeoutMs) override;
+    QString name() const override { return "virsh-session"; }
+    Factory peerFactory() const override;
+    bool watchDomain(const QString &domain) override;
+
+private slots:
+    void onReadyRead();
+    void onSessionFinished(int exitCode, QProcess::ExitStatus exitStatus);
+    void onResponseTimeout();
+    void onEventOutput();
+
+private:
+    struct Pending {
+        quint64 id;
+        QString commandLine;
+        QString marker;
+        Callback done;
+        int timeoutMs;
+        qint64 deadline;        // on clock: enqueue time + timeoutMs, then the wedge check
+        bool abandoned;         // timed out; its output is still drained
+        QStringList outputLines;
+        QStringList errorLines;
+    };
+
+    QString uri;
+    QProcess *session;
+    QQueue<Pending> pending;
+    QByteArray buffer;
+    quint64 nextId;
+    QElapsedTimer clock;
+    QTimer responseTimer;       // for the earliest deadline in pending
+
+    // Separate long-lived `virsh event --loop` process; the command session
+    // cannot be used because `event` blocks it
+    QProcess *eventProcess;
+    QString watchedDomain;
+    QByteArray eventBuffer;
+    QTimer eventRestartTimer;
+
+    bool ensureSession();
+    void send(const Pending &p);
+    void processLine(QString line);
+    void failAll(const QString &error);
+    void armResponseTimer();
+    void startEventStream();
+    static QString quoteArg(const QString &arg);
+};
+
+#endif // VIRSHSESSIONBACKEND_H
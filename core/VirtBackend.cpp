@@ -0,0 +1,14 @@
+#include "VirtBackend.h"
+#include "VirshSessionBackend.h"
+#include "FakeVirtBackend.h"
+#include <QDebug>
+
+VirtBackend *VirtBackend::create(QObject *parent)
+{
+    QString choice = qEnvironmentVariable("SDUI_VIRT_BACKEND").toLower();
+    if (choice == "fake") {
+        qDebug() << "Using in-process fake virtualization backend";
+        return new FakeVirtBackend(parent);
+    }
+    return new VirshSessionBackend("qemu:///system", parent);
+}
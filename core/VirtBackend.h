@@ -0,0 +1,57 @@
+#ifndef VIRTBACKEND_H
+#define VIRTBACKEND_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <functional>
+
+struct VirtResult {
+    bool ok = false;
+    QString output;
+    QString error;
+};
+
+// Transport for virsh-style commands such as {"domstate", "sdui-debian"}.
+// Implementations keep whatever connection they need open between calls so
+// callers never pay for a process spawn per query.
+class VirtBackend : public QObject
+{
+    Q_OBJECT
+
+public:
+    using Callback = std::function<void(const VirtResult &result)>;
+    using Factory = std::function<VirtBackend *(QObject *parent)>;
+
+    // Enough for queries; slow verbs such as restore or start pass their own
+    static const int DefaultTimeoutMs = 30000;
+
+    // Picks the backend named by SDUI_VIRT_BACKEND ("virsh" or "fake");
+    // defaults to the persistent virsh session.
+    static VirtBackend *create(QObject *parent = nullptr);
+
+    explicit VirtBackend(QObject *parent = nullptr) : QObject(parent) {}
+    virtual ~VirtBackend() = default;
+
+    // Queue a command; done is invoked on this object's thread. A command
+    // that runs past timeoutMs fails on its own, without the ones behind it.
+    virtual void execute(const QStringList &command, Callback done, int timeoutMs = DefaultTimeoutMs) = 0;
+
+    virtual QString name() const = 0;
+
+    // Opens further connections to the same hypervisor, e.g. for a worker
+    // thread; safe to call from any thread
+    virtual Factory peerFactory() const = 0;
+
+    // Start streaming lifecycle events for a domain. Returns false when the
+    // backend cannot deliver events and the caller should poll instead.
+    virtual bool watchDomain(const QString &domain) = 0;
+
+signals:
+    // event is the libvirt lifecycle name, e.g. "Started", "Stopped", "Suspended"
+    void domainEvent(const QString &domain, const QString &event);
+    // Emitted whenever the event stream (re)connects; events may have been missed
+    void eventStreamStarted(const QString &domain);
+};
+
+#endif // VIRTBACKEND_H
@@ -0,0 +1,787 @@
+#include "ArchiveWalker.h"
+#include <algorithm>
+#include <bzlib.h>
+#include <cstring>
+#include <memory>
+#include <strings.h>
+#include <vector>
+#include <zlib.h>
+
+namespace {
+
+const size_t kFileBuffer = 1 << 20;      // reads from disk
+const size_t kMemberBuffer = 64 * 1024;  // each nesting level below
+const size_t kDetectBytes = 512;         // a tar header
+const uint64_t kRatioGrace = 1 << 20;    // tiny members compress absurdly well too
+const uint64_t kMaxTarHeader = 1 << 20;  // GNU long names and pax records
+const uint64_t kUnlimited = ~uint64_t(0);
+
+uint16_t le16(const uint8_t *p)
+{
+    return uint16_t(p[0] | p[1] << 8);
+}
+
+uint32_t le32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint64_t le64(const uint8_t *p)
+{
+    return uint64_t(le32(p)) | uint64_t(le32(p + 4)) << 32;
+}
+
+// Octal, or base-256 when the top bit is set (GNU, sizes over 8 GiB)
+bool tarNumber(const uint8_t *field, size_t length, uint64_t *value)
+{
+    uint64_t v = 0;
+    if (field[0] & 0x80) {
+        if (field[0] & 0x40) {
+            return false;
+        }
+        v = field[0] & 0x3f;
+        for (size_t i = 1; i < length; ++i) {
+            if (v >> 56) {
+                return false;
+            }
+            v = v << 8 | field[i];
+        }
+        *value = v;
+        return true;
+    }
+    size_t i = 0;
+    while (i < length && field[i] == ' ') {
+        ++i;
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; ++i) {
+        v = v << 3 | uint64_t(field[i] - '0');
+    }
+    *value = v;
+    return true;
+}
+
+bool tarChecksumOk(const uint8_t *h)
+{
+    uint64_t stored;
+    if (h[0] == 0 || !tarNumber(h + 148, 8, &stored)) {
+        return false;
+    }
+    // Old tars summed signed chars
+    uint64_t sum = 0;
+    int64_t signedSum = 0;
+    for (int i = 0; i < 512; ++i) {
+        uint8_t c = i >= 148 && i < 156 ? ' ' : h[i];
+        sum += c;
+        signedSum += int8_t(c);
+    }
+    return stored == sum || int64_t(stored) == signedSum;
+}
+
+std::string tarField(const uint8_t *field, size_t length)
+{
+    return std::string(reinterpret_cast<const char *>(field),
+                       strnlen(reinterpret_cast<const char *>(field), length));
+}
+
+// "<length> <key>=<value>\n" records
+void parsePax(const std::string &text, std::string *path, uint64_t *size, bool *hasSize)
+{
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t space = text.find(' ', pos);
+        if (space == std::string::npos) {
+            return;
+        }
+        uint64_t length = strtoull(text.c_str() + pos, nullptr, 10);
+        if (length <= space - pos || pos + length > text.size()) {
+            return;
+        }
+        std::string record = text.substr(space + 1, pos + length - space - 2);
+        size_t eq = record.find('=');
+        if (eq != std::string::npos) {
+            std::string key = record.substr(0, eq);
+            if (key == "path") {
+                *path = record.substr(eq + 1);
+            } else if (key == "size") {
+                *size = strtoull(record.c_str() + eq + 1, nullptr, 10);
+                *hasSize = true;
+            }
+        }
+        pos += length;
+    }
+}
+
+// What a gzip or bzip2 file holds, named after it: a.tar.gz -> a.tar
+std::string decompressedName(const std::string &path, ArchiveWalker::Format format)
+{
+    std::string base = path.substr(path.rfind('/') + 1);
+    auto endsWith = [&base](const char *suffix) {
+        size_t n = strlen(suffix);
+        return base.size() > n && strcasecmp(base.c_str() + base.size() - n, suffix) == 0;
+    };
+    auto replace = [&base](size_t n, const char *with) { return base.substr(0, base.size() - n) + with; };
+    if (format == ArchiveWalker::Gzip) {
+        if (endsWith(".tgz")) return replace(4, ".tar");
+        if (endsWith(".gz")) return replace(3, "");
+    } else {
+        if (endsWith(".tbz2")) return replace(5, ".tar");
+        if (endsWith(".tbz")) return replace(4, ".tar");
+        if (endsWith(".bz2")) return replace(4, "");
+    }
+    return base;
+}
+
+// Pull interface of every layer; errors are sticky
+class Stream
+{
+public:
+    virtual ~Stream() {}
+    virtual long read(uint8_t *buffer, size_t capacity) = 0;
+    std::string error;
+};
+
+// State shared by every level of one walk
+struct Walk {
+    Walk(const ArchiveWalker::Limits &limits, ArchiveWalker::Sink &sink) : limits(limits), sink(sink) {}
+    const ArchiveWalker::Limits &limits;
+    ArchiveWalker::Sink &sink;
+    uint64_t produced = 0;   // decompressed bytes, all levels
+    uint32_t members = 0;
+    bool exhausted = false;  // total limit hit; nothing more is unpacked
+};
+
+class FileStream : public Stream
+{
+public:
+    explicit FileStream(ArchiveWalker::Source &source) : source(source) {}
+
+    long read(uint8_t *buffer, size_t capacity) override
+    {
+        if (!error.empty()) {
+            return -1;
+        }
+        long n = source.read(buffer, capacity, &error);
+        if (n < 0 && error.empty()) {
+            error = "read error";
+        }
+        return n;
+    }
+
+private:
+    ArchiveWalker::Source &source;
+};
+
+// Hands the bytes of one level to the sink as they are pulled
+class TeeStream : public Stream
+{
+public:
+    TeeStream(Stream &in, Walk &walk, int depth) : in(in), walk(walk), depth(depth), total(0) {}
+
+    long read(uint8_t *buffer, size_t capacity) override
+    {
+        if (!error.empty()) {
+            return -1;
+        }
+        if (walk.sink.cancelled()) {
+            error = "cancelled";
+            return -1;
+        }
+        long n = in.read(buffer, capacity);
+        if (n < 0) {
+            error = in.error;
+            return -1;
+        }
+        total += uint64_t(n);
+        if (depth > 0 && total > walk.limits.maxMemberBytes) {
+            error = "archive limit: member larger than " + std::to_string(walk.limits.maxMemberBytes) + " bytes";
+            return -1;
+        }
+        if (n > 0) {
+            walk.sink.data(depth, buffer, size_t(n));
+        }
+        return n;
+    }
+
+private:
+    Stream &in;
+    Walk &walk;
+    int depth;
+    uint64_t total;
+};
+
+class Buffered : public Stream
+{
+public:
+    Buffered(Stream &in, size_t size) : in(in), buffer(size), start(0), end(0), eof(false) {}
+
+    // At least n bytes available unless the stream ends first; false on error
+    bool fill(size_t n)
+    {
+        n = std::min(n, buffer.size());
+        if (end - start >= n) {
+            return true;
+        }
+        if (!error.empty()) {
+            return false;
+        }
+        if (start > 0) {
+            memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            start = 0;
+        }
+        while (end < n && !eof) {
+            long got = in.read(buffer.data() + end, buffer.size() - end);
+            if (got < 0) {
+                error = in.error;
+                return false;
+            }
+            eof = got == 0;
+            end += size_t(got);
+        }
+        return true;
+    }
+
+    const uint8_t *data() const { return buffer.data() + start; }
+    size_t available() const { return end - start; }
+    void consume(size_t n) { start += n; }
+
+    long read(uint8_t *out, size_t capacity) override
+    {
+        if (available() == 0 && !fill(1)) {
+            return -1;
+        }
+        size_t n = std::min(capacity, available());
+        memcpy(out, data(), n);
+        consume(n);
+        return long(n);
+    }
+
+    bool readExact(void *out, size_t n)
+    {
+        uint8_t *p = static_cast<uint8_t *>(out);
+        while (n > 0) {
+            long got = read(p, n);
+            if (got <= 0) {
+                if (got == 0) {
+                    error = "truncated";
+                }
+                return false;
+            }
+            p += got;
+            n -= size_t(got);
+        }
+        return true;
+    }
+
+    bool skip(uint64_t n)
+    {
+        while (n > 0) {
+            if (!fill(1)) {
+                return false;
+            }
+            if (available() == 0) {
+                error = "truncated";
+                return false;
+            }
+            size_t k = size_t(std::min<uint64_t>(n, available()));
+            consume(k);
+            n -= k;
+        }
+        return true;
+    }
+
+    // Reads to the end so every byte has passed through the levels below
+    bool drain()
+    {
+        for (;;) {
+            start = end;
+            if (!fill(1)) {
+                return false;
+            }
+            if (available() == 0) {
+                return true;
+            }
+        }
+    }
+
+private:
+    Stream &in;
+    std::vector<uint8_t> buffer;
+    size_t start;
+    size_t end;
+    bool eof;
+};
+
+// The next length bytes of a container (stored zip and tar members)
+class LimitedStream : public Stream
+{
+public:
+    LimitedStream(Buffered &in, uint64_t length) : in(in), remaining(length) {}
+
+    long read(uint8_t *buffer, size_t capacity) override
+    {
+        if (!error.empty()) {
+            return -1;
+        }
+        if (remaining == 0) {
+            return 0;
+        }
+        long n = in.read(buffer, size_t(std::min<uint64_t>(capacity, remaining)));
+        if (n <= 0) {
+            error = n < 0 ? in.error : "truncated";
+            return -1;
+        }
+        remaining -= uint64_t(n);
+        return n;
+    }
+
+private:
+    Buffered &in;
+    uint64_t remaining;
+};
+
+// Decompressors: count output against the walk's budget and their own ratio
+class Decoder : public Stream
+{
+public:
+    Decoder(Buffered &in, Walk &walk, uint64_t inputLimit)
+        : in(in), walk(walk), inputLimit(inputLimit), inputUsed(0), output(0), done(false) {}
+
+    uint64_t consumed() const { return inputUsed; }
+
+protected:
+    Buffered &in;
+    Walk &walk;
+    uint64_t inputLimit;
+    uint64_t inputUsed;
+    uint64_t output;
+    bool done;
+
+    // Input for the next step, empty at the end
+    size_t nextInput()
+    {
+        if (in.available() == 0 && !in.fill(1)) {
+            error = in.error;
+            return 0;
+        }
+        size_t n = size_t(std::min<uint64_t>(in.available(), inputLimit - inputUsed));
+        if (n == 0) {
+            error = "truncated compressed data";
+        }
+        return n;
+    }
+
+    void used(size_t n)
+    {
+        in.consume(n);
+        inputUsed += n;
+    }
+
+    long produced(size_t n)
+    {
+        output += n;
+        walk.produced += n;
+        if (walk.produced > walk.limits.maxTotalBytes) {
+            walk.exhausted = true;
+            error = "archive limit: more than " + std::to_string(walk.limits.maxTotalBytes) + " bytes unpacked";
+            return -1;
+        }
+        if (output > kRatioGrace && output / std::max<uint64_t>(inputUsed, 1) > walk.limits.maxRatio) {
+            error = "archive limit: compression ratio over " + std::to_string(walk.limits.maxRatio) + ":1";
+            return -1;
+        }
+        return long(n);
+    }
+
+    // The next bytes start another stream of the same format
+    bool followedBy(const char *magic, size_t length)
+    {
+        return in.fill(length) && in.available() >= length && memcmp(in.data(), magic, length) == 0;
+    }
+};
+
+class InflateStream : public Decoder
+{
+public:
+    // gzip: a gzip file (concatenated members allowed); otherwise raw deflate
+    InflateStream(Buffered &in, Walk &walk, bool gzip, uint64_t inputLimit)
+        : Decoder(in, walk, inputLimit), gzip(gzip)
+    {
+        memset(&z, 0, sizeof(z));
+        ready = inflateInit2(&z, gzip ? 15 + 16 : -15) == Z_OK;
+    }
+
+    ~InflateStream() override
+    {
+        if (ready) {
+            inflateEnd(&z);
+        }
+    }
+
+    long read(uint8_t *buffer, size_t capacity) override
+    {
+        if (!error.empty()) {
+            return -1;
+        }
+        if (!ready) {
+            error = "cannot initialize zlib";
+            return -1;
+        }
+        capacity = std::min<size_t>(capacity, 1u << 30);
+        z.next_out = buffer;
+        z.avail_out = uInt(capacity);
+        while (!done && z.avail_out == capacity) {
+            size_t n = nextInput();
+            if (n == 0) {
+                return -1;
+            }
+            z.next_in = const_cast<Bytef *>(in.data());
+            z.avail_in = uInt(n);
+            int ret = inflate(&z, Z_NO_FLUSH);
+            used(n - z.avail_in);
+            if (ret == Z_STREAM_END) {
+                if (gzip && followedBy("\x1f\x8b", 2)) {
+                    inflateReset(&z);
+                } else {
+                    done = true;
+                }
+            } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                error = "corrupt deflate data";
+                return -1;
+            }
+        }
+        return produced(capacity - z.avail_out);
+    }
+
+private:
+    z_stream z;
+    bool gzip;
+    bool ready;
+};
+
+class Bunzip2Stream : public Decoder
+{
+public:
+    Bunzip2Stream(Buffered &in, Walk &walk) : Decoder(in, walk, kUnlimited)
+    {
+        memset(&bz, 0, sizeof(bz));
+        ready = BZ2_bzDecompressInit(&bz, 0, 0) == BZ_OK;
+    }
+
+    ~Bunzip2Stream() override
+    {
+        if (ready) {
+            BZ2_bzDecompressEnd(&bz);
+        }
+    }
+
+    long read(uint8_t *buffer, size_t capacity) override
+    {
+        if (!error.empty()) {
+            return -1;
+        }
+        if (!ready) {
+            error = "cannot initialize bzip2";
+            return -1;
+        }
+        capacity = std::min<size_t>(capacity, 1u << 30);
+        bz.next_out = reinterpret_cast<char *>(buffer);
+        bz.avail_out = unsigned(capacity);
+        while (!done && bz.avail_out == capacity) {
+            size_t n = nextInput();
+            if (n == 0) {
+                return -1;
+            }
+            bz.next_in = const_cast<char *>(reinterpret_cast<const char *>(in.data()));
+            bz.avail_in = unsigned(n);
+            int ret = BZ2_bzDecompress(&bz);
+            used(n - bz.avail_in);
+            if (ret == BZ_STREAM_END) {
+                // pbzip2 and friends write one stream per block
+                if (followedBy("BZh", 3)) {
+                    BZ2_bzDecompressEnd(&bz);
+                    ready = BZ2_bzDecompressInit(&bz, 0, 0) == BZ_OK;
+                    if (!ready) {
+                        error = "cannot initialize bzip2";
+                        return -1;
+                    }
+                    bz.next_out = reinterpret_cast<char *>(buffer) + (capacity - bz.avail_out);
+                } else {
+                    done = true;
+                }
+            } else if (ret != BZ_OK) {
+                error = "corrupt bzip2 data";
+                return -1;
+            }
+        }
+        return produced(capacity - bz.avail_out);
+    }
+
+private:
+    bz_stream bz;
+    bool ready;
+};
+
+class Walker
+{
+public:
+    explicit Walker(Walk &walk) : walk(walk) {}
+
+    // Passes one file or member through, unpacking it when it is a container.
+    // Returns the error of content itself; member errors end at their sink.
+    std::string entity(Stream &content, int depth, const std::string &path)
+    {
+        TeeStream tee(content, walk, depth);
+        Buffered in(tee, depth == 0 ? kFileBuffer : kMemberBuffer);
+        if (depth < walk.limits.maxDepth && !walk.exhausted) {
+            if (!in.fill(kDetectBytes)) {
+                return in.error;
+            }
+            switch (ArchiveWalker::detect(in.data(), in.available())) {
+            case ArchiveWalker::Zip: unpackZip(in, depth + 1, path); break;
+            case ArchiveWalker::Tar: unpackTar(in, depth + 1, path); break;
+            case ArchiveWalker::Gzip: {
+                InflateStream gz(in, walk, true, kUnlimited);
+                member(gz, depth + 1, path + "//" + decompressedName(path, ArchiveWalker::Gzip));
+                break;
+            }
+            case ArchiveWalker::Bzip2: {
+                Bunzip2Stream bz(in, walk);
+                member(bz, depth + 1, path + "//" + decompressedName(path, ArchiveWalker::Bzip2));
+                break;
+            }
+            case ArchiveWalker::None: break;
+            }
+        }
+        return in.drain() ? std::string() : in.error;
+    }
+
+private:
+    Walk &walk;
+
+    // False when the container cannot go on: the member failed or a limit hit
+    bool member(Stream &content, int depth, const std::string &path)
+    {
+        if (walk.members >= walk.limits.maxMembers) {
+            return report(depth, path, "archive limit: more than " + std::to_string(walk.limits.maxMembers) + " members");
+        }
+        ++walk.members;
+        walk.sink.beginMember(depth, path);
+        std::string error = entity(content, depth, path);
+        walk.sink.endMember(depth, error);
+        return error.empty();
+    }
+
+    // A member that cannot be read; always false so callers can return it
+    bool report(int depth, const std::string &path, const std::string &error)
+    {
+        walk.sink.beginMember(depth, path);
+        walk.sink.endMember(depth, error);
+        return false;
+    }
+
+    static bool discard(Stream &content)
+    {
+        uint8_t chunk[4096];
+        long n;
+        while ((n = content.read(chunk, sizeof(chunk))) > 0) {
+        }
+        return n == 0;
+    }
+
+    void unpackZip(Buffered &in, int depth, const std::string &path)
+    {
+        for (;;) {
+            if (!in.fill(30) || in.available() < 4) {
+                return;
+            }
+            uint32_t signature = le32(in.data());
+            if (signature == 0x08074b50) {
+                in.consume(4);  // spanned archive marker
+                continue;
+            }
+            // Anything else, normally the central directory, ends the walk
+            if (signature != 0x04034b50 || in.available() < 30) {
+                return;
+            }
+            const uint8_t *h = in.data();
+            uint16_t flags = le16(h + 6);
+            uint16_t method = le16(h + 8);
+            uint64_t compressed = le32(h + 18);
+            uint64_t uncompressed = le32(h + 22);
+            size_t nameLength = le16(h + 26);
+            size_t extraLength = le16(h + 28);
+            in.consume(30);
+            std::string name(nameLength, '\0');
+            std::vector<uint8_t> extra(extraLength);
+            if (!in.readExact(&name[0], nameLength) || !in.readExact(extra.data(), extraLength)) {
+                return;
+            }
+
+            bool zip64 = false;
+            for (size_t p = 0; p + 4 <= extra.size();) {
+                uint16_t id = le16(&extra[p]);
+                size_t length = le16(&extra[p + 2]);
+                p += 4;
+                if (p + length > extra.size()) {
+                    break;
+                }
+                if (id == 0x0001) {
+                    zip64 = true;
+                    size_t q = p;
+                    if (uncompressed == 0xffffffff && q + 8 <= p + length) {
+                        uncompressed = le64(&extra[q]);
+                        q += 8;
+                    }
+                    if (compressed == 0xffffffff && q + 8 <= p + length) {
+                        compressed = le64(&extra[q]);
+                    }
+                }
+                p += length;
+            }
+
+            bool descriptor = flags & 0x08;
+            std::string memberPath = path + "//" + name;
+            std::unique_ptr<Stream> content;
+            InflateStream *inflater = nullptr;
+            std::string problem;
+            if (flags & 0x01) {
+                problem = "encrypted";
+            } else if (method == 0 && !descriptor) {
+                content.reset(new LimitedStream(in, compressed));
+            } else if (method == 8) {
+                inflater = new InflateStream(in, walk, false, descriptor ? kUnlimited : compressed);
+                content.reset(inflater);
+            } else if (method == 0) {
+                problem = "stored with a data descriptor";
+            } else {
+                problem = "compression method " + std::to_string(method) + " not supported";
+            }
+            if (!problem.empty()) {
+                report(depth, memberPath, problem);
+                // Without sizes the next header cannot be found
+                if (descriptor || !in.skip(compressed)) {
+                    return;
+                }
+                continue;
+            }
+
+            bool directory = !name.empty() && name.back() == '/';
+            if (!(directory ? discard(*content) : member(*content, depth, memberPath))) {
+                return;
+            }
+            if (inflater && !descriptor && inflater->consumed() < compressed
+                && !in.skip(compressed - inflater->consumed())) {
+                return;
+            }
+            if (descriptor) {
+                // Optional signature, then CRC and both sizes
+                if (!in.fill(4)) {
+                    return;
+                }
+                if (in.available() >= 4 && le32(in.data()) == 0x08074b50) {
+                    in.consume(4);
+                }
+                if (!in.skip(zip64 ? 20 : 12)) {
+                    return;
+                }
+            }
+        }
+    }
+
+    void unpackTar(Buffered &in, int depth, const std::string &path)
+    {
+        std::string longName;
+        std::string paxPath;
+        uint64_t paxSize = 0;
+        bool hasPaxSize = false;
+        uint8_t h[512];
+        for (;;) {
+            if (!in.readExact(h, sizeof(h)) || !tarChecksumOk(h)) {
+                return;  // end-of-archive zero blocks land here too
+            }
+            uint64_t size;
+            if (!tarNumber(h + 124, 12, &size)) {
+                return;
+            }
+            char type = char(h[156]);
+            if ((type == 'L' || type == 'x') && size <= kMaxTarHeader) {
+                std::string text(size_t(size), '\0');
+                if (!in.readExact(&text[0], text.size()) || !in.skip(((size + 511) & ~uint64_t(511)) - size)) {
+                    return;
+                }
+                if (type == 'L') {
+                    longName = text.c_str();
+                } else {
+                    parsePax(text, &paxPath, &paxSize, &hasPaxSize);
+                }
+                continue;
+            }
+
+            if (hasPaxSize) {
+                size = paxSize;
+            }
+            std::string name = !paxPath.empty() ? paxPath : !longName.empty() ? longName : tarField(h, 100);
+            if (paxPath.empty() && longName.empty() && memcmp(h + 257, "ustar", 5) == 0 && h[345]) {
+                name = tarField(h + 345, 155) + "/" + name;
+            }
+            longName.clear();
+            paxPath.clear();
+            hasPaxSize = false;
+
+            if (type == '0' || type == '\0' || type == '7') {
+                LimitedStream content(in, size);
+                if (!member(content, depth, path + "//" + name)) {
+                    return;
+                }
+            } else if (!in.skip(size)) {
+                return;  // directories, links, devices, global headers
+            }
+            if (!in.skip(((size + 511) & ~uint64_t(511)) - size)) {
+                return;
+            }
+        }
+    }
+};
+
+} // namespace
+
+ArchiveWalker::ArchiveWalker()
+{
+}
+
+ArchiveWalker::ArchiveWalker(const Limits &limits)
+    : limits(limits)
+{
+}
+
+bool ArchiveWalker::walk(Source &file, const std::string &name, Sink &sink, std::string *error)
+{
+    Walk state(limits, sink);
+    FileStream stream(file);
+    Walker walker(state);
+    std::string err = walker.entity(stream, 0, name);
+    if (!err.empty()) {
+        if (error) *error = err;
+        return false;
+    }
+    return true;
+}
+
+ArchiveWalker::Format ArchiveWalker::detect(const uint8_t *data, size_t length)
+{
+    if (length >= 4 && memcmp(data, "PK\x03\x04", 4) == 0) {
+        return Zip;
+    }
+    if (length >= 3 && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8) {
+        return Gzip;
+    }
+    if (length >= 10 && memcmp(data, "BZh", 3) == 0 && data[3] >= '1' && data[3] <= '9'
+        && (memcmp(data + 4, "\x31\x41\x59\x26\x53\x59", 6) == 0 || memcmp(data + 4, "\x17\x72\x45\x38\x50\x90", 6) == 0)) {
+        return Bzip2;
+    }
+    if (length >= 512 && tarChecksumOk(data)) {
+        return Tar;
+    }
+    return None;
+}
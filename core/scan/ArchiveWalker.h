@@ -0,0 +1,67 @@
+#ifndef ARCHIVEWALKER_H
+#define ARCHIVEWALKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Streams a file and, when it is a zip (zip64 included), tar, gzip or bzip2
+// container, the decompressed bytes of every member, recursively. Nothing
+// is written to disk and nothing seeks: each nesting level pulls from the
+// one below through a fixed-size buffer, so a member is unpacked while its
+// container is still being read and memory is bounded by the depth limit.
+//
+// Every byte is reported to a Sink by nesting level; depth 0 is the file
+// itself and members of a container at depth d sit at d + 1. Member paths
+// join the names with "//", e.g. "docs/a.zip//b.tar.gz//b.tar//c.exe".
+// Zip is read from local headers, so members only listed in the central
+// directory are not seen; stored members with data descriptors, encryption
+// and methods other than stored and deflate end the member with an error.
+class ArchiveWalker
+{
+public:
+    struct Limits {
+        int maxDepth = 4;                            // containers within containers
+        uint64_t maxMemberBytes = uint64_t(1) << 30; // decompressed size of one member
+        uint64_t maxTotalBytes = uint64_t(4) << 30;  // decompressed bytes per file
+        uint32_t maxRatio = 100;                     // decompressed : compressed per stream
+        uint32_t maxMembers = 100000;                // per file
+    };
+
+    enum Format { None, Zip, Tar, Gzip, Bzip2 };
+
+    class Sink
+    {
+    public:
+        virtual ~Sink() {}
+        virtual void beginMember(int depth, const std::string &path) = 0;
+        virtual void data(int depth, const uint8_t *data, size_t length) = 0;
+        // error is empty when the member was read to its end
+        virtual void endMember(int depth, const std::string &error) = 0;
+        virtual bool cancelled() { return false; }
+    };
+
+    // The file's bytes, pulled in order
+    class Source
+    {
+    public:
+        virtual ~Source() {}
+        // Bytes read, 0 at the end, -1 on failure with *error set
+        virtual long read(uint8_t *buffer, size_t capacity, std::string *error) = 0;
+    };
+
+    ArchiveWalker();
+    explicit ArchiveWalker(const Limits &limits);
+
+    // Reads file to its end, reporting it at depth 0 and its members below.
+    // Fails only when the file itself cannot be read (or on cancellation);
+    // member problems, limits included, go to Sink::endMember.
+    bool walk(Source &file, const std::string &name, Sink &sink, std::string *error = nullptr);
+
+    static Format detect(const uint8_t *data, size_t length);
+
+private:
+    Limits limits;
+};
+
+#endif // ARCHIVEWALKER_H
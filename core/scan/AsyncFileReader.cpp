@@ -0,0 +1,679 @@
+#include "AsyncFileReader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+const uint64_t kWakeTag = ~uint64_t(0);
+const size_t kMaxPending = 4096;
+const size_t kAlignment = 4096;
+
+std::string errnoText(const std::string &what, int code)
+{
+    return what + ": " + strerror(code);
+}
+
+int ioUringSetup(unsigned entries, io_uring_params *params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned submit, unsigned minComplete, unsigned flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned count)
+{
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+} // namespace
+
+// An io_uring instance and its three shared mappings; only the I/O thread
+// touches it once set up
+struct AsyncFileReader::Ring {
+    int fd = -1;
+    void *sqMap = MAP_FAILED;
+    size_t sqBytes = 0;
+    void *cqMap = MAP_FAILED;
+    size_t cqBytes = 0;
+    void *sqeMap = MAP_FAILED;
+    size_t sqeBytes = 0;
+    io_uring_sqe *sqes = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe *cqes = nullptr;
+    unsigned queued = 0;
+    bool fixed = false;  // the arena is registered, so reads use READ_FIXED
+
+    ~Ring()
+    {
+        if (sqeMap != MAP_FAILED) {
+            munmap(sqeMap, sqeBytes);
+        }
+        if (cqMap != MAP_FAILED) {
+            munmap(cqMap, cqBytes);
+        }
+        if (sqMap != MAP_FAILED) {
+            munmap(sqMap, sqBytes);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    void queue(int file, void *data, size_t length, uint64_t offset, uint64_t tag, bool fixedBuffer)
+    {
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = fixedBuffer ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->fd = file;
+        sqe->addr = uint64_t(uintptr_t(data));
+        sqe->len = unsigned(length);
+        sqe->off = offset;
+        sqe->user_data = tag;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        ++queued;
+    }
+
+    // Submits what was queued, waits for minComplete completions and reaps
+    // every completion there is
+    bool enter(unsigned minComplete, std::vector<std::pair<uint64_t, long>> *out, std::string *error)
+    {
+        if (queued > 0 || minComplete > 0) {
+            int n;
+            do {
+                n = ioUringEnter(fd, queued, minComplete, minComplete > 0 ? IORING_ENTER_GETEVENTS : 0);
+            } while (n < 0 && errno == EINTR);
+            if (n < 0) {
+                *error = errnoText("io_uring_enter", errno);
+                return false;
+            }
+            queued -= std::min(queued, unsigned(n));
+        }
+
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            out->emplace_back(cqe.user_data, long(cqe.res));
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return true;
+    }
+};
+
+AsyncFileReader::AsyncFileReader()
+    : AsyncFileReader(Options())
+{
+}
+
+AsyncFileReader::AsyncFileReader(const Options &options)
+    : options(options)
+    , active(ThreadPool)
+    , arena(nullptr)
+    , wakeFd(-1)
+    , wakeValue(0)
+    , wakeArmed(false)
+    , reading(0)
+    , waitingBuffers(0)
+    , opening(0)
+    , addingDone(false)
+    , stopping(false)
+    , poolExit(false)
+    , poked(false)
+    , sleeping(false)
+{
+}
+
+AsyncFileReader::~AsyncFileReader()
+{
+    cancel();
+    if (io.joinable()) {
+        io.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        poolExit = true;
+        work.notify_all();
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    for (const std::unique_ptr<File> &f : files) {
+        if (f->fd >= 0) {
+            ::close(f->fd);
+        }
+    }
+    bool abandoned = ring && reading > 0;
+    ring.reset();
+    if (wakeFd >= 0) {
+        ::close(wakeFd);
+    }
+    // After a broken ring the kernel may still complete reads into the arena
+    if (!abandoned) {
+        free(arena);
+    }
+}
+
+const char *AsyncFileReader::backendName(Backend backend)
+{
+    switch (backend) {
+    case IoUring:
+        return "io_uring";
+    case ThreadPool:
+        return "pread threads";
+    default:
+        return "auto";
+    }
+}
+
+bool AsyncFileReader::start(std::string *error)
+{
+    options.queueDepth = std::max(1, options.queueDepth);
+    options.chunksPerFile = std::max(1, options.chunksPerFile);
+    options.maxOpenFiles = std::max(1, options.maxOpenFiles);
+    options.threads = std::max(1, options.threads);
+    options.chunkBytes = (std::max(options.chunkBytes, kAlignment) + kAlignment - 1) / kAlignment * kAlignment;
+
+    // Chunks that have arrived, or that a consumer holds, keep their
+    // buffers, so twice as many buffers as reads in flight
+    size_t count = size_t(options.queueDepth) * 2;
+    void *p = nullptr;
+    if (posix_memalign(&p, kAlignment, count * options.chunkBytes) != 0) {
+        if (error) *error = "Out of memory for read buffers";
+        return false;
+    }
+    arena = static_cast<uint8_t *>(p);
+    buffers.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        buffers[i].data = arena + i * options.chunkBytes;
+        freeBuffers.push_back(int(count - 1 - i));
+    }
+
+    active = ThreadPool;
+    if (options.backend != ThreadPool) {
+        std::string why;
+        if (setupRing(&why)) {
+            active = IoUring;
+        } else if (options.backend == IoUring) {
+            if (error) *error = why;
+            return false;
+        }
+    }
+    if (active == ThreadPool) {
+        for (int i = 0; i < options.threads; ++i) {
+            threads.emplace_back(&AsyncFileReader::pool, this);
+        }
+    }
+    io = std::thread(&AsyncFileReader::run, this);
+    return true;
+}
+
+bool AsyncFileReader::setupRing(std::string *error)
+{
+    std::unique_ptr<Ring> r(new Ring);
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // One entry per read in flight plus the wake-up read
+    r->fd = ioUringSetup(unsigned(options.queueDepth + 1), &params);
+    if (r->fd < 0) {
+        *error = errnoText("io_uring_setup", errno);
+        return false;
+    }
+
+    r->sqBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r->cqBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    r->sqeBytes = params.sq_entries * sizeof(io_uring_sqe);
+    r->sqMap = mmap(nullptr, r->sqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cqMap = mmap(nullptr, r->cqBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqeMap = mmap(nullptr, r->sqeBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqMap == MAP_FAILED || r->cqMap == MAP_FAILED || r->sqeMap == MAP_FAILED) {
+        *error = errnoText("Cannot map the io_uring rings", errno);
+        return false;
+    }
+    uint8_t *sq = static_cast<uint8_t *>(r->sqMap);
+    uint8_t *cq = static_cast<uint8_t *>(r->cqMap);
+    r->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    r->sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    r->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    r->sqes = static_cast<io_uring_sqe *>(r->sqeMap);
+    r->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    r->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    r->cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    r->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // IORING_OP_READ came with the probe in 5.6; older rings are not worth it
+    std::vector<uint8_t> probeMemory(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeMemory.data());
+    if (ioUringRegister(r->fd, IORING_REGISTER_PROBE, probe, 256) != 0 || probe->last_op < IORING_OP_READ
+        || !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+        *error = "io_uring without IORING_OP_READ";
+        return false;
+    }
+
+    // Pinned once rather than on every read; before 5.12 this counts
+    // against RLIMIT_MEMLOCK, and plain reads do without
+    iovec iov;
+    iov.iov_base = arena;
+    iov.iov_len = buffers.size() * options.chunkBytes;
+    r->fixed = ioUringRegister(r->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+    wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        *error = errnoText("eventfd", errno);
+        return false;
+    }
+    ring = std::move(r);
+    return true;
+}
+
+bool AsyncFileReader::add(const std::string &path)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return pending.size() < kMaxPending || stopping; });
+    if (stopping) {
+        return false;
+    }
+    pending.push_back(path);
+    wake();
+    return true;
+}
+
+bool AsyncFileReader::add(std::vector<std::string> &paths)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return pending.size() < kMaxPending || stopping; });
+    if (stopping) {
+        return false;
+    }
+    for (std::string &path : paths) {
+        pending.push_back(std::move(path));
+    }
+    wake();
+    return true;
+}
+
+void AsyncFileReader::finishAdding()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    addingDone = true;
+    changed.notify_all();
+}
+
+AsyncFileReader::File *AsyncFileReader::next()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        if (stopping) {
+            return nullptr;
+        }
+        bool waiting = false;
+        for (const std::unique_ptr<File> &f : files) {
+            if (f->handedOut) {
+                continue;
+            }
+            if (startable(f.get())) {
+                f->handedOut = true;
+                waitingBuffers -= int(f->chunks.size());
+                // Its further chunks now go ahead of the files still waiting
+                wake();
+                return f.get();
+            }
+            waiting = true;
+        }
+        if (addingDone && pending.empty() && opening == 0 && !waiting) {
+            return nullptr;
+        }
+        changed.wait(lock);
+    }
+}
+
+bool AsyncFileReader::read(File *file, Chunk *chunk, std::string *error)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!file->error.empty()) {
+        if (error) *error = file->error;
+        return false;
+    }
+    if (!file->chunks.empty() && buffers[size_t(file->chunks.front())].state == Held) {
+        freeBuffer(file->chunks.front());
+        file->chunks.pop_front();
+        wake();
+    }
+
+    changed.wait(lock, [&]() {
+        if (stopping) {
+            return true;
+        }
+        if (file->chunks.empty()) {
+            return file->planned >= file->end;
+        }
+        return buffers[size_t(file->chunks.front())].state == Ready;
+    });
+    if (stopping) {
+        if (error) *error = failure.empty() ? "Cancelled" : failure;
+        return false;
+    }
+    if (file->chunks.empty()) {
+        return false;
+    }
+    Buffer &b = buffers[size_t(file->chunks.front())];
+    if (b.result < 0) {
+        if (error) *error = strerror(int(-b.result));
+        return false;
+    }
+    if (b.result == 0) {
+        return false;
+    }
+    b.state = Held;
+    chunk->data = b.data;
+    chunk->length = size_t(b.result);
+    return true;
+}
+
+void AsyncFileReader::release(File *file)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    file->released = true;
+    // Buffers still being read into are freed when their read completes
+    for (int index : file->chunks) {
+        if (buffers[size_t(index)].state != Reading) {
+            freeBuffer(index);
+        }
+    }
+    file->chunks.clear();
+    forget(file);
+    wake();
+}
+
+void AsyncFileReader::cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    wake();
+    changed.notify_all();
+}
+
+void AsyncFileReader::run()
+{
+    std::vector<std::pair<uint64_t, long>> completions;
+    std::vector<Read> reads;
+    std::vector<std::string> paths;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        for (int index : done) {
+            completions.emplace_back(uint64_t(index), buffers[size_t(index)].result);
+        }
+        done.clear();
+        for (const std::pair<uint64_t, long> &c : completions) {
+            if (c.first == kWakeTag) {
+                wakeArmed = false;
+            } else {
+                complete(int(c.first), c.second);
+            }
+        }
+        completions.clear();
+        sleeping = false;
+        poked = false;
+
+        if (stopping) {
+            // Reads in flight still own their buffers
+            if (reading == 0 && !wakeArmed) {
+                return;
+            }
+        } else {
+            while (!pending.empty() && files.size() + paths.size() < size_t(options.maxOpenFiles)) {
+                paths.push_back(std::move(pending.front()));
+                pending.pop_front();
+            }
+            if (!paths.empty()) {
+                opening = int(paths.size());
+                changed.notify_all();
+                lock.unlock();
+                std::vector<std::unique_ptr<File>> opened;
+                for (const std::string &path : paths) {
+                    opened.push_back(openFile(path));
+                }
+                lock.lock();
+                for (std::unique_ptr<File> &f : opened) {
+                    files.push_back(std::move(f));
+                }
+                opening = 0;
+                paths.clear();
+                changed.notify_all();
+            }
+            if (!stopping) {
+                plan(&reads);
+            }
+        }
+
+        bool wait = reads.empty() && !poked;
+        if (!ring) {
+            for (const Read &r : reads) {
+                jobs.push_back(r);
+            }
+            if (!reads.empty()) {
+                work.notify_all();
+            }
+            reads.clear();
+            if (wait) {
+                ioWake.wait(lock, [this]() { return poked || !done.empty(); });
+            }
+            continue;
+        }
+
+        bool arm = !wakeArmed && !stopping;
+        wakeArmed = wakeArmed || arm;
+        sleeping = wait;
+        lock.unlock();
+        for (const Read &r : reads) {
+            ring->queue(r.fd, r.data, r.length, r.offset, uint64_t(r.buffer), ring->fixed);
+        }
+        if (arm) {
+            ring->queue(wakeFd, &wakeValue, sizeof(wakeValue), 0, kWakeTag, false);
+        }
+        reads.clear();
+        std::string error;
+        bool ok = ring->enter(wait ? 1 : 0, &completions, &error);
+        lock.lock();
+        if (!ok) {
+            failure = error;
+            stopping = true;
+            changed.notify_all();
+            return;
+        }
+    }
+}
+
+void AsyncFileReader::pool()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        work.wait(lock, [this]() { return !jobs.empty() || poolExit; });
+        if (jobs.empty()) {
+            return;
+        }
+        Read r = jobs.front();
+        jobs.pop_front();
+        lock.unlock();
+
+        long result = 0;
+        size_t got = 0;
+        while (got < r.length) {
+            ssize_t n = pread(r.fd, r.data + got, r.length - got, off_t(r.offset + got));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                result = -errno;
+                break;
+            }
+            if (n == 0) {
+                break;
+            }
+            got += size_t(n);
+        }
+
+        lock.lock();
+        buffers[size_t(r.buffer)].result = result < 0 ? result : long(got);
+        done.push_back(r.buffer);
+        ioWake.notify_one();
+    }
+}
+
+// Called with the mutex held. Files being consumed come first. Files
+// nobody has taken yet get a first chunk each before any gets a second,
+// and together never hold more than half the buffers, so a consumer
+// always gets the buffer its next chunk needs.
+void AsyncFileReader::plan(std::vector<Read> *reads)
+{
+    for (int index : retry) {
+        Buffer &b = buffers[size_t(index)];
+        reads->push_back({index, b.file->fd, b.data, b.length, b.offset});
+    }
+    retry.clear();
+
+    int budget = options.queueDepth - reading;
+    int waitingLimit = int(buffers.size() / 2);
+    for (int pass = 0; pass < 3; ++pass) {
+        bool handedOut = pass == 0;
+        size_t window = pass == 1 ? 1 : size_t(options.chunksPerFile);
+        for (const std::unique_ptr<File> &f : files) {
+            if (f->handedOut != handedOut || f->released || f->fd < 0) {
+                continue;
+            }
+            while (budget > 0 && !freeBuffers.empty() && f->planned < f->end && f->chunks.size() < window
+                   && (handedOut || waitingBuffers < waitingLimit)) {
+                int index = freeBuffers.back();
+                freeBuffers.pop_back();
+                Buffer &b = buffers[size_t(index)];
+                b.file = f.get();
+                b.offset = f->planned;
+                b.length = size_t(std::min<uint64_t>(options.chunkBytes, f->end - f->planned));
+                b.result = 0;
+                b.state = Reading;
+                f->planned += b.length;
+                f->chunks.push_back(index);
+                ++f->reading;
+                ++reading;
+                --budget;
+                if (!handedOut) {
+                    ++waitingBuffers;
+                }
+                reads->push_back({index, f->fd, b.data, b.length, b.offset});
+            }
+        }
+    }
+}
+
+// Called with the mutex held
+void AsyncFileReader::complete(int index, long result)
+{
+    Buffer &b = buffers[size_t(index)];
+    File *f = b.file;
+    if (result == -EINTR || result == -EAGAIN) {
+        if (!f->released && !stopping) {
+            retry.push_back(index);
+            return;
+        }
+        result = -ECANCELED;
+    }
+    --reading;
+    --f->reading;
+    if (f->released) {
+        freeBuffer(index);
+        forget(f);
+        return;
+    }
+    if (result >= 0 && size_t(result) < b.length) {
+        // Shorter than when it was opened; later chunks come back empty
+        f->end = std::min(f->end, b.offset + uint64_t(result));
+    }
+    b.result = result;
+    b.state = Ready;
+    changed.notify_all();
+}
+
+std::unique_ptr<AsyncFileReader::File> AsyncFileReader::openFile(const std::string &path)
+{
+    std::unique_ptr<File> file(new File);
+    file->path = path;
+    file->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+    struct stat st;
+    if (file->fd < 0 || fstat(file->fd, &st) != 0) {
+        file->error = strerror(errno);
+        if (file->fd >= 0) {
+            ::close(file->fd);
+            file->fd = -1;
+        }
+        return file;
+    }
+    file->size = uint64_t(st.st_size);
+    file->end = file->size;
+    file->mtimeNs = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    file->inode = uint64_t(st.st_ino);
+    return file;
+}
+
+void AsyncFileReader::freeBuffer(int index)
+{
+    Buffer &b = buffers[size_t(index)];
+    b.state = Free;
+    b.file = nullptr;
+    freeBuffers.push_back(index);
+}
+
+// Closes a released file once no read still uses its descriptor
+void AsyncFileReader::forget(File *file)
+{
+    if (!file->released || file->reading > 0) {
+        return;
+    }
+    if (file->fd >= 0) {
+        ::close(file->fd);
+    }
+    files.erase(std::find_if(files.begin(), files.end(),
+                             [file](const std::unique_ptr<File> &f) { return f.get() == file; }));
+}
+
+bool AsyncFileReader::startable(const File *file) const
+{
+    if (!file->error.empty() || file->end == 0) {
+        return true;
+    }
+    return !file->chunks.empty() && buffers[size_t(file->chunks.front())].state == Ready;
+}
+
+// Called with the mutex held; gets the I/O thread to look at the queues again
+void AsyncFileReader::wake()
+{
+    poked = true;
+    if (!ring) {
+        ioWake.notify_one();
+    } else if (sleeping || stopping) {
+        // A cancelled reader also has to complete the armed wake-up read
+        sleeping = false;
+        uint64_t one = 1;
+        ssize_t written = write(wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
@@ -0,0 +1,158 @@
+#ifndef ASYNCFILEREADER_H
+#define ASYNCFILEREADER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads many files at once on behalf of the scan workers. One I/O thread
+// opens the queued files and keeps up to queueDepth chunk reads in flight
+// across them, so a slow drive always has requests waiting while the
+// workers only hash and match what has arrived. With io_uring (raw
+// syscalls, no liburing) reads land in one buffer arena registered with
+// the ring; where the kernel lacks io_uring or has it disabled (seccomp,
+// kernel.io_uring_disabled) a few threads issue the same reads with pread().
+//
+// A file is handed out once its first chunk has arrived, so a file stalled
+// on the drive does not hold up the ones queued behind it; each file's
+// chunks then reach its consumer in order.
+class AsyncFileReader
+{
+public:
+    enum Backend { Auto, IoUring, ThreadPool };
+
+    struct Options {
+        Backend backend = Auto;
+        int queueDepth = 32;            // reads in flight across all files
+        size_t chunkBytes = 256 << 10;
+        int chunksPerFile = 4;          // read ahead of the consumer, per file
+        int maxOpenFiles = 64;
+        int threads = 4;                // ThreadPool backend only
+    };
+
+    class File
+    {
+    public:
+        std::string path;
+        uint64_t size = 0;
+        int64_t mtimeNs = 0;
+        uint64_t inode = 0;
+        std::string error;              // could not be opened; read() fails with it
+
+    private:
+        friend class AsyncFileReader;
+        int fd = -1;
+        uint64_t planned = 0;           // bytes covered by reads issued so far
+        uint64_t end = 0;               // the size, or where a short read stopped
+        std::deque<int> chunks;         // buffers in file order: reading, ready or held
+        int reading = 0;
+        bool handedOut = false;
+        bool released = false;
+    };
+
+    struct Chunk {
+        const uint8_t *data = nullptr;
+        size_t length = 0;
+    };
+
+    AsyncFileReader();
+    explicit AsyncFileReader(const Options &options);
+    ~AsyncFileReader();
+
+    // Sets up the backend and starts the I/O thread
+    bool start(std::string *error = nullptr);
+    Backend backend() const { return active; }
+    static const char *backendName(Backend backend);
+
+    // Producer side. add() blocks while too many paths wait to be opened
+    // and returns false once cancelled.
+    bool add(const std::string &path);
+    // Several at once, under one lock; the paths are moved from
+    bool add(std::vector<std::string> &paths);
+    void finishAdding();
+
+    // Consumer side. next() returns null once every file has been handed
+    // out, or after cancel(). read() returns the file's chunks in order, the
+    // previous one going back to the pool; false at the end, or on a read
+    // error or cancel() with *error set. Every file from next() goes back
+    // through release().
+    File *next();
+    bool read(File *file, Chunk *chunk, std::string *error = nullptr);
+    void release(File *file);
+
+    // Safe from any thread
+    void cancel();
+
+private:
+    enum State { Free, Reading, Ready, Held };
+
+    struct Buffer {
+        uint8_t *data = nullptr;
+        File *file = nullptr;
+        uint64_t offset = 0;
+        size_t length = 0;
+        long result = 0;                // bytes read or -errno
+        State state = Free;
+    };
+
+    // What the backends need, copied out under the lock
+    struct Read {
+        int buffer;
+        int fd;
+        uint8_t *data;
+        size_t length;
+        uint64_t offset;
+    };
+
+    struct Ring;
+
+    Options options;
+    Backend active;
+    uint8_t *arena;
+    std::vector<Buffer> buffers;
+    std::vector<int> freeBuffers;
+    std::unique_ptr<Ring> ring;
+    int wakeFd;                         // eventfd the ring reads, so add() and release() reach a waiting I/O thread
+    uint64_t wakeValue;
+    bool wakeArmed;
+    std::vector<std::thread> threads;   // ThreadPool backend
+    std::thread io;
+
+    std::mutex mutex;
+    std::condition_variable changed;    // consumers and the producer
+    std::condition_variable ioWake;     // the I/O thread, ThreadPool backend
+    std::condition_variable work;       // the pool threads
+    std::deque<std::string> pending;
+    std::vector<std::unique_ptr<File>> files;  // open, in the order added
+    std::deque<Read> jobs;              // ThreadPool backend
+    std::vector<int> done;              // ThreadPool backend
+    std::vector<int> retry;
+    std::string failure;                // the ring broke; reported instead of "Cancelled"
+    int reading;
+    int waitingBuffers;                 // held by files not handed out yet
+    int opening;
+    bool addingDone;
+    bool stopping;
+    bool poolExit;
+    bool poked;
+    bool sleeping;
+
+    void run();
+    void pool();
+    void plan(std::vector<Read> *reads);
+    void complete(int index, long result);
+    std::unique_ptr<File> openFile(const std::string &path);
+    void freeBuffer(int index);
+    void forget(File *file);
+    bool startable(const File *file) const;
+    void wake();
+    bool setupRing(std::string *error);
+};
+
+#endif // ASYNCFILEREADER_H
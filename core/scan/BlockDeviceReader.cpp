@@ -0,0 +1,263 @@
+#include "BlockDeviceReader.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Page alignment satisfies O_DIRECT for 512-byte and 4 KiB sector drives alike
+const size_t kMinAlignment = 4096;
+
+std::string errnoText(const std::string &what)
+{
+    return what + ": " + strerror(errno);
+}
+
+} // namespace
+
+BlockDeviceReader::BlockDeviceReader()
+    : BlockDeviceReader(Options())
+{
+}
+
+BlockDeviceReader::BlockDeviceReader(const Options &options)
+    : options(options)
+    , fd(-1)
+    , deviceSize(0)
+    , align(kMinAlignment)
+    , direct(false)
+    , readOffset(0)
+    , consumeIndex(0)
+    , started(false)
+    , stopping(false)
+    , failed(false)
+    , finished(false)
+{
+}
+
+BlockDeviceReader::~BlockDeviceReader()
+{
+    close();
+}
+
+bool BlockDeviceReader::open(const std::string &path, std::string *error)
+{
+    close();
+
+    direct = options.direct;
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (direct ? O_DIRECT : 0));
+    if (fd < 0 && direct && errno == EINVAL) {
+        direct = false;
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        if (error) *error = errnoText("Cannot open " + path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        if (error) *error = errnoText("Cannot stat " + path);
+        close();
+        return false;
+    }
+    align = kMinAlignment;
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t bytes = 0;
+        int sector = 0;
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) {
+            if (error) *error = errnoText("Cannot get the size of " + path);
+            close();
+            return false;
+        }
+        deviceSize = bytes;
+        if (ioctl(fd, BLKSSZGET, &sector) == 0 && size_t(sector) > align) {
+            align = size_t(sector);
+        }
+    } else if (S_ISREG(st.st_mode)) {
+        deviceSize = uint64_t(st.st_size);
+    } else {
+        if (error) *error = path + " is not a block device or disk image";
+        close();
+        return false;
+    }
+    if (!direct) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    size_t bytes = std::max(options.bufferBytes, align);
+    bytes = (bytes + align - 1) / align * align;
+    options.bufferBytes = bytes;
+    buffers.resize(size_t(std::max(2, options.buffers)));
+    for (Buffer &b : buffers) {
+        void *p = nullptr;
+        if (posix_memalign(&p, align, bytes) != 0) {
+            if (error) *error = "Out of memory for read buffers";
+            close();
+            return false;
+        }
+        b.data = static_cast<uint8_t *>(p);
+    }
+    return true;
+}
+
+void BlockDeviceReader::close()
+{
+    cancel();
+    if (reader.joinable()) {
+        reader.join();
+    }
+    for (Buffer &b : buffers) {
+        free(b.data);
+    }
+    buffers.clear();
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    deviceSize = 0;
+    readOffset = 0;
+    consumeIndex = 0;
+    started = false;
+    stopping = false;
+    failed = false;
+    finished = false;
+    readError.clear();
+}
+
+void BlockDeviceReader::cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    changed.notify_all();
+}
+
+bool BlockDeviceReader::next(Chunk *chunk, std::string *error)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (fd < 0) {
+        if (error) *error = "Device is not open";
+        return false;
+    }
+    if (!started) {
+        started = true;
+        reader = std::thread(&BlockDeviceReader::readAhead, this);
+    }
+
+    Buffer &held = buffers[consumeIndex];
+    if (held.state == Held) {
+        // Buffered fallback: keep a whole-drive pass from evicting everything else
+        if (!direct) {
+            posix_fadvise(fd, off_t(held.offset), off_t(held.length), POSIX_FADV_DONTNEED);
+        }
+        held.state = Free;
+        consumeIndex = (consumeIndex + 1) % buffers.size();
+        changed.notify_all();
+    }
+
+    Buffer &b = buffers[consumeIndex];
+    changed.wait(lock, [&]() { return b.state == Ready || failed || stopping || finished; });
+    if (b.state == Ready) {
+        b.state = Held;
+        chunk->offset = b.offset;
+        chunk->data = b.data;
+        chunk->length = b.length;
+        return true;
+    }
+    if (failed) {
+        if (error) *error = readError;
+    } else if (stopping) {
+        if (error) *error = "Cancelled";
+    }
+    return false;
+}
+
+void BlockDeviceReader::readAhead()
+{
+    size_t index = 0;
+    for (;;) {
+        uint8_t *data;
+        uint64_t offset;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&]() { return buffers[index].state == Free || stopping; });
+            if (stopping) {
+                return;
+            }
+            if (readOffset >= deviceSize) {
+                finished = true;
+                changed.notify_all();
+                return;
+            }
+            buffers[index].state = Reading;
+            data = buffers[index].data;
+            offset = readOffset;
+            readOffset += options.bufferBytes;
+        }
+
+        size_t want = size_t(std::min<uint64_t>(options.bufferBytes, deviceSize - offset));
+        std::string error;
+        long n = readFully(data, want, offset, &error);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (n < 0) {
+            failed = true;
+            readError = error;
+            changed.notify_all();
+            return;
+        }
+        if (n == 0) {
+            // The device shrank under us (e.g. unplugged media); what was read stands
+            buffers[index].state = Free;
+            finished = true;
+            changed.notify_all();
+            return;
+        }
+        buffers[index].offset = offset;
+        buffers[index].length = size_t(n);
+        buffers[index].state = Ready;
+        index = (index + 1) % buffers.size();
+        changed.notify_all();
+    }
+}
+
+long BlockDeviceReader::readFully(uint8_t *buffer, size_t length, uint64_t offset, std::string *error)
+{
+    // O_DIRECT needs whole sectors; the tail of an image is rounded up and
+    // the read simply stops at its end
+    size_t request = direct ? (length + align - 1) / align * align : length;
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd, buffer + done, request - done, off_t(offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL && direct && done == 0) {
+            // Opened fine but the filesystem refuses direct reads after all
+            int flags = fcntl(fd, F_GETFL);
+            if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) != 0) {
+                *error = errnoText("Cannot read without O_DIRECT");
+                return -1;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            direct = false;
+            request = length;
+            continue;
+        }
+        if (n < 0) {
+            *error = errnoText("Read failed at offset " + std::to_string(offset + done));
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += size_t(n);
+    }
+    return long(std::min(done, length));
+}
@@ -0,0 +1,86 @@
+#ifndef BLOCKDEVICEREADER_H
+#define BLOCKDEVICEREADER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads a whole block device (or a disk image) front to back, for scans
+// that look at the raw bytes rather than the files on it. Reads bypass the
+// page cache with O_DIRECT into large aligned buffers. A read-ahead thread
+// fills the buffers the consumer is not holding, so with three buffers
+// the drive keeps streaming while one chunk is consumed and another waits.
+// Where O_DIRECT is refused (tmpfs, some FUSE mounts) reads go through the
+// page cache and each consumed range is dropped from it again.
+class BlockDeviceReader
+{
+public:
+    struct Options {
+        size_t bufferBytes = 4 << 20;  // rounded up to the device's alignment
+        int buffers = 3;
+        bool direct = true;
+    };
+
+    struct Chunk {
+        uint64_t offset = 0;
+        const uint8_t *data = nullptr;
+        size_t length = 0;
+    };
+
+    BlockDeviceReader();
+    explicit BlockDeviceReader(const Options &options);
+    ~BlockDeviceReader();
+
+    bool open(const std::string &path, std::string *error = nullptr);
+    void close();
+
+    bool isOpen() const { return fd >= 0; }
+    uint64_t size() const { return deviceSize; }
+    bool isDirect() const { return direct; }
+    size_t alignment() const { return align; }
+
+    // Waits for the next chunk in device order; the previous chunk's buffer
+    // goes back to the read-ahead. False at the end, or on a read error or
+    // cancel() with *error set.
+    bool next(Chunk *chunk, std::string *error = nullptr);
+
+    // Stops the read-ahead; next() then fails. Safe from any thread.
+    void cancel();
+
+private:
+    enum State { Free, Reading, Ready, Held };
+
+    struct Buffer {
+        uint8_t *data = nullptr;
+        uint64_t offset = 0;
+        size_t length = 0;
+        State state = Free;
+    };
+
+    Options options;
+    int fd;
+    uint64_t deviceSize;
+    size_t align;
+    bool direct;
+
+    std::vector<Buffer> buffers;
+    std::thread reader;
+    std::mutex mutex;
+    std::condition_variable changed;
+    uint64_t readOffset;   // next offset the read-ahead will fetch
+    size_t consumeIndex;   // buffer holding the next chunk in order
+    bool started;
+    bool stopping;
+    bool failed;
+    bool finished;         // the read-ahead reached the end
+    std::string readError;
+
+    void readAhead();
+    long readFully(uint8_t *buffer, size_t length, uint64_t offset, std::string *error);
+};
+
+#endif // BLOCKDEVICEREADER_H
@@ -0,0 +1,252 @@
+#include "DirectoryWalker.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <mutex>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+const size_t kDirentBytes = 32 << 10;
+
+// The kernel's record; glibc only wraps getdents64 from 2.30 on
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+std::string join(const std::string &dir, const char *name)
+{
+    size_t length = strlen(name);
+    std::string path;
+    path.reserve(dir.size() + length + 1);
+    path = dir;
+    if (path.empty() || path.back() != '/') {
+        path += '/';
+    }
+    path.append(name, length);
+    return path;
+}
+
+} // namespace
+
+// State shared by the threads of one walk
+struct DirectoryWalker::Walk {
+    struct Deque {
+        std::mutex mutex;
+        std::deque<std::string> dirs;
+    };
+
+    const Sink &sink;
+    std::vector<Deque> deques;            // one per thread
+    std::atomic<uint64_t> pending{0};     // directories queued or being read
+    std::atomic<uint64_t> queued{0};      // directories waiting in a deque
+    std::atomic<int> sleepers{0};
+    std::atomic<bool> stopped{false};
+    std::atomic<uint64_t> directories{0};
+    std::atomic<uint64_t> unreadable{0};
+    std::mutex idleMutex;
+    std::condition_variable idle;
+
+    Walk(const Sink &sink, size_t threads) : sink(sink), deques(threads) {}
+
+    void push(size_t self, std::string path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(deques[self].mutex);
+            deques[self].dirs.push_back(std::move(path));
+        }
+        ++pending;
+        ++queued;
+        if (sleepers > 0) {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idle.notify_one();
+        }
+    }
+
+    // Newest first from our own deque, so a thread stays in one subtree
+    bool pop(size_t self, std::string *path)
+    {
+        std::lock_guard<std::mutex> lock(deques[self].mutex);
+        if (deques[self].dirs.empty()) {
+            return false;
+        }
+        *path = std::move(deques[self].dirs.back());
+        deques[self].dirs.pop_back();
+        --queued;
+        return true;
+    }
+
+    // Oldest first from the others: the directories nearest the root
+    bool steal(size_t self, std::string *path)
+    {
+        for (size_t i = 1; i < deques.size(); ++i) {
+            Deque &victim = deques[(self + i) % deques.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.dirs.empty()) {
+                *path = std::move(victim.dirs.front());
+                victim.dirs.pop_front();
+                --queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // After the directory's subdirectories were pushed, so pending only
+    // reaches zero once the whole tree is done
+    void finishDirectory()
+    {
+        if (--pending == 0) {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idle.notify_all();
+        }
+    }
+
+    void emit(std::vector<Entry> &batch)
+    {
+        if (!batch.empty() && !stopped && !sink(batch)) {
+            stopped = true;
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idle.notify_all();
+        }
+        batch.clear();
+    }
+};
+
+DirectoryWalker::DirectoryWalker()
+    : DirectoryWalker(Options())
+{
+}
+
+DirectoryWalker::DirectoryWalker(const Options &options)
+    : options(options)
+    , directoryCount(0)
+    , unreadableCount(0)
+{
+}
+
+bool DirectoryWalker::walk(const std::string &root, const Sink &sink, std::string *error)
+{
+    directoryCount = 0;
+    unreadableCount = 0;
+    int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = root + ": " + strerror(errno);
+        return false;
+    }
+    close(fd);
+
+    size_t threads = size_t(std::max(1, options.threads));
+    options.batchSize = std::max<size_t>(1, options.batchSize);
+    Walk w(sink, threads);
+    w.push(0, root);
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < threads; ++i) {
+        helpers.emplace_back(&DirectoryWalker::run, this, std::ref(w), i);
+    }
+    run(w, 0);
+    for (std::thread &t : helpers) {
+        t.join();
+    }
+    directoryCount = w.directories;
+    unreadableCount = w.unreadable;
+    return true;
+}
+
+void DirectoryWalker::run(Walk &w, size_t self)
+{
+    std::vector<char> dirents(kDirentBytes);
+    std::vector<Entry> batch;
+    batch.reserve(options.batchSize);
+    std::string dir;
+    while (!w.stopped) {
+        if (w.pop(self, &dir) || w.steal(self, &dir)) {
+            readDirectory(w, self, dir, dirents.data(), batch);
+            w.finishDirectory();
+            continue;
+        }
+        // Out of work: hand over what was found before waiting for more
+        w.emit(batch);
+        std::unique_lock<std::mutex> lock(w.idleMutex);
+        ++w.sleepers;
+        w.idle.wait(lock, [&w]() { return w.queued > 0 || w.pending == 0 || w.stopped; });
+        --w.sleepers;
+        if (w.pending == 0) {
+            break;
+        }
+    }
+    w.emit(batch);
+}
+
+void DirectoryWalker::readDirectory(Walk &w, size_t self, const std::string &path, char *dirents,
+                                    std::vector<Entry> &batch)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        ++w.unreadable;
+        return;
+    }
+    ++w.directories;
+
+    while (!w.stopped) {
+        long n = syscall(SYS_getdents64, fd, dirents, kDirentBytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n < 0) {
+                ++w.unreadable;
+            }
+            break;
+        }
+        for (long offset = 0; offset < n;) {
+            const LinuxDirent64 *d = reinterpret_cast<const LinuxDirent64 *>(dirents + offset);
+            offset += d->d_reclen;
+            const char *name = d->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0))) {
+                continue;
+            }
+            if (d->d_type == DT_DIR) {
+                w.push(self, join(path, name));
+                continue;
+            }
+            // Symlinks, FIFOs, sockets and device nodes need no stat to skip
+            if (d->d_type != DT_REG && d->d_type != DT_UNKNOWN) {
+                continue;
+            }
+            struct stat st;
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+            if (S_ISDIR(st.st_mode)) {
+                w.push(self, join(path, name));
+                continue;
+            }
+            if (!S_ISREG(st.st_mode)) {
+                continue;
+            }
+            Entry entry;
+            entry.path = join(path, name);
+            entry.size = uint64_t(st.st_size);
+            entry.mtimeNs = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            entry.inode = uint64_t(st.st_ino);
+            batch.push_back(std::move(entry));
+            if (batch.size() >= options.batchSize) {
+                w.emit(batch);
+            }
+        }
+    }
+    close(fd);
+}
@@ -0,0 +1,62 @@
+#ifndef DIRECTORYWALKER_H
+#define DIRECTORYWALKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Enumerates the regular files below a directory with several threads.
+// Each directory is read with getdents64 and its entries are stat'ed with
+// fstatat relative to the directory's descriptor. The dirent type settles
+// directories and symlinks without a stat. Every thread keeps a deque of
+// directories still to read: it takes the newest of its own, depth-first,
+// and when it runs dry it steals the oldest (usually largest) subtree from
+// another thread.
+//
+// Like the QDirIterator walk it replaces, hidden files are included,
+// symlinks are never followed, FIFOs, sockets and device nodes are
+// skipped, and unreadable directories are passed over.
+class DirectoryWalker
+{
+public:
+    struct Options {
+        int threads = 4;
+        size_t batchSize = 256;
+    };
+
+    struct Entry {
+        std::string path;
+        uint64_t size = 0;
+        int64_t mtimeNs = 0;
+        uint64_t inode = 0;
+    };
+
+    // Called from any walker thread, concurrently, with up to batchSize
+    // files; entries may be moved out. Returning false stops the walk.
+    using Sink = std::function<bool(std::vector<Entry> &batch)>;
+
+    DirectoryWalker();
+    explicit DirectoryWalker(const Options &options);
+
+    // Returns once the tree has been walked or the sink has stopped it; the
+    // calling thread is one of the walkers. False when root cannot be read.
+    bool walk(const std::string &root, const Sink &sink, std::string *error = nullptr);
+
+    // Of the last walk
+    uint64_t directories() const { return directoryCount; }
+    uint64_t unreadable() const { return unreadableCount; }
+
+private:
+    struct Walk;
+
+    Options options;
+    uint64_t directoryCount;
+    uint64_t unreadableCount;
+
+    void run(Walk &w, size_t self);
+    void readDirectory(Walk &w, size_t self, const std::string &path, char *dirents, std::vector<Entry> &batch);
+};
+
+#endif // DIRECTORYWALKER_H
@@ -0,0 +1,256 @@
+#include "EntropyMeter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SDUI_ENTROPY_X86 1
+#endif
+
+namespace {
+
+typedef EntropyMeter EM;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+const bool kLittleEndian = false;
+#else
+const bool kLittleEndian = true;
+#endif
+
+// c * log2(c) for every count a window can hold
+struct PLogP {
+    float value[EM::kWindowBytes + 1];
+
+    PLogP()
+    {
+        value[0] = 0;
+        for (size_t c = 1; c <= EM::kWindowBytes; ++c) {
+            value[c] = float(double(c) * std::log2(double(c)));
+        }
+    }
+};
+
+const PLogP &plogp()
+{
+    static const PLogP table;
+    return table;
+}
+
+// Folds the block tables into the window, the ring slot and the totals.
+// Eight 8-bit counters at a time: even and odd bytes of a word widen into
+// 16-bit lanes, which hold the at most kBlockBytes a bin can reach.
+void mergeGeneric(uint8_t (*counts)[256], uint16_t *slot, uint16_t *window, uint64_t *total)
+{
+    const uint64_t kLow = 0x00ff00ff00ff00ffull;
+    for (size_t b = 0; b < 256; b += 8) {
+        uint64_t even = 0, odd = 0;
+        for (size_t t = 0; t < EM::kTables; ++t) {
+            uint64_t w;
+            memcpy(&w, &counts[t][b], 8);
+            even += w & kLow;
+            odd += (w >> 8) & kLow;
+        }
+        for (size_t k = 0; k < 4; ++k) {
+            uint16_t lanes[2] = {uint16_t(even >> (16 * k)), uint16_t(odd >> (16 * k))};
+            for (size_t j = 0; j < 2; ++j) {
+                size_t bin = b + (kLittleEndian ? 2 * k + j : 7 - 2 * k - j);
+                window[bin] = uint16_t(window[bin] + lanes[j] - slot[bin]);
+                slot[bin] = lanes[j];
+                total[bin] += lanes[j];
+            }
+        }
+    }
+}
+
+// log2(W) - sum(c log2 c) / W
+double windowEntropyGeneric(const uint16_t *window, const float *table)
+{
+    // Independent sums; one accumulator would wait on every add
+    float sum[4] = {0, 0, 0, 0};
+    for (size_t b = 0; b < 256; b += 4) {
+        for (size_t k = 0; k < 4; ++k) {
+            sum[k] += table[window[b + k]];
+        }
+    }
+    float all = (sum[0] + sum[1]) + (sum[2] + sum[3]);
+    return std::log2(double(EM::kWindowBytes)) - double(all) / double(EM::kWindowBytes);
+}
+
+#ifdef SDUI_ENTROPY_X86
+__attribute__((target("avx2")))
+void mergeAvx2(uint8_t (*counts)[256], uint16_t *slot, uint16_t *window, uint64_t *total)
+{
+    for (size_t b = 0; b < 256; b += 16) {
+        __m256i sum = _mm256_setzero_si256();
+        for (size_t t = 0; t < EM::kTables; ++t) {
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&counts[t][b]));
+            sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(c));
+        }
+        __m256i *w = reinterpret_cast<__m256i *>(window + b);
+        __m256i *s = reinterpret_cast<__m256i *>(slot + b);
+        _mm256_storeu_si256(w, _mm256_sub_epi16(_mm256_add_epi16(_mm256_loadu_si256(w), sum), _mm256_loadu_si256(s)));
+        _mm256_storeu_si256(s, sum);
+
+        __m128i halves[2] = {_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)};
+        for (int h = 0; h < 2; ++h) {
+            __m256i *t = reinterpret_cast<__m256i *>(total + b + 8 * h);
+            _mm256_storeu_si256(t, _mm256_add_epi64(_mm256_loadu_si256(t), _mm256_cvtepu16_epi64(halves[h])));
+            _mm256_storeu_si256(t + 1, _mm256_add_epi64(_mm256_loadu_si256(t + 1),
+                                                        _mm256_cvtepu16_epi64(_mm_srli_si128(halves[h], 8))));
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+double windowEntropyAvx2(const uint16_t *window, const float *table)
+{
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t b = 0; b < 256; b += 8) {
+        __m256i c = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(window + b)));
+        acc = _mm256_add_ps(acc, _mm256_i32gather_ps(table, c, 4));
+    }
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return std::log2(double(EM::kWindowBytes)) - double(_mm_cvtss_f32(s)) / double(EM::kWindowBytes);
+}
+#endif
+
+struct Kernel {
+    const char *name;
+    void (*merge)(uint8_t (*)[256], uint16_t *, uint16_t *, uint64_t *);
+    double (*windowEntropy)(const uint16_t *, const float *);
+};
+
+const Kernel &kernel()
+{
+    static const Kernel chosen = []() {
+#ifdef SDUI_ENTROPY_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return Kernel{"avx2", mergeAvx2, windowEntropyAvx2};
+        }
+#endif
+        return Kernel{"generic", mergeGeneric, windowEntropyGeneric};
+    }();
+    return chosen;
+}
+
+// Byte i of a block goes to table i % 8, so each 8-bit counter sees at
+// most kBlockBytes / 8 = 128 increments and runs of one value are spread
+// over eight counters
+static_assert(EM::kBlockBytes / EM::kTables < 256, "block counters are 8-bit");
+
+inline void countBytes(const uint8_t *data, size_t length, size_t fill, uint8_t (*counts)[256])
+{
+    size_t i = 0;
+    // Realign to the table rotation after a partial chunk
+    for (; i < length && ((fill + i) & 7); ++i) {
+        ++counts[(fill + i) & 7][data[i]];
+    }
+    for (; i + 8 <= length; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        ++counts[0][v & 0xff];
+        ++counts[1][(v >> 8) & 0xff];
+        ++counts[2][(v >> 16) & 0xff];
+        ++counts[3][(v >> 24) & 0xff];
+        ++counts[4][(v >> 32) & 0xff];
+        ++counts[5][(v >> 40) & 0xff];
+        ++counts[6][(v >> 48) & 0xff];
+        ++counts[7][v >> 56];
+    }
+    for (; i < length; ++i) {
+        ++counts[(fill + i) & 7][data[i]];
+    }
+}
+
+} // namespace
+
+EntropyMeter::EntropyMeter(double threshold)
+    : threshold(threshold)
+{
+    reset();
+}
+
+void EntropyMeter::reset()
+{
+    memset(counts, 0, sizeof(counts));
+    memset(ring, 0, sizeof(ring));
+    memset(window, 0, sizeof(window));
+    memset(total, 0, sizeof(total));
+    blockFill = 0;
+    blocks = 0;
+    bytes = 0;
+    maxWindow = 0;
+    found.clear();
+}
+
+void EntropyMeter::feed(const uint8_t *data, size_t length)
+{
+    while (length > 0) {
+        size_t n = std::min(length, kBlockBytes - blockFill);
+        countBytes(data, n, blockFill, counts);
+        blockFill += n;
+        bytes += n;
+        data += n;
+        length -= n;
+        if (blockFill == kBlockBytes) {
+            closeBlock();
+        }
+    }
+}
+
+void EntropyMeter::closeBlock()
+{
+    const Kernel &k = kernel();
+    k.merge(counts, ring[blocks % kWindowBlocks], window, total);
+    memset(counts, 0, sizeof(counts));
+    blockFill = 0;
+    ++blocks;
+    if (blocks < kWindowBlocks) {
+        return;
+    }
+
+    double e = k.windowEntropy(window, plogp().value);
+    maxWindow = std::max(maxWindow, e);
+    if (e < threshold) {
+        return;
+    }
+    uint64_t offset = (blocks - kWindowBlocks) * kBlockBytes;
+    if (!found.empty() && found.back().offset + found.back().length >= offset) {
+        Region &r = found.back();
+        r.length = offset + kWindowBytes - r.offset;
+        r.entropy = std::max(r.entropy, e);
+    } else if (found.size() < kMaxRegions) {
+        Region r;
+        r.offset = offset;
+        r.length = kWindowBytes;
+        r.entropy = e;
+        found.push_back(r);
+    }
+}
+
+double EntropyMeter::entropy() const
+{
+    if (bytes == 0) {
+        return 0;
+    }
+    double sum = 0;
+    for (size_t b = 0; b < 256; ++b) {
+        uint64_t c = total[b];
+        for (size_t t = 0; t < kTables; ++t) {
+            c += counts[t][b];
+        }
+        if (c) {
+            sum += double(c) * std::log2(double(c));
+        }
+    }
+    return std::log2(double(bytes)) - sum / double(bytes);
+}
+
+const char *EntropyMeter::kernelName()
+{
+    return kernel().name;
+}
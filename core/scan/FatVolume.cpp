@@ -0,0 +1,604 @@
+#include "FatVolume.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+namespace {
+
+const size_t kEntryBytes = 32;
+const uint64_t kMaxDirectoryBytes = 64 << 20;     // exFAT's limit is 256 MiB
+const uint64_t kMaxFatDirectoryBytes = 2 << 20;   // 65536 entries
+const uint64_t kMaxTableBytes = uint64_t(512) << 20;
+
+// FAT directory entry attributes
+const uint8_t kVolumeLabel = 0x08;
+const uint8_t kDirectory = 0x10;
+const uint8_t kLongName = 0x0F;
+const uint8_t kDeleted = 0xE5;
+
+// exFAT entry types, in-use bit included
+const uint8_t kExFatInUse = 0x80;
+const uint8_t kExFatBitmap = 0x81;
+const uint8_t kExFatFile = 0x85;
+const uint8_t kExFatStream = 0xC0;
+const uint8_t kExFatName = 0xC1;
+const uint8_t kExFatNoFatChain = 0x02;
+const uint16_t kExFatDirectory = 0x10;
+
+int64_t daysFromCivil(int year, unsigned month, unsigned day)
+{
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    unsigned yoe = unsigned(year - era * 400);
+    unsigned doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + int64_t(doe) - 719468;
+}
+
+// DOS date and time fields, shared by FAT and exFAT; 0 when unset
+int64_t dosTimeNs(uint32_t date, uint32_t time)
+{
+    unsigned month = date >> 5 & 15;
+    unsigned day = date & 31;
+    if (month < 1 || month > 12 || day < 1) {
+        return 0;
+    }
+    int64_t days = daysFromCivil(1980 + int(date >> 9), month, day);
+    int64_t seconds = days * 86400 + (time >> 11) * 3600 + (time >> 5 & 63) * 60 + (time & 31) * 2;
+    return seconds * 1000000000;
+}
+
+uint8_t shortNameChecksum(const uint8_t *name)
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; ++i) {
+        sum = uint8_t(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    }
+    return sum;
+}
+
+// Over the whole entry set, its own field skipped; the in-use bits are
+// put back so deleted sets still verify
+uint16_t entrySetChecksum(const uint8_t *set, size_t bytes)
+{
+    uint16_t sum = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        if (i == 2 || i == 3) {
+            continue;
+        }
+        uint8_t b = i % kEntryBytes == 0 ? uint8_t(set[i] | kExFatInUse) : set[i];
+        sum = uint16_t(((sum & 1) ? 0x8000 : 0) + (sum >> 1) + b);
+    }
+    return sum;
+}
+
+std::string join(const std::string &dir, const std::string &name)
+{
+    return dir.empty() ? name : dir + '/' + name;
+}
+
+// 8.3 name; bytes outside ASCII depend on a code page we do not know
+std::string shortName(const uint8_t *e, bool deleted)
+{
+    auto part = [e](int from, int count, bool lower) {
+        std::string s;
+        for (int i = from; i < from + count; ++i) {
+            uint8_t c = e[i];
+            if (c >= 0x80 || c < 0x20 || c == '/') {
+                c = '_';
+            } else if (lower && c >= 'A' && c <= 'Z') {
+                c = uint8_t(c + ('a' - 'A'));
+            }
+            s += char(c);
+        }
+        return s.substr(0, s.find_last_not_of(' ') + 1);
+    };
+    std::string name = part(0, 8, e[12] & 0x08);
+    std::string ext = part(8, 3, e[12] & 0x10);
+    if (deleted && !name.empty()) {
+        name[0] = '_';  // the first character is what deletion overwrites
+    }
+    return ext.empty() ? name : name + '.' + ext;
+}
+
+} // namespace
+
+// Reads a file's clusters in order, each run of consecutive clusters in
+// one read
+class FatVolume::ClusterStream : public ArchiveWalker::Source
+{
+public:
+    ClusterStream(const FatVolume &volume, const File &file)
+        : volume(volume)
+        , cluster(uint32_t(file.start))
+        , size(file.size)
+        , validSize(std::min(file.validSize, file.size))
+        , contiguous(file.contiguous)
+        , pos(0)
+    {
+    }
+
+    long read(uint8_t *buffer, size_t capacity, std::string *error) override
+    {
+        if (pos >= size) {
+            return 0;
+        }
+        size_t want = size_t(std::min<uint64_t>(capacity, size - pos));
+        if (pos >= validSize) {
+            memset(buffer, 0, want);
+            pos += want;
+            return long(want);
+        }
+        want = size_t(std::min<uint64_t>(want, validSize - pos));
+        if (!volume.valid(cluster)) {
+            *error = "Cluster chain ends " + std::to_string(size - pos) + " bytes early";
+            return -1;
+        }
+
+        uint32_t within = uint32_t(pos % volume.clusterBytes);
+        uint64_t run = volume.clusterBytes - within;
+        for (uint32_t last = cluster; run < want;) {
+            uint32_t following = contiguous ? last + 1 : volume.next(last);
+            if (following != last + 1 || !volume.valid(following)) {
+                break;
+            }
+            last = following;
+            run += volume.clusterBytes;
+        }
+        size_t n = size_t(std::min<uint64_t>(want, run));
+        if (!volume.readAt(volume.offsetOf(cluster) + within, buffer, n, error)) {
+            return -1;
+        }
+        pos += n;
+        for (uint64_t done = (within + n) / volume.clusterBytes; done > 0; --done) {
+            cluster = contiguous ? cluster + 1 : volume.next(cluster);
+        }
+        return long(n);
+    }
+
+private:
+    const FatVolume &volume;
+    uint32_t cluster;   // holding pos
+    uint64_t size;
+    uint64_t validSize;
+    bool contiguous;
+    uint64_t pos;
+};
+
+bool FatVolume::detect(const uint8_t *boot)
+{
+    if (boot[510] != 0x55 || boot[511] != 0xAA) {
+        return false;
+    }
+    if (memcmp(boot + 3, "EXFAT   ", 8) == 0) {
+        return true;
+    }
+    uint32_t sectorBytes = le16(boot + 11);
+    uint32_t perCluster = boot[13];
+    uint8_t media = boot[21];
+    return (boot[0] == 0xEB || boot[0] == 0xE9)
+        && (sectorBytes == 512 || sectorBytes == 1024 || sectorBytes == 2048 || sectorBytes == 4096)
+        && perCluster != 0 && (perCluster & (perCluster - 1)) == 0
+        && le16(boot + 14) != 0
+        && boot[16] >= 1 && boot[16] <= 2
+        && (media == 0xF0 || media >= 0xF8);
+}
+
+FatVolume::FatVolume()
+    : kind(Fat32)
+    , clusterBytes(0)
+    , clusterCount(0)
+    , heapOffset(0)
+    , rootCluster(0)
+    , rootOffset(0)
+    , rootBytes(0)
+{
+}
+
+const char *FatVolume::format() const
+{
+    switch (kind) {
+    case Fat12: return "FAT12";
+    case Fat16: return "FAT16";
+    case Fat32: return "FAT32";
+    case ExFat: return "exFAT";
+    }
+    return "FAT";
+}
+
+bool FatVolume::load(std::string *error)
+{
+    uint8_t boot[512];
+    if (!readAt(0, boot, sizeof(boot), error)) {
+        return false;
+    }
+
+    uint64_t fatOffset = 0;
+    uint64_t fatBytes = 0;
+    uint64_t fatCapacity = 0;
+    if (memcmp(boot + 3, "EXFAT   ", 8) == 0) {
+        kind = ExFat;
+        unsigned sectorShift = boot[108];
+        unsigned clusterShift = boot[109];
+        if (sectorShift < 9 || sectorShift > 12 || sectorShift + clusterShift > 25) {
+            if (error) *error = "Bad exFAT geometry";
+            return false;
+        }
+        clusterBytes = 1u << (sectorShift + clusterShift);
+        fatCapacity = uint64_t(le32(boot + 84)) << sectorShift;
+        fatOffset = uint64_t(le32(boot + 80)) << sectorShift;
+        // The second FAT of TexFAT, when it is the active one
+        if (boot[110] == 2 && (le16(boot + 106) & 1)) {
+            fatOffset += fatCapacity;
+        }
+        heapOffset = uint64_t(le32(boot + 88)) << sectorShift;
+        clusterCount = le32(boot + 92);
+        rootCluster = le32(boot + 96);
+        fatBytes = (uint64_t(clusterCount) + 2) * 4;
+    } else {
+        uint32_t sectorBytes = le16(boot + 11);
+        uint32_t perCluster = boot[13];
+        uint32_t reserved = le16(boot + 14);
+        uint32_t fats = boot[16];
+        uint32_t rootEntries = le16(boot + 17);
+        uint64_t total = le16(boot + 19) ? le16(boot + 19) : le32(boot + 32);
+        uint64_t fatSectors = le16(boot + 22) ? le16(boot + 22) : le32(boot + 36);
+        uint64_t rootSectors = (uint64_t(rootEntries) * kEntryBytes + sectorBytes - 1) / sectorBytes;
+        uint64_t dataStart = reserved + fats * fatSectors + rootSectors;
+        if (fatSectors == 0 || dataStart >= total) {
+            if (error) *error = "Bad FAT geometry";
+            return false;
+        }
+        clusterBytes = sectorBytes * perCluster;
+        clusterCount = uint32_t(std::min<uint64_t>((total - dataStart) / perCluster, 0x0FFFFFF5));
+        kind = clusterCount < 4085 ? Fat12 : clusterCount < 65525 ? Fat16 : Fat32;
+        fatCapacity = fatSectors * sectorBytes;
+        fatOffset = uint64_t(reserved) * sectorBytes;
+        heapOffset = dataStart * sectorBytes;
+        if (kind == Fat32) {
+            rootCluster = le32(boot + 44);
+            // Mirroring off: only the FAT named in the low bits is kept up to date
+            uint16_t flags = le16(boot + 40);
+            if ((flags & 0x80) && (flags & 0x0F) < fats) {
+                fatOffset += (flags & 0x0F) * fatCapacity;
+            }
+        } else {
+            rootCluster = 0;
+            rootOffset = (reserved + fats * fatSectors) * sectorBytes;
+            rootBytes = rootEntries * uint32_t(kEntryBytes);
+        }
+        fatBytes = kind == Fat12 ? (uint64_t(clusterCount) + 2) * 3 / 2 + 1
+                 : (uint64_t(clusterCount) + 2) * (kind == Fat16 ? 2 : 4);
+        fatBytes = std::min(fatBytes, fatCapacity);
+    }
+
+    if (clusterCount == 0 || fatBytes > fatCapacity || fatBytes > kMaxTableBytes) {
+        if (error) *error = std::string("Bad ") + format() + " allocation table size";
+        return false;
+    }
+    if (heapOffset + uint64_t(clusterCount) * clusterBytes > length) {
+        if (error) *error = std::string(format()) + " volume extends past the end of the device";
+        return false;
+    }
+    fat.resize(size_t(fatBytes));
+    if (!readAt(fatOffset, fat.data(), fat.size(), error)) {
+        return false;
+    }
+    return kind != ExFat || readBitmap(error);
+}
+
+// exFAT keeps free space in a bitmap named in the root directory
+bool FatVolume::readBitmap(std::string *error)
+{
+    std::vector<uint8_t> root;
+    if (!readClusters(rootCluster, kMaxDirectoryBytes, false, &root, error)) {
+        return false;
+    }
+    for (size_t off = 0; off + kEntryBytes <= root.size() && root[off] != 0; off += kEntryBytes) {
+        const uint8_t *e = &root[off];
+        if (e[0] != kExFatBitmap) {
+            continue;
+        }
+        uint64_t bytes = le64(e + 24);
+        if (bytes < (uint64_t(clusterCount) + 7) / 8 || bytes > kMaxTableBytes) {
+            break;
+        }
+        return readClusters(le32(e + 20), bytes, false, &bitmap, error);
+    }
+    if (error) *error = "exFAT volume has no allocation bitmap";
+    return false;
+}
+
+uint32_t FatVolume::next(uint32_t cluster) const
+{
+    uint32_t value = 0;
+    if (kind == Fat12) {
+        size_t off = size_t(cluster) + cluster / 2;
+        if (off + 1 < fat.size()) {
+            value = le16(&fat[off]);
+            value = cluster & 1 ? value >> 4 : value & 0xFFF;
+        }
+    } else if (kind == Fat16) {
+        size_t off = size_t(cluster) * 2;
+        if (off + 2 <= fat.size()) {
+            value = le16(&fat[off]);
+        }
+    } else {
+        size_t off = size_t(cluster) * 4;
+        if (off + 4 <= fat.size()) {
+            value = le32(&fat[off]);
+            if (kind == Fat32) {
+                value &= 0x0FFFFFFF;
+            }
+        }
+    }
+    return valid(value) ? value : 0;
+}
+
+bool FatVolume::allocated(uint32_t cluster) const
+{
+    if (kind == ExFat) {
+        uint32_t bit = cluster - 2;
+        return bit / 8 >= bitmap.size() || (bitmap[bit / 8] >> (bit % 8) & 1);
+    }
+    // Any value but 0 (free): a link, end of chain, bad or reserved
+    size_t off = kind == Fat12 ? size_t(cluster) + cluster / 2 : size_t(cluster) * (kind == Fat16 ? 2 : 4);
+    if (off + (kind == Fat32 ? 4 : 2) > fat.size()) {
+        return true;
+    }
+    uint32_t value = kind == Fat32 ? le32(&fat[off]) & 0x0FFFFFFF : le16(&fat[off]);
+    if (kind == Fat12) {
+        value = cluster & 1 ? value >> 4 : value & 0xFFF;
+    }
+    return value != 0;
+}
+
+// A deleted file's clusters, assumed contiguous, none reused since
+bool FatVolume::recoverable(uint32_t first, uint64_t bytes) const
+{
+    uint64_t clusters = (bytes + clusterBytes - 1) / clusterBytes;
+    if (!valid(first) || clusters > clusterCount - (first - 2)) {
+        return false;
+    }
+    for (uint64_t i = 0; i < clusters; ++i) {
+        if (allocated(uint32_t(first + i))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FatVolume::readClusters(uint32_t first, uint64_t bytes, bool contiguous, std::vector<uint8_t> *data,
+                             std::string *error) const
+{
+    data->clear();
+    if (contiguous) {
+        uint64_t clusters = (bytes + clusterBytes - 1) / clusterBytes;
+        if (!valid(first) || clusters > clusterCount - (first - 2)) {
+            if (error) *error = "Cluster run at " + std::to_string(first) + " leaves the volume";
+            return false;
+        }
+        data->resize(size_t(bytes));
+        return readAt(offsetOf(first), data->data(), data->size(), error);
+    }
+
+    uint64_t steps = 0;
+    for (uint32_t cluster = first; cluster != 0 && data->size() < bytes; cluster = next(cluster)) {
+        if (!valid(cluster) || ++steps > clusterCount) {
+            if (error) *error = "Broken cluster chain from " + std::to_string(first);
+            return false;
+        }
+        size_t old = data->size();
+        data->resize(old + clusterBytes);
+        if (!readAt(offsetOf(cluster), data->data() + old, clusterBytes, error)) {
+            return false;
+        }
+    }
+    if (data->size() > bytes) {
+        data->resize(size_t(bytes));
+    }
+    return true;
+}
+
+bool FatVolume::list(std::vector<File> *files, std::string *error)
+{
+    files->clear();
+    directoryCount = 0;
+    unreadableCount = 0;
+
+    std::vector<Directory> pending;
+    pending.push_back({rootCluster, kind == ExFat ? kMaxDirectoryBytes : kMaxFatDirectoryBytes, false, std::string()});
+    std::unordered_set<uint32_t> seen;  // a damaged tree may loop
+    std::vector<uint8_t> entries;
+    bool root = true;
+    while (!pending.empty()) {
+        Directory dir = std::move(pending.back());
+        pending.pop_back();
+        bool fixedRoot = root && rootCluster == 0;
+        if (!fixedRoot && !seen.insert(dir.cluster).second) {
+            continue;
+        }
+        std::string e;
+        bool ok;
+        if (fixedRoot) {
+            entries.resize(rootBytes);
+            ok = readAt(rootOffset, entries.data(), entries.size(), &e);
+        } else {
+            ok = readClusters(dir.cluster, dir.bytes, dir.contiguous, &entries, &e);
+        }
+        if (!ok) {
+            if (root) {
+                if (error) *error = "Cannot read the root directory: " + e;
+                return false;
+            }
+            ++unreadableCount;
+            continue;
+        }
+        root = false;
+        ++directoryCount;
+        if (kind == ExFat) {
+            listExFat(entries, dir.path, files, &pending);
+        } else {
+            listFat(entries, dir.path, files, &pending);
+        }
+    }
+
+    std::stable_sort(files->begin(), files->end(),
+                     [](const File &a, const File &b) { return a.diskOffset < b.diskOffset; });
+    return true;
+}
+
+void FatVolume::listFat(const std::vector<uint8_t> &entries, const std::string &dir, std::vector<File> *files,
+                        std::vector<Directory> *dirs) const
+{
+    // Long-name entries since the last short one, in disk order: the last
+    // part of the name comes first
+    std::vector<const uint8_t *> parts;
+    for (size_t off = 0; off + kEntryBytes <= entries.size(); off += kEntryBytes) {
+        const uint8_t *e = &entries[off];
+        if (e[0] == 0x00) {
+            break;
+        }
+        bool deleted = e[0] == kDeleted;
+        if ((e[11] & 0x3F) == kLongName) {
+            parts.push_back(e);
+            continue;
+        }
+        std::vector<const uint8_t *> longName;
+        longName.swap(parts);
+        if (e[11] & kVolumeLabel) {
+            continue;
+        }
+
+        // Deletion overwrites the short name's first byte and the parts'
+        // sequence numbers, so those only have to agree among themselves
+        std::string name;
+        uint8_t checksum = longName.empty() ? 0 : longName[0][13];
+        bool intact = !longName.empty() && (deleted || checksum == shortNameChecksum(e));
+        for (size_t i = 0; intact && i < longName.size(); ++i) {
+            const uint8_t *part = longName[i];
+            intact = part[13] == checksum
+                  && (deleted || (size_t(part[0] & 0x1F) == longName.size() - i && (i > 0 || (part[0] & 0x40))));
+        }
+        if (intact) {
+            std::vector<uint8_t> units;
+            for (size_t i = longName.size(); i-- > 0;) {
+                const uint8_t *part = longName[i];
+                units.insert(units.end(), part + 1, part + 11);
+                units.insert(units.end(), part + 14, part + 26);
+                units.insert(units.end(), part + 28, part + 32);
+            }
+            name = fromUtf16(units.data(), units.size() / 2);
+        }
+        if (name.empty()) {
+            name = shortName(e, deleted);
+        }
+        if (name.empty() || name == "." || name == "..") {
+            continue;
+        }
+
+        uint32_t cluster = le16(e + 26) | (kind == Fat32 ? uint32_t(le16(e + 20)) << 16 : 0);
+        if (e[11] & kDirectory) {
+            if (!deleted && valid(cluster)) {
+                dirs->push_back({cluster, kMaxFatDirectoryBytes, false, join(dir, name)});
+            }
+            continue;
+        }
+        File file;
+        file.size = le32(e + 28);
+        if (deleted && (file.size == 0 || !recoverable(cluster, file.size))) {
+            continue;
+        }
+        file.path = join(dir, name);
+        file.mtimeNs = dosTimeNs(le16(e + 24), le16(e + 22));
+        file.inode = cluster;
+        file.diskOffset = valid(cluster) ? offsetOf(cluster) : 0;
+        file.deleted = deleted;
+        file.start = cluster;
+        file.validSize = file.size;
+        file.contiguous = deleted;
+        files->push_back(std::move(file));
+    }
+}
+
+void FatVolume::listExFat(const std::vector<uint8_t> &entries, const std::string &dir, std::vector<File> *files,
+                          std::vector<Directory> *dirs) const
+{
+    for (size_t off = 0; off + kEntryBytes <= entries.size();) {
+        const uint8_t *e = &entries[off];
+        if (e[0] == 0x00) {
+            break;
+        }
+        // A file entry set: the file entry, a stream extension, then names
+        size_t secondaries = e[1];
+        size_t setBytes = (secondaries + 1) * kEntryBytes;
+        bool deleted = !(e[0] & kExFatInUse);
+        uint8_t inUse = deleted ? 0 : kExFatInUse;
+        if ((e[0] | kExFatInUse) != kExFatFile || secondaries < 2 || off + setBytes > entries.size()
+            || e[kEntryBytes] != ((kExFatStream & ~kExFatInUse) | inUse)
+            || entrySetChecksum(e, setBytes) != le16(e + 2)) {
+            off += kEntryBytes;
+            continue;
+        }
+        off += setBytes;
+
+        const uint8_t *stream = e + kEntryBytes;
+        size_t nameUnits = stream[3];
+        std::vector<uint8_t> units;
+        for (size_t i = 2; i <= secondaries && units.size() < nameUnits * 2; ++i) {
+            const uint8_t *part = e + i * kEntryBytes;
+            if ((part[0] | kExFatInUse) == kExFatName) {
+                units.insert(units.end(), part + 2, part + kEntryBytes);
+            }
+        }
+        if (nameUnits == 0 || units.size() < nameUnits * 2) {
+            continue;
+        }
+        std::string name = fromUtf16(units.data(), nameUnits);
+        if (name.empty()) {
+            continue;
+        }
+
+        uint32_t cluster = le32(stream + 20);
+        uint64_t size = le64(stream + 24);
+        bool contiguous = stream[1] & kExFatNoFatChain;
+        if (le16(e + 4) & kExFatDirectory) {
+            if (!deleted && valid(cluster) && size > 0) {
+                dirs->push_back({cluster, std::min(size, kMaxDirectoryBytes), contiguous, join(dir, name)});
+            }
+            continue;
+        }
+        if (deleted && (size == 0 || !recoverable(cluster, size))) {
+            continue;
+        }
+        File file;
+        file.path = join(dir, name);
+        file.size = size;
+        // Local time with a 10 ms remainder and, when flagged, its UTC offset in 15 minute steps
+        uint32_t stamp = le32(e + 12);
+        file.mtimeNs = dosTimeNs(stamp >> 16, stamp & 0xFFFF);
+        if (file.mtimeNs != 0) {
+            file.mtimeNs += int64_t(std::min<uint8_t>(e[21], 199)) * 10000000;
+            if (e[23] & 0x80) {
+                int quarters = e[23] & 0x40 ? int(e[23] & 0x7F) - 128 : int(e[23] & 0x7F);
+                file.mtimeNs -= int64_t(quarters) * 15 * 60 * 1000000000;
+            }
+        }
+        file.inode = cluster;
+        file.diskOffset = valid(cluster) ? offsetOf(cluster) : 0;
+        file.deleted = deleted;
+        file.start = cluster;
+        file.validSize = std::min(le64(stream + 8), size);
+        file.contiguous = contiguous || deleted;
+        files->push_back(std::move(file));
+    }
+}
+
+std::unique_ptr<ArchiveWalker::Source> FatVolume::stream(const File &file, std::string *error) const
+{
+    if (file.size > 0 && !valid(uint32_t(file.start))) {
+        if (error) *error = "No data clusters for " + file.path;
+        return nullptr;
+    }
+    return std::unique_ptr<ArchiveWalker::Source>(new ClusterStream(*this, file));
+}
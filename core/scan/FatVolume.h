@@ -0,0 +1,70 @@
+#ifndef FATVOLUME_H
+#define FATVOLUME_H
+
+#include "VolumeReader.h"
+
+// FAT12, FAT16, FAT32 and exFAT, read in process. The boot sector gives
+// the geometry and the whole FAT is loaded once; directories are then
+// followed from the root through their cluster chains, with long names
+// (VFAT entries, exFAT name entries) checked against their checksums.
+//
+// Deleted entries (0xE5 on FAT, a cleared in-use bit on exFAT) are
+// listed as recovered files when their size is known and every cluster
+// they would span is still free: the chain is gone once a file is
+// deleted, so the data is assumed to be contiguous, which holds for most
+// files written in one go to a drive that was not fragmented. Deleted
+// directories are not followed. FAT has no time zone and its times are
+// taken as UTC.
+class FatVolume : public VolumeReader
+{
+public:
+    // A FAT or exFAT boot sector, 512 bytes
+    static bool detect(const uint8_t *boot);
+
+    FatVolume();
+
+    const char *format() const override;
+    bool list(std::vector<File> *files, std::string *error = nullptr) override;
+    std::unique_ptr<ArchiveWalker::Source> stream(const File &file, std::string *error = nullptr) const override;
+
+protected:
+    bool load(std::string *error) override;
+
+private:
+    class ClusterStream;
+
+    enum Kind { Fat12, Fat16, Fat32, ExFat };
+
+    struct Directory {
+        uint32_t cluster;
+        uint64_t bytes;
+        bool contiguous;
+        std::string path;
+    };
+
+    Kind kind;
+    uint32_t clusterBytes;
+    uint32_t clusterCount;
+    uint64_t heapOffset;          // cluster 2
+    uint32_t rootCluster;         // 0 for the fixed FAT12/16 root directory
+    uint64_t rootOffset;
+    uint32_t rootBytes;
+    std::vector<uint8_t> fat;
+    std::vector<uint8_t> bitmap;  // exFAT; FAT marks free clusters in the FAT
+
+    bool valid(uint32_t cluster) const { return cluster >= 2 && cluster - 2 < clusterCount; }
+    uint64_t offsetOf(uint32_t cluster) const { return heapOffset + uint64_t(cluster - 2) * clusterBytes; }
+    // 0 at the end of the chain or on a link out of the volume
+    uint32_t next(uint32_t cluster) const;
+    bool allocated(uint32_t cluster) const;
+    bool recoverable(uint32_t first, uint64_t bytes) const;
+    bool readClusters(uint32_t first, uint64_t bytes, bool contiguous, std::vector<uint8_t> *data,
+                      std::string *error) const;
+    bool readBitmap(std::string *error);
+    void listFat(const std::vector<uint8_t> &entries, const std::string &dir, std::vector<File> *files,
+                 std::vector<Directory> *dirs) const;
+    void listExFat(const std::vector<uint8_t> &entries, const std::string &dir, std::vector<File> *files,
+                   std::vector<Directory> *dirs) const;
+};
+
+#endif // FATVOLUME_H
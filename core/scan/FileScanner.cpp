@@ -0,0 +1,231 @@
+#include "FileScanner.h"
+#include "EntropyMeter.h"
+#include "FileTypeIdentifier.h"
+#include "SignatureMatcher.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const size_t kMaxHitsPerFile = 256;
+// Each consumer takes a slice in turn, so the later ones read it from L2
+// rather than memory
+const size_t kSliceBytes = 64 << 10;
+
+class FileSource : public ArchiveWalker::Source
+{
+public:
+    explicit FileSource(QFile &file) : file(file) {}
+
+    long read(uint8_t *buffer, size_t capacity, std::string *error) override
+    {
+        qint64 n = file.read(reinterpret_cast<char *>(buffer), qint64(capacity));
+        if (n < 0) {
+            *error = file.errorString().toStdString();
+        }
+        return long(n);
+    }
+
+private:
+    QFile &file;
+};
+
+} // namespace
+
+// Everything needed to scan one file or member
+struct FileScanner::Level {
+    QCryptographicHash sha256{QCryptographicHash::Sha256};
+    QCryptographicHash sha1{QCryptographicHash::Sha1};
+    QCryptographicHash md5{QCryptographicHash::Md5};
+    std::unique_ptr<SignatureStream> stream;
+    std::vector<SignatureMatcher::Match> matches;
+    std::unique_ptr<RuleSet::Scanner> ruleScanner;
+    EntropyMeter entropy;
+    QString path;
+    qint64 size = 0;
+    uint8_t head[FileTypeIdentifier::kHeaderBytes];
+    size_t headLength = 0;
+
+    void begin(const QString &name)
+    {
+        sha256.reset();
+        sha1.reset();
+        md5.reset();
+        if (stream) {
+            stream->reset();
+        }
+        matches.clear();
+        if (ruleScanner) {
+            ruleScanner->reset();
+        }
+        entropy.reset();
+        path = name;
+        size = 0;
+        headLength = 0;
+    }
+
+    void feed(const uint8_t *data, size_t length)
+    {
+        for (size_t offset = 0; offset < length; offset += kSliceBytes) {
+            const uint8_t *slice = data + offset;
+            size_t n = std::min(kSliceBytes, length - offset);
+            QByteArray chunk = QByteArray::fromRawData(reinterpret_cast<const char *>(slice), int(n));
+            sha256.addData(chunk);
+            sha1.addData(chunk);
+            md5.addData(chunk);
+            entropy.feed(slice, n);
+            if (stream && matches.size() < kMaxHitsPerFile) {
+                stream->feed(slice, n, matches);
+            }
+            if (ruleScanner) {
+                ruleScanner->feed(slice, n);
+            }
+        }
+        if (headLength < sizeof(head)) {
+            size_t n = std::min(length, sizeof(head) - headLength);
+            memcpy(head + headLength, data, n);
+            headLength += n;
+        }
+        size += qint64(length);
+    }
+
+    void finish(const SignatureMatcher *signatures, ScanFileResult *result)
+    {
+        result->path = path;
+        result->size = size;
+        result->sha256 = sha256.result();
+        result->sha1 = sha1.result();
+        result->md5 = md5.result();
+        FileTypeIdentifier::Type type = FileTypeIdentifier::identify(head, headLength);
+        result->fileType = QString::fromLatin1(FileTypeIdentifier::name(type));
+        result->entropy = entropy.entropy();
+        // Compressed archives and media are high-entropy by design; in an
+        // executable it points at a packer or an encrypted payload
+        if (FileTypeIdentifier::isExecutable(type)) {
+            for (const EntropyMeter::Region &r : entropy.regions()) {
+                ScanEntropyRegion region;
+                region.offset = qint64(r.offset);
+                region.length = qint64(r.length);
+                region.entropy = r.entropy;
+                result->highEntropy.append(region);
+            }
+        }
+
+        // A file made of one repeated byte could match on every offset
+        std::sort(matches.begin(), matches.end(), [](const SignatureMatcher::Match &a, const SignatureMatcher::Match &b) {
+            return a.offset != b.offset ? a.offset < b.offset : a.pattern < b.pattern;
+        });
+        for (size_t i = 0; i < matches.size() && i < kMaxHitsPerFile; ++i) {
+            ScanHit hit;
+            hit.signature = QString::fromStdString(signatures->patternName(matches[i].pattern));
+            hit.offset = qint64(matches[i].offset);
+            result->hits.append(hit);
+        }
+        if (ruleScanner) {
+            for (uint32_t rule : ruleScanner->finish()) {
+                result->rules.append(QString::fromStdString(ruleScanner->ruleSet().ruleName(rule)));
+            }
+            result->rulesIncomplete = ruleScanner->limitReached();
+        }
+    }
+};
+
+FileScanner::FileScanner(const SignatureMatcher *signatures, const RuleSet *rules, const ArchiveWalker::Limits &limits)
+    : signatures(signatures)
+    , rules(rules)
+    , walker(limits)
+    , memberResults(nullptr)
+    , bytesRead(nullptr)
+    , isCancelled(nullptr)
+{
+}
+
+FileScanner::~FileScanner()
+{
+}
+
+FileScanner::Level &FileScanner::level(int depth)
+{
+    // Levels are created on first use, so plain files never pay for archive state
+    while (int(levels.size()) <= depth) {
+        std::unique_ptr<Level> l(new Level);
+        if (signatures) {
+            l->stream.reset(new SignatureStream(*signatures));
+        }
+        if (rules) {
+            l->ruleScanner.reset(new RuleSet::Scanner(*rules));
+        }
+        levels.push_back(std::move(l));
+    }
+    return *levels[size_t(depth)];
+}
+
+bool FileScanner::scan(const QString &path, const QString &name, ScanFileResult *result, QList<ScanFileResult> *members,
+                       const std::function<void(qint64)> &onBytes, const std::function<bool()> &cancelled)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Unbuffered)) {
+        result->error = file.errorString();
+        return false;
+    }
+    FileSource source(file);
+    return scan(source, name, result, members, onBytes, cancelled);
+}
+
+bool FileScanner::scan(ArchiveWalker::Source &source, const QString &name, ScanFileResult *result,
+                       QList<ScanFileResult> *members, const std::function<void(qint64)> &onBytes,
+                       const std::function<bool()> &cancelled)
+{
+    memberResults = members;
+    bytesRead = &onBytes;
+    isCancelled = &cancelled;
+    level(0).begin(name);
+
+    std::string error;
+    bool ok = walker.walk(source, name.toStdString(), *this, &error);
+    memberResults = nullptr;
+    bytesRead = nullptr;
+    isCancelled = nullptr;
+    if (!ok) {
+        result->error = QString::fromStdString(error);
+        result->size = level(0).size;
+        return false;
+    }
+    level(0).finish(signatures, result);
+    // Members are cached with their file, so one undecided member keeps the
+    // whole archive out of the cache
+    for (int i = 0; members && i < members->size(); ++i) {
+        result->rulesIncomplete |= members->at(i).rulesIncomplete;
+    }
+    return true;
+}
+
+void FileScanner::beginMember(int depth, const std::string &path)
+{
+    level(depth).begin(QString::fromStdString(path));
+}
+
+void FileScanner::data(int depth, const uint8_t *data, size_t length)
+{
+    level(depth).feed(data, length);
+    if (depth == 0 && *bytesRead) {
+        (*bytesRead)(qint64(length));
+    }
+}
+
+void FileScanner::endMember(int depth, const std::string &error)
+{
+    ScanFileResult member;
+    level(depth).finish(signatures, &member);
+    member.error = QString::fromStdString(error);
+    if (memberResults) {
+        memberResults->append(member);
+    }
+}
+
+bool FileScanner::cancelled()
+{
+    return *isCancelled && (*isCancelled)();
+}
@@ -0,0 +1,52 @@
+#ifndef FILESCANNER_H
+#define FILESCANNER_H
+
+#include "ArchiveWalker.h"
+#include "RuleSet.h"
+#include "ScanTypes.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+class SignatureMatcher;
+
+// Reads one file in a single pass and computes SHA-256, SHA-1 and MD5 for it
+// and for every archive member the walker unpacks from it, matching
+// signatures and rules on the way when given. Digest, matcher and rule
+// state is kept per nesting level and reused between files; one instance
+// per worker thread.
+class FileScanner : private ArchiveWalker::Sink
+{
+public:
+    FileScanner(const SignatureMatcher *signatures, const RuleSet *rules, const ArchiveWalker::Limits &limits);
+    ~FileScanner() override;
+
+    // Results are reported under name (the path relative to the scan root);
+    // members are appended in the order their containers finish them
+    bool scan(const QString &path, const QString &name, ScanFileResult *result, QList<ScanFileResult> *members,
+              const std::function<void(qint64)> &onBytes = nullptr,
+              const std::function<bool()> &cancelled = nullptr);
+    // Same for any byte stream, e.g. a whole device through BlockDeviceReader
+    bool scan(ArchiveWalker::Source &source, const QString &name, ScanFileResult *result,
+              QList<ScanFileResult> *members, const std::function<void(qint64)> &onBytes = nullptr,
+              const std::function<bool()> &cancelled = nullptr);
+
+private:
+    struct Level;
+
+    const SignatureMatcher *signatures;
+    const RuleSet *rules;
+    ArchiveWalker walker;
+    std::vector<std::unique_ptr<Level>> levels;
+    QList<ScanFileResult> *memberResults;
+    const std::function<void(qint64)> *bytesRead;
+    const std::function<bool()> *isCancelled;
+
+    Level &level(int depth);
+    void beginMember(int depth, const std::string &path) override;
+    void data(int depth, const uint8_t *data, size_t length) override;
+    void endMember(int depth, const std::string &error) override;
+    bool cancelled() override;
+};
+
+#endif // FILESCANNER_H
@@ -0,0 +1,248 @@
+#include "FileTypeIdentifier.h"
+#include <cstring>
+
+namespace {
+
+typedef FileTypeIdentifier FT;
+
+struct Magic {
+    uint8_t length;
+    const char *bytes;
+    FT::Type type;
+};
+
+// Leading bytes; where one magic prefixes another the longer one wins
+constexpr Magic kMagics[] = {
+    {2, "MZ", FT::PE},
+    {4, "\x7f" "ELF", FT::ELF},
+    {4, "\xfe\xed\xfa\xce", FT::MachO},
+    {4, "\xfe\xed\xfa\xcf", FT::MachO},
+    {4, "\xce\xfa\xed\xfe", FT::MachO},
+    {4, "\xcf\xfa\xed\xfe", FT::MachO},
+    {4, "\xca\xfe\xba\xbe", FT::MachO},  // fat binary, or a Java class
+    {8, "\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", FT::OLE},
+    {20, "\x4c\0\0\0\x01\x14\x02\0\0\0\0\0\xc0\0\0\0\0\0\0\x46", FT::LNK},
+    {5, "%PDF-", FT::PDF},
+    {5, "{\\rtf", FT::RTF},
+    {2, "#!", FT::Script},
+    {4, "PK\x03\x04", FT::Zip},
+    {4, "PK\x05\x06", FT::Zip},
+    {3, "\x1f\x8b\x08", FT::Gzip},
+    {3, "BZh", FT::Bzip2},
+    {6, "\xfd" "7zXZ\0", FT::Xz},
+    {4, "\x28\xb5\x2f\xfd", FT::Zstd},
+    {6, "7z\xbc\xaf\x27\x1c", FT::SevenZip},
+    {6, "Rar!\x1a\x07", FT::Rar},
+    {4, "MSCF", FT::Cab},
+};
+constexpr size_t kMagicCount = sizeof(kMagics) / sizeof(kMagics[0]);
+constexpr size_t kMaxMagicLength = 20;
+
+// Magics grouped by first byte, longest first within a group
+struct JumpTable {
+    uint8_t begin[257];
+    uint8_t order[kMagicCount];
+};
+
+constexpr JumpTable buildJumpTable()
+{
+    JumpTable table{};
+    size_t pos = 0;
+    for (size_t first = 0; first < 256; ++first) {
+        table.begin[first] = uint8_t(pos);
+        for (size_t length = kMaxMagicLength; length > 0; --length) {
+            for (size_t i = 0; i < kMagicCount; ++i) {
+                if (uint8_t(kMagics[i].bytes[0]) == first && kMagics[i].length == length) {
+                    table.order[pos++] = uint8_t(i);
+                }
+            }
+        }
+    }
+    table.begin[256] = uint8_t(pos);
+    return table;
+}
+
+constexpr JumpTable kJumpTable = buildJumpTable();
+static_assert(kJumpTable.begin[256] == kMagicCount, "every magic must be 1..kMaxMagicLength bytes long");
+
+uint16_t le16(const uint8_t *p)
+{
+    return uint16_t(p[0] | p[1] << 8);
+}
+
+uint32_t le32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+bool startsWith(const uint8_t *data, size_t length, const char *prefix, size_t prefixLength)
+{
+    return length >= prefixLength && memcmp(data, prefix, prefixLength) == 0;
+}
+
+// Lower-case ASCII comparison against a lower-case prefix
+bool startsWithNoCase(const uint8_t *data, size_t length, const char *prefix)
+{
+    size_t n = strlen(prefix);
+    if (length < n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t c = data[i];
+        if (c >= 'A' && c <= 'Z') {
+            c = uint8_t(c + 32);
+        }
+        if (c != uint8_t(prefix[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+FT::Type refineMZ(const uint8_t *data, size_t length)
+{
+    if (length < 0x40) {
+        return FT::DosExecutable;
+    }
+    uint32_t offset = le32(data + 0x3c);
+    // A PE header past the sample cannot be checked; MZ files almost always have one
+    if (size_t(offset) + 4 > length) {
+        return offset < (1u << 16) ? FT::PE : FT::DosExecutable;
+    }
+    return memcmp(data + offset, "PE\0\0", 4) == 0 ? FT::PE : FT::DosExecutable;
+}
+
+FT::Type refineCafeBabe(const uint8_t *data, size_t length)
+{
+    // Fat Mach-O: big-endian architecture count; Java: minor then major
+    // version, and majors start at 45
+    if (length < 8) {
+        return FT::MachO;
+    }
+    uint32_t next = uint32_t(data[4]) << 24 | uint32_t(data[5]) << 16 | uint32_t(data[6]) << 8 | data[7];
+    return next >= 45 ? FT::JavaClass : FT::MachO;
+}
+
+// Zip containers are told apart by the entries in the first local headers
+FT::Type refineZip(const uint8_t *data, size_t length)
+{
+    bool ooxml = false, odf = false, jar = false, apk = false;
+    size_t p = 0;
+    while (p + 30 <= length && memcmp(data + p, "PK\x03\x04", 4) == 0) {
+        uint16_t flags = le16(data + p + 6);
+        uint32_t compressed = le32(data + p + 18);
+        size_t nameLength = le16(data + p + 26);
+        size_t extraLength = le16(data + p + 28);
+        const uint8_t *name = data + p + 30;
+        size_t available = length - (p + 30);
+        if (nameLength > available) {
+            break;
+        }
+        auto is = [&](const char *text) { return nameLength == strlen(text) && memcmp(name, text, nameLength) == 0; };
+        auto has = [&](const char *text) { return startsWith(name, nameLength, text, strlen(text)); };
+        if (is("[Content_Types].xml") || has("_rels/") || has("word/") || has("xl/") || has("ppt/")) {
+            ooxml = true;
+        } else if (is("AndroidManifest.xml") || is("classes.dex")) {
+            apk = true;
+        } else if (is("mimetype")) {
+            const uint8_t *content = name + nameLength + extraLength;
+            size_t left = content < data + length ? size_t(data + length - content) : 0;
+            odf = startsWith(content, left, "application/vnd.oasis.opendocument", 34);
+        } else if (has("META-INF/") || (nameLength > 6 && memcmp(name + nameLength - 6, ".class", 6) == 0)) {
+            jar = true;
+        }
+        // Sizes come after the data with a data descriptor
+        if (flags & 0x08) {
+            break;
+        }
+        p += 30 + nameLength + extraLength + compressed;
+    }
+    return apk ? FT::APK : ooxml ? FT::OOXML : odf ? FT::ODF : jar ? FT::JAR : FT::Zip;
+}
+
+FT::Type sniffText(const uint8_t *data, size_t length)
+{
+    size_t sample = length < 512 ? length : 512;
+    if (sample == 0) {
+        return FT::Unknown;
+    }
+    if (memchr(data, 0, sample)) {
+        return FT::Unknown;
+    }
+    // Control characters other than tab, newline, form feed, return and escape
+    const uint32_t kTextControls = 1u << '\t' | 1u << '\n' | 1u << '\f' | 1u << '\r' | 1u << 0x1b;
+    size_t binary = 0;
+    for (size_t i = 0; i < sample; ++i) {
+        uint8_t c = data[i];
+        binary += (c < 0x20) & ~(kTextControls >> (c & 31)) & 1u;
+    }
+    if (binary * 20 > sample) {
+        return FT::Unknown;
+    }
+
+    size_t p = startsWith(data, length, "\xef\xbb\xbf", 3) ? 3 : 0;
+    while (p < length && (data[p] == ' ' || data[p] == '\t' || data[p] == '\r' || data[p] == '\n')) {
+        ++p;
+    }
+    const uint8_t *start = data + p;
+    size_t left = length - p;
+    if (startsWithNoCase(start, left, "@echo") || startsWithNoCase(start, left, "rem ")
+        || startsWithNoCase(start, left, "::")) {
+        return FT::Batch;
+    }
+    if (startsWithNoCase(start, left, "<!doctype html") || startsWithNoCase(start, left, "<html")
+        || startsWithNoCase(start, left, "<script") || startsWithNoCase(start, left, "<hta:")) {
+        return FT::HTML;
+    }
+    return FT::Text;
+}
+
+} // namespace
+
+FileTypeIdentifier::Type FileTypeIdentifier::identify(const uint8_t *data, size_t length)
+{
+    if (!data || length == 0) {
+        return Unknown;
+    }
+
+    const uint8_t first = data[0];
+    for (size_t k = kJumpTable.begin[first]; k < kJumpTable.begin[first + 1]; ++k) {
+        const Magic &m = kMagics[kJumpTable.order[k]];
+        if (length < m.length || memcmp(data, m.bytes, m.length) != 0) {
+            continue;
+        }
+        switch (m.type) {
+        case PE: return refineMZ(data, length);
+        case MachO: return first == 0xca ? refineCafeBabe(data, length) : MachO;
+        case Zip: return refineZip(data, length);
+        default: return m.type;
+        }
+    }
+
+    if (length >= 262 && memcmp(data + 257, "ustar", 5) == 0) {
+        return Tar;
+    }
+    // Readers accept the PDF header anywhere in the first KiB
+    size_t window = length < 1024 ? length : 1024;
+    if (window >= 5 && memmem(data, window, "%PDF-", 5)) {
+        return PDF;
+    }
+    return sniffText(data, length);
+}
+
+bool FileTypeIdentifier::isExecutable(Type type)
+{
+    return type == PE || type == DosExecutable || type == ELF || type == MachO;
+}
+
+const char *FileTypeIdentifier::name(Type type)
+{
+    static const char *const kNames[TypeCount] = {
+        "unknown",
+        "pe", "dos", "elf", "macho", "java-class",
+        "ole", "ooxml", "odf", "pdf", "rtf", "lnk",
+        "script", "batch", "html", "text",
+        "zip", "jar", "apk", "gzip", "bzip2", "xz", "zstd", "7z", "rar", "cab", "tar",
+    };
+    return type < TypeCount ? kNames[type] : kNames[Unknown];
+}
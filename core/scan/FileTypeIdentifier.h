@@ -0,0 +1,41 @@
+#ifndef FILETYPEIDENTIFIER_H
+#define FILETYPEIDENTIFIER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Classifies content from its first bytes, never from the name. Magic
+// numbers at offset 0 are found through a jump table on the first byte
+// that is built at compile time; a few types are then refined (MZ with a
+// PE header, Java class vs. fat Mach-O, zip flavours from the entry names
+// in the first local headers), and the rest falls back to offset magics
+// (tar) and a text sniff for scripts.
+class FileTypeIdentifier
+{
+public:
+    enum Type : uint8_t {
+        Unknown,
+        // executables
+        PE, DosExecutable, ELF, MachO, JavaClass,
+        // documents
+        OLE, OOXML, ODF, PDF, RTF, LNK,
+        // scripts and text
+        Script, Batch, HTML, Text,
+        // archives
+        Zip, JAR, APK, Gzip, Bzip2, Xz, Zstd, SevenZip, Rar, Cab, Tar,
+        TypeCount
+    };
+
+    // Enough for every check; less still works, with less certainty
+    static const size_t kHeaderBytes = 4096;
+
+    static Type identify(const uint8_t *data, size_t length);
+
+    // PE, DOS, ELF and Mach-O images
+    static bool isExecutable(Type type);
+
+    // Short lower-case name stored with scan results, e.g. "pe", "ooxml"
+    static const char *name(Type type);
+};
+
+#endif // FILETYPEIDENTIFIER_H
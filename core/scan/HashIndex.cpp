@@ -0,0 +1,300 @@
+#include "HashIndex.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'S', 'D', 'U', 'I', 'H', 'I', 'X', '1'};
+const uint32_t kVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304;
+const uint32_t kBloomHashes = 8;
+const uint64_t kBloomBitsPerKey = 12;
+const size_t kPage = 4096;
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t keyBytes;
+    uint32_t bucketBits;
+    uint32_t bloomBlockBits;   // log2 of the number of 64-byte blocks
+    uint32_t bloomHashes;
+    uint64_t count;
+    uint64_t bloomOffset;
+    uint64_t bucketsOffset;
+    uint64_t entriesOffset;
+    uint64_t fileSize;
+};
+
+uint64_t alignUp(uint64_t v)
+{
+    return (v + kPage - 1) & ~uint64_t(kPage - 1);
+}
+
+uint64_t loadBigEndian64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+uint64_t load64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+// Leading bits pick the bucket so that buckets follow sort order
+inline uint64_t bucketOf(const uint8_t *key, uint32_t bits)
+{
+    return bits == 0 ? 0 : loadBigEndian64(key) >> (64 - bits);
+}
+
+// Digests are uniform, so disjoint key bytes serve as independent hashes
+inline uint64_t bloomBlockOf(const uint8_t *key, uint32_t blockBits)
+{
+    return blockBits == 0 ? 0 : load64(key + 8) >> (64 - blockBits);
+}
+
+inline uint32_t bloomBit(const uint8_t *key, uint32_t i)
+{
+    uint64_t h = i < 7 ? load64(key + 16) >> (9 * i) : load64(key + 24);
+    return uint32_t(h & 511);
+}
+
+int log2Ceil(uint64_t v)
+{
+    int bits = 0;
+    while ((uint64_t(1) << bits) < v) {
+        ++bits;
+    }
+    return bits;
+}
+
+} // namespace
+
+HashIndex::HashIndex()
+    : map(nullptr)
+    , mapLength(0)
+    , count(0)
+    , bucketBits(0)
+    , bloomBlockBits(0)
+    , bloom(nullptr)
+    , buckets(nullptr)
+    , entries(nullptr)
+{
+}
+
+HashIndex::~HashIndex()
+{
+    close();
+}
+
+bool HashIndex::open(const std::string &path, std::string *error)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = "Cannot open " + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+        if (error) *error = path + " is not a hash index";
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        if (error) *error = "Cannot map " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    // Every bound is checked without overflow, since the file may be
+    // corrupt or crafted
+    const Header *h = static_cast<const Header *>(mapped);
+    uint64_t size = uint64_t(st.st_size);
+    bool valid = memcmp(h->magic, kMagic, sizeof(kMagic)) == 0
+        && h->version == kVersion
+        && h->byteOrder == kByteOrderMark
+        && h->keyBytes == kKeyBytes
+        && h->bloomHashes == kBloomHashes
+        && h->bucketBits <= 32 && h->bloomBlockBits <= 40
+        && h->fileSize == size
+        && h->bloomOffset >= sizeof(Header) && h->bloomOffset % 8 == 0
+        && h->bucketsOffset >= h->bloomOffset && h->bucketsOffset % 4 == 0
+        && h->entriesOffset >= h->bucketsOffset && h->entriesOffset <= size
+        && (uint64_t(64) << h->bloomBlockBits) <= h->bucketsOffset - h->bloomOffset
+        && ((uint64_t(1) << h->bucketBits) + 1) * 4 <= h->entriesOffset - h->bucketsOffset
+        && h->count <= (size - h->entriesOffset) / kKeyBytes;
+
+    // contains() trusts the bucket table to index inside the entries
+    const uint8_t *base = static_cast<const uint8_t *>(mapped);
+    if (valid) {
+        const uint32_t *table = reinterpret_cast<const uint32_t *>(base + h->bucketsOffset);
+        uint64_t slots = (uint64_t(1) << h->bucketBits) + 1;
+        valid = table[0] == 0 && table[slots - 1] == h->count;
+        for (uint64_t i = 1; valid && i < slots; ++i) {
+            valid = table[i] >= table[i - 1];
+        }
+    }
+    if (!valid) {
+        if (error) *error = path + " is not a compatible hash index";
+        munmap(mapped, size_t(st.st_size));
+        return false;
+    }
+
+    map = mapped;
+    mapLength = size_t(st.st_size);
+    count = h->count;
+    bucketBits = h->bucketBits;
+    bloomBlockBits = h->bloomBlockBits;
+    bloom = reinterpret_cast<const uint64_t *>(base + h->bloomOffset);
+    buckets = reinterpret_cast<const uint32_t *>(base + h->bucketsOffset);
+    entries = base + h->entriesOffset;
+
+    // Lookups are random; readahead would only pull in unrelated pages
+    madvise(mapped, mapLength, MADV_RANDOM);
+    return true;
+}
+
+void HashIndex::close()
+{
+    if (map) {
+        munmap(map, mapLength);
+    }
+    map = nullptr;
+    mapLength = 0;
+    count = 0;
+    bloom = nullptr;
+    buckets = nullptr;
+    entries = nullptr;
+}
+
+bool HashIndex::contains(const uint8_t *digest) const
+{
+    if (!map || count == 0) {
+        return false;
+    }
+
+    const uint64_t *block = bloom + bloomBlockOf(digest, bloomBlockBits) * 8;
+    for (uint32_t i = 0; i < kBloomHashes; ++i) {
+        uint32_t bit = bloomBit(digest, i);
+        if (!((block[bit >> 6] >> (bit & 63)) & 1)) {
+            return false;
+        }
+    }
+
+    uint64_t bucket = bucketOf(digest, bucketBits);
+    const uint8_t *first = entries + uint64_t(buckets[bucket]) * kKeyBytes;
+    const uint8_t *last = entries + uint64_t(buckets[bucket + 1]) * kKeyBytes;
+    for (const uint8_t *e = first; e < last; e += kKeyBytes) {
+        int c = memcmp(e, digest, kKeyBytes);
+        if (c == 0) {
+            return true;
+        }
+        if (c > 0) {
+            break;
+        }
+    }
+    return false;
+}
+
+bool HashIndex::build(std::vector<Key> &keys, const std::string &path, std::string *error)
+{
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    if (keys.size() >= (uint64_t(1) << 32)) {
+        if (error) *error = "Too many digests for one index";
+        return false;
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, kMagic, sizeof(kMagic));
+    h.version = kVersion;
+    h.byteOrder = kByteOrderMark;
+    h.keyBytes = kKeyBytes;
+    h.bloomHashes = kBloomHashes;
+    h.count = keys.size();
+    // About two entries per bucket, ~12 Bloom bits per key (under 1% false positives)
+    h.bucketBits = uint32_t(std::max(0, log2Ceil(keys.size()) - 1));
+    h.bloomBlockBits = uint32_t(std::max(0, log2Ceil(keys.size() * kBloomBitsPerKey / 512)));
+    uint64_t bloomBytes = uint64_t(64) << h.bloomBlockBits;
+    uint64_t bucketSlots = (uint64_t(1) << h.bucketBits) + 1;
+    h.bloomOffset = alignUp(sizeof(Header));
+    h.bucketsOffset = alignUp(h.bloomOffset + bloomBytes);
+    h.entriesOffset = alignUp(h.bucketsOffset + bucketSlots * 4);
+    h.fileSize = h.entriesOffset + h.count * kKeyBytes;
+
+    std::vector<uint64_t> bloom(size_t(bloomBytes / 8), 0);
+    std::vector<uint32_t> buckets(size_t(bucketSlots), 0);
+    for (const Key &k : keys) {
+        uint64_t *block = &bloom[size_t(bloomBlockOf(k.data(), h.bloomBlockBits) * 8)];
+        for (uint32_t i = 0; i < kBloomHashes; ++i) {
+            uint32_t bit = bloomBit(k.data(), i);
+            block[bit >> 6] |= uint64_t(1) << (bit & 63);
+        }
+        ++buckets[size_t(bucketOf(k.data(), h.bucketBits)) + 1];
+    }
+    for (size_t b = 1; b < buckets.size(); ++b) {
+        buckets[b] += buckets[b - 1];
+    }
+
+    // Written beside the target and renamed, so readers never see half a file
+    std::string temp = path + ".tmp";
+    FILE *f = fopen(temp.c_str(), "wb");
+    if (!f) {
+        if (error) *error = "Cannot create " + temp + ": " + strerror(errno);
+        return false;
+    }
+    auto writeAt = [f](uint64_t offset, const void *data, size_t length) {
+        return fseeko(f, off_t(offset), SEEK_SET) == 0 && fwrite(data, 1, length, f) == length;
+    };
+    bool ok = writeAt(0, &h, sizeof(h))
+        && writeAt(h.bloomOffset, bloom.data(), bloom.size() * 8)
+        && writeAt(h.bucketsOffset, buckets.data(), buckets.size() * 4)
+        && (keys.empty() || writeAt(h.entriesOffset, keys.data(), keys.size() * kKeyBytes));
+    // The entries section may be empty; make sure the file reaches fileSize
+    ok = ok && fflush(f) == 0 && ftruncate(fileno(f), off_t(h.fileSize)) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        if (error) *error = "Cannot write " + path + ": " + strerror(errno);
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool HashIndex::parseHex(const char *text, size_t length, Key *key)
+{
+    if (length != kKeyBytes * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < kKeyBytes; ++i) {
+        int v = 0;
+        for (int n = 0; n < 2; ++n) {
+            char c = text[i * 2 + n];
+            int d = c >= '0' && c <= '9' ? c - '0'
+                  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                  : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (d < 0) {
+                return false;
+            }
+            v = v << 4 | d;
+        }
+        (*key)[i] = uint8_t(v);
+    }
+    return true;
+}
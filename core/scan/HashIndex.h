@@ -0,0 +1,64 @@
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read-only set of SHA-256 digests (known-bad reputation data), memory
+// mapped from a file built offline by tools/hashindex-build.
+//
+// File layout, every section page aligned:
+//   header
+//   blocked Bloom filter: 512-bit blocks, 8 bits set per key
+//   bucket table: (2^bucketBits + 1) uint32 start indices
+//   entries: the digests, sorted and unique, 32 bytes each
+//
+// A lookup touches one Bloom cache line and, only when that passes, two
+// adjacent bucket slots and a few entries of the bucket (digests are
+// uniform, so buckets are keyed on the leading bits directly). Opening
+// maps the file and checks the header and bucket table; nothing is read
+// into the heap and resident memory is whatever the page cache keeps.
+class HashIndex
+{
+public:
+    static const size_t kKeyBytes = 32;
+    typedef std::array<uint8_t, kKeyBytes> Key;
+
+    HashIndex();
+    ~HashIndex();
+
+    bool open(const std::string &path, std::string *error = nullptr);
+    void close();
+    bool isOpen() const { return map != nullptr; }
+
+    uint64_t size() const { return count; }
+    size_t fileSize() const { return mapLength; }
+
+    // No allocation, safe to call from any number of threads
+    bool contains(const uint8_t *digest) const;
+
+    // Sorts and deduplicates keys in place, then writes path atomically
+    static bool build(std::vector<Key> &keys, const std::string &path, std::string *error = nullptr);
+
+    // 64 hex digits, either case
+    static bool parseHex(const char *text, size_t length, Key *key);
+
+private:
+    void *map;
+    size_t mapLength;
+    uint64_t count;
+    uint32_t bucketBits;
+    uint32_t bloomBlockBits;
+    const uint64_t *bloom;
+    const uint32_t *buckets;
+    const uint8_t *entries;
+
+    // non-copyable
+    HashIndex(const HashIndex &) = delete;
+    HashIndex &operator=(const HashIndex &) = delete;
+};
+
+#endif // HASHINDEX_H
@@ -0,0 +1,651 @@
+#include "NtfsVolume.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+const size_t kChunkBytes = 1 << 20;
+const size_t kSectorStride = 512;          // fixups protect every 512 bytes, whatever the sector size
+const uint64_t kReferenceMask = 0xFFFFFFFFFFFFULL;
+const uint64_t kRootRecord = 5;
+const uint64_t kFirstUserRecord = 16;
+const size_t kMaxDepth = 256;
+const char kOrphans[] = "$OrphanFiles";
+
+// Record header flags
+const uint16_t kInUse = 0x0001;
+const uint16_t kDirectoryRecord = 0x0002;
+
+// Attribute types
+const uint32_t kStandardInformation = 0x10;
+const uint32_t kAttributeList = 0x20;
+const uint32_t kFileName = 0x30;
+const uint32_t kData = 0x80;
+const uint32_t kEnd = 0xFFFFFFFF;
+
+// Attribute flags
+const uint16_t kCompressionMask = 0x00FF;
+const uint16_t kEncrypted = 0x4000;
+
+// FILETIME: 100 ns ticks since 1601
+int64_t filetimeNs(uint64_t ticks)
+{
+    const int64_t epoch = 116444736000000000LL;
+    if (ticks == 0 || ticks > uint64_t(LLONG_MAX)) {
+        return 0;
+    }
+    int64_t since = int64_t(ticks) - epoch;
+    return since > LLONG_MAX / 100 || since < LLONG_MIN / 100 ? 0 : since * 100;
+}
+
+// Win32 names over POSIX ones over DOS 8.3 ones
+uint8_t nameRank(uint8_t space)
+{
+    switch (space) {
+    case 1:
+    case 3: return 3;
+    case 0: return 2;
+    case 2: return 1;
+    }
+    return 0;
+}
+
+std::string join(const std::string &dir, const std::string &name)
+{
+    return dir.empty() ? name : dir + '/' + name;
+}
+
+} // namespace
+
+// Resident values arrive with the stream; non-resident ones are read
+// through the runs as the scanner pulls
+class NtfsVolume::DataStream : public ArchiveWalker::Source
+{
+public:
+    DataStream(const NtfsVolume &volume, const Stream &stream, std::vector<uint8_t> value)
+        : volume(volume)
+        , stream(stream)
+        , value(std::move(value))
+        , validSize(std::min(stream.validSize, stream.size))
+        , pos(0)
+    {
+    }
+
+    long read(uint8_t *buffer, size_t capacity, std::string *error) override
+    {
+        if (pos >= stream.size) {
+            return 0;
+        }
+        size_t want = size_t(std::min<uint64_t>(capacity, stream.size - pos));
+        if (pos >= validSize) {
+            memset(buffer, 0, want);
+        } else {
+            want = size_t(std::min<uint64_t>(want, validSize - pos));
+            if (stream.resident) {
+                memcpy(buffer, value.data() + pos, want);
+            } else if (!volume.readRuns(stream.runs, pos, buffer, want, error)) {
+                return -1;
+            }
+        }
+        pos += want;
+        return long(want);
+    }
+
+private:
+    const NtfsVolume &volume;
+    const Stream &stream;
+    std::vector<uint8_t> value;
+    uint64_t validSize;
+    uint64_t pos;
+};
+
+bool NtfsVolume::detect(const uint8_t *boot)
+{
+    return boot[510] == 0x55 && boot[511] == 0xAA && memcmp(boot + 3, "NTFS    ", 8) == 0;
+}
+
+NtfsVolume::NtfsVolume()
+    : clusterBytes(0)
+    , recordBytes(0)
+    , totalClusters(0)
+    , mftBytes(0)
+{
+}
+
+bool NtfsVolume::applyFixups(uint8_t *record, size_t bytes)
+{
+    size_t offset = le16(record + 4);
+    size_t count = le16(record + 6);
+    if (count < 2 || (count - 1) * kSectorStride != bytes || offset + count * 2 > bytes) {
+        return false;
+    }
+    const uint8_t *array = record + offset;
+    for (size_t i = 1; i < count; ++i) {
+        uint8_t *tail = record + i * kSectorStride - 2;
+        if (tail[0] != array[0] || tail[1] != array[1]) {
+            return false;  // torn write
+        }
+        tail[0] = array[2 * i];
+        tail[1] = array[2 * i + 1];
+    }
+    return true;
+}
+
+template <typename Visit>
+void NtfsVolume::attributes(const uint8_t *record, size_t bytes, Visit visit)
+{
+    size_t used = std::min<size_t>(le32(record + 24), bytes);
+    for (size_t off = le16(record + 20); off + 16 <= used;) {
+        const uint8_t *a = record + off;
+        uint32_t type = le32(a);
+        uint32_t length = le32(a + 4);
+        if (type == kEnd || length < 16 || length > used - off) {
+            break;
+        }
+        visit(type, a, length, uint32_t(off));
+        off += length;
+    }
+}
+
+bool NtfsVolume::load(std::string *error)
+{
+    uint8_t boot[512];
+    if (!readAt(0, boot, sizeof(boot), error)) {
+        return false;
+    }
+    uint32_t sectorBytes = le16(boot + 11);
+    uint8_t perCluster = boot[13];
+    int8_t perRecord = int8_t(boot[64]);
+    if (sectorBytes < 256 || sectorBytes > 4096 || (sectorBytes & (sectorBytes - 1)) != 0 || perCluster == 0
+        || (perCluster > 0x80 && 256 - perCluster > 21)) {
+        if (error) *error = "Bad NTFS geometry";
+        return false;
+    }
+    clusterBytes = perCluster <= 0x80 ? sectorBytes * perCluster : 1u << (256 - perCluster);
+    uint64_t records = perRecord > 0 ? uint64_t(perRecord) * clusterBytes
+                     : perRecord < 0 && perRecord > -31 ? uint64_t(1) << -perRecord : 0;
+    if (records < 512 || records > 65536 || records % kSectorStride != 0) {
+        if (error) *error = "Bad NTFS record size";
+        return false;
+    }
+    recordBytes = uint32_t(records);
+    totalClusters = le64(boot + 40) * sectorBytes / clusterBytes;
+    if (totalClusters * clusterBytes > length) {
+        if (error) *error = "NTFS volume extends past the end of the device";
+        return false;
+    }
+    uint64_t mftLcn = le64(boot + 48);
+    if (mftLcn >= totalClusters) {
+        if (error) *error = "Bad $MFT location";
+        return false;
+    }
+
+    // Record 0 describes the whole table, itself included
+    mftRuns = {{0, int64_t(mftLcn), (recordBytes + clusterBytes - 1) / clusterBytes}};
+    std::vector<uint8_t> record;
+    std::string e;
+    if (!readRecord(0, &record, &e)) {
+        if (error) *error = "Cannot read $MFT: " + e;
+        return false;
+    }
+    std::vector<Run> runs;
+    bool ok = true;
+    mftBytes = 0;
+    attributes(record.data(), record.size(), [&](uint32_t type, const uint8_t *a, uint32_t length, uint32_t) {
+        if (type != kData || !a[8] || a[9] != 0 || length < 64) {
+            return;
+        }
+        uint64_t vcn = le64(a + 16);
+        if (vcn == 0) {
+            mftBytes = le64(a + 48);
+        }
+        size_t runsOffset = le16(a + 32);
+        ok = ok && runsOffset < length && decodeRuns(a + runsOffset, length - runsOffset, vcn, &runs);
+    });
+    if (!ok || runs.empty() || mftBytes < kFirstUserRecord * recordBytes || mftBytes > totalClusters * clusterBytes) {
+        if (error) *error = "Bad $MFT data runs";
+        return false;
+    }
+    mftRuns = std::move(runs);
+    std::sort(mftRuns.begin(), mftRuns.end(), [](const Run &a, const Run &b) { return a.vcn < b.vcn; });
+    if (!addMftExtents(record, error)) {
+        return false;
+    }
+
+    // list() allocates per record, so the size must be backed by clusters
+    // on disk, mapped without a gap from the start of the table
+    uint64_t mapped = 0;
+    for (size_t i = 0; i < mftRuns.size() && mapped * clusterBytes < mftBytes; ++i) {
+        if (mftRuns[i].vcn > mapped || mftRuns[i].lcn < 0) {
+            break;
+        }
+        mapped = std::max(mapped, mftRuns[i].vcn + mftRuns[i].clusters);
+    }
+    if (mapped * clusterBytes < mftBytes) {
+        if (error) *error = "$MFT is larger than its data runs";
+        return false;
+    }
+    return true;
+}
+
+// A fragmented $MFT keeps the rest of its runs in extension records,
+// named by the attribute list of record 0
+bool NtfsVolume::addMftExtents(const std::vector<uint8_t> &base, std::string *error)
+{
+    std::vector<uint8_t> list;
+    bool ok = true;
+    attributes(base.data(), base.size(), [&](uint32_t type, const uint8_t *a, uint32_t length, uint32_t) {
+        if (type != kAttributeList) {
+            return;
+        }
+        if (!a[8]) {
+            uint32_t bytes = le32(a + 16);
+            size_t offset = le16(a + 20);
+            ok = offset + bytes <= length;
+            if (ok) {
+                list.assign(a + offset, a + offset + bytes);
+            }
+            return;
+        }
+        std::vector<Run> runs;
+        size_t runsOffset = length >= 64 ? le16(a + 32) : length;
+        uint64_t bytes = length >= 64 ? le64(a + 48) : 0;
+        ok = runsOffset < length && bytes <= kChunkBytes && decodeRuns(a + runsOffset, length - runsOffset, 0, &runs);
+        if (ok) {
+            list.resize(size_t(bytes));
+            ok = readRuns(runs, 0, list.data(), list.size(), nullptr);
+        }
+    });
+    if (!ok) {
+        if (error) *error = "Bad $MFT attribute list";
+        return false;
+    }
+
+    std::vector<uint64_t> done;
+    for (size_t off = 0; off + 26 <= list.size();) {
+        const uint8_t *entry = &list[off];
+        uint32_t listed = le32(entry);
+        uint16_t entryBytes = le16(entry + 4);
+        if (entryBytes < 26 || off + entryBytes > list.size()) {
+            break;
+        }
+        off += entryBytes;
+        uint64_t number = le64(entry + 16) & kReferenceMask;
+        if (listed != kData || entry[6] != 0 || number == 0
+            || std::find(done.begin(), done.end(), number) != done.end()) {
+            continue;
+        }
+        done.push_back(number);
+        std::vector<uint8_t> record;
+        std::string e;
+        if (!readRecord(number, &record, &e)) {
+            if (error) *error = "Cannot read $MFT extension record " + std::to_string(number) + ": " + e;
+            return false;
+        }
+        attributes(record.data(), record.size(), [&](uint32_t type, const uint8_t *a, uint32_t length, uint32_t) {
+            if (type != kData || !a[8] || a[9] != 0 || length < 64) {
+                return;
+            }
+            size_t runsOffset = le16(a + 32);
+            ok = ok && runsOffset < length && decodeRuns(a + runsOffset, length - runsOffset, le64(a + 16), &mftRuns);
+        });
+        if (!ok) {
+            if (error) *error = "Bad $MFT data runs";
+            return false;
+        }
+        std::sort(mftRuns.begin(), mftRuns.end(), [](const Run &a, const Run &b) { return a.vcn < b.vcn; });
+    }
+    return true;
+}
+
+bool NtfsVolume::decodeRuns(const uint8_t *data, size_t bytes, uint64_t vcn, std::vector<Run> *runs) const
+{
+    int64_t lcn = 0;
+    for (size_t i = 0; i < bytes && data[i] != 0;) {
+        unsigned lengthBytes = data[i] & 0x0F;
+        unsigned offsetBytes = data[i] >> 4;
+        if (lengthBytes == 0 || lengthBytes > 8 || offsetBytes > 8 || i + 1 + lengthBytes + offsetBytes > bytes) {
+            return false;
+        }
+        const uint8_t *p = data + i + 1;
+        uint64_t clusters = 0;
+        for (unsigned k = 0; k < lengthBytes; ++k) {
+            clusters |= uint64_t(p[k]) << (8 * k);
+        }
+        uint64_t delta = 0;
+        for (unsigned k = 0; k < offsetBytes; ++k) {
+            delta |= uint64_t(p[lengthBytes + k]) << (8 * k);
+        }
+        // The offset is signed, relative to the previous run
+        if (offsetBytes > 0 && offsetBytes < 8 && (delta >> (8 * offsetBytes - 1)) & 1) {
+            delta |= ~uint64_t(0) << (8 * offsetBytes);
+        }
+        i += 1 + lengthBytes + offsetBytes;
+        if (clusters == 0 || clusters > totalClusters) {
+            return false;
+        }
+        if (offsetBytes == 0) {
+            runs->push_back({vcn, -1, clusters});
+        } else {
+            lcn = int64_t(uint64_t(lcn) + delta);
+            if (lcn < 0 || uint64_t(lcn) > totalClusters - clusters) {
+                return false;
+            }
+            runs->push_back({vcn, lcn, clusters});
+        }
+        vcn += clusters;
+    }
+    return true;
+}
+
+bool NtfsVolume::readRuns(const std::vector<Run> &runs, uint64_t offset, uint8_t *buffer, size_t bytes,
+                          std::string *error) const
+{
+    while (bytes > 0) {
+        uint64_t vcn = offset / clusterBytes;
+        auto it = std::upper_bound(runs.begin(), runs.end(), vcn,
+                                   [](uint64_t v, const Run &run) { return v < run.vcn; });
+        if (it == runs.begin() || vcn - std::prev(it)->vcn >= std::prev(it)->clusters) {
+            if (error) *error = "Data runs end at byte " + std::to_string(offset);
+            return false;
+        }
+        const Run &run = *std::prev(it);
+        uint64_t within = offset - run.vcn * clusterBytes;
+        size_t n = size_t(std::min<uint64_t>(bytes, run.clusters * clusterBytes - within));
+        if (run.lcn < 0) {
+            memset(buffer, 0, n);
+        } else if (!readAt(uint64_t(run.lcn) * clusterBytes + within, buffer, n, error)) {
+            return false;
+        }
+        buffer += n;
+        offset += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+// 0 when sparse or past the runs
+uint64_t NtfsVolume::deviceOffset(const std::vector<Run> &runs, uint64_t offset) const
+{
+    uint64_t vcn = offset / clusterBytes;
+    for (const Run &run : runs) {
+        if (vcn >= run.vcn && vcn - run.vcn < run.clusters) {
+            return run.lcn < 0 ? 0 : uint64_t(run.lcn) * clusterBytes + (offset - run.vcn * clusterBytes);
+        }
+    }
+    return 0;
+}
+
+bool NtfsVolume::readRecord(uint64_t number, std::vector<uint8_t> *record, std::string *error) const
+{
+    record->resize(recordBytes);
+    if (!readRuns(mftRuns, number * recordBytes, record->data(), recordBytes, error)) {
+        return false;
+    }
+    if (memcmp(record->data(), "FILE", 4) != 0 || !applyFixups(record->data(), recordBytes)) {
+        if (error) *error = "Bad MFT record " + std::to_string(number);
+        return false;
+    }
+    return true;
+}
+
+void NtfsVolume::parseRecord(const uint8_t *record, uint64_t number, std::vector<Record> &records)
+{
+    uint16_t flags = le16(record + 22);
+    if (!(flags & kInUse)) {
+        return;
+    }
+    // Extension records hold attributes that did not fit in their base
+    // (the reference keeps its sequence number, so even record 0's are non-zero)
+    uint64_t base = le64(record + 32);
+    uint64_t owner = base ? base & kReferenceMask : number;
+    if (owner >= records.size()) {
+        return;
+    }
+    Record &r = records[owner];
+    if (!base) {
+        r.inUse = true;
+        r.directory = flags & kDirectoryRecord;
+        r.sequence = le16(record + 16);
+        if (r.directory) {
+            ++directoryCount;
+        }
+    }
+
+    attributes(record, recordBytes, [&](uint32_t type, const uint8_t *a, uint32_t length, uint32_t offset) {
+        bool resident = !a[8];
+        const uint8_t *value = nullptr;
+        uint32_t valueBytes = 0;
+        if (resident) {
+            valueBytes = le32(a + 16);
+            uint32_t valueOffset = le16(a + 20);
+            if (valueOffset > length || valueBytes > length - valueOffset) {
+                return;
+            }
+            value = a + valueOffset;
+        } else if (length < 64) {
+            return;
+        }
+
+        if (type == kStandardInformation && resident && valueBytes >= 16) {
+            r.mtimeNs = filetimeNs(le64(value + 8));
+        } else if (type == kFileName && resident && valueBytes >= 66) {
+            uint8_t units = value[64];
+            uint8_t rank = nameRank(value[65]);
+            if (rank > r.nameRank && 66 + 2 * size_t(units) <= valueBytes) {
+                r.name = fromUtf16(value + 66, units);
+                r.nameRank = rank;
+                r.parent = le64(value) & kReferenceMask;
+                r.parentSequence = le16(value + 6);
+            }
+        } else if (type == kData) {
+            size_t nameOffset = le16(a + 10);
+            size_t nameUnits = a[9];
+            if (nameOffset + 2 * nameUnits > length) {
+                return;
+            }
+            std::string name = fromUtf16(a + nameOffset, nameUnits);
+            uint32_t id = r.firstStream;
+            while (id != UINT32_MAX && streams[id].name != name) {
+                id = streams[id].next;
+            }
+            if (id == UINT32_MAX) {
+                id = uint32_t(streams.size());
+                streams.emplace_back();
+                streams[id].owner = owner;
+                streams[id].name = std::move(name);
+                streams[id].next = r.firstStream;
+                r.firstStream = id;
+            }
+            Stream &s = streams[id];
+            if (resident) {
+                s.resident = true;
+                s.record = number;
+                s.attribute = offset;
+                s.size = valueBytes;
+                s.validSize = valueBytes;
+                return;
+            }
+            // A long run list is split over several records, each extent
+            // starting at its own VCN; only the first carries the sizes
+            uint64_t vcn = le64(a + 16);
+            if (vcn == 0) {
+                s.size = le64(a + 48);
+                s.validSize = le64(a + 56);
+                s.flags = le16(a + 12);
+            }
+            size_t runsOffset = le16(a + 32);
+            if (runsOffset >= length || !decodeRuns(a + runsOffset, length - runsOffset, vcn, &s.runs)) {
+                s.broken = true;
+            }
+        }
+    });
+}
+
+bool NtfsVolume::list(std::vector<File> *files, std::string *error)
+{
+    files->clear();
+    streams.clear();
+    directoryCount = 0;
+    unreadableCount = 0;
+
+    // load() made sure the runs map all of it
+    uint64_t count = mftBytes / recordBytes;
+    uint64_t tableBytes = count * recordBytes;
+    std::vector<Record> records(static_cast<size_t>(count));
+    std::vector<uint8_t> chunk(kChunkBytes / recordBytes * recordBytes);
+    for (uint64_t offset = 0; offset < tableBytes; offset += chunk.size()) {
+        size_t n = size_t(std::min<uint64_t>(chunk.size(), tableBytes - offset));
+        std::string e;
+        if (!readRuns(mftRuns, offset, chunk.data(), n, &e)) {
+            if (offset == 0) {
+                if (error) *error = "Cannot read the MFT: " + e;
+                return false;
+            }
+            unreadableCount += n / recordBytes;
+            continue;
+        }
+        for (size_t i = 0; i < n; i += recordBytes) {
+            uint8_t *record = &chunk[i];
+            // Never used records are zeros; "BAAD" marks a failed check
+            if (memcmp(record, "FILE", 4) != 0) {
+                continue;
+            }
+            if (!applyFixups(record, recordBytes)) {
+                ++unreadableCount;
+                continue;
+            }
+            parseRecord(record, (offset + i) / recordBytes, records);
+        }
+    }
+
+    std::unordered_map<uint64_t, Directory> dirs;
+    for (uint32_t id = 0; id < streams.size(); ++id) {
+        Stream &s = streams[id];
+        const Record &r = records[s.owner];
+        // An unnamed stream on a directory would be a damaged record
+        if (!r.inUse || s.owner < kFirstUserRecord || (r.directory && s.name.empty())) {
+            continue;
+        }
+        std::sort(s.runs.begin(), s.runs.end(), [](const Run &a, const Run &b) { return a.vcn < b.vcn; });
+        // The runs must cover the size, or a damaged record would stream zeros without end
+        uint64_t mapped = s.runs.empty() ? 0 : (s.runs.back().vcn + s.runs.back().clusters) * clusterBytes;
+        if (!s.resident && s.size > mapped) {
+            s.broken = true;
+        }
+
+        bool system = false;
+        std::string path;
+        if (r.directory) {
+            path = directoryPath(s.owner, r.sequence, records, dirs, &system);
+        } else {
+            std::string parent = directoryPath(r.parent, r.parentSequence, records, dirs, &system);
+            path = join(parent, r.name.empty() ? std::to_string(s.owner) : r.name);
+        }
+        if (system) {
+            continue;
+        }
+        if (!s.name.empty()) {
+            path += ':' + s.name;
+        }
+
+        File file;
+        file.path = std::move(path);
+        file.size = s.size;
+        file.mtimeNs = r.mtimeNs;
+        file.inode = s.owner;
+        file.start = id;
+        file.validSize = std::min(s.validSize, s.size);
+        if (s.resident) {
+            file.diskOffset = deviceOffset(mftRuns, s.record * recordBytes);
+        } else {
+            for (const Run &run : s.runs) {
+                if (run.lcn >= 0) {
+                    file.diskOffset = uint64_t(run.lcn) * clusterBytes;
+                    break;
+                }
+            }
+        }
+        files->push_back(std::move(file));
+    }
+
+    std::stable_sort(files->begin(), files->end(),
+                     [](const File &a, const File &b) { return a.diskOffset < b.diskOffset; });
+    return true;
+}
+
+// The path of a directory record, "" for the root; the chain up to a known
+// directory is memoised on the way back down
+std::string NtfsVolume::directoryPath(uint64_t number, uint16_t sequence, const std::vector<Record> &records,
+                                      std::unordered_map<uint64_t, Directory> &dirs, bool *system) const
+{
+    std::vector<uint64_t> chain;
+    Directory top = {false, std::string()};
+    while (number != kRootRecord) {
+        if (number < kFirstUserRecord) {
+            top.system = true;
+            break;
+        }
+        // Gone, reused (the sequence number moved on), looping (each
+        // directory of the loop is kept once) or too deep
+        const Record *r = number < records.size() ? &records[number] : nullptr;
+        if (!r || !r->inUse || !r->directory || (sequence != 0 && r->sequence != sequence)
+            || chain.size() >= kMaxDepth || std::find(chain.begin(), chain.end(), number) != chain.end()) {
+            top.path = kOrphans;
+            break;
+        }
+        auto known = dirs.find(number);
+        if (known != dirs.end()) {
+            top = known->second;
+            break;
+        }
+        chain.push_back(number);
+        sequence = r->parentSequence;
+        number = r->parent;
+    }
+    for (size_t i = chain.size(); i-- > 0;) {
+        const Record &r = records[chain[i]];
+        top.path = join(top.path, r.name.empty() ? std::to_string(chain[i]) : r.name);
+        dirs.emplace(chain[i], top);
+    }
+    *system = top.system;
+    return top.path;
+}
+
+std::unique_ptr<ArchiveWalker::Source> NtfsVolume::stream(const File &file, std::string *error) const
+{
+    if (file.start >= streams.size()) {
+        if (error) *error = "Unknown stream " + file.path;
+        return nullptr;
+    }
+    const Stream &s = streams[file.start];
+    if (s.flags & kEncrypted) {
+        if (error) *error = "Encrypted (EFS) NTFS streams cannot be read";
+        return nullptr;
+    }
+    if (s.flags & kCompressionMask) {
+        if (error) *error = "Compressed NTFS streams are not supported";
+        return nullptr;
+    }
+    if (s.broken) {
+        if (error) *error = "Bad data runs";
+        return nullptr;
+    }
+    std::vector<uint8_t> value;
+    if (s.resident) {
+        std::vector<uint8_t> record;
+        if (!readRecord(s.record, &record, error)) {
+            return nullptr;
+        }
+        const uint8_t *a = record.data() + s.attribute;
+        bool ok = s.attribute + 24 <= recordBytes && le32(a) == kData && !a[8];
+        uint32_t valueOffset = ok ? le16(a + 20) : 0;
+        if (!ok || le32(a + 16) != s.size || s.attribute + uint64_t(valueOffset) + s.size > recordBytes) {
+            if (error) *error = "MFT record " + std::to_string(s.record) + " changed";
+            return nullptr;
+        }
+        value.assign(a + valueOffset, a + valueOffset + s.size);
+    }
+    return std::unique_ptr<ArchiveWalker::Source>(new DataStream(*this, s, std::move(value)));
+}
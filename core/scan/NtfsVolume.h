@@ -0,0 +1,99 @@
+#ifndef NTFSVOLUME_H
+#define NTFSVOLUME_H
+
+#include "VolumeReader.h"
+#include <unordered_map>
+
+// NTFS, read in process from the Master File Table rather than the
+// directory indexes. $MFT's own data runs come from record 0 (and the
+// extension records its attribute list names); list() then reads the
+// whole table front to back in large chunks and folds extension records
+// into their base records, so a volume of a million files is enumerated
+// in one sequential pass. Paths are rebuilt from the parent references in
+// the file name attributes (Win32 names over DOS ones).
+//
+// Every $DATA stream is listed: the unnamed one under the file's path,
+// alternate data streams as "path:name". Files whose parent directory is
+// gone or reused go under "$OrphanFiles"; the metafiles and everything
+// under $Extend are left out. Resident data is read back from its record,
+// non-resident data through its runs, sparse runs as zeros. Compressed
+// and encrypted streams are listed but cannot be read.
+class NtfsVolume : public VolumeReader
+{
+public:
+    // An NTFS boot sector, 512 bytes
+    static bool detect(const uint8_t *boot);
+
+    NtfsVolume();
+
+    const char *format() const override { return "NTFS"; }
+    bool list(std::vector<File> *files, std::string *error = nullptr) override;
+    // Streams from the last list()
+    std::unique_ptr<ArchiveWalker::Source> stream(const File &file, std::string *error = nullptr) const override;
+
+protected:
+    bool load(std::string *error) override;
+
+private:
+    class DataStream;
+
+    struct Run {
+        uint64_t vcn;
+        int64_t lcn;        // -1 for a sparse run
+        uint64_t clusters;
+    };
+
+    struct Stream {
+        uint64_t owner = 0;         // base record
+        uint64_t record = 0;        // holding the resident value
+        uint32_t attribute = 0;     // its offset in that record
+        uint32_t next = UINT32_MAX; // the owner's next stream
+        std::string name;
+        uint64_t size = 0;
+        uint64_t validSize = 0;
+        uint16_t flags = 0;
+        bool resident = false;
+        bool broken = false;
+        std::vector<Run> runs;
+    };
+
+    struct Record {
+        std::string name;
+        uint64_t parent = 0;
+        uint16_t parentSequence = 0;
+        uint16_t sequence = 0;
+        uint8_t nameRank = 0;       // 0: no name yet
+        bool inUse = false;
+        bool directory = false;
+        int64_t mtimeNs = 0;
+        uint32_t firstStream = UINT32_MAX;
+    };
+
+    struct Directory {
+        bool system;        // a metafile, or below one
+        std::string path;
+    };
+
+    uint32_t clusterBytes;
+    uint32_t recordBytes;
+    uint64_t totalClusters;
+    uint64_t mftBytes;
+    std::vector<Run> mftRuns;
+    std::vector<Stream> streams;
+
+    static bool applyFixups(uint8_t *record, size_t bytes);
+    template <typename Visit>
+    static void attributes(const uint8_t *record, size_t bytes, Visit visit);
+
+    bool readRuns(const std::vector<Run> &runs, uint64_t offset, uint8_t *buffer, size_t bytes,
+                  std::string *error) const;
+    uint64_t deviceOffset(const std::vector<Run> &runs, uint64_t offset) const;
+    bool decodeRuns(const uint8_t *data, size_t bytes, uint64_t vcn, std::vector<Run> *runs) const;
+    bool readRecord(uint64_t number, std::vector<uint8_t> *record, std::string *error) const;
+    bool addMftExtents(const std::vector<uint8_t> &base, std::string *error);
+    void parseRecord(const uint8_t *record, uint64_t number, std::vector<Record> &records);
+    std::string directoryPath(uint64_t number, uint16_t sequence, const std::vector<Record> &records,
+                              std::unordered_map<uint64_t, Directory> &dirs, bool *system) const;
+};
+
+#endif // NTFSVOLUME_H
@@ -0,0 +1,972 @@
+#include "RuleCompiler.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+const uint32_t kMaxJump = 1u << 20;
+
+int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool isIdentifierChar(char c)
+{
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+std::string toHex(const std::string &bytes, bool wide)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    for (unsigned char b : bytes) {
+        hex += digits[b >> 4];
+        hex += digits[b & 15];
+        if (wide) {
+            hex += "00";
+        }
+    }
+    return hex;
+}
+
+} // namespace
+
+RuleCompiler::RuleCompiler(RuleSet &out)
+    : out(out)
+    , pos(0)
+    , line(1)
+    , ruleIndex(0)
+    , depth(0)
+    , maxDepth(0)
+{
+}
+
+bool RuleCompiler::compile(const std::string &text, std::string *error)
+{
+    source = text;
+    pos = 0;
+    line = 1;
+    failure.clear();
+
+    bool ok = advance();
+    while (ok && current.type != End) {
+        ok = parseRule();
+    }
+    if (!ok) {
+        if (error) *error = failure;
+        return false;
+    }
+    return true;
+}
+
+bool RuleCompiler::fail(const std::string &message)
+{
+    if (failure.empty()) {
+        failure = "line " + std::to_string(current.line) + ": " + message;
+    }
+    return false;
+}
+
+// Lexer. hexValue: a '{' starts a hex string (right after '=' in strings:)
+bool RuleCompiler::advance(bool hexValue)
+{
+    // Whitespace and comments
+    for (;;) {
+        while (pos < source.size() && std::isspace(static_cast<unsigned char>(source[pos]))) {
+            line += source[pos] == '\n';
+            ++pos;
+        }
+        if (source.compare(pos, 2, "//") == 0) {
+            while (pos < source.size() && source[pos] != '\n') {
+                ++pos;
+            }
+            continue;
+        }
+        if (source.compare(pos, 2, "/*") == 0) {
+            size_t end = source.find("*/", pos + 2);
+            if (end == std::string::npos) {
+                current.line = line;
+                return fail("unterminated comment");
+            }
+            for (size_t i = pos; i < end; ++i) {
+                line += source[i] == '\n';
+            }
+            pos = end + 2;
+            continue;
+        }
+        break;
+    }
+
+    current = Token();
+    current.line = line;
+    if (pos >= source.size()) {
+        return true;
+    }
+
+    char c = source[pos];
+    if (hexValue && c == '{') {
+        size_t end = source.find('}', pos);
+        if (end == std::string::npos) {
+            return fail("unterminated hex string");
+        }
+        current.type = Hex;
+        current.text = source.substr(pos + 1, end - pos - 1);
+        for (char h : current.text) {
+            line += h == '\n';
+        }
+        pos = end + 1;
+        return true;
+    }
+
+    if (c == '"') {
+        current.type = Text;
+        ++pos;
+        for (;;) {
+            if (pos >= source.size() || source[pos] == '\n') {
+                return fail("unterminated string");
+            }
+            char s = source[pos++];
+            if (s == '"') {
+                break;
+            }
+            if (s != '\\') {
+                current.text += s;
+                continue;
+            }
+            if (pos >= source.size()) {
+                return fail("unterminated string");
+            }
+            char e = source[pos++];
+            switch (e) {
+            case 'n': current.text += '\n'; break;
+            case 'r': current.text += '\r'; break;
+            case 't': current.text += '\t'; break;
+            case '\\': current.text += '\\'; break;
+            case '"': current.text += '"'; break;
+            case 'x': {
+                int hi = pos < source.size() ? hexDigit(source[pos]) : -1;
+                int lo = pos + 1 < source.size() ? hexDigit(source[pos + 1]) : -1;
+                if (hi < 0 || lo < 0) {
+                    return fail("invalid \\x escape");
+                }
+                current.text += char(hi << 4 | lo);
+                pos += 2;
+                break;
+            }
+            default:
+                return fail(std::string("unknown escape \\") + e);
+            }
+        }
+        return true;
+    }
+
+    if (c == '$' || c == '#' || c == '@') {
+        current.type = c == '$' ? StringRef : c == '#' ? CountRef : OffsetRef;
+        ++pos;
+        while (pos < source.size() && isIdentifierChar(source[pos])) {
+            current.text += source[pos++];
+        }
+        if (c == '$' && pos < source.size() && source[pos] == '*') {
+            current.wildcard = true;
+            ++pos;
+        }
+        return true;
+    }
+
+    if (std::isdigit(static_cast<unsigned char>(c))) {
+        current.type = Number;
+        uint64_t value = 0;
+        bool hex = source.compare(pos, 2, "0x") == 0 || source.compare(pos, 2, "0X") == 0;
+        if (hex) {
+            pos += 2;
+            size_t start = pos;
+            while (pos < source.size() && hexDigit(source[pos]) >= 0) {
+                value = value * 16 + uint64_t(hexDigit(source[pos++]));
+            }
+            if (pos == start || pos - start > 15) {
+                return fail("invalid hex number");
+            }
+        } else {
+            size_t start = pos;
+            while (pos < source.size() && std::isdigit(static_cast<unsigned char>(source[pos]))) {
+                value = value * 10 + uint64_t(source[pos++] - '0');
+            }
+            if (pos - start > 18) {
+                return fail("number too large");
+            }
+            int shift = source.compare(pos, 2, "KB") == 0 ? 10 : source.compare(pos, 2, "MB") == 0 ? 20 : 0;
+            if (value > uint64_t(INT64_MAX) >> shift) {
+                return fail("number too large");
+            }
+            value <<= shift;
+            pos += shift ? 2 : 0;
+        }
+        if (pos < source.size() && isIdentifierChar(source[pos])) {
+            return fail("invalid number");
+        }
+        current.number = int64_t(value);
+        return true;
+    }
+
+    if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+        current.type = Identifier;
+        while (pos < source.size() && isIdentifierChar(source[pos])) {
+            current.text += source[pos++];
+        }
+        return true;
+    }
+
+    static const char *const twoChar[] = {"..", "<=", ">=", "==", "!="};
+    for (const char *p : twoChar) {
+        if (source.compare(pos, 2, p) == 0) {
+            current.type = Punct;
+            current.text = p;
+            pos += 2;
+            return true;
+        }
+    }
+    if (c != '\0' && std::strchr("{}()[]=:,<>+-*\\%", c)) {
+        current.type = Punct;
+        current.text = std::string(1, c);
+        ++pos;
+        return true;
+    }
+    return fail(std::string("unexpected character '") + c + "'");
+}
+
+bool RuleCompiler::isPunct(const char *text) const
+{
+    return current.type == Punct && current.text == text;
+}
+
+bool RuleCompiler::isKeyword(const char *word) const
+{
+    return current.type == Identifier && current.text == word;
+}
+
+bool RuleCompiler::expectPunct(const char *text, bool hexValue)
+{
+    if (!isPunct(text)) {
+        return fail(std::string("expected '") + text + "'");
+    }
+    return advance(hexValue);
+}
+
+bool RuleCompiler::expectKeyword(const char *word)
+{
+    if (!isKeyword(word)) {
+        return fail(std::string("expected '") + word + "'");
+    }
+    return advance();
+}
+
+bool RuleCompiler::parseRule()
+{
+    if (isKeyword("private") && !advance()) {
+        return false;
+    }
+    if (!expectKeyword("rule")) {
+        return false;
+    }
+    if (current.type != Identifier) {
+        return fail("expected rule name");
+    }
+    for (const RuleSet::Rule &r : out.rules) {
+        if (r.name == current.text) {
+            return fail("duplicate rule " + current.text);
+        }
+    }
+
+    RuleSet::Rule rule;
+    rule.name = current.text;
+    rule.codeStart = 0;
+    rule.firstString = uint32_t(out.strings.size());
+    rule.stringCount = 0;
+    rule.needsString = false;
+    ruleIndex = uint32_t(out.rules.size());
+    out.rules.push_back(rule);
+    if (!advance()) {
+        return false;
+    }
+
+    // Tags are accepted and ignored
+    if (isPunct(":")) {
+        if (!advance()) {
+            return false;
+        }
+        while (current.type == Identifier) {
+            if (!advance()) {
+                return false;
+            }
+        }
+    }
+    if (!expectPunct("{")) {
+        return false;
+    }
+    if (isKeyword("meta") && !parseMeta()) {
+        return false;
+    }
+    if (isKeyword("strings") && !parseStrings()) {
+        return false;
+    }
+    if (!expectKeyword("condition") || !expectPunct(":")) {
+        return false;
+    }
+
+    out.rules[ruleIndex].codeStart = uint32_t(out.code.size());
+    depth = 0;
+    maxDepth = 0;
+    ExprInfo info;
+    if (!parseOr(&info)) {
+        return false;
+    }
+    emit(RuleSet::Halt);
+    if (maxDepth > RuleSet::kMaxStack) {
+        return fail("condition of rule " + out.rules[ruleIndex].name + " is too deeply nested");
+    }
+    if (!expectPunct("}")) {
+        return false;
+    }
+
+    bool needs = info.needsString || info.undefinedWithout;
+    out.rules[ruleIndex].needsString = needs;
+    if (!needs) {
+        out.alwaysEvaluate.push_back(ruleIndex);
+    }
+    return true;
+}
+
+bool RuleCompiler::parseMeta()
+{
+    if (!advance() || !expectPunct(":")) {
+        return false;
+    }
+    while (current.type == Identifier && !isKeyword("strings") && !isKeyword("condition")) {
+        if (!advance() || !expectPunct("=")) {
+            return false;
+        }
+        if (isPunct("-") && !advance()) {
+            return false;
+        }
+        if (current.type != Text && current.type != Number && !isKeyword("true") && !isKeyword("false")) {
+            return fail("expected meta value");
+        }
+        if (!advance()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RuleCompiler::parseStrings()
+{
+    if (!advance() || !expectPunct(":")) {
+        return false;
+    }
+    while (current.type == StringRef) {
+        std::string name = current.text;
+        if (name.empty() || current.wildcard) {
+            return fail("strings need a name");
+        }
+        if (findString(name) >= 0) {
+            return fail("duplicate string $" + name);
+        }
+        if (!advance() || !expectPunct("=", true)) {
+            return false;
+        }
+
+        if (current.type == Hex) {
+            std::string hex = current.text;
+            if (!addHex(name, hex) || !advance()) {
+                return false;
+            }
+            continue;
+        }
+        if (current.type != Text) {
+            return fail("expected a text or hex string for $" + name);
+        }
+        std::string bytes = current.text;
+        if (bytes.empty()) {
+            return fail("empty string $" + name);
+        }
+        if (!advance()) {
+            return false;
+        }
+        bool ascii = false;
+        bool wide = false;
+        while (current.type == Identifier && (isKeyword("ascii") || isKeyword("wide") || isKeyword("nocase")
+                                              || isKeyword("fullword") || isKeyword("xor") || isKeyword("base64")
+                                              || isKeyword("private"))) {
+            if (isKeyword("ascii")) {
+                ascii = true;
+            } else if (isKeyword("wide")) {
+                wide = true;
+            } else {
+                return fail("string modifier '" + current.text + "' is not supported");
+            }
+            if (!advance()) {
+                return false;
+            }
+        }
+        if (!addText(name, bytes, ascii || !wide, wide)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RuleCompiler::addText(const std::string &name, const std::string &bytes, bool ascii, bool wide)
+{
+    RuleSet::StringDef def;
+    def.name = name;
+    def.rule = ruleIndex;
+    def.firstChain = uint32_t(out.chains.size());
+    def.chainCount = 0;
+    out.strings.push_back(def);
+    ++out.rules[ruleIndex].stringCount;
+
+    for (int variant = 0; variant < 2; ++variant) {
+        bool isWide = variant == 1;
+        if ((isWide && !wide) || (!isWide && !ascii)) {
+            continue;
+        }
+        uint32_t length = uint32_t(bytes.size() * (isWide ? 2 : 1));
+        if (!addChain({toHex(bytes, isWide)}, {length}, {0}, {0})) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RuleCompiler::addHex(const std::string &name, const std::string &hex)
+{
+    // Pieces are runs of bytes between jumps; a piece with only wildcards
+    // in the middle just widens the surrounding jump
+    struct Piece {
+        std::string hex;
+        uint32_t length = 0;
+        bool literal = false;
+        uint32_t minGap = 0;
+        uint32_t maxGap = 0;
+    };
+    std::vector<Piece> pieces(1);
+
+    size_t i = 0;
+    auto readNumber = [&](uint32_t *value) {
+        size_t start = i;
+        uint64_t v = 0;
+        while (i < hex.size() && std::isdigit(static_cast<unsigned char>(hex[i])) && v <= kMaxJump) {
+            v = v * 10 + uint64_t(hex[i++] - '0');
+        }
+        *value = uint32_t(v);
+        return i > start && v <= kMaxJump;
+    };
+    auto skipSpace = [&]() {
+        while (i < hex.size() && std::isspace(static_cast<unsigned char>(hex[i]))) {
+            ++i;
+        }
+    };
+
+    for (;;) {
+        skipSpace();
+        if (i >= hex.size()) {
+            break;
+        }
+        char c = hex[i];
+        if (c == '[') {
+            ++i;
+            skipSpace();
+            uint32_t low = 0, high = 0;
+            if (!readNumber(&low)) {
+                return fail("invalid jump in $" + name);
+            }
+            skipSpace();
+            high = low;
+            if (i < hex.size() && hex[i] == '-') {
+                ++i;
+                skipSpace();
+                if (!readNumber(&high)) {
+                    return fail("jumps in $" + name + " must be bounded (at most 1048576)");
+                }
+                skipSpace();
+            }
+            if (i >= hex.size() || hex[i] != ']' || high < low) {
+                return fail("invalid jump in $" + name);
+            }
+            ++i;
+            if (pieces.back().length == 0) {
+                return fail("jumps in $" + name + " must sit between bytes");
+            }
+            Piece next;
+            next.minGap = low;
+            next.maxGap = high;
+            pieces.push_back(next);
+            continue;
+        }
+        if (c == '(' || c == '|') {
+            return fail("alternatives in hex strings are not supported ($" + name + ")");
+        }
+        if (i + 1 >= hex.size()) {
+            return fail("odd number of hex digits in $" + name);
+        }
+        char hi = hex[i], lo = hex[i + 1];
+        if ((hi != '?' && hexDigit(hi) < 0) || (lo != '?' && hexDigit(lo) < 0)) {
+            return fail("invalid hex string $" + name);
+        }
+        pieces.back().hex += hi;
+        pieces.back().hex += lo;
+        ++pieces.back().length;
+        pieces.back().literal |= hi != '?' && lo != '?';
+        i += 2;
+    }
+    if (pieces.back().length == 0) {
+        return fail(pieces.size() == 1 ? "empty hex string $" + name
+                                       : "hex string $" + name + " cannot end with a jump");
+    }
+    if (!pieces.front().literal || !pieces.back().literal) {
+        return fail("hex string $" + name + " needs a fixed byte before the first and after the last jump");
+    }
+
+    std::vector<std::string> fragments;
+    std::vector<uint32_t> lengths, minGaps, maxGaps;
+    uint32_t carryMin = 0, carryMax = 0;
+    for (const Piece &p : pieces) {
+        if (!p.literal) {
+            carryMin += p.minGap + p.length;
+            carryMax += p.maxGap + p.length;
+            continue;
+        }
+        fragments.push_back(p.hex);
+        lengths.push_back(p.length);
+        minGaps.push_back(p.minGap + carryMin);
+        maxGaps.push_back(p.maxGap + carryMax);
+        carryMin = carryMax = 0;
+    }
+
+    RuleSet::StringDef def;
+    def.name = name;
+    def.rule = ruleIndex;
+    def.firstChain = uint32_t(out.chains.size());
+    def.chainCount = 0;
+    out.strings.push_back(def);
+    ++out.rules[ruleIndex].stringCount;
+    return addChain(fragments, lengths, minGaps, maxGaps);
+}
+
+bool RuleCompiler::addChain(const std::vector<std::string> &hexFragments, const std::vector<uint32_t> &lengths,
+                            const std::vector<uint32_t> &minGaps, const std::vector<uint32_t> &maxGaps)
+{
+    uint32_t string = uint32_t(out.strings.size() - 1);
+    RuleSet::Chain chain;
+    chain.firstFragment = uint32_t(out.fragments.size());
+    chain.fragmentCount = uint32_t(hexFragments.size());
+
+    std::string patternName = out.rules[ruleIndex].name + ":$" + out.strings[string].name;
+    for (size_t k = 0; k < hexFragments.size(); ++k) {
+        std::string err;
+        if (out.matcher.add(patternName, hexFragments[k], &err) < 0) {
+            return fail(err);
+        }
+        RuleSet::Fragment f;
+        f.string = string;
+        f.length = lengths[k];
+        f.minGap = minGaps[k];
+        f.maxGap = maxGaps[k];
+        f.countOnly = false;
+        out.fragments.push_back(f);
+    }
+    out.chains.push_back(chain);
+    ++out.strings[string].chainCount;
+    return true;
+}
+
+int RuleCompiler::findString(const std::string &name) const
+{
+    if (out.rules.empty()) {
+        return -1;
+    }
+    const RuleSet::Rule &rule = out.rules[ruleIndex];
+    for (uint32_t s = rule.firstString; s < rule.firstString + rule.stringCount; ++s) {
+        if (out.strings[s].name == name) {
+            return int(s);
+        }
+    }
+    return -1;
+}
+
+bool RuleCompiler::parseStringSet(uint32_t *set, uint32_t *size)
+{
+    const RuleSet::Rule &rule = out.rules[ruleIndex];
+    RuleSet::StringSet result;
+    result.start = uint32_t(out.setMembers.size());
+
+    if (isKeyword("them")) {
+        for (uint32_t s = rule.firstString; s < rule.firstString + rule.stringCount; ++s) {
+            out.setMembers.push_back(s);
+        }
+        if (!advance()) {
+            return false;
+        }
+    } else {
+        if (!expectPunct("(")) {
+            return false;
+        }
+        for (;;) {
+            if (current.type != StringRef) {
+                return fail("expected a string in the set");
+            }
+            if (current.wildcard) {
+                bool any = false;
+                for (uint32_t s = rule.firstString; s < rule.firstString + rule.stringCount; ++s) {
+                    if (out.strings[s].name.compare(0, current.text.size(), current.text) == 0) {
+                        out.setMembers.push_back(s);
+                        any = true;
+                    }
+                }
+                if (!any) {
+                    return fail("no strings match $" + current.text + "*");
+                }
+            } else {
+                int s = findString(current.text);
+                if (s < 0) {
+                    return fail("undefined string $" + current.text);
+                }
+                out.setMembers.push_back(uint32_t(s));
+            }
+            if (!advance()) {
+                return false;
+            }
+            if (!isPunct(",")) {
+                break;
+            }
+            if (!advance()) {
+                return false;
+            }
+        }
+        if (!expectPunct(")")) {
+            return false;
+        }
+    }
+
+    result.count = uint32_t(out.setMembers.size()) - result.start;
+    if (result.count == 0) {
+        return fail("empty string set");
+    }
+    *set = uint32_t(out.sets.size());
+    *size = result.count;
+    out.sets.push_back(result);
+    return true;
+}
+
+void RuleCompiler::emit(RuleSet::Op op, uint32_t arg)
+{
+    out.code.push_back({op, arg});
+    switch (op) {
+    case RuleSet::PushConst: case RuleSet::PushTrue: case RuleSet::PushFalse:
+    case RuleSet::FileSize: case RuleSet::Found: case RuleSet::Count:
+        ++depth;
+        break;
+    case RuleSet::Offset: case RuleSet::FoundAt: case RuleSet::Read: case RuleSet::Of:
+    case RuleSet::Not: case RuleSet::Neg:
+        break;
+    default:
+        --depth;  // binary operators, FoundIn, Halt
+        break;
+    }
+    maxDepth = std::max(maxDepth, depth);
+}
+
+void RuleCompiler::emitConstant(int64_t value)
+{
+    out.constants.push_back(value);
+    emit(RuleSet::PushConst, uint32_t(out.constants.size() - 1));
+}
+
+bool RuleCompiler::parseOr(ExprInfo *info)
+{
+    if (!parseAnd(info)) {
+        return false;
+    }
+    while (isKeyword("or")) {
+        ExprInfo right;
+        if (!advance() || !parseAnd(&right)) {
+            return false;
+        }
+        emit(RuleSet::Or);
+        ExprInfo combined;
+        combined.needsString = (info->needsString || info->undefinedWithout)
+                               && (right.needsString || right.undefinedWithout);
+        *info = combined;
+    }
+    return true;
+}
+
+bool RuleCompiler::parseAnd(ExprInfo *info)
+{
+    if (!parseNot(info)) {
+        return false;
+    }
+    while (isKeyword("and")) {
+        ExprInfo right;
+        if (!advance() || !parseNot(&right)) {
+            return false;
+        }
+        emit(RuleSet::And);
+        ExprInfo combined;
+        combined.needsString = info->needsString || info->undefinedWithout
+                               || right.needsString || right.undefinedWithout;
+        *info = combined;
+    }
+    return true;
+}
+
+bool RuleCompiler::parseNot(ExprInfo *info)
+{
+    if (!isKeyword("not")) {
+        return parseComparison(info);
+    }
+    ExprInfo operand;
+    if (!advance() || !parseNot(&operand)) {
+        return false;
+    }
+    emit(RuleSet::Not);
+    *info = ExprInfo();
+    info->undefinedWithout = operand.undefinedWithout;
+    return true;
+}
+
+bool RuleCompiler::parseComparison(ExprInfo *info)
+{
+    if (!parseAdditive(info)) {
+        return false;
+    }
+    static const struct { const char *text; RuleSet::Op op; } ops[] = {
+        {"<", RuleSet::Lt}, {"<=", RuleSet::Le}, {">", RuleSet::Gt},
+        {">=", RuleSet::Ge}, {"==", RuleSet::Eq}, {"!=", RuleSet::Ne},
+    };
+    for (const auto &o : ops) {
+        if (!isPunct(o.text)) {
+            continue;
+        }
+        ExprInfo right;
+        if (!advance() || !parseAdditive(&right)) {
+            return false;
+        }
+        emit(o.op);
+
+        // "#a > 0", "#a >= 2", "#a == 1" (or mirrored) need a hit
+        const ExprInfo &left = *info;
+        bool needs = false;
+        if (left.isCount && right.isConstant) {
+            int64_t c = right.constant;
+            needs = (o.op == RuleSet::Gt && c >= 0) || ((o.op == RuleSet::Ge || o.op == RuleSet::Eq) && c >= 1);
+        } else if (right.isCount && left.isConstant) {
+            int64_t c = left.constant;
+            needs = (o.op == RuleSet::Lt && c >= 0) || ((o.op == RuleSet::Le || o.op == RuleSet::Eq) && c >= 1);
+        }
+        ExprInfo combined;
+        combined.needsString = needs;
+        combined.undefinedWithout = left.undefinedWithout || right.undefinedWithout;
+        *info = combined;
+        break;
+    }
+    return true;
+}
+
+bool RuleCompiler::parseAdditive(ExprInfo *info)
+{
+    if (!parseMultiplicative(info)) {
+        return false;
+    }
+    while (isPunct("+") || isPunct("-")) {
+        bool add = isPunct("+");
+        ExprInfo right;
+        if (!advance() || !parseMultiplicative(&right)) {
+            return false;
+        }
+        emit(add ? RuleSet::Add : RuleSet::Sub);
+        ExprInfo combined;
+        combined.undefinedWithout = info->undefinedWithout || right.undefinedWithout;
+        // A constant outside int64 is undefined at run time; not one for the prefilter
+        bool overflow = add ? __builtin_add_overflow(info->constant, right.constant, &combined.constant)
+                            : __builtin_sub_overflow(info->constant, right.constant, &combined.constant);
+        combined.isConstant = info->isConstant && right.isConstant && !overflow;
+        *info = combined;
+    }
+    return true;
+}
+
+bool RuleCompiler::parseMultiplicative(ExprInfo *info)
+{
+    if (!parseUnary(info)) {
+        return false;
+    }
+    while (isPunct("*") || isPunct("\\") || isPunct("%")) {
+        RuleSet::Op op = isPunct("*") ? RuleSet::Mul : isPunct("\\") ? RuleSet::Div : RuleSet::Mod;
+        ExprInfo right;
+        if (!advance() || !parseUnary(&right)) {
+            return false;
+        }
+        emit(op);
+        ExprInfo combined;
+        combined.undefinedWithout = info->undefinedWithout || right.undefinedWithout;
+        bool overflow = __builtin_mul_overflow(info->constant, right.constant, &combined.constant);
+        combined.isConstant = op == RuleSet::Mul && info->isConstant && right.isConstant && !overflow;
+        *info = combined;
+    }
+    return true;
+}
+
+bool RuleCompiler::parseUnary(ExprInfo *info)
+{
+    if (!isPunct("-")) {
+        return parsePrimary(info);
+    }
+    if (!advance() || !parseUnary(info)) {
+        return false;
+    }
+    emit(RuleSet::Neg);
+    info->isConstant = info->isConstant && info->constant != INT64_MIN;
+    info->constant = info->constant == INT64_MIN ? 0 : -info->constant;
+    info->isCount = false;
+    return true;
+}
+
+bool RuleCompiler::parsePrimary(ExprInfo *info)
+{
+    *info = ExprInfo();
+
+    if (current.type == Number) {
+        int64_t value = current.number;
+        if (!advance()) {
+            return false;
+        }
+        if (isKeyword("of")) {
+            return parseOf(value, false, info);
+        }
+        emitConstant(value);
+        info->isConstant = true;
+        info->constant = value;
+        return true;
+    }
+
+    if (isPunct("(")) {
+        if (!advance() || !parseOr(info)) {
+            return false;
+        }
+        return expectPunct(")");
+    }
+
+    if (current.type == StringRef || current.type == CountRef || current.type == OffsetRef) {
+        TokenType type = current.type;
+        if (current.wildcard) {
+            return fail("wildcards are only allowed in string sets");
+        }
+        int s = findString(current.text);
+        if (s < 0) {
+            return fail("undefined string $" + current.text);
+        }
+        uint32_t string = uint32_t(s);
+        if (!advance()) {
+            return false;
+        }
+
+        if (type == CountRef) {
+            emit(RuleSet::Count, string);
+            info->isCount = true;
+            return true;
+        }
+        if (type == OffsetRef) {
+            if (isPunct("[")) {
+                ExprInfo index;
+                if (!advance() || !parseOr(&index) || !expectPunct("]")) {
+                    return false;
+                }
+            } else {
+                emitConstant(1);
+            }
+            emit(RuleSet::Offset, string);
+            info->undefinedWithout = true;
+            return true;
+        }
+
+        info->needsString = true;
+        ExprInfo a, b;
+        if (isKeyword("at")) {
+            if (!advance() || !parseAdditive(&a)) {
+                return false;
+            }
+            emit(RuleSet::FoundAt, string);
+        } else if (isKeyword("in")) {
+            if (!advance() || !expectPunct("(") || !parseAdditive(&a) || !expectPunct("..")
+                || !parseAdditive(&b) || !expectPunct(")")) {
+                return false;
+            }
+            emit(RuleSet::FoundIn, string);
+        } else {
+            emit(RuleSet::Found, string);
+        }
+        return true;
+    }
+
+    if (current.type != Identifier) {
+        return fail("expected an expression");
+    }
+
+    std::string word = current.text;
+    if (word == "true" || word == "false") {
+        emit(word == "true" ? RuleSet::PushTrue : RuleSet::PushFalse);
+        info->isConstant = true;
+        info->constant = word == "true";
+        return advance();
+    }
+    if (word == "filesize") {
+        emit(RuleSet::FileSize);
+        return advance();
+    }
+    if (word == "any" || word == "all") {
+        return advance() && parseOf(1, word == "all", info);
+    }
+
+    static const struct { const char *name; uint32_t arg; } reads[] = {
+        {"uint8", 1}, {"uint16", 2}, {"uint32", 4}, {"uint16be", 2 | 0x80}, {"uint32be", 4 | 0x80},
+    };
+    for (const auto &r : reads) {
+        if (word != r.name) {
+            continue;
+        }
+        ExprInfo offset;
+        if (!advance() || !expectPunct("(") || !parseOr(&offset) || !expectPunct(")")) {
+            return false;
+        }
+        emit(RuleSet::Read, r.arg);
+        info->undefinedWithout = offset.undefinedWithout;
+        return true;
+    }
+    return fail("unknown identifier '" + word + "'");
+}
+
+bool RuleCompiler::parseOf(int64_t needed, bool all, ExprInfo *info)
+{
+    if (!expectKeyword("of")) {
+        return false;
+    }
+    uint32_t set = 0, size = 0;
+    if (!parseStringSet(&set, &size)) {
+        return false;
+    }
+    if (all) {
+        needed = size;
+    }
+    emitConstant(needed);
+    emit(RuleSet::Of, set);
+    *info = ExprInfo();
+    info->needsString = needed >= 1;
+    return true;
+}
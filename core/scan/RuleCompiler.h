@@ -0,0 +1,97 @@
+#ifndef RULECOMPILER_H
+#define RULECOMPILER_H
+
+#include "RuleSet.h"
+#include <string>
+#include <vector>
+
+// Parses rule source into a RuleSet. The language is a subset of YARA:
+//
+//   rule Name : optional tags {
+//       meta:
+//           author = "..."                  (ignored)
+//       strings:
+//           $text = "MZ\x90\x00" ascii wide
+//           $hex  = { 4D 5A ?? 00 [2-16] 50 45 }
+//       condition:
+//           $hex at 0 and (#text > 2 or @text[1] < 0x400)
+//           and filesize < 2MB and uint16(0) == 0x5a4d
+//   }
+//
+// Conditions support and/or/not, comparisons, + - * \ %, integer
+// literals (decimal, 0x hex, KB/MB suffixes), filesize, $s, $s at x,
+// $s in (a..b), #s, @s[k], "N|any|all of them|($a, $b*)", and
+// uint8/uint16/uint32 (little endian) and uint16be/uint32be reads within
+// the first 4 KiB of the file. Hex jumps must be bounded and must sit
+// between fixed bytes; "nocase", regular expressions and modules are not
+// supported.
+class RuleCompiler
+{
+public:
+    explicit RuleCompiler(RuleSet &out);
+
+    bool compile(const std::string &source, std::string *error);
+
+private:
+    enum TokenType { End, Identifier, StringRef, CountRef, OffsetRef, Number, Text, Hex, Punct };
+
+    struct Token {
+        TokenType type = End;
+        std::string text;       // identifier/punctuation, name without sigil, decoded text, raw hex
+        int64_t number = 0;
+        bool wildcard = false;  // $name* in string sets
+        int line = 1;
+    };
+
+    // What a subexpression means for the prefilter
+    struct ExprInfo {
+        bool needsString = false;     // cannot be true without a string hit
+        bool undefinedWithout = false;// undefined without a string hit
+        bool isCount = false;
+        bool isConstant = false;
+        int64_t constant = 0;
+    };
+
+    RuleSet &out;
+    std::string source;
+    size_t pos;
+    int line;
+    Token current;
+    std::string failure;
+    uint32_t ruleIndex;
+    int depth;
+    int maxDepth;
+
+    bool fail(const std::string &message);
+    bool advance(bool hexValue = false);
+    bool isPunct(const char *text) const;
+    bool isKeyword(const char *word) const;
+    bool expectPunct(const char *text, bool hexValue = false);
+    bool expectKeyword(const char *word);
+
+    bool parseRule();
+    bool parseMeta();
+    bool parseStrings();
+    bool addText(const std::string &name, const std::string &bytes, bool ascii, bool wide);
+    bool addHex(const std::string &name, const std::string &hex);
+    bool addChain(const std::vector<std::string> &hexFragments, const std::vector<uint32_t> &lengths,
+                  const std::vector<uint32_t> &minGaps, const std::vector<uint32_t> &maxGaps);
+
+    int findString(const std::string &name) const;
+    bool parseStringSet(uint32_t *set, uint32_t *size);
+
+    void emit(RuleSet::Op op, uint32_t arg = 0);
+    void emitConstant(int64_t value);
+
+    bool parseOr(ExprInfo *info);
+    bool parseAnd(ExprInfo *info);
+    bool parseNot(ExprInfo *info);
+    bool parseComparison(ExprInfo *info);
+    bool parseAdditive(ExprInfo *info);
+    bool parseMultiplicative(ExprInfo *info);
+    bool parseUnary(ExprInfo *info);
+    bool parsePrimary(ExprInfo *info);
+    bool parseOf(int64_t needed, bool all, ExprInfo *info);
+};
+
+#endif // RULECOMPILER_H
@@ -0,0 +1,366 @@
+#include "RuleSet.h"
+#include "RuleCompiler.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+// Offsets kept per fragment and file; a rule needing more is unusual and
+// the scanner reports the limit rather than growing without bound. Strings
+// only tested or counted keep no offsets at all
+const size_t kMaxHitsPerFragment = 10000;
+const size_t kHeaderBytes = 4096;
+
+struct Value {
+    int64_t v;
+    bool defined;
+};
+
+} // namespace
+
+RuleSet::RuleSet()
+    : headerBytes(kHeaderBytes)
+{
+}
+
+void RuleSet::clear()
+{
+    rules.clear();
+    strings.clear();
+    chains.clear();
+    fragments.clear();
+    sets.clear();
+    setMembers.clear();
+    constants.clear();
+    code.clear();
+    alwaysEvaluate.clear();
+    matcher = SignatureMatcher();
+}
+
+bool RuleSet::compile(const std::string &source, std::string *error)
+{
+    clear();
+    RuleCompiler compiler(*this);
+    if (!compiler.compile(source, error)) {
+        clear();
+        return false;
+    }
+    if (!fragments.empty() && !matcher.compile(error)) {
+        clear();
+        return false;
+    }
+    markCountOnly();
+    return true;
+}
+
+void RuleSet::markCountOnly()
+{
+    std::vector<uint8_t> offsetsRead(strings.size(), 0);
+    for (const Instruction &in : code) {
+        if (in.op == Offset || in.op == FoundAt || in.op == FoundIn) {
+            offsetsRead[in.arg] = 1;
+        }
+    }
+    for (uint32_t s = 0; s < strings.size(); ++s) {
+        const Chain &chain = chains[strings[s].firstChain];
+        if (strings[s].chainCount == 1 && chain.fragmentCount == 1) {
+            fragments[chain.firstFragment].countOnly = !offsetsRead[s];
+        }
+    }
+}
+
+RuleSet::Scanner::Scanner(const RuleSet &rules)
+    : rules(rules)
+    , stream(rules.matcher)
+    , fragmentHits(rules.fragments.size())
+    , fragmentCounts(rules.fragments.size(), 0)
+    , stringHits(rules.strings.size())
+    , stringResolved(rules.strings.size(), 0)
+    , size(0)
+    , truncated(false)
+{
+}
+
+void RuleSet::Scanner::reset()
+{
+    stream.reset();
+    matches.clear();
+    for (uint32_t f : touchedFragments) {
+        fragmentHits[f].clear();
+        fragmentCounts[f] = 0;
+    }
+    touchedFragments.clear();
+    for (uint32_t s : resolvedStrings) {
+        stringHits[s].clear();
+        stringResolved[s] = 0;
+    }
+    resolvedStrings.clear();
+    header.clear();
+    size = 0;
+    truncated = false;
+}
+
+void RuleSet::Scanner::feed(const uint8_t *data, size_t length)
+{
+    if (header.size() < rules.headerBytes) {
+        size_t take = std::min(length, rules.headerBytes - header.size());
+        header.insert(header.end(), data, data + take);
+    }
+    size += length;
+    if (rules.fragments.empty()) {
+        return;
+    }
+    stream.feed(data, length, matches);
+    collect();
+}
+
+void RuleSet::Scanner::collect()
+{
+    for (const SignatureMatcher::Match &m : matches) {
+        if (fragmentCounts[m.pattern]++ == 0) {
+            touchedFragments.push_back(m.pattern);
+        }
+        if (rules.fragments[m.pattern].countOnly) {
+            continue;
+        }
+        std::vector<uint64_t> &hits = fragmentHits[m.pattern];
+        if (hits.size() < kMaxHitsPerFragment) {
+            hits.push_back(m.offset);
+        } else {
+            truncated = true;
+        }
+    }
+    matches.clear();
+}
+
+std::vector<uint32_t> RuleSet::Scanner::finish()
+{
+    std::vector<uint32_t> candidates = rules.alwaysEvaluate;
+    for (uint32_t f : touchedFragments) {
+        // Seam matches can arrive after later in-chunk ones
+        std::vector<uint64_t> &hits = fragmentHits[f];
+        std::sort(hits.begin(), hits.end());
+        candidates.push_back(rules.strings[rules.fragments[f].string].rule);
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    std::vector<uint32_t> matched;
+    for (uint32_t rule : candidates) {
+        if (evaluate(rule)) {
+            matched.push_back(rule);
+        }
+    }
+    return matched;
+}
+
+// Offsets of the chain's first fragment from which the whole chain matches.
+// Worked backwards: a hit of fragment k is kept when a kept hit of k + 1
+// lies within the jump after it. Hits are sorted, so one sweep per fragment.
+void RuleSet::Scanner::chainStarts(uint32_t c, std::vector<uint64_t> &out)
+{
+    const Chain &chain = rules.chains[c];
+    uint32_t last = chain.firstFragment + chain.fragmentCount - 1;
+    reachable = fragmentHits[last];
+    for (uint32_t k = last; k-- > chain.firstFragment && !reachable.empty();) {
+        const Fragment &f = rules.fragments[k];
+        const Fragment &next = rules.fragments[k + 1];
+        scratch.clear();
+        size_t j = 0;
+        for (uint64_t offset : fragmentHits[k]) {
+            uint64_t end = offset + f.length;
+            while (j < reachable.size() && reachable[j] < end + next.minGap) {
+                ++j;
+            }
+            if (j == reachable.size()) {
+                break;
+            }
+            if (reachable[j] <= end + next.maxGap) {
+                scratch.push_back(offset);
+            }
+        }
+        reachable.swap(scratch);
+    }
+    out.insert(out.end(), reachable.begin(), reachable.end());
+}
+
+uint64_t RuleSet::Scanner::countOf(uint32_t string)
+{
+    const StringDef &def = rules.strings[string];
+    uint32_t first = rules.chains[def.firstChain].firstFragment;
+    if (rules.fragments[first].countOnly) {
+        return fragmentCounts[first];
+    }
+    return hitsOf(string).size();
+}
+
+const std::vector<uint64_t> &RuleSet::Scanner::hitsOf(uint32_t string)
+{
+    std::vector<uint64_t> &out = stringHits[string];
+    if (stringResolved[string]) {
+        return out;
+    }
+    stringResolved[string] = 1;
+    resolvedStrings.push_back(string);
+
+    const StringDef &def = rules.strings[string];
+    for (uint32_t c = def.firstChain; c < def.firstChain + def.chainCount; ++c) {
+        chainStarts(c, out);
+    }
+    if (def.chainCount > 1) {
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+    return out;
+}
+
+// Undefined values (an offset past the last hit, a read past the header)
+// propagate through arithmetic and comparisons; a rule is true only when
+// its condition is defined and non-zero
+bool RuleSet::Scanner::evaluate(uint32_t rule)
+{
+    Value stack[kMaxStack];
+    int top = 0;
+    auto pop = [&]() { return stack[--top]; };
+    auto push = [&](int64_t v, bool defined) { stack[top++] = Value{v, defined}; };
+
+    for (size_t pc = rules.rules[rule].codeStart;; ++pc) {
+        const Instruction &in = rules.code[pc];
+        switch (in.op) {
+        case PushConst:
+            push(rules.constants[in.arg], true);
+            break;
+        case PushTrue:
+            push(1, true);
+            break;
+        case PushFalse:
+            push(0, true);
+            break;
+        case FileSize:
+            push(int64_t(size), true);
+            break;
+        case Found:
+            push(countOf(in.arg) != 0, true);
+            break;
+        case Count:
+            push(int64_t(countOf(in.arg)), true);
+            break;
+        case Offset: {
+            Value k = pop();
+            const std::vector<uint64_t> &hits = hitsOf(in.arg);
+            if (!k.defined || k.v < 1 || uint64_t(k.v) > hits.size()) {
+                push(0, false);
+            } else {
+                push(int64_t(hits[size_t(k.v - 1)]), true);
+            }
+            break;
+        }
+        case FoundAt: {
+            Value at = pop();
+            const std::vector<uint64_t> &hits = hitsOf(in.arg);
+            push(at.defined && at.v >= 0 && std::binary_search(hits.begin(), hits.end(), uint64_t(at.v)), true);
+            break;
+        }
+        case FoundIn: {
+            Value high = pop();
+            Value low = pop();
+            if (!low.defined || !high.defined) {
+                push(0, false);
+                break;
+            }
+            const std::vector<uint64_t> &hits = hitsOf(in.arg);
+            auto it = std::lower_bound(hits.begin(), hits.end(), uint64_t(std::max<int64_t>(low.v, 0)));
+            push(it != hits.end() && high.v >= 0 && *it <= uint64_t(high.v), true);
+            break;
+        }
+        case Read: {
+            Value at = pop();
+            size_t width = in.arg & 0x7f;
+            bool bigEndian = in.arg & 0x80;
+            if (!at.defined || at.v < 0 || uint64_t(at.v) + width > header.size()) {
+                push(0, false);
+                break;
+            }
+            uint64_t v = 0;
+            for (size_t i = 0; i < width; ++i) {
+                uint8_t b = header[size_t(at.v) + (bigEndian ? i : width - 1 - i)];
+                v = (v << 8) | b;
+            }
+            push(int64_t(v), true);
+            break;
+        }
+        case Of: {
+            Value needed = pop();
+            const StringSet &set = rules.sets[in.arg];
+            int64_t found = 0;
+            for (uint32_t i = set.start; i < set.start + set.count; ++i) {
+                found += countOf(rules.setMembers[i]) != 0;
+            }
+            push(needed.defined && found >= needed.v, needed.defined);
+            break;
+        }
+        case Add: case Sub: case Mul: case Div: case Mod:
+        case Lt: case Le: case Gt: case Ge: case Eq: case Ne: {
+            Value b = pop();
+            Value a = pop();
+            // Division by zero and results outside int64 are undefined too
+            bool divide = in.op == Div || in.op == Mod;
+            if (!a.defined || !b.defined || (divide && (b.v == 0 || (b.v == -1 && a.v == INT64_MIN)))) {
+                push(0, false);
+                break;
+            }
+            int64_t r = 0;
+            bool overflow = false;
+            switch (in.op) {
+            case Add: overflow = __builtin_add_overflow(a.v, b.v, &r); break;
+            case Sub: overflow = __builtin_sub_overflow(a.v, b.v, &r); break;
+            case Mul: overflow = __builtin_mul_overflow(a.v, b.v, &r); break;
+            case Div: r = a.v / b.v; break;
+            case Mod: r = a.v % b.v; break;
+            case Lt: r = a.v < b.v; break;
+            case Le: r = a.v <= b.v; break;
+            case Gt: r = a.v > b.v; break;
+            case Ge: r = a.v >= b.v; break;
+            case Eq: r = a.v == b.v; break;
+            default: r = a.v != b.v; break;
+            }
+            push(r, !overflow);
+            break;
+        }
+        case And: {
+            Value b = pop();
+            Value a = pop();
+            if ((a.defined && !a.v) || (b.defined && !b.v)) {
+                push(0, true);
+            } else {
+                push(1, a.defined && b.defined);
+            }
+            break;
+        }
+        case Or: {
+            Value b = pop();
+            Value a = pop();
+            if ((a.defined && a.v) || (b.defined && b.v)) {
+                push(1, true);
+            } else {
+                push(0, a.defined && b.defined);
+            }
+            break;
+        }
+        case Not: {
+            Value a = pop();
+            push(!a.v, a.defined);
+            break;
+        }
+        case Neg: {
+            Value a = pop();
+            push(a.v == INT64_MIN ? 0 : -a.v, a.defined && a.v != INT64_MIN);
+            break;
+        }
+        case Halt: {
+            Value result = pop();
+            return result.defined && result.v != 0;
+        }
+        }
+    }
+}
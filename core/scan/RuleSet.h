@@ -0,0 +1,151 @@
+#ifndef RULESET_H
+#define RULESET_H
+
+#include "SignatureMatcher.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Compiled detection rules for the detailed scan.
+//
+// Rules are written in a YARA-like language (see RuleCompiler.h) and
+// compiled into a small stack bytecode. Every literal string, and every
+// fragment of a hex string with jumps, goes into one shared
+// SignatureMatcher whose rarest-window atoms act as the prefilter: after a
+// file is scanned, only rules whose strings were seen (plus the few whose
+// condition can hold without any string) are evaluated.
+//
+// Plain C++ like the matcher, so rules can be compiled and checked without Qt.
+class RuleSet
+{
+public:
+    RuleSet();
+
+    // Replaces any previously compiled rules
+    bool compile(const std::string &source, std::string *error = nullptr);
+
+    size_t ruleCount() const { return rules.size(); }
+    const std::string &ruleName(uint32_t id) const { return rules[id].name; }
+    size_t stringCount() const { return strings.size(); }
+    size_t codeSize() const { return code.size(); }
+    const SignatureMatcher &prefilter() const { return matcher; }
+
+    // Per-file scan state. One per worker; reset() between files.
+    class Scanner
+    {
+    public:
+        explicit Scanner(const RuleSet &rules);
+
+        void reset();
+        void feed(const uint8_t *data, size_t length);
+        // Ids of the rules whose condition holds for the data fed so far
+        std::vector<uint32_t> finish();
+        // A string whose offsets a rule reads matched more often than is
+        // kept, so finish() may have missed or wrongly matched rules
+        bool limitReached() const { return truncated; }
+        const RuleSet &ruleSet() const { return rules; }
+
+    private:
+        const RuleSet &rules;
+        SignatureStream stream;
+        std::vector<SignatureMatcher::Match> matches;
+        std::vector<std::vector<uint64_t>> fragmentHits;
+        std::vector<uint64_t> fragmentCounts;  // every hit, kept or not
+        std::vector<uint32_t> touchedFragments;
+        std::vector<std::vector<uint64_t>> stringHits;
+        std::vector<uint8_t> stringResolved;
+        std::vector<uint32_t> resolvedStrings;
+        std::vector<uint8_t> header;  // first bytes, for uintN() reads
+        std::vector<uint64_t> reachable;  // chainStarts() scratch
+        std::vector<uint64_t> scratch;
+        uint64_t size;
+        bool truncated;
+
+        void collect();
+        uint64_t countOf(uint32_t string);
+        const std::vector<uint64_t> &hitsOf(uint32_t string);
+        void chainStarts(uint32_t c, std::vector<uint64_t> &out);
+        bool evaluate(uint32_t rule);
+    };
+
+private:
+    friend class RuleCompiler;
+
+    enum Op : uint8_t {
+        PushConst,   // arg: constant index
+        PushTrue,
+        PushFalse,
+        FileSize,
+        Found,       // arg: string
+        Count,       // arg: string
+        Offset,      // arg: string; pops k (1-based)
+        FoundAt,     // arg: string; pops offset
+        FoundIn,     // arg: string; pops high, low
+        Read,        // arg: width (1, 2, 4) | 0x80 big endian; pops offset
+        Of,          // arg: string set; pops how many (all = set size)
+        Add, Sub, Mul, Div, Mod,
+        Lt, Le, Gt, Ge, Eq, Ne,
+        And, Or, Not,
+        Neg,
+        Halt
+    };
+
+    static const int kMaxStack = 64;
+
+    struct Instruction {
+        Op op;
+        uint32_t arg;
+    };
+
+    struct Fragment {
+        uint32_t string;
+        uint32_t length;
+        uint32_t minGap;     // jump from the end of the previous fragment
+        uint32_t maxGap;
+        bool countOnly;      // a whole string whose offsets no rule reads
+    };
+
+    // A string is one or more chains (text with "ascii wide" has two); a
+    // chain is one or more fragments separated by jumps
+    struct Chain {
+        uint32_t firstFragment;
+        uint32_t fragmentCount;
+    };
+
+    struct StringDef {
+        std::string name;
+        uint32_t rule;
+        uint32_t firstChain;
+        uint32_t chainCount;
+    };
+
+    struct Rule {
+        std::string name;
+        uint32_t codeStart;
+        uint32_t firstString;
+        uint32_t stringCount;
+        bool needsString;    // condition cannot hold without a string hit
+    };
+
+    struct StringSet {
+        uint32_t start;      // into setMembers
+        uint32_t count;
+    };
+
+    std::vector<Rule> rules;
+    std::vector<StringDef> strings;
+    std::vector<Chain> chains;
+    std::vector<Fragment> fragments;    // index == matcher pattern id
+    std::vector<StringSet> sets;
+    std::vector<uint32_t> setMembers;
+    std::vector<int64_t> constants;
+    std::vector<Instruction> code;
+    std::vector<uint32_t> alwaysEvaluate;
+    SignatureMatcher matcher;
+    size_t headerBytes;
+
+    void clear();
+    void markCountOnly();
+};
+
+#endif // RULESET_H
@@ -0,0 +1,252 @@
+#include "ScanCache.h"
+#include "../DatabaseManager.h"
+#include "../SysfsUSBEnumerator.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStorageInfo>
+#include <QDebug>
+
+namespace {
+
+// Bump when a change to the matcher, the rule compiler, hit capping or
+// archive unpacking would give different verdicts for the same inputs,
+// or when results gain a field the cache must fill in
+const int kVerdictFormat = 4;
+const char *const kMemberSeparator = "//";
+
+QString readSysfs(const QString &dir, const char *name)
+{
+    QFile file(dir + "/" + name);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QString::fromUtf8(file.read(256)).trimmed();
+}
+
+// Serial of the USB device a block device hangs off, empty for other buses
+QString usbSerialOf(const QString &device)
+{
+    QString sysRoot = SysfsUSBEnumerator::defaultRoot();
+    QString dir = QFileInfo(sysRoot + "/class/block/" + QFileInfo(device).fileName()).canonicalFilePath();
+    while (!dir.isEmpty() && dir.startsWith(sysRoot + "/devices/")) {
+        if (QFile::exists(dir + "/idVendor")) {
+            return readSysfs(dir, "serial");
+        }
+        dir = QFileInfo(dir).path();
+    }
+    return QString();
+}
+
+QString uuidOf(const QString &device)
+{
+    QDir byUuid("/dev/disk/by-uuid");
+    const QFileInfoList links = byUuid.entryInfoList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+    for (const QFileInfo &link : links) {
+        if (link.canonicalFilePath() == device) {
+            return link.fileName();
+        }
+    }
+    return QString();
+}
+
+} // namespace
+
+ScanCache::Volume ScanCache::identify(const QString &root)
+{
+    Volume volume;
+    QStorageInfo storage(root);
+    if (!storage.isValid()) {
+        return volume;
+    }
+    // tmpfs, overlay and network mounts have no device node and no UUID
+    QString device = QFileInfo(QString::fromLocal8Bit(storage.device())).canonicalFilePath();
+    if (!device.startsWith("/dev/")) {
+        return volume;
+    }
+    QString uuid = uuidOf(device);
+    if (uuid.isEmpty()) {
+        return volume;
+    }
+
+    // Paths are cached relative to the scan root, so the root is part of the key
+    QString subdir = QDir(storage.rootPath()).relativeFilePath(QFileInfo(root).canonicalFilePath());
+    volume.id = QString("%1/%2:%3").arg(usbSerialOf(device), uuid, subdir);
+
+    // FAT and exFAT inode numbers are handed out per mount; fuseblk may be either
+    QByteArray type = storage.fileSystemType();
+    volume.stableInodes = type != "vfat" && type != "msdos" && type != "exfat" && type != "fuseblk";
+    return volume;
+}
+
+QString ScanCache::rulesetVersion(bool detailed, const QStringList &files)
+{
+    if (!detailed) {
+        return QString("quick/%1").arg(kVerdictFormat);
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(QByteArray::number(kVerdictFormat));
+    for (const QString &path : files) {
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly)) {
+            hash.addData(":" + QByteArray::number(file.size()) + ":");
+            hash.addData(&file);
+        } else {
+            hash.addData(":-:");
+        }
+    }
+    return QString("detailed/%1/%2").arg(kVerdictFormat).arg(QString::fromLatin1(hash.result().toHex().left(16)));
+}
+
+ScanCache::ScanCache(const Volume &volume, const QString &ruleset)
+    : volume(volume)
+    , version(ruleset)
+{
+}
+
+std::shared_ptr<const ScanCache> ScanCache::load(const Volume &volume, const QString &ruleset, QString *error)
+{
+    if (volume.id.isEmpty()) {
+        return nullptr;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    auto cache = std::make_shared<ScanCache>(volume, ruleset);
+    QString filter = ruleset.startsWith("quick/") ? QString() : ruleset;
+    auto insert = [&cache](const QVariantMap &row) { cache->insertRow(row); };
+    if (!DatabaseManager::instance().readScanCache(volume.id, filter, insert, error)) {
+        return nullptr;
+    }
+    qDebug() << "Loaded" << cache->size() << "cached verdicts for" << volume.id << "in" << timer.elapsed() << "ms";
+    return cache;
+}
+
+bool ScanCache::lookup(const QString &path, qint64 size, qint64 mtimeNs, quint64 inode, ScanFileResult *result,
+                       QList<ScanFileResult> *members) const
+{
+    auto it = entries.constFind(path);
+    if (it == entries.constEnd()) {
+        return false;
+    }
+    const Entry &e = it.value();
+    if (e.size != size || e.mtimeNs != mtimeNs || (volume.stableInodes && e.inode != inode)) {
+        return false;
+    }
+    fill(path, e, result);
+    result->mtimeNs = mtimeNs;
+    result->inode = inode;
+    for (const QString &memberPath : e.members) {
+        auto m = entries.constFind(memberPath);
+        if (m != entries.constEnd()) {
+            ScanFileResult member;
+            fill(memberPath, m.value(), &member);
+            members->append(member);
+        }
+    }
+    return true;
+}
+
+void ScanCache::fill(const QString &path, const Entry &entry, ScanFileResult *result) const
+{
+    result->path = path;
+    result->size = entry.size;
+    result->sha256 = entry.sha256;
+    result->sha1 = entry.sha1;
+    result->md5 = entry.md5;
+    result->fileType = entry.fileType;
+    result->entropy = entry.entropy;
+    result->highEntropy = entry.highEntropy;
+    // A quick scan may reuse a detailed entry; it only reports digests
+    if (!version.startsWith("quick/")) {
+        result->hits = entry.hits;
+        result->rules = entry.rules;
+    }
+    result->error = entry.error;
+    result->cached = true;
+}
+
+QVariantMap ScanCache::toRow(const ScanFileResult &result) const
+{
+    // Hits as "offset signature" lines; names may contain anything but newlines.
+    // Entropy regions as "offset length entropy" lines
+    QStringList hits;
+    for (const ScanHit &hit : result.hits) {
+        hits.append(QString("%1 %2").arg(hit.offset).arg(hit.signature));
+    }
+    QStringList regions;
+    for (const ScanEntropyRegion &region : result.highEntropy) {
+        regions.append(QString("%1 %2 %3").arg(region.offset).arg(region.length).arg(region.entropy, 0, 'f', 3));
+    }
+    QVariantMap row;
+    row["path"] = result.path;
+    row["size"] = result.size;
+    row["mtime_ns"] = result.mtimeNs;
+    row["inode"] = result.inode;
+    row["ruleset"] = version;
+    row["sha256"] = QString::fromLatin1(result.sha256.toHex());
+    row["sha1"] = QString::fromLatin1(result.sha1.toHex());
+    row["md5"] = QString::fromLatin1(result.md5.toHex());
+    row["file_type"] = result.fileType;
+    row["entropy"] = result.entropy;
+    row["high_entropy"] = regions.join('\n');
+    row["hits"] = hits.join('\n');
+    row["rules"] = result.rules.join('\n');
+    row["error"] = result.error;
+    return row;
+}
+
+void ScanCache::insertRow(const QVariantMap &row)
+{
+    // Entries written by an older unpacker or matcher are rescanned
+    QString ruleset = row["ruleset"].toString();
+    if (!ruleset.startsWith(QString("quick/%1").arg(kVerdictFormat))
+        && !ruleset.startsWith(QString("detailed/%1/").arg(kVerdictFormat))) {
+        return;
+    }
+
+    Entry e;
+    e.size = row["size"].toLongLong();
+    e.mtimeNs = row["mtime_ns"].toLongLong();
+    e.inode = row["inode"].toULongLong();
+    e.sha256 = QByteArray::fromHex(row["sha256"].toString().toLatin1());
+    e.sha1 = QByteArray::fromHex(row["sha1"].toString().toLatin1());
+    e.md5 = QByteArray::fromHex(row["md5"].toString().toLatin1());
+    e.fileType = row["file_type"].toString();
+    e.entropy = row["entropy"].toDouble();
+    const QStringList regions = row["high_entropy"].toString().split('\n', Qt::SkipEmptyParts);
+    for (const QString &line : regions) {
+        const QStringList fields = line.split(' ');
+        if (fields.size() == 3) {
+            ScanEntropyRegion region;
+            region.offset = fields[0].toLongLong();
+            region.length = fields[1].toLongLong();
+            region.entropy = fields[2].toDouble();
+            e.highEntropy.append(region);
+        }
+    }
+    const QStringList hits = row["hits"].toString().split('\n', Qt::SkipEmptyParts);
+    for (const QString &line : hits) {
+        int space = line.indexOf(' ');
+        if (space > 0) {
+            ScanHit hit;
+            hit.offset = line.left(space).toLongLong();
+            hit.signature = line.mid(space + 1);
+            e.hits.append(hit);
+        }
+    }
+    e.rules = row["rules"].toString().split('\n', Qt::SkipEmptyParts);
+    e.error = row["error"].toString();
+
+    // Paths on disk never contain "//", so the first one ends the file's path
+    QString path = row["path"].toString();
+    int separator = path.indexOf(kMemberSeparator);
+    if (separator > 0) {
+        entries[path.left(separator)].members.append(path);
+    }
+    QStringList members = entries.value(path).members;
+    e.members = members;
+    entries.insert(path, e);
+}
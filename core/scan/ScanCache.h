@@ -0,0 +1,79 @@
+#ifndef SCANCACHE_H
+#define SCANCACHE_H
+
+#include "ScanTypes.h"
+#include <QHash>
+#include <QStringList>
+#include <QVariantMap>
+#include <memory>
+
+// Verdicts from earlier scans of the same drive, persisted in the
+// scan_cache table and loaded into memory for the duration of a scan.
+//
+// A drive is identified by the USB serial of the device it sits on plus
+// its volume UUID (and the scan root below the mount point); a file by its
+// path, size, mtime and, where the filesystem keeps them stable across
+// mounts, its inode number. A detailed scan reuses an entry only when it
+// was produced by the same signatures and rules; a quick scan reuses any
+// entry since it only needs the digests. Archive members are cached with
+// their file and come back with it. Known-bad lookups are not cached: they
+// are redone against the current hash index.
+class ScanCache
+{
+public:
+    struct Volume {
+        QString id;                 // empty when the drive cannot be identified
+        bool stableInodes = false;  // false on FAT and exFAT, whose inodes are per mount
+    };
+
+    // Block device, USB serial and UUID behind a mounted directory
+    static Volume identify(const QString &root);
+
+    // "quick" or a digest over the files a detailed scan matches against;
+    // missing files count as empty
+    static QString rulesetVersion(bool detailed, const QStringList &files = QStringList());
+
+    ScanCache(const Volume &volume, const QString &ruleset);
+
+    // Quick scan versions load every entry of the volume, detailed ones only theirs
+    static std::shared_ptr<const ScanCache> load(const Volume &volume, const QString &ruleset,
+                                                 QString *error = nullptr);
+
+    QString volumeId() const { return volume.id; }
+    QString ruleset() const { return version; }
+    int size() const { return entries.size(); }
+
+    // Fills digests, hits, rules and archive members when path is unchanged
+    // since it was cached
+    bool lookup(const QString &path, qint64 size, qint64 mtimeNs, quint64 inode, ScanFileResult *result,
+                QList<ScanFileResult> *members) const;
+
+    // Database row (see DatabaseManager::storeScanCache) and back
+    QVariantMap toRow(const ScanFileResult &result) const;
+    void insertRow(const QVariantMap &row);
+
+private:
+    struct Entry {
+        qint64 size = -1;        // -1 until the row itself is seen (members may come first)
+        qint64 mtimeNs = 0;
+        quint64 inode = 0;
+        QByteArray sha256;
+        QByteArray sha1;
+        QByteArray md5;
+        QString fileType;
+        double entropy = 0;
+        QList<ScanEntropyRegion> highEntropy;
+        QList<ScanHit> hits;
+        QStringList rules;
+        QString error;           // members only: why unpacking stopped
+        QStringList members;     // files only: paths of their archive members
+    };
+
+    Volume volume;
+    QString version;
+    QHash<QString, Entry> entries;
+
+    void fill(const QString &path, const Entry &entry, ScanFileResult *result) const;
+};
+
+#endif // SCANCACHE_H
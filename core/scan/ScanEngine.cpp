@@ -0,0 +1,669 @@
+#include "ScanEngine.h"
+#include "AsyncFileReader.h"
+#include "BlockDeviceReader.h"
+#include "DirectoryWalker.h"
+#include "FileScanner.h"
+#include "SignatureMatcher.h"
+#include "HashIndex.h"
+#include "ScanCache.h"
+#include "VolumeReader.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
+#include <QThread>
+#include <QDebug>
+#include <atomic>
+#include <cstring>
+#include <functional>
+
+// State shared between the GUI thread, the walker and the workers
+struct ScanEngine::Shared {
+    static const int kQueueCapacity = 4096;
+
+    QMutex mutex;
+    QWaitCondition notEmpty;
+    QWaitCondition notFull;
+    QQueue<DirectoryWalker::Entry> queue;  // files waiting for a worker
+    bool walkDone = false;
+    std::shared_ptr<const SignatureMatcher> signatures;
+    std::shared_ptr<const RuleSet> rules;
+    std::shared_ptr<const HashIndex> hashIndex;
+    std::shared_ptr<const ScanCache> cache;
+    ArchiveWalker::Limits archiveLimits;
+    std::unique_ptr<AsyncFileReader> reader;  // null: each worker reads its own files
+    std::unique_ptr<VolumeReader> volume;     // set by listVolume: files come off an unmounted volume
+    std::vector<VolumeReader::File> volumeFiles;  // queue entries' inode indexes it
+
+    std::atomic<bool> cancelled{false};
+    std::atomic<int> runningTasks{0};
+    std::atomic<qint64> bytes{0};
+    std::atomic<qint64> files{0};
+    std::atomic<qint64> errors{0};
+    std::atomic<qint64> hits{0};
+    std::atomic<qint64> ruleHits{0};
+    std::atomic<qint64> knownBad{0};
+    std::atomic<qint64> highEntropy{0};
+    std::atomic<qint64> cached{0};
+    std::atomic<qint64> members{0};
+    std::atomic<qint64> discovered{0};
+
+    QMutex resultsMutex;
+    QList<ScanFileResult> results;  // finished since the last tick
+
+    void wakeAll()
+    {
+        QMutexLocker lock(&mutex);
+        notEmpty.wakeAll();
+        notFull.wakeAll();
+    }
+};
+
+namespace {
+
+// Counts what a file or member was found to be
+void tally(const std::shared_ptr<ScanEngine::Shared> &s, ScanFileResult &result)
+{
+    if (result.error.isEmpty() && s->hashIndex
+        && s->hashIndex->contains(reinterpret_cast<const uint8_t *>(result.sha256.constData()))) {
+        result.knownBad = true;
+        ++s->knownBad;
+    }
+    if (!result.highEntropy.isEmpty()) {
+        ++s->highEntropy;
+    }
+    s->hits += result.hits.size();
+    s->ruleHits += result.rules.size();
+}
+
+// Counts a finished file and hands it, members after it, to the next tick
+void record(const std::shared_ptr<ScanEngine::Shared> &s, ScanFileResult &result, QList<ScanFileResult> &members,
+            bool ok)
+{
+    if (!ok) {
+        ++s->errors;
+    }
+    tally(s, result);
+    for (ScanFileResult &member : members) {
+        tally(s, member);
+    }
+    s->members += members.size();
+    ++s->files;
+
+    QMutexLocker lock(&s->resultsMutex);
+    s->results.append(result);
+    s->results.append(members);
+}
+
+// The walker's stat is the metadata; the drive is mounted read-only
+bool lookupCache(const std::shared_ptr<ScanEngine::Shared> &s, const DirectoryWalker::Entry &entry,
+                 ScanFileResult *result, QList<ScanFileResult> *members)
+{
+    result->mtimeNs = entry.mtimeNs;
+    result->inode = quint64(entry.inode);
+    return s->cache && s->cache->lookup(result->path, qint64(entry.size), result->mtimeNs, result->inode, result,
+                                        members);
+}
+
+// Reader mode: files the rescan cache vouches for are settled here and
+// never reach the reader
+bool queueReads(const std::shared_ptr<ScanEngine::Shared> &s, std::vector<DirectoryWalker::Entry> &batch,
+                const QString &prefix)
+{
+    std::vector<std::string> paths;
+    paths.reserve(batch.size());
+    for (DirectoryWalker::Entry &entry : batch) {
+        if (s->cache) {
+            ScanFileResult result;
+            QList<ScanFileResult> members;
+            QString path = QFile::decodeName(QByteArray::fromStdString(entry.path));
+            result.path = path.startsWith(prefix) ? path.mid(prefix.size()) : path;
+            if (lookupCache(s, entry, &result, &members)) {
+                ++s->cached;
+                record(s, result, members, true);
+                continue;
+            }
+        }
+        paths.push_back(std::move(entry.path));
+    }
+    return s->reader->add(paths);
+}
+
+// The walker threads hand their batches straight to the queue (or the
+// reader), so workers start on the first files while the rest of the
+// tree is still being listed
+void walk(const std::shared_ptr<ScanEngine::Shared> &s, const QString &root, const QString &prefix, int threads)
+{
+    DirectoryWalker::Options options;
+    options.threads = threads;
+    DirectoryWalker walker(options);
+    auto sink = [&s, &prefix](std::vector<DirectoryWalker::Entry> &batch) {
+        s->discovered += qint64(batch.size());
+        if (s->reader) {
+            return queueReads(s, batch, prefix) && !s->cancelled;
+        }
+
+        // Whole batches go in, so the queue may overshoot by one
+        QMutexLocker lock(&s->mutex);
+        while (s->queue.size() >= ScanEngine::Shared::kQueueCapacity && !s->cancelled) {
+            s->notFull.wait(&s->mutex);
+        }
+        if (s->cancelled) {
+            return false;
+        }
+        for (DirectoryWalker::Entry &entry : batch) {
+            s->queue.enqueue(std::move(entry));
+        }
+        s->notEmpty.wakeAll();
+        return true;
+    };
+    std::string error;
+    if (!walker.walk(QFile::encodeName(root).toStdString(), sink, &error)) {
+        qWarning() << "Cannot walk" << root << ":" << QString::fromStdString(error);
+    } else if (walker.unreadable() > 0) {
+        qWarning() << walker.unreadable() << "directories under" << root << "could not be read";
+    }
+
+    if (s->reader) {
+        s->reader->finishAdding();
+    }
+    QMutexLocker lock(&s->mutex);
+    s->walkDone = true;
+    s->notEmpty.wakeAll();
+}
+
+// Volume mode: the whole tree is listed before anything is queued, so
+// the workers take the files in the order their data sits on the device
+void listVolume(const std::shared_ptr<ScanEngine::Shared> &s, const QString &device)
+{
+    // Opening reads the boot sector and, for NTFS, the whole $MFT map, so it
+    // is done here rather than on the GUI thread; a volume that cannot be
+    // opened is reported as the device's result, as a raw scan would
+    std::string error;
+    std::unique_ptr<VolumeReader> volume = VolumeReader::open(QFile::encodeName(device).toStdString(), &error);
+    if (!volume) {
+        if (!s->cancelled) {
+            ScanFileResult result;
+            QList<ScanFileResult> members;
+            result.path = device;
+            result.error = QString::fromStdString(error);
+            s->discovered = 1;
+            record(s, result, members, false);
+        }
+        QMutexLocker lock(&s->mutex);
+        s->walkDone = true;
+        s->notEmpty.wakeAll();
+        return;
+    }
+    qDebug() << "Listing" << device << "as unmounted" << volume->format();
+    // Workers only look at it once they have dequeued a file, which the
+    // queue's mutex orders after this
+    s->volume = std::move(volume);
+
+    if (!s->volume->list(&s->volumeFiles, &error)) {
+        qWarning() << "Cannot list" << device << ":" << QString::fromStdString(error);
+    } else if (s->volume->unreadable() > 0) {
+        qWarning() << s->volume->unreadable() << "directories on" << device << "could not be read";
+    }
+    s->discovered = qint64(s->volumeFiles.size());
+
+    for (size_t i = 0; i < s->volumeFiles.size(); ++i) {
+        DirectoryWalker::Entry entry;
+        entry.size = s->volumeFiles[i].size;
+        entry.inode = i;
+        QMutexLocker lock(&s->mutex);
+        while (s->queue.size() >= ScanEngine::Shared::kQueueCapacity && !s->cancelled) {
+            s->notFull.wait(&s->mutex);
+        }
+        if (s->cancelled) {
+            break;
+        }
+        s->queue.enqueue(std::move(entry));
+        s->notEmpty.wakeOne();
+    }
+
+    QMutexLocker lock(&s->mutex);
+    s->walkDone = true;
+    s->notEmpty.wakeAll();
+}
+
+// Volume mode: streamed from the device by the volume's parser
+bool scanVolumeFile(const std::shared_ptr<ScanEngine::Shared> &s, FileScanner &scanner, const VolumeReader::File &file,
+                    ScanFileResult *result, QList<ScanFileResult> *members,
+                    const std::function<void(qint64)> &onBytes, const std::function<bool()> &cancelled)
+{
+    result->path = QString::fromStdString(file.path);
+    if (file.deleted) {
+        result->path += " (deleted)";
+    }
+    result->mtimeNs = file.mtimeNs;
+    result->inode = file.inode;
+    std::string error;
+    std::unique_ptr<ArchiveWalker::Source> source = s->volume->stream(file, &error);
+    if (!source) {
+        result->error = QString::fromStdString(error);
+        return false;
+    }
+    return scanner.scan(*source, result->path, result, members, onBytes, cancelled);
+}
+
+void work(const std::shared_ptr<ScanEngine::Shared> &s, const QString &prefix)
+{
+    auto onBytes = [&s](qint64 n) { s->bytes += n; };
+    auto cancelled = [&s]() { return s->cancelled.load(); };
+    FileScanner scanner(s->signatures.get(), s->rules.get(), s->archiveLimits);
+
+    for (;;) {
+        DirectoryWalker::Entry entry;
+        {
+            QMutexLocker lock(&s->mutex);
+            while (s->queue.isEmpty() && !s->walkDone && !s->cancelled) {
+                s->notEmpty.wait(&s->mutex);
+            }
+            if (s->cancelled || s->queue.isEmpty()) {
+                return;
+            }
+            entry = s->queue.dequeue();
+            s->notFull.wakeOne();
+        }
+
+        ScanFileResult result;
+        QList<ScanFileResult> members;
+        bool ok;
+        if (s->volume) {
+            ok = scanVolumeFile(s, scanner, s->volumeFiles[size_t(entry.inode)], &result, &members, onBytes,
+                                cancelled);
+        } else {
+            QString path = QFile::decodeName(QByteArray::fromStdString(entry.path));
+            result.path = path.startsWith(prefix) ? path.mid(prefix.size()) : path;
+            ok = lookupCache(s, entry, &result, &members);
+            if (ok) {
+                ++s->cached;
+            } else {
+                ok = scanner.scan(path, result.path, &result, &members, onBytes, cancelled);
+            }
+        }
+        if (s->cancelled) {
+            return;
+        }
+        record(s, result, members, ok);
+    }
+}
+
+// Copies chunks handed out by a reader into a FileScanner's buffer
+class ChunkSource : public ArchiveWalker::Source
+{
+public:
+    // Fills data and length with the next chunk; false at the end, or on
+    // failure with the error set
+    using Next = std::function<bool(const uint8_t **data, size_t *length, std::string *error)>;
+
+    explicit ChunkSource(Next next) : next(std::move(next)), data(nullptr), length(0), pos(0) {}
+
+    long read(uint8_t *buffer, size_t capacity, std::string *error) override
+    {
+        if (pos == length) {
+            std::string e;
+            pos = 0;
+            if (!next(&data, &length, &e)) {
+                length = 0;
+                if (e.empty()) {
+                    return 0;
+                }
+                *error = e;
+                return -1;
+            }
+        }
+        size_t n = std::min(capacity, length - pos);
+        memcpy(buffer, data + pos, n);
+        pos += n;
+        return long(n);
+    }
+
+private:
+    Next next;
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+};
+
+// Reader mode: the I/O thread has the reads in flight, workers only scan
+void workReads(const std::shared_ptr<ScanEngine::Shared> &s, const QString &prefix)
+{
+    auto onBytes = [&s](qint64 n) { s->bytes += n; };
+    auto cancelled = [&s]() { return s->cancelled.load(); };
+    FileScanner scanner(s->signatures.get(), s->rules.get(), s->archiveLimits);
+    AsyncFileReader &reader = *s->reader;
+
+    while (AsyncFileReader::File *file = reader.next()) {
+        ScanFileResult result;
+        QList<ScanFileResult> members;
+        QString path = QFile::decodeName(file->path.c_str());
+        result.path = path.startsWith(prefix) ? path.mid(prefix.size()) : path;
+        result.mtimeNs = file->mtimeNs;
+        result.inode = file->inode;
+
+        bool ok = file->error.empty();
+        if (ok) {
+            ChunkSource source([&reader, file](const uint8_t **data, size_t *length, std::string *error) {
+                AsyncFileReader::Chunk chunk;
+                if (!reader.read(file, &chunk, error)) {
+                    return false;
+                }
+                *data = chunk.data;
+                *length = chunk.length;
+                return true;
+            });
+            ok = scanner.scan(source, result.path, &result, &members, onBytes, cancelled);
+        } else {
+            result.error = QString::fromStdString(file->error);
+        }
+        reader.release(file);
+        if (s->cancelled) {
+            return;
+        }
+        record(s, result, members, ok);
+    }
+}
+
+// One pass over the raw device: digests, type, entropy, signatures and
+// rules see every sector, allocated or not
+void scanDevice(const std::shared_ptr<ScanEngine::Shared> &s, const QString &device)
+{
+    auto onBytes = [&s](qint64 n) { s->bytes += n; };
+    auto cancelled = [&s]() { return s->cancelled.load(); };
+
+    ScanFileResult result;
+    QList<ScanFileResult> members;
+    result.path = device;
+    BlockDeviceReader reader;
+    std::string error;
+    bool ok = reader.open(QFile::encodeName(device).toStdString(), &error);
+    if (ok) {
+        qDebug() << "Reading" << device << reader.size() << "bytes" << (reader.isDirect() ? "with O_DIRECT" : "through the page cache");
+        // A partition table is not an archive; files are reached through the filesystem
+        ArchiveWalker::Limits limits = s->archiveLimits;
+        limits.maxDepth = 0;
+        FileScanner scanner(s->signatures.get(), s->rules.get(), limits);
+        ChunkSource source([&reader](const uint8_t **data, size_t *length, std::string *error) {
+            BlockDeviceReader::Chunk chunk;
+            if (!reader.next(&chunk, error)) {
+                return false;
+            }
+            *data = chunk.data;
+            *length = chunk.length;
+            return true;
+        });
+        ok = scanner.scan(source, device, &result, &members, onBytes, cancelled);
+    } else {
+        result.error = QString::fromStdString(error);
+    }
+    if (s->cancelled) {
+        return;
+    }
+    record(s, result, members, ok);
+}
+
+} // namespace
+
+ScanEngine::ScanEngine(QObject *parent)
+    : QObject(parent)
+    , workers(qMax(1, QThread::idealThreadCount()))
+    , activeWorkers(0)
+    , readQueueDepth(0)
+    , running(false)
+    , lastTickBytes(0)
+    , lastTickFiles(0)
+    , lastTickMs(0)
+{
+    tickTimer.setInterval(250);
+    connect(&tickTimer, &QTimer::timeout, this, &ScanEngine::tick);
+}
+
+ScanEngine::~ScanEngine()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+bool ScanEngine::start(const QString &rootPath, QString *error)
+{
+    if (running) {
+        if (error) *error = "A scan is already running";
+        return false;
+    }
+    QFileInfo info(rootPath);
+    if (!info.isDir() || !info.isReadable()) {
+        if (error) *error = "Cannot read " + rootPath;
+        return false;
+    }
+
+    root = QDir::cleanPath(info.absoluteFilePath());
+    QString prefix = root.endsWith('/') ? root : root + '/';
+
+    std::shared_ptr<Shared> s = prepare();
+    s->runningTasks = workers + 1;
+    activeWorkers = workers;
+    const char *reads = "blocking reads";
+    if (readQueueDepth > 0) {
+        AsyncFileReader::Options options;
+        options.queueDepth = readQueueDepth;
+        s->reader.reset(new AsyncFileReader(options));
+        std::string readerError;
+        if (s->reader->start(&readerError)) {
+            reads = AsyncFileReader::backendName(s->reader->backend());
+        } else {
+            qWarning() << "Reading files on the workers:" << QString::fromStdString(readerError);
+            s->reader.reset();
+        }
+    }
+
+    // Walker plus workers; the pool is ours so other background jobs
+    // (e.g. overlay cleanup on the global pool) do not steal slots.
+    // Listing mostly waits on the drive, so a few walker threads overlap
+    // it even on a small CPU; the walk task runs one of them.
+    pool.setMaxThreadCount(workers + 1);
+    QString walkRoot = root;
+    int walkers = qBound(2, workers, 4);
+    pool.start([s, walkRoot, prefix, walkers]() {
+        walk(s, walkRoot, prefix, walkers);
+        --s->runningTasks;
+    });
+    for (int i = 0; i < workers; ++i) {
+        pool.start([s, prefix]() {
+            if (s->reader) {
+                workReads(s, prefix);
+            } else {
+                work(s, prefix);
+            }
+            --s->runningTasks;
+        });
+    }
+
+    launched();
+    qDebug() << (signatures || rules ? "Detailed scan of" : "Quick scan of") << root << "with" << workers << "workers,"
+             << reads;
+    return true;
+}
+
+bool ScanEngine::startDevice(const QString &devicePath, QString *error)
+{
+    if (running) {
+        if (error) *error = "A scan is already running";
+        return false;
+    }
+    QFileInfo info(devicePath);
+    if (!info.exists() || !info.isReadable()) {
+        if (error) *error = "Cannot read " + devicePath;
+        return false;
+    }
+
+    root = info.absoluteFilePath();
+    std::shared_ptr<Shared> s = prepare();
+    s->cache.reset();
+    // Nothing to walk: the device is one stream, read ahead by its own thread
+    s->walkDone = true;
+    s->discovered = 1;
+    s->runningTasks = 1;
+    activeWorkers = 1;
+
+    pool.setMaxThreadCount(1);
+    QString device = root;
+    pool.start([s, device]() {
+        scanDevice(s, device);
+        --s->runningTasks;
+    });
+
+    launched();
+    qDebug() << (signatures || rules ? "Detailed raw scan of" : "Quick raw scan of") << root;
+    return true;
+}
+
+bool ScanEngine::startVolume(const QString &devicePath, QString *error)
+{
+    if (running) {
+        if (error) *error = "A scan is already running";
+        return false;
+    }
+    QFileInfo info(devicePath);
+    if (!info.exists() || !info.isReadable()) {
+        if (error) *error = "Cannot read " + devicePath;
+        return false;
+    }
+
+    root = info.absoluteFilePath();
+    std::shared_ptr<Shared> s = prepare();
+    s->cache.reset();
+    s->runningTasks = workers + 1;
+    activeWorkers = workers;
+
+    // Lister plus workers, as for a mounted drive
+    pool.setMaxThreadCount(workers + 1);
+    QString device = root;
+    pool.start([s, device]() {
+        listVolume(s, device);
+        --s->runningTasks;
+    });
+    for (int i = 0; i < workers; ++i) {
+        pool.start([s]() {
+            work(s, QString());
+            --s->runningTasks;
+        });
+    }
+
+    launched();
+    qDebug() << (signatures || rules ? "Detailed scan of" : "Quick scan of") << root << "as an unmounted volume with"
+             << workers << "workers";
+    return true;
+}
+
+std::shared_ptr<ScanEngine::Shared> ScanEngine::prepare()
+{
+    shared = std::make_shared<Shared>();
+    shared->signatures = signatures;
+    shared->rules = rules;
+    shared->hashIndex = hashIndex;
+    shared->cache = cache;
+    shared->archiveLimits = archiveLimits;
+    return shared;
+}
+
+void ScanEngine::launched()
+{
+    running = true;
+    lastTickBytes = 0;
+    lastTickFiles = 0;
+    lastTickMs = 0;
+    clock.start();
+    tickTimer.start();
+}
+
+void ScanEngine::cancel()
+{
+    if (!running || !shared) {
+        return;
+    }
+    shared->cancelled = true;
+    if (shared->reader) {
+        shared->reader->cancel();
+    }
+    shared->wakeAll();
+}
+
+void ScanEngine::tick()
+{
+    if (!shared) {
+        return;
+    }
+
+    // Read before draining: once every task has exited, this drain is the last
+    bool done = shared->runningTasks == 0;
+
+    QList<ScanFileResult> batch;
+    {
+        QMutexLocker lock(&shared->resultsMutex);
+        batch.swap(shared->results);
+    }
+    if (!batch.isEmpty()) {
+        emit filesHashed(batch);
+    }
+
+    qint64 now = clock.elapsed();
+    ScanProgress p;
+    p.files = shared->files;
+    p.bytes = shared->bytes;
+    p.errors = shared->errors;
+    p.hits = shared->hits;
+    p.ruleHits = shared->ruleHits;
+    p.knownBad = shared->knownBad;
+    p.highEntropy = shared->highEntropy;
+    p.cached = shared->cached;
+    p.members = shared->members;
+    p.queued = shared->discovered - p.files;
+    p.elapsedMs = now;
+    {
+        QMutexLocker lock(&shared->mutex);
+        p.walking = !shared->walkDone;
+    }
+    qint64 interval = qMax<qint64>(1, now - lastTickMs);
+    p.mbPerSec = (p.bytes - lastTickBytes) / 1048576.0 / (interval / 1000.0);
+    p.filesPerSec = (p.files - lastTickFiles) / (interval / 1000.0);
+    lastTickBytes = p.bytes;
+    lastTickFiles = p.files;
+    lastTickMs = now;
+    emit progress(p);
+
+    if (done) {
+        finish();
+    }
+}
+
+void ScanEngine::finish()
+{
+    tickTimer.stop();
+    running = false;
+
+    ScanSummary summary;
+    summary.root = root;
+    summary.files = shared->files;
+    summary.bytes = shared->bytes;
+    summary.errors = shared->errors;
+    summary.hits = shared->hits;
+    summary.ruleHits = shared->ruleHits;
+    summary.knownBad = shared->knownBad;
+    summary.highEntropy = shared->highEntropy;
+    summary.cached = shared->cached;
+    summary.members = shared->members;
+    summary.cacheUsed = shared->cache != nullptr;
+    summary.elapsedMs = clock.elapsed();
+    summary.workers = activeWorkers;
+    summary.cancelled = shared->cancelled;
+    shared.reset();
+
+    qDebug() << "Scan finished:" << summary.files << "files (" << summary.members << "archive members)," << summary.bytes << "bytes in"
+             << summary.elapsedMs << "ms (" << summary.averageMBps() << "MB/s)," << summary.hits << "signature hits," << summary.ruleHits << "rule hits,"
+             << summary.knownBad << "known bad," << summary.highEntropy << "high-entropy executables," << summary.cached << "unchanged since the last scan";
+    emit finished(summary);
+}
@@ -0,0 +1,97 @@
+#ifndef SCANENGINE_H
+#define SCANENGINE_H
+
+#include "ScanTypes.h"
+#include "ArchiveWalker.h"
+#include <QObject>
+#include <QThreadPool>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <memory>
+
+class SignatureMatcher;
+class RuleSet;
+class HashIndex;
+class ScanCache;
+
+// Scans a drive's files on a pool of workers, each file hashed with SHA-256,
+// SHA-1 and MD5 and checked in a single read pass (see FileScanner); results
+// and throughput are published on the GUI thread every progress interval.
+class ScanEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ScanEngine(QObject *parent = nullptr);
+    ~ScanEngine();
+
+    // Walker threads (see DirectoryWalker) list the mounted rootPath into a
+    // bounded queue, in batches, drained by one worker per core
+    bool start(const QString &rootPath, QString *error = nullptr);
+    // Reads a whole block device (or disk image) sequentially instead of
+    // the files on it, and reports it as a single result; the rescan cache
+    // does not apply
+    bool startDevice(const QString &devicePath, QString *error = nullptr);
+    // Scans the files of a FAT, exFAT or NTFS volume on a block device (or
+    // disk image) without mounting it: deleted FAT files that can still be
+    // recovered and NTFS alternate data streams included (see
+    // VolumeReader); the rescan cache does not apply. The volume is opened
+    // by the scan itself: one that cannot be is its only, failed, result
+    bool startVolume(const QString &devicePath, QString *error = nullptr);
+    void cancel();
+    bool isRunning() const { return running; }
+
+    // Defaults to the core count
+    void setWorkerCount(int count) { workers = qMax(1, count); }
+    int workerCount() const { return workers; }
+
+    // Applies to the next start(); null hashes only. The compiled matcher is
+    // shared read-only by all workers.
+    void setSignatures(std::shared_ptr<const SignatureMatcher> matcher) { signatures = std::move(matcher); }
+    void setRules(std::shared_ptr<const RuleSet> ruleSet) { rules = std::move(ruleSet); }
+    // Digests of any scan are looked up in it, lock-free against the mapped file
+    void setHashIndex(std::shared_ptr<const HashIndex> index) { hashIndex = std::move(index); }
+    // Files unchanged since the cached verdict are not read again
+    void setCache(std::shared_ptr<const ScanCache> previous) { cache = std::move(previous); }
+    // Archive members are unpacked in memory and scanned like files;
+    // maxDepth 0 scans archives as plain files
+    void setArchiveLimits(const ArchiveWalker::Limits &limits) { archiveLimits = limits; }
+    // 0 (the default) has each worker read its own files. Otherwise one I/O
+    // thread keeps this many reads in flight across upcoming files, with
+    // io_uring where the kernel allows it, and the workers only scan.
+    void setReadQueueDepth(int depth) { readQueueDepth = qMax(0, depth); }
+
+    struct Shared;
+
+signals:
+    void progress(const ScanProgress &progress);
+    // Batches of results, in completion order
+    void filesHashed(const QList<ScanFileResult> &results);
+    void finished(const ScanSummary &summary);
+
+private:
+    std::shared_ptr<Shared> shared;
+    std::shared_ptr<const SignatureMatcher> signatures;
+    std::shared_ptr<const RuleSet> rules;
+    std::shared_ptr<const HashIndex> hashIndex;
+    std::shared_ptr<const ScanCache> cache;
+    ArchiveWalker::Limits archiveLimits;
+    QThreadPool pool;
+    QTimer tickTimer;
+    QElapsedTimer clock;
+    QString root;
+    int workers;
+    int activeWorkers;     // of the running scan
+    int readQueueDepth;
+    bool running;
+    qint64 lastTickBytes;
+    qint64 lastTickFiles;
+    qint64 lastTickMs;
+
+    std::shared_ptr<Shared> prepare();
+    void launched();
+    void tick();
+    void finish();
+};
+
+#endif // SCANENGINE_H
@@ -0,0 +1,170 @@
+#include "ScanRecorder.h"
+#include "ScanEngine.h"
+#include "ScanCache.h"
+#include "../DatabaseManager.h"
+#include "../LogManager.h"
+#include <QDateTime>
+#include <QDir>
+#include <QVariantMap>
+#include <QDebug>
+
+ScanRecorder::ScanRecorder(ScanEngine *engine, const QString &kind, const QString &user, QObject *parent)
+    : QObject(parent)
+    , kind(kind)
+    , user(user)
+    , id(-1)
+{
+    connect(engine, &ScanEngine::filesHashed, this, &ScanRecorder::onFilesHashed);
+    connect(engine, &ScanEngine::finished, this, &ScanRecorder::onFinished);
+}
+
+bool ScanRecorder::begin(const QString &root, QString *error)
+{
+    id = DatabaseManager::instance().startScan(kind, root, user, error);
+    if (id < 0) {
+        return false;
+    }
+
+    QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_HHmmss");
+    report.setFileName(LogManager::instance().getReportsDirectory() + QDir::separator()
+                       + QString("%1_%2.txt").arg(kind, timestamp));
+    if (!report.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        if (error) *error = "Failed to create report file: " + report.fileName();
+        return false;
+    }
+    out.setDevice(&report);
+    out << "Scan: " << kind << "\n";
+    out << "Root: " << root << "\n";
+    out << "Started: " << QDateTime::currentDateTime().toString(Qt::ISODate) << "\n";
+    out << "User: " << user << "\n\n";
+    out << "sha256  sha1  md5  size  type  entropy  path\n";
+    return true;
+}
+
+void ScanRecorder::onFilesHashed(const QList<ScanFileResult> &results)
+{
+    if (id < 0) {
+        return;
+    }
+
+    QList<QVariantMap> rows;
+    QList<QVariantMap> cacheRows;
+    rows.reserve(results.size());
+    for (const ScanFileResult &r : results) {
+        QVariantMap row;
+        row["path"] = r.path;
+        row["size"] = r.size;
+        if (r.error.isEmpty()) {
+            row["sha256"] = QString::fromLatin1(r.sha256.toHex());
+            row["sha1"] = QString::fromLatin1(r.sha1.toHex());
+            row["md5"] = QString::fromLatin1(r.md5.toHex());
+            row["file_type"] = r.fileType;
+            row["entropy"] = r.entropy;
+            row["known_bad"] = r.knownBad;
+            out << row["sha256"].toString() << "  " << row["sha1"].toString() << "  "
+                << row["md5"].toString() << "  " << r.size << "  " << r.fileType << "  "
+                << QString::number(r.entropy, 'f', 2) << "  " << r.path << "\n";
+            if (r.knownBad) {
+                out << "    KNOWN BAD (hash index)\n";
+            }
+            QVariantList hits;
+            for (const ScanHit &hit : r.hits) {
+                QVariantMap h;
+                h["signature"] = hit.signature;
+                h["offset"] = hit.offset;
+                hits.append(h);
+                out << "    MATCH " << hit.signature << " at offset " << hit.offset << "\n";
+            }
+            row["hits"] = hits;
+            for (const QString &rule : r.rules) {
+                out << "    RULE " << rule << "\n";
+            }
+            row["rules"] = r.rules;
+            // Not an error: the digests and rules found still stand
+            if (r.rulesIncomplete) {
+                row["error"] = QString("Rules not fully evaluated: too many string matches");
+                out << "    RULES INCOMPLETE (too many string matches)\n";
+            }
+            QVariantList regions;
+            for (const ScanEntropyRegion &region : r.highEntropy) {
+                QVariantMap m;
+                m["offset"] = region.offset;
+                m["length"] = region.length;
+                m["entropy"] = region.entropy;
+                regions.append(m);
+                out << "    HIGH ENTROPY " << region.length << " bytes at offset " << region.offset << " ("
+                    << QString::number(region.entropy, 'f', 2) << " bits/byte)\n";
+            }
+            row["high_entropy"] = regions;
+        } else {
+            row["error"] = r.error;
+            out << "ERROR (" << r.error << ")  " << r.path << "\n";
+        }
+        // Unreadable files and undecided rules are retried next time; archive
+        // members that hit a limit keep that verdict with their file
+        if (cache && !r.cached && !r.rulesIncomplete && (r.error.isEmpty() || r.path.contains("//"))) {
+            cacheRows.append(cache->toRow(r));
+        }
+        rows.append(row);
+    }
+
+    QString err;
+    if (!DatabaseManager::instance().addScanFiles(id, rows, &err)) {
+        qWarning() << "Failed to record scan results:" << err;
+    }
+    if (!cacheRows.isEmpty() && !DatabaseManager::instance().storeScanCache(cache->volumeId(), cacheRows, &err)) {
+        qWarning() << "Failed to update scan cache:" << err;
+    }
+}
+
+void ScanRecorder::onFinished(const ScanSummary &summary)
+{
+    if (id < 0) {
+        return;
+    }
+
+    QString status = summary.cancelled ? "cancelled" : "completed";
+    QVariantMap stats;
+    stats["files"] = summary.files;
+    stats["bytes"] = summary.bytes;
+    stats["errors"] = summary.errors;
+    stats["duration_ms"] = summary.elapsedMs;
+    stats["status"] = status;
+    QString err;
+    if (!DatabaseManager::instance().finishScan(id, stats, &err)) {
+        qWarning() << "Failed to finish scan record:" << err;
+    }
+
+    out << "\nStatus: " << status << "\n";
+    out << "Files: " << summary.files << " (" << summary.errors << " unreadable)\n";
+    out << "Archive members: " << summary.members << "\n";
+    out << "Known bad: " << summary.knownBad << "\n";
+    out << "High-entropy executables: " << summary.highEntropy << "\n";
+    if (summary.cacheUsed) {
+        out << "Unchanged since last scan: " << summary.cached << " ("
+            << QString::number(summary.cacheHitRate() * 100, 'f', 1) << "%, verdicts reused)\n";
+    }
+    if (kind == "detailed_scan") {
+        out << "Signature matches: " << summary.hits << "\n";
+        out << "Rule matches: " << summary.ruleHits << "\n";
+    }
+    out << "Bytes: " << summary.bytes << "\n";
+    out << "Duration: " << summary.elapsedMs << " ms, " << QString::number(summary.averageMBps(), 'f', 1)
+        << " MB/s with " << summary.workers << " workers\n";
+    out.flush();
+    report.close();
+
+    QString name = kind == "quick_scan" ? "Quick scan" : kind == "detailed_scan" ? "Detailed scan" : kind;
+    QString title = QString("%1 of %2").arg(name, summary.root);
+    if (!DatabaseManager::instance().addReport(title, user, report.fileName(), "txt", &err)) {
+        qWarning() << "Failed to register scan report:" << err;
+    }
+    LogManager::instance().log(LogManager::INFO, user,
+        QString("%1: %2 files, %3 bytes in %4 ms, %5 signature matches, %6 rule matches").arg(title)
+            .arg(summary.files).arg(summary.bytes).arg(summary.elapsedMs).arg(summary.hits).arg(summary.ruleHits));
+    if (summary.knownBad > 0) {
+        LogManager::instance().log(LogManager::WARN, user,
+            QString("%1: %2 files match the known-bad hash index").arg(title).arg(summary.knownBad));
+    }
+    emit recorded(report.fileName());
+}
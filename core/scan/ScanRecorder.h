@@ -0,0 +1,47 @@
+#ifndef SCANRECORDER_H
+#define SCANRECORDER_H
+
+#include "ScanTypes.h"
+#include <QObject>
+#include <QFile>
+#include <QTextStream>
+#include <memory>
+
+class ScanEngine;
+class ScanCache;
+
+// Persists one scan run: a scans row plus scan_files rows in the database,
+// and a plain-text report (registered with the Reports screen) listing every
+// digest. Rows and report lines are written as batches arrive, so nothing
+// accumulates in memory for large drives. Freshly read files also refresh
+// the rescan cache when one is set.
+class ScanRecorder : public QObject
+{
+    Q_OBJECT
+
+public:
+    ScanRecorder(ScanEngine *engine, const QString &kind, const QString &user, QObject *parent = nullptr);
+
+    // Call right after the engine started
+    bool begin(const QString &root, QString *error = nullptr);
+    void setCache(std::shared_ptr<const ScanCache> scanCache) { cache = std::move(scanCache); }
+
+    int scanId() const { return id; }
+    QString reportPath() const { return report.fileName(); }
+
+signals:
+    void recorded(const QString &reportPath);
+
+private:
+    QString kind;
+    QString user;
+    int id;
+    QFile report;
+    QTextStream out;
+    std::shared_ptr<const ScanCache> cache;
+
+    void onFilesHashed(const QList<ScanFileResult> &results);
+    void onFinished(const ScanSummary &summary);
+};
+
+#endif // SCANRECORDER_H
@@ -0,0 +1,84 @@
+#ifndef SCANTYPES_H
+#define SCANTYPES_H
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+// A signature found by the detailed scan
+struct ScanHit {
+    QString signature;
+    qint64 offset = 0;     // of the first matching byte
+};
+
+// A stretch of an executable whose entropy suggests packed or encrypted code
+struct ScanEntropyRegion {
+    qint64 offset = 0;
+    qint64 length = 0;
+    double entropy = 0;    // bits per byte, highest 4 KiB window inside
+};
+
+// One hashed file or archive member ("a.zip//dir/b.exe"). Digests are raw
+// bytes; use toHex() for display/storage.
+struct ScanFileResult {
+    QString path;          // relative to the scan root
+    qint64 size = 0;
+    QByteArray sha256;
+    QByteArray sha1;
+    QByteArray md5;
+    QString fileType;      // from the leading bytes, see FileTypeIdentifier::name()
+    double entropy = 0;    // bits per byte over the whole content, 0..8
+    QList<ScanEntropyRegion> highEntropy; // executables only
+    QList<ScanHit> hits;   // detailed scan only, capped per file
+    QStringList rules;     // detailed scan: rules whose condition held
+    bool rulesIncomplete = false; // a string matched too often for every rule to be decided
+    bool knownBad = false; // SHA-256 is in the known-bad hash index
+    qint64 mtimeNs = 0;    // metadata as of the scan, for the rescan cache
+    quint64 inode = 0;
+    bool cached = false;   // unchanged since a previous scan; verdict reused
+    QString error;         // set when the file could not be read
+};
+
+struct ScanProgress {
+    qint64 files = 0;      // finished (hashed or failed)
+    qint64 bytes = 0;      // read so far, including partially read files
+    qint64 errors = 0;
+    qint64 hits = 0;
+    qint64 ruleHits = 0;
+    qint64 knownBad = 0;
+    qint64 highEntropy = 0; // executables with high-entropy regions
+    qint64 cached = 0;     // files whose previous verdict was reused
+    qint64 members = 0;    // archive members unpacked (not counted in files)
+    qint64 queued = 0;     // discovered by the walker but not finished
+    qint64 elapsedMs = 0;
+    double mbPerSec = 0;   // over the last progress interval
+    double filesPerSec = 0;
+    bool walking = true;   // the walker is still discovering files
+};
+
+struct ScanSummary {
+    QString root;
+    qint64 files = 0;
+    qint64 bytes = 0;
+    qint64 errors = 0;
+    qint64 hits = 0;
+    qint64 ruleHits = 0;
+    qint64 knownBad = 0;
+    qint64 highEntropy = 0;
+    qint64 cached = 0;
+    qint64 members = 0;
+    qint64 elapsedMs = 0;
+    int workers = 0;
+    bool cancelled = false;
+    bool cacheUsed = false; // the drive was identified and the rescan cache consulted
+
+    double averageMBps() const {
+        return elapsedMs > 0 ? (bytes / 1048576.0) / (elapsedMs / 1000.0) : 0;
+    }
+    double cacheHitRate() const {
+        return files > 0 ? double(cached) / files : 0;
+    }
+};
+
+#endif // SCANTYPES_H
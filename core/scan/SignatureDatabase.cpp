@@ -0,0 +1,132 @@
+#include "SignatureDatabase.h"
+#include <QFile>
+#include <QDir>
+#include <QStandardPaths>
+#include <QTextStream>
+#include <QElapsedTimer>
+#include <QDebug>
+
+namespace {
+
+const char *const kEicarName = "EICAR-Test-File";
+const char *const kEicarPattern =
+    "58354f2150254041505b345c505a58353428505e2937434329377d2445494341522d5354414e"
+    "444152442d414e544956495255532d544553542d46494c452124482b482a";
+
+} // namespace
+
+QString SignatureDatabase::defaultPath()
+{
+    QString path = qEnvironmentVariable("SDUI_SIGNATURES");
+    if (!path.isEmpty()) {
+        return path;
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QDir::separator() + "signatures.txt";
+}
+
+QString SignatureDatabase::defaultRulesPath()
+{
+    QString path = qEnvironmentVariable("SDUI_RULES");
+    if (!path.isEmpty()) {
+        return path;
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QDir::separator() + "rules.yar";
+}
+
+QString SignatureDatabase::defaultHashIndexPath()
+{
+    QString path = qEnvironmentVariable("SDUI_HASH_INDEX");
+    if (!path.isEmpty()) {
+        return path;
+    }
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + QDir::separator() + "known_bad.hix";
+}
+
+std::shared_ptr<const SignatureMatcher> SignatureDatabase::load(const QString &path, QString *error)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    auto matcher = std::make_shared<SignatureMatcher>();
+    matcher->add(kEicarName, kEicarPattern);
+
+    QFile file(path);
+    if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        QTextStream in(&file);
+        int lineNumber = 0;
+        while (!in.atEnd()) {
+            QString line = in.readLine().trimmed();
+            ++lineNumber;
+            if (line.isEmpty() || line.startsWith('#')) {
+                continue;
+            }
+            int colon = line.lastIndexOf(':');
+            if (colon <= 0) {
+                if (error) *error = QString("%1:%2: expected name:hexpattern").arg(path).arg(lineNumber);
+                return nullptr;
+            }
+            std::string err;
+            if (matcher->add(line.left(colon).trimmed().toStdString(), line.mid(colon + 1).toStdString(), &err) < 0) {
+                if (error) *error = QString("%1:%2: %3").arg(path).arg(lineNumber).arg(QString::fromStdString(err));
+                return nullptr;
+            }
+        }
+    } else if (file.exists()) {
+        if (error) *error = "Cannot read " + path + ": " + file.errorString();
+        return nullptr;
+    }
+
+    std::string err;
+    if (!matcher->compile(&err)) {
+        if (error) *error = QString::fromStdString(err);
+        return nullptr;
+    }
+
+    SignatureMatcher::Stats stats = matcher->stats();
+    qDebug() << "Loaded" << stats.patterns << "signatures from" << path << "in" << timer.elapsed() << "ms:"
+             << stats.states << "states," << stats.memoryBytes / 1024 << "KiB," << stats.mode << "mode,"
+             << stats.prefilter << "prefilter";
+    return matcher;
+}
+
+std::shared_ptr<const RuleSet> SignatureDatabase::loadRules(const QString &path, QString *error)
+{
+    QFile file(path);
+    if (!file.exists()) {
+        return nullptr;
+    }
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (error) *error = "Cannot read " + path + ": " + file.errorString();
+        return nullptr;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    auto rules = std::make_shared<RuleSet>();
+    std::string err;
+    if (!rules->compile(file.readAll().toStdString(), &err)) {
+        if (error) *error = path + ": " + QString::fromStdString(err);
+        return nullptr;
+    }
+    qDebug() << "Compiled" << rules->ruleCount() << "rules (" << rules->stringCount() << "strings,"
+             << rules->codeSize() << "instructions) from" << path << "in" << timer.elapsed() << "ms";
+    return rules;
+}
+
+std::shared_ptr<const HashIndex> SignatureDatabase::loadHashIndex(const QString &path, QString *error)
+{
+    if (!QFile::exists(path)) {
+        return nullptr;
+    }
+
+    // Only maps the file; pages come in as lookups touch them
+    auto index = std::make_shared<HashIndex>();
+    std::string err;
+    if (!index->open(QFile::encodeName(path).toStdString(), &err)) {
+        if (error) *error = QString::fromStdString(err);
+        return nullptr;
+    }
+    qDebug() << "Mapped" << index->size() << "known-bad digests from" << path << "("
+             << index->fileSize() / 1048576 << "MiB)";
+    return index;
+}
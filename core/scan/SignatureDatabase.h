@@ -0,0 +1,34 @@
+#ifndef SIGNATUREDATABASE_H
+#define SIGNATUREDATABASE_H
+
+#include "SignatureMatcher.h"
+#include "RuleSet.h"
+#include "HashIndex.h"
+#include <QString>
+#include <memory>
+
+// Loads what the detailed scan matches against.
+//
+// Signatures: one "name:hexpattern" per line ('#' starts a comment); the
+// EICAR test string is always included so the pipeline can be checked end
+// to end. Rules: source for RuleCompiler. Hash index: known-bad SHA-256
+// digests built by hashindex-build, used by both scans.
+class SignatureDatabase
+{
+public:
+    // SDUI_SIGNATURES, else signatures.txt in the app data directory
+    static QString defaultPath();
+    // SDUI_RULES, else rules.yar in the app data directory
+    static QString defaultRulesPath();
+    // SDUI_HASH_INDEX, else known_bad.hix in the app data directory
+    static QString defaultHashIndexPath();
+
+    // A missing file is not an error (built-ins only); malformed lines are
+    static std::shared_ptr<const SignatureMatcher> load(const QString &path, QString *error = nullptr);
+    // Null without an error when there is no rules file
+    static std::shared_ptr<const RuleSet> loadRules(const QString &path, QString *error = nullptr);
+    // Null without an error when there is no index file
+    static std::shared_ptr<const HashIndex> loadHashIndex(const QString &path, QString *error = nullptr);
+};
+
+#endif // SIGNATUREDATABASE_H
@@ -0,0 +1,692 @@
+#include "SignatureMatcher.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SDUI_SIG_X86 1
+#endif
+
+namespace {
+
+const size_t kMaxPatternLength = 4096;
+const size_t kMaxAtomLength = 12;
+// Full transition rows for the first states in BFS order (1 KiB each)
+const size_t kDenseBudgetBytes = 16u << 20;
+// Above this many distinct atom byte pairs the SIMD classifier stops paying off
+const size_t kSimdMaxPairs = 64;
+// Above this share of byte pairs the automaton rarely returns to the root
+const double kAnchoredPairDensity = 0.05;
+const unsigned kHashBits = 21;
+
+int hexNibble(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+inline bool testBit(const std::vector<uint64_t> &bits, uint32_t index)
+{
+    return (bits[index >> 6] >> (index & 63)) & 1;
+}
+
+inline void setBit(std::vector<uint64_t> &bits, uint32_t index)
+{
+    bits[index >> 6] |= uint64_t(1) << (index & 63);
+}
+
+inline uint32_t quadHash(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+inline uint32_t octHash(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return uint32_t((v * 0x9e3779b97f4a7c15ull) >> (64 - kHashBits));
+}
+
+// Rough rarity of an atom in real files: padding and filler bytes are
+// everywhere, so they count for little, as do repeats within the atom
+int atomQuality(const uint8_t *atom, size_t length)
+{
+    bool seen[256] = {};
+    int quality = 0;
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t b = atom[i];
+        bool common = b == 0x00 || b == 0xff || b == 0x20 || b == 0xcc || b == 0x90;
+        quality += common ? 1 : 4;
+        if (!seen[b]) {
+            seen[b] = true;
+            quality += 2;
+        }
+    }
+    return quality;
+}
+
+#ifdef SDUI_SIG_X86
+// Two-byte shufti: a lane is a candidate when byte i and byte i+1 fall in a
+// common bucket; candidates are confirmed against the exact pair bitmap
+__attribute__((target("avx2")))
+size_t findPairAvx2(const uint8_t *data, size_t pos, size_t length,
+                    const uint8_t (*tables)[16], const uint64_t *pairs)
+{
+    __m256i t[4];
+    for (int k = 0; k < 4; ++k) {
+        t[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[k])));
+    }
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    while (pos + 33 <= length) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + 1));
+        __m256i r = _mm256_and_si256(_mm256_shuffle_epi8(t[0], _mm256_and_si256(v0, nibble)),
+                                     _mm256_shuffle_epi8(t[1], _mm256_and_si256(_mm256_srli_epi16(v0, 4), nibble)));
+        r = _mm256_and_si256(r, _mm256_shuffle_epi8(t[2], _mm256_and_si256(v1, nibble)));
+        r = _mm256_and_si256(r, _mm256_shuffle_epi8(t[3], _mm256_and_si256(_mm256_srli_epi16(v1, 4), nibble)));
+        uint32_t mask = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(r, zero)));
+        while (mask) {
+            size_t at = pos + __builtin_ctz(mask);
+            uint32_t pair = (uint32_t(data[at]) << 8) | data[at + 1];
+            if ((pairs[pair >> 6] >> (pair & 63)) & 1) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+        pos += 32;
+    }
+    return pos;
+}
+
+__attribute__((target("ssse3")))
+size_t findPairSsse3(const uint8_t *data, size_t pos, size_t length,
+                     const uint8_t (*tables)[16], const uint64_t *pairs)
+{
+    __m128i t[4];
+    for (int k = 0; k < 4; ++k) {
+        t[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables[k]));
+    }
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+    while (pos + 17 <= length) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + 1));
+        __m128i r = _mm_and_si128(_mm_shuffle_epi8(t[0], _mm_and_si128(v0, nibble)),
+                                  _mm_shuffle_epi8(t[1], _mm_and_si128(_mm_srli_epi16(v0, 4), nibble)));
+        r = _mm_and_si128(r, _mm_shuffle_epi8(t[2], _mm_and_si128(v1, nibble)));
+        r = _mm_and_si128(r, _mm_shuffle_epi8(t[3], _mm_and_si128(_mm_srli_epi16(v1, 4), nibble)));
+        uint32_t mask = ~uint32_t(_mm_movemask_epi8(_mm_cmpeq_epi8(r, zero))) & 0xffffu;
+        while (mask) {
+            size_t at = pos + __builtin_ctz(mask);
+            uint32_t pair = (uint32_t(data[at]) << 8) | data[at + 1];
+            if ((pairs[pair >> 6] >> (pair & 63)) & 1) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+        pos += 16;
+    }
+    return pos;
+}
+#endif
+
+int detectSimdLevel()
+{
+#ifdef SDUI_SIG_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return 2;
+    if (__builtin_cpu_supports("ssse3")) return 1;
+#endif
+    return 0;
+}
+
+} // namespace
+
+SignatureMatcher::SignatureMatcher()
+    : maxLength(0)
+    , compiled(false)
+    , denseCount(0)
+    , simdLevel(detectSimdLevel())
+    , useSimdPrefilter(false)
+    , anchored(false)
+{
+    memset(firstByte, 0, sizeof(firstByte));
+    memset(singleByteAtom, 0, sizeof(singleByteAtom));
+    memset(shufti, 0, sizeof(shufti));
+}
+
+int SignatureMatcher::add(const std::string &name, const std::string &hexPattern, std::string *error)
+{
+    std::vector<uint8_t> value;
+    std::vector<uint8_t> mask;
+    int pending = -1;
+    for (char c : hexPattern) {
+        if (c == ' ' || c == '\t') {
+            continue;
+        }
+        int n = c == '?' ? 0x10 : hexNibble(c);
+        if (n < 0) {
+            if (error) *error = "Invalid character '" + std::string(1, c) + "' in signature " + name;
+            return -1;
+        }
+        if (pending < 0) {
+            pending = n;
+            continue;
+        }
+        uint8_t v = uint8_t(((pending & 0x0f) << 4) | (n & 0x0f));
+        uint8_t m = uint8_t((pending == 0x10 ? 0x00 : 0xf0) | (n == 0x10 ? 0x00 : 0x0f));
+        value.push_back(v & m);
+        mask.push_back(m);
+        pending = -1;
+    }
+    if (pending >= 0) {
+        if (error) *error = "Odd number of hex digits in signature " + name;
+        return -1;
+    }
+    if (value.empty() || value.size() > kMaxPatternLength) {
+        if (error) *error = "Signature " + name + " must be 1 to 4096 bytes long";
+        return -1;
+    }
+
+    // Atom: the best-scoring window of fully specified bytes
+    size_t bestStart = 0, bestLength = 0;
+    int bestQuality = -1;
+    for (size_t i = 0; i < mask.size();) {
+        if (mask[i] != 0xff) {
+            ++i;
+            continue;
+        }
+        size_t j = i;
+        while (j < mask.size() && mask[j] == 0xff) {
+            ++j;
+        }
+        size_t window = std::min(j - i, kMaxAtomLength);
+        for (size_t start = i; start + window <= j; ++start) {
+            int quality = atomQuality(&value[start], window);
+            if (quality > bestQuality) {
+                bestStart = start;
+                bestLength = window;
+                bestQuality = quality;
+            }
+        }
+        i = j;
+    }
+    if (bestLength == 0) {
+        if (error) *error = "Signature " + name + " has no fully specified byte";
+        return -1;
+    }
+
+    Pattern p;
+    p.name = name;
+    p.bytesOffset = uint32_t(values.size());
+    p.length = uint32_t(value.size());
+    p.atomOffset = uint32_t(bestStart);
+    p.atomLength = uint32_t(bestLength);
+    values.insert(values.end(), value.begin(), value.end());
+    masks.insert(masks.end(), mask.begin(), mask.end());
+    patterns.push_back(p);
+    maxLength = std::max(maxLength, value.size());
+    compiled = false;
+    return int(patterns.size() - 1);
+}
+
+bool SignatureMatcher::compile(std::string *error)
+{
+    if (patterns.empty()) {
+        if (error) *error = "No signatures loaded";
+        return false;
+    }
+
+    compiled = false;
+    denseCount = 0;
+
+    // Trie over the atoms, in insertion order first
+    struct Edge { uint32_t parent; uint8_t byte; uint32_t child; };
+    std::unordered_map<uint64_t, uint32_t> children;
+    std::vector<Edge> edges;
+    std::vector<std::pair<uint32_t, uint32_t>> outputs;  // (node, pattern)
+    uint32_t nodes = 1;
+    for (uint32_t id = 0; id < patterns.size(); ++id) {
+        const Pattern &p = patterns[id];
+        const uint8_t *atom = &values[p.bytesOffset + p.atomOffset];
+        uint32_t node = 0;
+        for (uint32_t k = 0; k < p.atomLength; ++k) {
+            uint64_t key = (uint64_t(node) << 8) | atom[k];
+            auto it = children.find(key);
+            if (it == children.end()) {
+                it = children.emplace(key, nodes).first;
+                edges.push_back({node, atom[k], nodes});
+                ++nodes;
+            }
+            node = it->second;
+        }
+        outputs.push_back({node, id});
+    }
+    children.clear();
+    std::sort(edges.begin(), edges.end(), [](const Edge &a, const Edge &b) {
+        return a.parent != b.parent ? a.parent < b.parent : a.byte < b.byte;
+    });
+    std::vector<uint32_t> oldStart(nodes + 1, 0);
+    for (const Edge &e : edges) {
+        ++oldStart[e.parent + 1];
+    }
+    for (uint32_t s = 0; s < nodes; ++s) {
+        oldStart[s + 1] += oldStart[s];
+    }
+
+    // Renumber breadth-first so shallow states are contiguous
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> renumber(nodes);
+    order.reserve(nodes);
+    order.push_back(0);
+    renumber[0] = 0;
+    for (size_t head = 0; head < order.size(); ++head) {
+        uint32_t old = order[head];
+        for (uint32_t e = oldStart[old]; e < oldStart[old + 1]; ++e) {
+            renumber[edges[e].child] = uint32_t(order.size());
+            order.push_back(edges[e].child);
+        }
+    }
+
+    edgeStart.assign(nodes + 1, 0);
+    edgeBytes.clear();
+    edgeTargets.clear();
+    edgeBytes.reserve(edges.size());
+    edgeTargets.reserve(edges.size());
+    depth.assign(nodes, 0);
+    for (uint32_t s = 0; s < nodes; ++s) {
+        uint32_t old = order[s];
+        edgeStart[s] = uint32_t(edgeBytes.size());
+        for (uint32_t e = oldStart[old]; e < oldStart[old + 1]; ++e) {
+            uint32_t target = renumber[edges[e].child];
+            edgeBytes.push_back(edges[e].byte);
+            edgeTargets.push_back(target);
+            depth[target] = uint16_t(depth[s] + 1);
+        }
+    }
+    edgeStart[nodes] = uint32_t(edgeBytes.size());
+    edges.clear();
+    edges.shrink_to_fit();
+
+    std::vector<uint32_t> ownCount(nodes + 1, 0);
+    for (auto &o : outputs) {
+        o.first = renumber[o.first];
+        ++ownCount[o.first + 1];
+    }
+    outStart.assign(nodes + 1, 0);
+    for (uint32_t s = 0; s < nodes; ++s) {
+        outStart[s + 1] = outStart[s] + ownCount[s + 1];
+    }
+    outPatterns.assign(outputs.size(), 0);
+    std::vector<uint32_t> fill(outStart.begin(), outStart.end() - 1);
+    for (const auto &o : outputs) {
+        outPatterns[fill[o.first]++] = o.second;
+    }
+
+    // Failure and dictionary links; parents precede children in BFS order
+    fail.assign(nodes, 0);
+    dictLink.assign(nodes, 0);
+    hasOutput.assign(nodes, 0);
+    for (uint32_t s = 0; s < nodes; ++s) {
+        for (uint32_t e = edgeStart[s]; e < edgeStart[s + 1]; ++e) {
+            uint32_t t = edgeTargets[e];
+            uint32_t f = 0;
+            if (s != 0) {
+                uint32_t g = fail[s];
+                for (;;) {
+                    uint32_t c = child(g, edgeBytes[e]);
+                    if (c != kNoState) {
+                        f = c;
+                        break;
+                    }
+                    if (g == 0) {
+                        break;
+                    }
+                    g = fail[g];
+                }
+            }
+            fail[t] = f;
+            dictLink[t] = outStart[f + 1] > outStart[f] ? f : dictLink[f];
+            hasOutput[t] = outStart[t + 1] > outStart[t] || dictLink[t] != 0;
+        }
+    }
+
+    // Dense rows: complete transitions, filled in BFS order so fail rows exist
+    denseCount = uint32_t(std::min<size_t>(nodes, kDenseBudgetBytes / (256 * sizeof(uint32_t))));
+    dense.assign(size_t(denseCount) * 256, 0);
+    for (uint32_t s = 0; s < denseCount; ++s) {
+        uint32_t *row = &dense[size_t(s) * 256];
+        if (s != 0) {
+            memcpy(row, &dense[size_t(fail[s]) * 256], 256 * sizeof(uint32_t));
+        }
+        for (uint32_t e = edgeStart[s]; e < edgeStart[s + 1]; ++e) {
+            row[edgeBytes[e]] = edgeTargets[e];
+        }
+    }
+
+    // Prefilter tables
+    memset(firstByte, 0, sizeof(firstByte));
+    memset(singleByteAtom, 0, sizeof(singleByteAtom));
+    memset(shufti, 0, sizeof(shufti));
+    pairBits.assign(65536 / 64, 0);
+    shortPairBits.assign(65536 / 64, 0);
+    quadBits.assign((size_t(1) << kHashBits) / 64, 0);
+    shortQuadBits.assign((size_t(1) << kHashBits) / 64, 0);
+    octBits.assign((size_t(1) << kHashBits) / 64, 0);
+    for (const Pattern &p : patterns) {
+        const uint8_t *atom = &values[p.bytesOffset + p.atomOffset];
+        firstByte[atom[0]] = true;
+        if (p.atomLength == 1) {
+            singleByteAtom[atom[0]] = true;
+            for (uint32_t next = 0; next < 256; ++next) {
+                setBit(pairBits, (uint32_t(atom[0]) << 8) | next);
+            }
+            continue;
+        }
+        uint32_t pair = (uint32_t(atom[0]) << 8) | atom[1];
+        setBit(pairBits, pair);
+        if (p.atomLength < 4) {
+            setBit(shortPairBits, pair);
+            continue;
+        }
+        setBit(quadBits, quadHash(atom));
+        if (p.atomLength < 8) {
+            setBit(shortQuadBits, quadHash(atom));
+        } else {
+            setBit(octBits, octHash(atom));
+        }
+    }
+    // Shufti buckets: pairs sharing a first byte share a bucket, first bytes
+    // are dealt round-robin over the eight buckets
+    size_t pairs = 0;
+    int firstIndex = 0;
+    for (uint32_t first = 0; first < 256; ++first) {
+        bool any = false;
+        uint8_t bucket = uint8_t(1u << (firstIndex & 7));
+        for (uint32_t second = 0; second < 256; ++second) {
+            uint32_t pair = (first << 8) | second;
+            if (!testBit(pairBits, pair)) {
+                continue;
+            }
+            any = true;
+            ++pairs;
+            shufti[0][first & 0x0f] |= bucket;
+            shufti[1][first >> 4] |= bucket;
+            shufti[2][second & 0x0f] |= bucket;
+            shufti[3][second >> 4] |= bucket;
+        }
+        firstIndex += any;
+    }
+    useSimdPrefilter = simdLevel > 0 && pairs <= kSimdMaxPairs;
+    anchored = double(pairs) / 65536.0 > kAnchoredPairDensity;
+
+    compiled = true;
+    return true;
+}
+
+SignatureMatcher::Stats SignatureMatcher::stats() const
+{
+    Stats s;
+    s.patterns = patterns.size();
+    s.states = fail.size();
+    s.denseStates = denseCount;
+    s.sparseEdges = edgeBytes.size();
+    s.memoryBytes = dense.size() * sizeof(uint32_t)
+        + edgeStart.size() * sizeof(uint32_t) + edgeBytes.size() + edgeTargets.size() * sizeof(uint32_t)
+        + fail.size() * sizeof(uint32_t) + depth.size() * sizeof(uint16_t)
+        + outStart.size() * sizeof(uint32_t) + outPatterns.size() * sizeof(uint32_t)
+        + dictLink.size() * sizeof(uint32_t) + hasOutput.size()
+        + (pairBits.size() + shortPairBits.size() + quadBits.size() + shortQuadBits.size()
+           + octBits.size()) * sizeof(uint64_t)
+        + values.size() + masks.size();
+    for (int b = 0; b < 256; ++b) {
+        s.firstBytes += firstByte[b];
+    }
+    size_t pairs = 0;
+    for (uint64_t w : pairBits) {
+        pairs += __builtin_popcountll(w);
+    }
+    s.pairDensity = double(pairs) / 65536.0;
+    if (!useSimdPrefilter) {
+        s.prefilter = "scalar";
+    } else {
+        s.prefilter = simdLevel == 2 ? "avx2" : "ssse3";
+    }
+    s.mode = anchored ? "anchored" : "automaton";
+    return s;
+}
+
+uint32_t SignatureMatcher::child(uint32_t state, uint8_t byte) const
+{
+    if (state < denseCount) {
+        uint32_t t = dense[size_t(state) * 256 + byte];
+        return depth[t] == depth[state] + 1 ? t : kNoState;
+    }
+    const uint8_t *begin = edgeBytes.data() + edgeStart[state];
+    const uint8_t *end = edgeBytes.data() + edgeStart[state + 1];
+    const uint8_t *it = std::lower_bound(begin, end, byte);
+    if (it == end || *it != byte) {
+        return kNoState;
+    }
+    return edgeTargets[edgeStart[state] + (it - begin)];
+}
+
+uint32_t SignatureMatcher::step(uint32_t state, uint8_t byte) const
+{
+    while (state >= denseCount) {
+        uint32_t t = child(state, byte);
+        if (t != kNoState) {
+            return t;
+        }
+        state = fail[state];
+    }
+    return dense[size_t(state) * 256 + byte];
+}
+
+size_t SignatureMatcher::findPair(const uint8_t *data, size_t pos, size_t length) const
+{
+    const uint64_t *pairs = pairBits.data();
+#ifdef SDUI_SIG_X86
+    if (useSimdPrefilter) {
+        if (simdLevel == 2) {
+            pos = findPairAvx2(data, pos, length, shufti, pairs);
+        } else {
+            pos = findPairSsse3(data, pos, length, shufti, pairs);
+        }
+    }
+#endif
+    while (pos + 1 < length) {
+        uint32_t pair = (uint32_t(data[pos]) << 8) | data[pos + 1];
+        if ((pairs[pair >> 6] >> (pair & 63)) & 1) {
+            break;
+        }
+        ++pos;
+    }
+    return pos;
+}
+
+// First position >= pos where an atom may start. Exact on the negative
+// side: a skipped position never starts an atom.
+size_t SignatureMatcher::nextCandidate(const uint8_t *data, size_t pos, size_t length) const
+{
+    for (;; ++pos) {
+        // Single-byte atoms set every pair they start, so the pair bitmap
+        // alone decides which positions go further
+        pos = findPair(data, pos, length);
+        if (pos + 1 >= length) {
+            return pos < length && firstByte[data[pos]] ? pos : length;
+        }
+        uint8_t b = data[pos];
+        uint32_t pair = (uint32_t(b) << 8) | data[pos + 1];
+        if (singleByteAtom[b]) {
+            return pos;
+        }
+        if (pos + 4 > length || testBit(shortPairBits, pair)) {
+            return pos;
+        }
+        uint32_t quad = quadHash(data + pos);
+        if (!testBit(quadBits, quad)) {
+            continue;
+        }
+        if (pos + 8 > length || testBit(shortQuadBits, quad) || testBit(octBits, octHash(data + pos))) {
+            return pos;
+        }
+    }
+}
+
+bool SignatureMatcher::verify(uint32_t pattern, const uint8_t *data, size_t length, size_t start) const
+{
+    const Pattern &p = patterns[pattern];
+    if (start + p.length > length) {
+        return false;
+    }
+    const uint8_t *v = &values[p.bytesOffset];
+    const uint8_t *m = &masks[p.bytesOffset];
+    const uint8_t *d = data + start;
+    for (uint32_t k = 0; k < p.length; ++k) {
+        if ((d[k] & m[k]) != v[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <bool Crossing>
+void SignatureMatcher::report(uint32_t pattern, const uint8_t *data, size_t length, size_t atomStart,
+                              size_t splitAt, std::vector<Match> &out, uint64_t baseOffset) const
+{
+    const Pattern &p = patterns[pattern];
+    if (atomStart < p.atomOffset) {
+        return;
+    }
+    size_t start = atomStart - p.atomOffset;
+    if (Crossing && (start >= splitAt || start + p.length <= splitAt)) {
+        return;
+    }
+    if (verify(pattern, data, length, start)) {
+        out.push_back({pattern, baseOffset + start});
+    }
+}
+
+template <bool Crossing>
+void SignatureMatcher::runAutomaton(const uint8_t *data, size_t length, size_t splitAt,
+                                    std::vector<Match> &out, uint64_t baseOffset) const
+{
+    uint32_t state = 0;
+    size_t i = 0;
+    while (i < length) {
+        if (state == 0) {
+            i = nextCandidate(data, i, length);
+            if (i >= length) {
+                break;
+            }
+        }
+        state = step(state, data[i]);
+        if (hasOutput[state]) {
+            for (uint32_t s = state; s != 0; s = dictLink[s]) {
+                for (uint32_t o = outStart[s]; o < outStart[s + 1]; ++o) {
+                    uint32_t id = outPatterns[o];
+                    report<Crossing>(id, data, length, i + 1 - patterns[id].atomLength, splitAt, out, baseOffset);
+                }
+            }
+        }
+        ++i;
+    }
+}
+
+template <bool Crossing>
+void SignatureMatcher::runAnchored(const uint8_t *data, size_t length, size_t splitAt,
+                                   std::vector<Match> &out, uint64_t baseOffset) const
+{
+    size_t pos = 0;
+    for (;;) {
+        pos = nextCandidate(data, pos, length);
+        if (pos >= length) {
+            break;
+        }
+        uint32_t state = 0;
+        for (size_t k = pos; k < length; ++k) {
+            state = child(state, data[k]);
+            if (state == kNoState) {
+                break;
+            }
+            for (uint32_t o = outStart[state]; o < outStart[state + 1]; ++o) {
+                report<Crossing>(outPatterns[o], data, length, pos, splitAt, out, baseOffset);
+            }
+        }
+        ++pos;
+    }
+}
+
+void SignatureMatcher::scan(const uint8_t *data, size_t length, std::vector<Match> &out, uint64_t baseOffset) const
+{
+    if (!compiled || length == 0) {
+        return;
+    }
+    if (anchored) {
+        runAnchored<false>(data, length, 0, out, baseOffset);
+    } else {
+        runAutomaton<false>(data, length, 0, out, baseOffset);
+    }
+}
+
+void SignatureMatcher::scanCrossing(const uint8_t *data, size_t length, size_t splitAt,
+                                    std::vector<Match> &out, uint64_t baseOffset) const
+{
+    if (!compiled || length == 0) {
+        return;
+    }
+    if (anchored) {
+        runAnchored<true>(data, length, splitAt, out, baseOffset);
+    } else {
+        runAutomaton<true>(data, length, splitAt, out, baseOffset);
+    }
+}
+
+SignatureStream::SignatureStream(const SignatureMatcher &matcher)
+    : matcher(matcher)
+    , consumed(0)
+{
+}
+
+void SignatureStream::feed(const uint8_t *data, size_t length, std::vector<SignatureMatcher::Match> &out)
+{
+    if (length == 0) {
+        return;
+    }
+    size_t keep = matcher.maxPatternLength() > 0 ? matcher.maxPatternLength() - 1 : 0;
+
+    // Matches straddling the previous chunk and this one
+    if (!tail.empty()) {
+        size_t head = std::min(length, keep);
+        seam.assign(tail.begin(), tail.end());
+        seam.insert(seam.end(), data, data + head);
+        matcher.scanCrossing(seam.data(), seam.size(), tail.size(), out, consumed - tail.size());
+    }
+
+    matcher.scan(data, length, out, consumed);
+    consumed += length;
+
+    // Tail = last `keep` bytes of everything seen so far
+    if (length >= keep) {
+        tail.assign(data + length - keep, data + length);
+    } else {
+        tail.insert(tail.end(), data, data + length);
+        if (tail.size() > keep) {
+            tail.erase(tail.begin(), tail.end() - keep);
+        }
+    }
+}
+
+void SignatureStream::reset()
+{
+    tail.clear();
+    seam.clear();
+    consumed = 0;
+}
@@ -0,0 +1,146 @@
+#ifndef SIGNATUREMATCHER_H
+#define SIGNATUREMATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Multi-pattern byte-signature matcher for the detailed scan.
+//
+// Patterns are hex strings with wildcards ("4d5a??00 ?? 50 45", "3?" and
+// "?f" for nibbles). Each pattern contributes its longest literal run (its
+// "atom") to a single Aho-Corasick automaton; an atom hit is then verified
+// against the full masked pattern. A buffer is therefore scanned once no
+// matter how many patterns are loaded.
+//
+// Layout keeps the hot part small: states are numbered breadth-first, the
+// shallow ones (where almost all time is spent) get full 256-entry rows, deep
+// ones only store their edges and fall back along failure links.
+//
+// Positions where no atom can start are skipped by a prefilter: a byte-pair
+// bitmap (behind a two-byte SSSE3/AVX2 shufti classifier when the pair set is
+// small), then hashed 4- and 8-byte-prefix bitmaps. With few patterns the automaton runs normally and
+// the prefilter is consulted whenever it is back in the root state. Large
+// sets saturate the first-byte and pair tables and keep the automaton away
+// from the root, so there the matcher walks the trie only at positions that
+// pass the prefilter ("anchored" mode); both modes report the same matches.
+//
+// Plain C++ so the kernel can be built and benchmarked without Qt
+// (tools/sigbench.cpp).
+class SignatureMatcher
+{
+public:
+    struct Match {
+        uint32_t pattern;
+        uint64_t offset;  // of the first pattern byte
+    };
+
+    struct Stats {
+        size_t patterns = 0;
+        size_t states = 0;
+        size_t denseStates = 0;
+        size_t sparseEdges = 0;
+        size_t memoryBytes = 0;
+        size_t firstBytes = 0;     // distinct atom first bytes
+        double pairDensity = 0;    // share of byte pairs that can start an atom
+        const char *prefilter = "";
+        const char *mode = "";
+    };
+
+    SignatureMatcher();
+
+    // Returns the pattern id, or -1 with *error set for malformed patterns
+    int add(const std::string &name, const std::string &hexPattern, std::string *error = nullptr);
+    bool compile(std::string *error = nullptr);
+    bool isCompiled() const { return compiled; }
+
+    size_t patternCount() const { return patterns.size(); }
+    const std::string &patternName(uint32_t id) const { return patterns[id].name; }
+    size_t maxPatternLength() const { return maxLength; }
+    Stats stats() const;
+
+    // Every occurrence in data. Offsets are reported as baseOffset + position.
+    void scan(const uint8_t *data, size_t length, std::vector<Match> &out, uint64_t baseOffset = 0) const;
+
+    // Only occurrences that start before and end after splitAt; used to
+    // catch matches straddling two chunks without rescanning either
+    void scanCrossing(const uint8_t *data, size_t length, size_t splitAt,
+                      std::vector<Match> &out, uint64_t baseOffset) const;
+
+private:
+    struct Pattern {
+        std::string name;
+        uint32_t bytesOffset;  // into values/masks
+        uint32_t length;
+        uint32_t atomOffset;   // atom position inside the pattern
+        uint32_t atomLength;
+    };
+
+    std::vector<Pattern> patterns;
+    std::vector<uint8_t> values;
+    std::vector<uint8_t> masks;
+    size_t maxLength;
+    bool compiled;
+
+    // Automaton, states in BFS order; state 0 is the root
+    uint32_t denseCount;
+    std::vector<uint32_t> dense;        // denseCount * 256 full transitions
+    std::vector<uint32_t> edgeStart;    // per state, into edgeBytes/edgeTargets
+    std::vector<uint8_t> edgeBytes;     // sorted per state
+    std::vector<uint32_t> edgeTargets;
+    std::vector<uint32_t> fail;
+    std::vector<uint16_t> depth;
+    std::vector<uint32_t> outStart;     // per state (+1), into outPatterns
+    std::vector<uint32_t> outPatterns;
+    std::vector<uint32_t> dictLink;     // nearest suffix state with outputs, or 0
+    std::vector<uint8_t> hasOutput;     // own outputs or a dictionary link
+
+    // Root prefilter
+    bool firstByte[256];
+    bool singleByteAtom[256];
+    std::vector<uint64_t> pairBits;     // 65536-bit set of atom two-byte prefixes
+    std::vector<uint64_t> shortPairBits;// same, for atoms of 2 or 3 bytes
+    std::vector<uint64_t> quadBits;     // hashed 4-byte prefixes of longer atoms
+    std::vector<uint64_t> shortQuadBits;// same, for atoms of 4 to 7 bytes
+    std::vector<uint64_t> octBits;      // hashed 8-byte prefixes of longer atoms
+    uint8_t shufti[4][16];              // nibble tables: lo/hi of byte 0, lo/hi of byte 1
+    int simdLevel;                      // 0 scalar, 1 SSSE3, 2 AVX2
+    bool useSimdPrefilter;
+    bool anchored;
+
+    static const uint32_t kNoState = 0xffffffffu;
+
+    uint32_t step(uint32_t state, uint8_t byte) const;
+    uint32_t child(uint32_t state, uint8_t byte) const;
+    size_t nextCandidate(const uint8_t *data, size_t pos, size_t length) const;
+    size_t findPair(const uint8_t *data, size_t pos, size_t length) const;
+    bool verify(uint32_t pattern, const uint8_t *data, size_t length, size_t start) const;
+
+    template <bool Crossing>
+    void runAutomaton(const uint8_t *data, size_t length, size_t splitAt, std::vector<Match> &out, uint64_t baseOffset) const;
+    template <bool Crossing>
+    void runAnchored(const uint8_t *data, size_t length, size_t splitAt, std::vector<Match> &out, uint64_t baseOffset) const;
+    template <bool Crossing>
+    void report(uint32_t pattern, const uint8_t *data, size_t length, size_t start, size_t splitAt,
+                std::vector<Match> &out, uint64_t baseOffset) const;
+};
+
+// Feeds consecutive chunks of one file through a compiled matcher. Keeps
+// the last (max pattern length - 1) bytes so straddling matches are found.
+class SignatureStream
+{
+public:
+    explicit SignatureStream(const SignatureMatcher &matcher);
+
+    void feed(const uint8_t *data, size_t length, std::vector<SignatureMatcher::Match> &out);
+    void reset();
+
+private:
+    const SignatureMatcher &matcher;
+    std::vector<uint8_t> tail;
+    std::vector<uint8_t> seam;
+    uint64_t consumed;
+};
+
+#endif // SIGNATUREMATCHER_H
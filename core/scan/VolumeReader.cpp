@@ -0,0 +1,259 @@
+#include "VolumeReader.h"
+#include "FatVolume.h"
+#include "NtfsVolume.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t kBootBytes = 512;
+const uint32_t kMaxGptEntries = 1024;
+
+struct Extent {
+    uint64_t offset;
+    uint64_t length;
+};
+
+std::string errnoText(const std::string &what)
+{
+    return what + ": " + strerror(errno);
+}
+
+bool preadFully(int fd, void *buffer, size_t bytes, uint64_t offset)
+{
+    uint8_t *p = static_cast<uint8_t *>(buffer);
+    while (bytes > 0) {
+        ssize_t n = pread(fd, p, bytes, off_t(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= size_t(n);
+        offset += uint64_t(n);
+    }
+    return true;
+}
+
+uint32_t le32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint64_t le64(const uint8_t *p)
+{
+    return uint64_t(le32(p)) | uint64_t(le32(p + 4)) << 32;
+}
+
+// GPT entries from the header at LBA 1
+void gptPartitions(int fd, uint64_t size, uint64_t sector, std::vector<Extent> *out)
+{
+    std::vector<uint8_t> header(sector);
+    if (!preadFully(fd, header.data(), header.size(), sector) || memcmp(header.data(), "EFI PART", 8) != 0) {
+        return;
+    }
+    uint64_t entriesLba = le64(&header[72]);
+    uint32_t count = le32(&header[80]);
+    uint32_t entryBytes = le32(&header[84]);
+    if (count == 0 || count > kMaxGptEntries || entryBytes < 128 || entryBytes > 4096) {
+        return;
+    }
+    std::vector<uint8_t> entries(size_t(count) * entryBytes);
+    if (!preadFully(fd, entries.data(), entries.size(), entriesLba * sector)) {
+        return;
+    }
+    static const uint8_t unused[16] = {};
+    for (uint32_t i = 0; i < count; ++i) {
+        const uint8_t *e = &entries[size_t(i) * entryBytes];
+        uint64_t first = le64(e + 32);
+        uint64_t last = le64(e + 40);
+        if (memcmp(e, unused, 16) == 0 || last < first || (last + 1) * sector > size) {
+            continue;
+        }
+        out->push_back({first * sector, (last - first + 1) * sector});
+    }
+}
+
+// Primary partitions in table order; logical partitions inside an
+// extended one are not followed
+void partitions(int fd, uint64_t size, uint64_t sector, const uint8_t *mbr, std::vector<Extent> *out)
+{
+    if (mbr[510] != 0x55 || mbr[511] != 0xAA) {
+        return;
+    }
+    for (int i = 0; i < 4; ++i) {
+        const uint8_t *e = mbr + 446 + 16 * i;
+        uint8_t type = e[4];
+        if ((e[0] != 0x00 && e[0] != 0x80) || type == 0x00) {
+            continue;
+        }
+        if (type == 0xEE) {
+            gptPartitions(fd, size, sector, out);
+            return;
+        }
+        if (type == 0x05 || type == 0x0F || type == 0x85) {
+            continue;
+        }
+        uint64_t first = le32(e + 8);
+        uint64_t count = le32(e + 12);
+        if (first == 0 || count == 0 || (first + count) * sector > size) {
+            continue;
+        }
+        out->push_back({first * sector, count * sector});
+    }
+}
+
+} // namespace
+
+VolumeReader::VolumeReader()
+    : fd(-1)
+    , base(0)
+    , length(0)
+    , directoryCount(0)
+    , unreadableCount(0)
+{
+}
+
+VolumeReader::~VolumeReader()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+std::unique_ptr<VolumeReader> VolumeReader::open(const std::string &device, std::string *error)
+{
+    int fd = ::open(device.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = errnoText("Cannot open " + device);
+        return nullptr;
+    }
+    struct stat st;
+    uint64_t size = 0;
+    int sector = 512;
+    if (fstat(fd, &st) != 0) {
+        if (error) *error = errnoText("Cannot stat " + device);
+        close(fd);
+        return nullptr;
+    }
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(fd, BLKGETSIZE64, &size) != 0) {
+            if (error) *error = errnoText("Cannot get the size of " + device);
+            close(fd);
+            return nullptr;
+        }
+        ioctl(fd, BLKSSZGET, &sector);
+    } else if (S_ISREG(st.st_mode)) {
+        size = uint64_t(st.st_size);
+    } else {
+        if (error) *error = device + " is not a block device or disk image";
+        close(fd);
+        return nullptr;
+    }
+
+    uint8_t boot[kBootBytes];
+    if (size < kBootBytes || !preadFully(fd, boot, kBootBytes, 0)) {
+        if (error) *error = "Cannot read the first sector of " + device;
+        close(fd);
+        return nullptr;
+    }
+    // The device itself first: a partition table never parses as a boot sector
+    std::vector<Extent> candidates = {{0, size}};
+    partitions(fd, size, uint64_t(sector), boot, &candidates);
+
+    std::string failure;
+    for (const Extent &extent : candidates) {
+        if (extent.offset != 0 && !preadFully(fd, boot, kBootBytes, extent.offset)) {
+            continue;
+        }
+        std::unique_ptr<VolumeReader> volume;
+        if (FatVolume::detect(boot)) {
+            volume.reset(new FatVolume());
+        } else if (NtfsVolume::detect(boot)) {
+            volume.reset(new NtfsVolume());
+        } else {
+            continue;
+        }
+        volume->fd = fd;
+        volume->base = extent.offset;
+        volume->length = extent.length;
+        if (volume->load(&failure)) {
+            return volume;
+        }
+        volume->fd = -1;
+    }
+    close(fd);
+    if (error) *error = failure.empty() ? "No FAT, exFAT or NTFS volume on " + device : device + ": " + failure;
+    return nullptr;
+}
+
+bool VolumeReader::readAt(uint64_t offset, void *buffer, size_t bytes, std::string *error) const
+{
+    if (offset > length || bytes > length - offset) {
+        if (error) *error = "Read past the end of the volume at offset " + std::to_string(offset);
+        return false;
+    }
+    uint8_t *p = static_cast<uint8_t *>(buffer);
+    offset += base;
+    while (bytes > 0) {
+        ssize_t n = pread(fd, p, bytes, off_t(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (error) {
+                *error = n < 0 ? errnoText("Read error at offset " + std::to_string(offset))
+                               : "Unexpected end of device at offset " + std::to_string(offset);
+            }
+            return false;
+        }
+        p += n;
+        bytes -= size_t(n);
+        offset += uint64_t(n);
+    }
+    return true;
+}
+
+std::string VolumeReader::fromUtf16(const uint8_t *data, size_t units)
+{
+    std::string out;
+    for (size_t i = 0; i < units; ++i) {
+        uint32_t c = le16(data + 2 * i);
+        if (c == 0) {
+            break;
+        }
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < units) {
+            uint32_t low = le16(data + 2 * (i + 1));
+            if (low >= 0xDC00 && low < 0xE000) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                ++i;
+            }
+        }
+        if ((c >= 0xD800 && c < 0xE000) || c == '/') {
+            c = '_';
+        }
+        if (c < 0x80) {
+            out += char(c);
+        } else if (c < 0x800) {
+            out += char(0xC0 | c >> 6);
+            out += char(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += char(0xE0 | c >> 12);
+            out += char(0x80 | (c >> 6 & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        } else {
+            out += char(0xF0 | c >> 18);
+            out += char(0x80 | (c >> 12 & 0x3F));
+            out += char(0x80 | (c >> 6 & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
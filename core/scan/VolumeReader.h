@@ -0,0 +1,78 @@
+#ifndef VOLUMEREADER_H
+#define VOLUMEREADER_H
+
+#include "ArchiveWalker.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Reads a filesystem straight from a block device or disk image, without
+// mounting it: the host kernel never interprets the drive and nothing is
+// written to it. open() takes the device as a bare volume, or else the
+// first recognised partition of its MBR or GPT partition table, and hands
+// it to the matching parser (see FatVolume and NtfsVolume).
+class VolumeReader
+{
+public:
+    struct File {
+        std::string path;          // relative to the volume root, '/'-separated
+        uint64_t size = 0;
+        int64_t mtimeNs = 0;
+        uint64_t inode = 0;        // first cluster on FAT, MFT record on NTFS
+        uint64_t diskOffset = 0;   // where the data starts, 0 when nothing is stored
+        bool deleted = false;      // recovered from a deleted directory entry
+
+        // Where the parser finds the data again
+        uint64_t start = 0;
+        uint64_t validSize = 0;    // bytes past it read as zeros
+        bool contiguous = false;   // no chain to follow
+    };
+
+    virtual ~VolumeReader();
+
+    // e.g. "FAT32", "NTFS"
+    virtual const char *format() const = 0;
+
+    // Every file on the volume, plus the deleted ones whose data still
+    // looks intact, ordered by diskOffset so reading them in turn sweeps
+    // the device once. False when the root directory (or the MFT) cannot be
+    // read; other unreadable directories (MFT records) are skipped and
+    // counted.
+    virtual bool list(std::vector<File> *files, std::string *error = nullptr) = 0;
+
+    // The file's contents; any number of streams may be read at once, from
+    // any threads, while the reader lives
+    virtual std::unique_ptr<ArchiveWalker::Source> stream(const File &file, std::string *error = nullptr) const = 0;
+
+    // Of the last list()
+    uint64_t directories() const { return directoryCount; }
+    uint64_t unreadable() const { return unreadableCount; }
+
+    // Null with *error set when no supported filesystem is found
+    static std::unique_ptr<VolumeReader> open(const std::string &device, std::string *error = nullptr);
+
+protected:
+    int fd;
+    uint64_t base;      // of the volume on the device
+    uint64_t length;
+    uint64_t directoryCount;
+    uint64_t unreadableCount;
+
+    VolumeReader();
+
+    // Parses the volume's metadata once the device is attached
+    virtual bool load(std::string *error) = 0;
+
+    // offset is relative to the volume
+    bool readAt(uint64_t offset, void *buffer, size_t bytes, std::string *error) const;
+
+    static uint16_t le16(const uint8_t *p) { return uint16_t(p[0] | p[1] << 8); }
+    static uint32_t le32(const uint8_t *p) { return uint32_t(le16(p)) | uint32_t(le16(p + 2)) << 16; }
+    static uint64_t le64(const uint8_t *p) { return uint64_t(le32(p)) | uint64_t(le32(p + 4)) << 32; }
+    // UTF-16LE name up to the first NUL; '/' and broken surrogates become '_'
+    static std::string fromUtf16(const uint8_t *data, size_t units);
+};
+
+#endif // VOLUMEREADER_H
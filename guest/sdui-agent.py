@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+"""SandDrive guest agent.
+
+Talks to the host over the virtio-serial port org.sanddrive.agent.0 using
+the framed protocol in core/GuestChannel.h, so the kiosk gets a shell as
+soon as the guest kernel is up - no network, DHCP or sshd involved.
+"""
+
+import os
+import pty
+import select
+import struct
+import subprocess
+import sys
+import termios
+import time
+
+PORT = "/dev/virtio-ports/org.sanddrive.agent.0"
+VERSION = b"sdui-agent 1"
+SHELL_USER = "debian"
+
+HELLO, CONSOLE_OPEN, CONSOLE_INPUT, CONSOLE_OUTPUT = 0x01, 0x02, 0x03, 0x04
+CONSOLE_CLOSED, CONTROL, CONTROL_RESULT, PING, PONG = 0x05, 0x06, 0x07, 0x08, 0x09
+
+HEADER = struct.Struct(">2sBBI")
+MAX_PAYLOAD = 1 << 20
+
+CONTROL_COMMANDS = {
+    "sync": ["sync"],
+    "poweroff": ["systemctl", "poweroff"],
+    "reboot": ["systemctl", "reboot"],
+    "uptime": ["uptime"],
+}
+
+
+def frame(ftype, payload=b""):
+    return HEADER.pack(b"SD", ftype, 0, len(payload)) + payload
+
+
+class Decoder:
+    def __init__(self):
+        self.buf = b""
+
+    def feed(self, data):
+        self.buf += data
+
+    def frames(self):
+        while True:
+            magic = self.buf.find(b"SD")
+            if magic < 0:
+                self.buf = self.buf[-1:] if self.buf.endswith(b"S") else b""
+                return
+            self.buf = self.buf[magic:]
+            if len(self.buf) < HEADER.size:
+                return
+            _, ftype, _, length = HEADER.unpack_from(self.buf)
+            if length > MAX_PAYLOAD:
+                self.buf = self.buf[2:]
+                continue
+            if len(self.buf) < HEADER.size + length:
+                return
+            payload = self.buf[HEADER.size:HEADER.size + length]
+            self.buf = self.buf[HEADER.size + length:]
+            yield ftype, payload
+
+
+class Agent:
+    def __init__(self, port_fd):
+        self.port = port_fd
+        self.decoder = Decoder()
+        self.shell_pid = None
+        self.shell_fd = None
+
+    def send(self, ftype, payload=b""):
+        data = frame(ftype, payload)
+        while data:
+            try:
+                written = os.write(self.port, data)
+                data = data[written:]
+            except BlockingIOError:
+                select.select([], [self.port], [], 1.0)
+
+    def open_shell(self):
+        if self.shell_fd is not None:
+            return
+        pid, fd = pty.fork()
+        if pid == 0:
+            # Same experience as the old SSH path: a non-readline bash -i
+            os.execvp("runuser", ["runuser", "-l", SHELL_USER, "-c", "bash --noediting -i"])
+        # The host terminal widget does its own echo and expects plain newlines
+        attrs = termios.tcgetattr(fd)
+        attrs[1] &= ~termios.ONLCR
+        attrs[3] &= ~termios.ECHO
+        termios.tcsetattr(fd, termios.TCSANOW, attrs)
+        self.shell_pid, self.shell_fd = pid, fd
+
+    def close_shell(self):
+        if self.shell_fd is None:
+            return
+        os.close(self.shell_fd)
+        _, status = os.waitpid(self.shell_pid, 0)
+        self.shell_pid = self.shell_fd = None
+        self.send(CONSOLE_CLOSED, str(os.waitstatus_to_exitcode(status)).encode())
+
+    def control(self, command):
+        argv = CONTROL_COMMANDS.get(command)
+        if argv is None:
+            self.send(CONTROL_RESULT, b"127 unknown command")
+            return
+        result = subprocess.run(argv, capture_output=True, timeout=30)
+        self.send(CONTROL_RESULT, str(result.returncode).encode() + b" " + result.stdout)
+
+    def handle(self, ftype, payload):
+        if ftype == HELLO:
+            self.send(HELLO, VERSION)
+        elif ftype == CONSOLE_OPEN:
+            self.open_shell()
+        elif ftype == CONSOLE_INPUT and self.shell_fd is not None:
+            os.write(self.shell_fd, payload)
+        elif ftype == CONTROL:
+            self.control(payload.decode(errors="replace").strip())
+        elif ftype == PING:
+            self.send(PONG)
+
+    def run(self):
+        self.send(HELLO, VERSION)
+        while True:
+            watched = [self.port] + ([self.shell_fd] if self.shell_fd is not None else [])
+            readable, _, _ = select.select(watched, [], [], 5.0)
+            if self.port in readable:
+                try:
+                    data = os.read(self.port, 65536)
+                except BlockingIOError:
+                    data = b""
+                if data:
+                    self.decoder.feed(data)
+                    for ftype, payload in self.decoder.frames():
+                        self.handle(ftype, payload)
+                else:
+                    # Host side not connected; avoid spinning
+                    time.sleep(0.2)
+            if self.shell_fd is not None and self.shell_fd in readable:
+                try:
+                    data = os.read(self.shell_fd, 65536)
+                except OSError:
+                    data = b""
+                if data:
+                    self.send(CONSOLE_OUTPUT, data)
+                else:
+                    self.close_shell()
+
+
+def main():
+    while not os.path.exists(PORT):
+        time.sleep(0.5)
+    fd = os.open(PORT, os.O_RDWR | os.O_NONBLOCK)
+    Agent(fd).run()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
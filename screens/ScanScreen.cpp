@@ -1,16 +1,247 @@
 #include "ScanScreen.h"
 #include "ui_ScanScreen.h"
+#include "../core/scan/ScanEngine.h"
+#include "../core/scan/ScanRecorder.h"
+#include "../core/scan/ScanCache.h"
+#include "../core/scan/SignatureDatabase.h"
+#include <QFileDialog>
+#include <QDir>
+#include <QLocale>
+#include <QDebug>
+
+// What a scan reads from disk and the database before it starts
+struct ScanScreen::ScanInputs {
+    std::shared_ptr<const SignatureMatcher> signatures;
+    std::shared_ptr<const RuleSet> rules;
+    std::shared_ptr<const HashIndex> hashIndex;
+    std::shared_ptr<const ScanCache> cache;
+    QString error;              // set when the scan cannot start
+};
+
+// Runs on the prepare pool
+ScanScreen::ScanInputs ScanScreen::loadInputs(bool withSignatures, const QString &root, bool identify)
+{
+    ScanInputs inputs;
+    QString error;
+    if (withSignatures) {
+        // Reloaded per scan so updated signature and rule files are picked up
+        inputs.signatures = SignatureDatabase::load(SignatureDatabase::defaultPath(), &error);
+        if (!inputs.signatures) {
+            inputs.error = "Cannot load signatures: " + error;
+            return inputs;
+        }
+        inputs.rules = SignatureDatabase::loadRules(SignatureDatabase::defaultRulesPath(), &error);
+        if (!inputs.rules && !error.isEmpty()) {
+            inputs.error = "Cannot load rules: " + error;
+            return inputs;
+        }
+    }
+    // Both scans check digests; without an index file there is nothing to check
+    inputs.hashIndex = SignatureDatabase::loadHashIndex(SignatureDatabase::defaultHashIndexPath(), &error);
+    if (!inputs.hashIndex && !error.isEmpty()) {
+        inputs.error = "Cannot load hash index: " + error;
+        return inputs;
+    }
+
+    // Drives we cannot identify are always read in full
+    QStringList verdictInputs;
+    if (withSignatures) {
+        verdictInputs << SignatureDatabase::defaultPath() << SignatureDatabase::defaultRulesPath();
+    }
+    ScanCache::Volume volume = identify ? ScanCache::identify(root) : ScanCache::Volume();
+    if (!volume.id.isEmpty()) {
+        inputs.cache = ScanCache::load(volume, ScanCache::rulesetVersion(withSignatures, verdictInputs), &error);
+        if (!inputs.cache) {
+            qWarning() << "Scanning without the rescan cache:" << error;
+        }
+    }
+    return inputs;
+}
 
 ScanScreen::ScanScreen(QWidget *parent)
     : QWidget(parent)
     , ui(new Ui::ScanScreen)
+    , engine(new ScanEngine(this))
+    , recorder(nullptr)
+    , detailed(false)
+    , preparing(false)
 {
     ui->setupUi(this);
+    preparePool.setMaxThreadCount(1);
     connect(ui->backButton, &QPushButton::clicked, this, &ScanScreen::backRequested);
     connect(ui->openTerminalButton, &QPushButton::clicked, this, &ScanScreen::openTerminalRequested);
+    connect(ui->quickScanButton, &QPushButton::clicked, this, &ScanScreen::onQuickScan);
+    connect(ui->detailedScanButton, &QPushButton::clicked, this, &ScanScreen::onDetailedScan);
+
+    connect(engine, &ScanEngine::progress, this, &ScanScreen::onScanProgress);
+    connect(engine, &ScanEngine::finished, this, &ScanScreen::onScanFinished);
+
+    // Flash drives stall between requests; reads queued across files keep
+    // them busy. SDUI_READ_QUEUE_DEPTH=0 has the workers read for themselves.
+    bool depthSet = false;
+    int depth = qEnvironmentVariableIntValue("SDUI_READ_QUEUE_DEPTH", &depthSet);
+    engine->setReadQueueDepth(depthSet ? depth : 32);
 }
 
 ScanScreen::~ScanScreen()
 {
+    // Its result is posted to this screen, and dropped with it
+    preparePool.waitForDone();
     delete ui;
 }
+
+QString ScanScreen::scanRoot()
+{
+    // The drive is mounted read-only by the intake tooling; let the operator
+    // pick it when it is not at the configured place
+    QString root = qEnvironmentVariable("SDUI_SCAN_ROOT", "/media/sanddrive");
+    if (QDir(root).exists()) {
+        return root;
+    }
+    return QFileDialog::getExistingDirectory(this, "Select drive to scan", "/media");
+}
+
+void ScanScreen::onQuickScan()
+{
+    runScan(false);
+}
+
+void ScanScreen::onDetailedScan()
+{
+    runScan(true);
+}
+
+void ScanScreen::runScan(bool withSignatures)
+{
+    if (engine->isRunning()) {
+        engine->cancel();
+        ui->statusLabel->setText("Cancelling scan...");
+        return;
+    }
+    if (preparing) {
+        return;
+    }
+
+    // A device node (e.g. /dev/sdb) is read raw, end to end, instead of
+    // walking the files of the mounted drive; a FAT, exFAT or NTFS device
+    // named as the volume has its files read without mounting it
+    QString device = qEnvironmentVariable("SDUI_SCAN_DEVICE");
+    QString volumeDevice = qEnvironmentVariable("SDUI_SCAN_VOLUME");
+    QString root = !device.isEmpty() ? device : !volumeDevice.isEmpty() ? volumeDevice : scanRoot();
+    if (root.isEmpty()) {
+        return;
+    }
+
+    // Signature, rule and hash index files and the cached verdicts of a
+    // large drive take a while to load; the scan starts once they are in
+    preparing = true;
+    ui->quickScanButton->setEnabled(false);
+    ui->detailedScanButton->setEnabled(false);
+    ui->statusLabel->setText(withSignatures ? "Loading signatures and rules..." : "Preparing scan...");
+    bool identify = device.isEmpty() && volumeDevice.isEmpty();
+    preparePool.start([this, withSignatures, device, volumeDevice, root, identify]() {
+        auto inputs = std::make_shared<ScanInputs>(loadInputs(withSignatures, root, identify));
+        QMetaObject::invokeMethod(this, [this, withSignatures, device, volumeDevice, root, inputs]() {
+            startScan(withSignatures, device, volumeDevice, root, *inputs);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ScanScreen::startScan(bool withSignatures, const QString &device, const QString &volumeDevice,
+                           const QString &root, const ScanInputs &inputs)
+{
+    preparing = false;
+    ui->quickScanButton->setEnabled(true);
+    ui->detailedScanButton->setEnabled(true);
+    if (!inputs.error.isEmpty()) {
+        ui->statusLabel->setText(inputs.error);
+        return;
+    }
+
+    QString error;
+    engine->setHashIndex(inputs.hashIndex);
+    engine->setCache(inputs.cache);
+    engine->setSignatures(inputs.signatures);
+    engine->setRules(inputs.rules);
+    bool started = !device.isEmpty() ? engine->startDevice(device, &error)
+                 : !volumeDevice.isEmpty() ? engine->startVolume(volumeDevice, &error)
+                 : engine->start(root, &error);
+    if (!started) {
+        ui->statusLabel->setText("Scan failed: " + error);
+        return;
+    }
+    detailed = withSignatures;
+
+    delete recorder;
+    recorder = new ScanRecorder(engine, detailed ? "detailed_scan" : "quick_scan", "system", this);
+    recorder->setCache(inputs.cache);
+    if (!recorder->begin(root, &error)) {
+        ui->statusLabel->setText("Scanning without saving results: " + error);
+    } else {
+        ui->statusLabel->setText("Scanning " + root + "...");
+    }
+
+    QPushButton *active = detailed ? ui->detailedScanButton : ui->quickScanButton;
+    QPushButton *other = detailed ? ui->quickScanButton : ui->detailedScanButton;
+    active->setText(detailed ? "Cancel Detailed Scan" : "Cancel Quick Scan");
+    other->setEnabled(false);
+}
+
+void ScanScreen::onScanProgress(const ScanProgress &progress)
+{
+    QLocale locale;
+    QString text = QString("%1 files, %2 hashed\n%3 MB/s, %4 files/s%5")
+        .arg(progress.files)
+        .arg(locale.formattedDataSize(progress.bytes))
+        .arg(progress.mbPerSec, 0, 'f', 1)
+        .arg(progress.filesPerSec, 0, 'f', 0)
+        .arg(progress.walking ? QString(" (still discovering files)")
+                              : QString(", %1 to go").arg(progress.queued));
+    if (detailed) {
+        text += QString("\n%1 signature matches, %2 rule matches").arg(progress.hits).arg(progress.ruleHits);
+    }
+    if (progress.members > 0) {
+        text += QString("\n%1 archive members unpacked").arg(progress.members);
+    }
+    if (progress.knownBad > 0) {
+        text += QString("\n%1 known-bad files").arg(progress.knownBad);
+    }
+    if (progress.highEntropy > 0) {
+        text += QString("\n%1 executables with packed or encrypted sections").arg(progress.highEntropy);
+    }
+    ui->statusLabel->setText(text);
+}
+
+void ScanScreen::onScanFinished(const ScanSummary &summary)
+{
+    QLocale locale;
+    QString text = QString("%1 %2: %3 files (%4 unreadable), %5 in %6 s, avg %7 MB/s")
+        .arg(detailed ? "Detailed scan" : "Quick scan")
+        .arg(summary.cancelled ? "cancelled" : "complete")
+        .arg(summary.files)
+        .arg(summary.errors)
+        .arg(locale.formattedDataSize(summary.bytes))
+        .arg(summary.elapsedMs / 1000.0, 0, 'f', 1)
+        .arg(summary.averageMBps(), 0, 'f', 1);
+    if (detailed) {
+        text += QString("\n%1 signature matches, %2 rule matches").arg(summary.hits).arg(summary.ruleHits);
+    }
+    if (summary.members > 0) {
+        text += QString("\n%1 archive members unpacked").arg(summary.members);
+    }
+    if (summary.knownBad > 0) {
+        text += QString("\n%1 known-bad files").arg(summary.knownBad);
+    }
+    if (summary.highEntropy > 0) {
+        text += QString("\n%1 executables with packed or encrypted sections").arg(summary.highEntropy);
+    }
+    if (summary.cacheUsed) {
+        text += QString("\n%1 files unchanged since the last scan (%2% cache hits)")
+            .arg(summary.cached).arg(summary.cacheHitRate() * 100, 0, 'f', 1);
+    }
+    ui->statusLabel->setText(text);
+    ui->quickScanButton->setText("Run Quick Scan");
+    ui->quickScanButton->setEnabled(true);
+    ui->detailedScanButton->setText("Run Detailed Scan");
+    ui->detailedScanButton->setEnabled(true);
+}
@@ -2,6 +2,11 @@
 #define SCANSCREEN_H
 
 #include <QWidget>
+#include <QThreadPool>
+#include "../core/scan/ScanTypes.h"
+
+class ScanEngine;
+class ScanRecorder;
 
 namespace Ui {
 class ScanScreen;
@@ -19,8 +24,27 @@ signals:
     void backRequested();
     void openTerminalRequested();
 
+private slots:
+    void onQuickScan();
+    void onDetailedScan();
+
 private:
+    struct ScanInputs;
+
     Ui::ScanScreen *ui;
+    ScanEngine *engine;
+    ScanRecorder *recorder;
+    bool detailed;
+    bool preparing;             // loading what the next scan needs
+    QThreadPool preparePool;    // for that loading, off the GUI thread
+
+    QString scanRoot();
+    void runScan(bool withSignatures);
+    static ScanInputs loadInputs(bool withSignatures, const QString &root, bool identify);
+    void startScan(bool withSignatures, const QString &device, const QString &volumeDevice, const QString &root,
+                   const ScanInputs &inputs);
+    void onScanProgress(const ScanProgress &progress);
+    void onScanFinished(const ScanSummary &summary);
 };
 
 #endif // SCANSCREEN_H
@@ -160,7 +160,7 @@ VMTerminal::VMTerminal(QWidget *parent)
     
     connect(&VMManager::instance(), &VMManager::vmStarted, this, [this]() {
         appendOutput("\n=== VM Started ===\n");
-        appendOutput("SSH auto-login enabled (debian/debian).\n\n");
+        appendOutput("Console auto-login enabled (debian/debian).\n\n");
         updateButtonState();
     });
     
@@ -174,13 +174,26 @@ VMTerminal::VMTerminal(QWidget *parent)
         appendOutput(error + "\n");
     });
 
+    // Lifecycle progress from the asynchronous start/stop sequence
+    connect(&VMManager::instance(), &VMManager::progress, this, [this](const QString &message) {
+        appendOutput(message + "\n");
+    });
+
+    connect(&VMManager::instance(), &VMManager::lifecycleStateChanged,
+            this, &VMTerminal::updateButtonState);
+
+    connect(&VMManager::instance(), &VMManager::sessionReady,
+            this, [this](const QString &bootMode, qint64 timeToShellMs) {
+        appendOutput(QString("Shell ready in %1 s (%2 start)\n\n")
+                     .arg(timeToShellMs / 1000.0, 0, 'f', 1).arg(bootMode));
+    });
+
+    // VMManager caches the domain state from libvirt events; no polling here
+    connect(&VMManager::instance(), &VMManager::stateChanged,
+            this, &VMTerminal::updateButtonState);
+
     // Set initial button state based on VM status
     updateButtonState();
-
-    // Periodically refresh button state to stay in sync
-    stateTimer.setInterval(2000);
-    connect(&stateTimer, &QTimer::timeout, this, &VMTerminal::updateButtonState);
-    stateTimer.start();
 }
 
 VMTerminal::~VMTerminal()
@@ -240,16 +253,15 @@ void VMTerminal::clear()
 
 void VMTerminal::onCommandEntered(const QString &command)
 {
-    QProcess *virshProcess = VMManager::instance().getVirshProcess();
-    if (virshProcess && virshProcess->state() == QProcess::Running) {
+    if (VMManager::instance().isConsoleConnected()) {
         // Track command to filter echo
         lastCommand = command;
         
         // If command ends with \t (tab autocomplete), don't add newline
         if (command.endsWith("\t")) {
-            virshProcess->write(command.toUtf8());
+            VMManager::instance().sendConsoleInput(command.toUtf8());
         } else {
-            virshProcess->write((command + "\n").toUtf8());
+            VMManager::instance().sendConsoleInput((command + "\n").toUtf8());
         }
     } else {
         appendOutput("Error: VM console is not connected\n");
@@ -258,6 +270,12 @@ void VMTerminal::onCommandEntered(const QString &command)
 
 void VMTerminal::onToggleVM()
 {
+    // A click while booting cancels the pending start
+    if (VMManager::instance().isTransitioning()) {
+        VMManager::instance().cancel();
+        return;
+    }
+
     ui->stopVMButton->setEnabled(false);
     bool running = VMManager::instance().isVMRunning();
     if (running) {
@@ -270,6 +288,24 @@ void VMTerminal::onToggleVM()
 
 void VMTerminal::updateButtonState()
 {
+    VMManager::LifecycleState state = VMManager::instance().lifecycleState();
+    if (state == VMManager::LifecycleState::Stopping) {
+        ui->stopVMButton->setText("Stopping...");
+        ui->stopVMButton->setEnabled(false);
+        return;
+    }
+    if (VMManager::instance().isTransitioning()) {
+        // Amber while the VM boots; clicking cancels
+        ui->stopVMButton->setText("Cancel");
+        ui->stopVMButton->setStyleSheet(
+            "QPushButton { background-color: #8B6508; color: white; }"
+            "QPushButton:hover { background-color: #A0760A; }"
+            "QPushButton:pressed { background-color: #6B4E06; }"
+        );
+        ui->stopVMButton->setEnabled(true);
+        return;
+    }
+
     bool running = VMManager::instance().isVMRunning();
     ui->stopVMButton->setText(running ? "Stop VM" : "Start VM");
     
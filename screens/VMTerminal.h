@@ -4,8 +4,6 @@
 #include <QWidget>
 #include <QTextEdit>
 #include <QKeyEvent>
-#include <QTimer>
-#include <QTimer>
 
 namespace Ui {
 class VMTerminal;
@@ -57,7 +55,6 @@ private slots:
 private:
     Ui::VMTerminal *ui;
     InteractiveTerminal *terminal;
-    QTimer stateTimer;
     QString lastCommand;  // Track last sent command to filter echo
 };
 
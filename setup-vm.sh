@@ -3,6 +3,9 @@ set -e
 
 echo "Setting up sdui-debian VM..."
 
+# guest/ holds the agent installed into the image below
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+
 # Create VM storage
 sudo mkdir -p /var/lib/libvirt/images/sdui
 cd /var/lib/libvirt/images/sdui
@@ -36,6 +39,22 @@ packages:
 runcmd:
   - systemctl enable ssh
   - systemctl start ssh
+  - systemctl daemon-reload
+  - systemctl enable --now sdui-agent.service
+EOF
+
+# Install the guest agent, which serves the SandDrive console over the
+# org.sanddrive.agent.0 virtio-serial port (SSH remains the fallback)
+cat >> user-data <<EOF
+write_files:
+  - path: /usr/local/sbin/sdui-agent.py
+    permissions: '0755'
+    encoding: b64
+    content: $(base64 -w0 "$SCRIPT_DIR/guest/sdui-agent.py")
+  - path: /etc/systemd/system/sdui-agent.service
+    permissions: '0644'
+    encoding: b64
+    content: $(base64 -w0 "$SCRIPT_DIR/guest/sdui-agent.service")
 EOF
 
 cat > meta-data <<'EOF'
@@ -61,6 +80,7 @@ virt-install \
   --disk path=/var/lib/libvirt/images/sdui/sdui-debian.qcow2,format=qcow2 \
   --disk path=/var/lib/libvirt/images/sdui/seed.img,format=raw \
   --network network=default \
+  --channel unix,mode=bind,path=/var/lib/libvirt/images/sdui/agent.sock,target.type=virtio,target.name=org.sanddrive.agent.0 \
   --graphics none \
   --os-variant debian12 \
   --import \
@@ -72,6 +92,65 @@ sleep 60
 echo "Checking VM IP..."
 virsh --connect qemu:///system domifaddr sdui-debian
 
+# Freeze the provisioned disk as the golden cold-boot image. SandDrive runs
+# every session on a disposable overlay of it and discards the overlay
+# afterwards, so nothing one drive does survives into the next session.
+echo "Shutting down to freeze the base image..."
+virsh --connect qemu:///system shutdown sdui-debian
+for i in $(seq 1 60); do
+    [ "$(virsh --connect qemu:///system domstate sdui-debian)" = "shut off" ] && break
+    sleep 2
+done
+virsh --connect qemu:///system destroy sdui-debian 2>/dev/null || true
+
+sudo mv sdui-debian.qcow2 sdui-base.qcow2
+sudo qemu-img create -f qcow2 -F qcow2 -b /var/lib/libvirt/images/sdui/sdui-base.qcow2 sdui-debian.qcow2
+sudo chmod 444 sdui-base.qcow2
+# Overlays and the warm image of an earlier setup belong to the old base
+sudo rm -rf pool sdui-warm.sav sdui-warm.qcow2
+sudo mkdir -p pool
+
+# Capture a warm image: a booted, SSH-ready memory snapshot that SandDrive
+# restores instead of cold booting. Pass --no-warm to skip.
+if [ "$1" != "--no-warm" ]; then
+    virsh --connect qemu:///system start sdui-debian
+    echo "Waiting for SSH before capturing warm image..."
+    VM_IP=""
+    for i in $(seq 1 60); do
+        VM_IP=$(virsh --connect qemu:///system domifaddr sdui-debian | awk '/ipv4/ {split($4, a, "/"); print a[1]}')
+        if [ -n "$VM_IP" ] && timeout 1 bash -c "echo > /dev/tcp/$VM_IP/22" 2>/dev/null; then
+            break
+        fi
+        VM_IP=""
+        sleep 2
+    done
+
+    if [ -z "$VM_IP" ]; then
+        echo "SSH never came up; skipping warm image (cold boot still works)."
+        virsh --connect qemu:///system destroy sdui-debian 2>/dev/null || true
+    else
+        # Flush the guest so the frozen disk matches the saved memory
+        sshpass -p debian ssh -o StrictHostKeyChecking=no -o UserKnownHostsFile=/dev/null \
+            -o LogLevel=ERROR debian@"$VM_IP" sync || true
+
+        echo "Saving warm memory snapshot..."
+        sudo virsh --connect qemu:///system save sdui-debian sdui-warm.sav --running
+
+        # Freeze the disk that belongs to the snapshot; each session gets a
+        # fresh overlay on top of it so the saved memory always matches
+        sudo mv sdui-debian.qcow2 sdui-warm.qcow2
+        sudo qemu-img create -f qcow2 -F qcow2 -b /var/lib/libvirt/images/sdui/sdui-warm.qcow2 sdui-debian.qcow2
+        sudo chmod 444 sdui-warm.qcow2
+        echo "Warm image ready: sdui-warm.sav + sdui-warm.qcow2"
+    fi
+fi
+
+# SandDrive swaps session disks and fills the overlay pool itself; let the
+# libvirt group write here
+sudo chown -R libvirt-qemu:libvirt /var/lib/libvirt/images/sdui/
+sudo chmod 2775 /var/lib/libvirt/images/sdui /var/lib/libvirt/images/sdui/pool
+sudo chmod g+rw /var/lib/libvirt/images/sdui/sdui-debian.qcow2
+
 echo ""
 echo "VM setup complete!"
 echo "Login: debian / debian"
@@ -79,3 +158,5 @@ echo ""
 echo "To connect:"
 echo "  virsh --connect qemu:///system console sdui-debian"
 echo "  (Press Ctrl+] to exit console)"
+echo ""
+echo "Set SDUI_VM_BOOT=cold to ignore the warm image and cold boot instead."
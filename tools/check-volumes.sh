@@ -0,0 +1,140 @@
+#!/bin/bash
+# Checks the FAT, exFAT and NTFS readers against generated images.
+#
+#   check-volumes.sh <volumecheck> [work directory]
+#
+# Each image built by mkfatimage.py and mkntfsimage.py must list and read
+# exactly as its generator expects, damaged variants included. Truncated
+# images must be refused. Copies with random metadata bytes overwritten
+# must be listed or refused, without a crash, sanitizer report or hang.
+# An $MFT claiming more than its runs map must be refused.
+set -u
+
+VOLUMECHECK=$(realpath "$1")
+WORK=${2:-$(mktemp -d)}
+TOOLS=$(dirname "$(realpath "$0")")
+PYTHON=${PYTHON:-python3}
+FUZZ_ROUNDS=${FUZZ_ROUNDS:-25}
+# A sanitizer build stops at the first report instead of carrying on
+export UBSAN_OPTIONS=${UBSAN_OPTIONS:-halt_on_error=1:print_stacktrace=1}
+mkdir -p "$WORK"
+cd "$WORK" || exit 1
+
+failures=0
+fail() {
+    echo "FAIL: $*"
+    failures=$((failures + 1))
+}
+
+# volumecheck exits 2 when it refuses a volume; anything else but 0 is a crash
+run() {
+    timeout 60 "$VOLUMECHECK" "$1" > "$1.out" 2> "$1.err"
+}
+
+images=()
+generate() {
+    local name=$1
+    shift
+    if "$PYTHON" "$@" > /dev/null; then
+        images+=("$name")
+    else
+        fail "$name: generator failed"
+    fi
+}
+for type in fat12 fat16 fat32 exfat; do
+    generate "$type" "$TOOLS/mkfatimage.py" "$type" "$type.img"
+    generate "$type-frag-mbr" "$TOOLS/mkfatimage.py" "$type" "$type-frag-mbr.img" frag mbr
+    generate "$type-damaged" "$TOOLS/mkfatimage.py" "$type" "$type-damaged.img" frag damaged
+done
+generate ntfs "$TOOLS/mkntfsimage.py" ntfs.img
+generate ntfs-nolist "$TOOLS/mkntfsimage.py" ntfs-nolist.img nolist
+generate ntfs-gpt-frag "$TOOLS/mkntfsimage.py" ntfs-gpt-frag.img gpt frag
+generate ntfs-damaged "$TOOLS/mkntfsimage.py" ntfs-damaged.img nolist frag damaged
+
+# The known trees
+for name in "${images[@]}"; do
+    run "$name.img"
+    status=$?
+    if [ $status -ne 0 ]; then
+        fail "$name: exit status $status: $(head -n 3 "$name.img.err")"
+    elif ! diff -u "$name.img.expected" "$name.img.out" > "$name.diff"; then
+        fail "$name: listing differs from $name.img.expected, see $WORK/$name.diff"
+    else
+        echo "ok: $name ($(cat "$name.img.err"))"
+    fi
+done
+
+# Truncated: a bare volume is refused for its size, a partition running
+# past the end of the device is not taken as a volume at all
+truncated() {
+    local name=$1 message=$2
+    cp "$name.img" "$name-truncated.img"
+    truncate -s $(($(stat -c %s "$name.img") / 2)) "$name-truncated.img"
+    run "$name-truncated.img"
+    status=$?
+    if [ $status -ne 2 ] || ! grep -q "$message" "$name-truncated.img.err"; then
+        fail "$name-truncated: exit status $status: $(head -n 3 "$name-truncated.img.err")"
+    else
+        echo "ok: $name-truncated refused"
+    fi
+}
+for type in fat12 fat16 fat32 exfat ntfs; do
+    case $type in
+    exfat) format=exFAT ;;
+    *) format=${type^^} ;;
+    esac
+    truncated "$type" "$format volume extends past the end of the device"
+done
+truncated fat32-frag-mbr "No FAT, exFAT or NTFS volume"
+truncated ntfs-gpt-frag "No FAT, exFAT or NTFS volume"
+head -c 100 fat16.img > short.img
+run short.img
+[ $? -eq 2 ] && grep -q "Cannot read the first sector" short.img.err \
+    && echo "ok: short refused" || fail "short: $(head -n 3 short.img.err)"
+for list in "" nolist; do
+    name=ntfs-oversized${list:+-$list}
+    if ! "$PYTHON" "$TOOLS/mkntfsimage.py" "$name.img" $list oversized > /dev/null; then
+        fail "$name: generator failed"
+        continue
+    fi
+    run "$name.img"
+    [ $? -eq 2 ] && grep -q "MFT is larger than its data runs" "$name.img.err" \
+        && echo "ok: $name refused" || fail "$name: $(head -n 3 "$name.img.err")"
+done
+
+# Corrupt: bytes overwritten inside the extents the generator lists in
+# <image>.metadata (boot sector, allocation tables, directories, MFT
+# records), seeded so that a failure can be reproduced
+corrupt() {
+    "$PYTHON" - "$@" <<'EOF'
+import random, sys
+source, target, seed = sys.argv[1], sys.argv[2], int(sys.argv[3])
+data = bytearray(open(source, "rb").read())
+extents = [tuple(map(int, line.split())) for line in open(source + ".metadata")]
+rnd = random.Random(seed)
+for _ in range(rnd.randint(1, 16)):
+    offset, length = rnd.choices(extents, weights=[n for _, n in extents])[0]
+    data[offset + rnd.randrange(length)] = rnd.getrandbits(8)
+open(target, "wb").write(data)
+EOF
+}
+for name in "${images[@]}"; do
+    crashes=0
+    for ((seed = 1; seed <= FUZZ_ROUNDS; ++seed)); do
+        corrupt "$name.img" corrupt.img "$seed"
+        run corrupt.img
+        status=$?
+        if [ $status -ne 0 ] && [ $status -ne 2 ]; then
+            fail "$name corrupted with seed $seed: exit status $status: $(head -n 3 corrupt.img.err)"
+            cp corrupt.img "$name-seed$seed.img"
+            crashes=$((crashes + 1))
+        fi
+    done
+    [ $crashes -eq 0 ] && echo "ok: $name survived $FUZZ_ROUNDS corruptions"
+done
+
+if [ $failures -ne 0 ]; then
+    echo "$failures check(s) failed; images are in $WORK"
+    exit 1
+fi
+echo "All volume checks passed"
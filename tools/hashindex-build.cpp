@@ -0,0 +1,92 @@
+// Builds a known-bad hash index for the quick scan from plain hash lists.
+//
+//   hashindex-build output.hix list.txt [more lists...]    ("-" reads stdin)
+//
+// Each line starts with a SHA-256 in hex; anything after the first
+// whitespace (sha256sum-style file names, CSV columns) is ignored, as are
+// blank lines and '#' comments. Copy the result to known_bad.hix in the
+// app data directory, or point SDUI_HASH_INDEX at it.
+
+#include "../core/scan/HashIndex.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool readList(FILE *in, const char *name, std::vector<HashIndex::Key> &keys, size_t *rejected)
+{
+    char line[4096];
+    size_t lineNumber = 0;
+    while (fgets(line, sizeof(line), in)) {
+        ++lineNumber;
+        size_t start = strspn(line, " \t");
+        size_t length = strcspn(line + start, " \t,;\r\n");
+        if (length == 0 || line[start] == '#') {
+            continue;
+        }
+        HashIndex::Key key;
+        if (!HashIndex::parseHex(line + start, length, &key)) {
+            if (*rejected < 10) {
+                fprintf(stderr, "%s:%zu: not a SHA-256, skipped\n", name, lineNumber);
+            }
+            ++*rejected;
+            continue;
+        }
+        keys.push_back(key);
+    }
+    if (ferror(in)) {
+        fprintf(stderr, "%s: read error\n", name);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s output.hix list.txt [more lists...]\n", argv[0]);
+        return 2;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<HashIndex::Key> keys;
+    size_t rejected = 0;
+    for (int i = 2; i < argc; ++i) {
+        bool useStdin = strcmp(argv[i], "-") == 0;
+        FILE *in = useStdin ? stdin : fopen(argv[i], "r");
+        if (!in) {
+            perror(argv[i]);
+            return 1;
+        }
+        bool ok = readList(in, argv[i], keys, &rejected);
+        if (!useStdin) {
+            fclose(in);
+        }
+        if (!ok) {
+            return 1;
+        }
+    }
+
+    size_t read = keys.size();
+    std::string error;
+    if (!HashIndex::build(keys, argv[1], &error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    HashIndex index;
+    if (!index.open(argv[1], &error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%s: %llu digests (%zu read, %zu duplicates, %zu rejected lines), %.1f MiB, %.1f s\n",
+           argv[1], static_cast<unsigned long long>(index.size()), read, read - keys.size(), rejected,
+           index.fileSize() / 1048576.0, seconds);
+    return 0;
+}
@@ -0,0 +1,560 @@
+#!/usr/bin/env python3
+# Builds a FAT12, FAT16, FAT32 or exFAT image holding a known tree, for
+# tools/check-volumes.sh.
+#
+#   mkfatimage.py fat12|fat16|fat32|exfat <image> [frag] [mbr] [damaged]
+#
+# The tree has long and Unicode names, nested directories, an empty file,
+# deleted files whose clusters are intact and a deleted file whose clusters
+# were reused. frag scatters files' clusters, mbr puts the volume in an MBR
+# partition and damaged adds a cut cluster chain, a directory loop, a
+# directory with a broken chain and entries pointing outside the volume.
+# Writes <image>.expected, the lines volumecheck prints for the image, and
+# <image>.metadata, the "offset length" extents of its boot sector, tables
+# and directories.
+import calendar
+import struct
+import sys
+import random
+
+rnd = random.Random(7)
+TIME = (2021, 6, 15, 13, 45, 30)
+DAMAGED_FILE = "docs/report final.docx"
+
+
+def content(n):
+    return bytes(rnd.getrandbits(8) for _ in range(n))
+
+
+def fnv(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h ^= b
+        h = (h * 0x100000001b3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def tree():
+    files = [
+        ("readme.txt", b"hello world\n"),
+        ("A Long File Name With Spaces.bin", content(5000)),
+        ("unicode-été-文件.dat", content(1500)),
+        ("empty.txt", b""),
+        ("docs/report final.docx", content(20000)),
+        ("docs/sub/deep/x.exe", content(70000)),
+    ]
+    for i in range(40):
+        files.append(("many/file%03d.bin" % i, content(rnd.randint(0, 9000))))
+    return files
+
+
+def directories(files):
+    """Maps each directory path to its ("dir", name, path) and ("file", name, data) children."""
+    dirs = {"": []}
+    for path, data in files:
+        parts = path.split("/")
+        for i in range(1, len(parts)):
+            dp = "/".join(parts[:i])
+            if dp not in dirs:
+                dirs[dp] = []
+                dirs["/".join(parts[:i - 1])].append(("dir", parts[i - 1], dp))
+        dirs["/".join(parts[:-1])].append(("file", parts[-1], data))
+    return dirs
+
+
+def join(dp, name):
+    return dp + "/" + name if dp else name
+
+
+def epoch_ns(t):
+    return calendar.timegm(t + (0, 0, 0)) * 10**9
+
+
+class Expected:
+    def __init__(self):
+        self.lines = []
+
+    def file(self, path, data, mtime, deleted=False):
+        self.lines.append("%s|%d|%016x|%d|%d" % (path, len(data), fnv(data), deleted, mtime))
+
+    def error(self, path, read, mtime, error):
+        self.lines.append("%s|%d|%016x|0|%d ERR %s" % (path, len(read), fnv(read), mtime, error))
+
+
+class Alloc:
+    def __init__(self, count, fragment):
+        self.count = count
+        self.used = [False] * (count + 2)
+        self.used[0] = self.used[1] = True
+        self.fragment = fragment
+        self.cursor = 2
+
+    def take(self, n, contiguous=False):
+        c = self.cursor
+        if contiguous:
+            while any(self.used[c:c + n]):
+                c += 1
+            for k in range(c, c + n):
+                self.used[k] = True
+            return list(range(c, c + n))
+        out = []
+        while len(out) < n:
+            if c >= self.count + 2:
+                raise Exception("volume full")
+            if not self.used[c]:
+                out.append(c)
+                self.used[c] = True
+                if self.fragment and len(out) % 3 == 0:
+                    c += 2  # leave holes for later files
+            c += 1
+        if not self.fragment:
+            self.cursor = c
+        return out
+
+
+def in_use(fat):
+    """The number of allocation table entries up to the last one in use."""
+    return max(c for c, v in enumerate(fat) if v) + 1
+
+
+def finish(path, img, expected, metadata, mbr, partition_type):
+    start = 0
+    if mbr:
+        start = 2048 * 512
+        pre = bytearray(start)
+        pre[446:462] = struct.pack("<B3sB3sII", 0x80, b"\0\0\0", partition_type, b"\0\0\0", 2048, len(img) // 512)
+        pre[510:512] = b"\x55\xAA"
+        img = pre + img
+    with open(path, "wb") as f:
+        f.write(img)
+    with open(path + ".expected", "w") as f:
+        for line in sorted(expected.lines):
+            f.write(line + "\n")
+    with open(path + ".metadata", "w") as f:
+        for offset, length in [(0, 512)] + metadata:
+            f.write("%d %d\n" % (start + offset, length))
+
+
+# ---------------------------------------------------------------- FAT
+
+def dos_date_time(t):
+    y, mo, d, h, mi, s = t
+    return ((y - 1980) << 9) | (mo << 5) | d, (h << 11) | (mi << 5) | (s // 2)
+
+
+def short_name_checksum(name11):
+    s = 0
+    for b in name11:
+        s = (((s & 1) << 7) + (s >> 1) + b) & 0xFF
+    return s
+
+
+def make_fat(path, bits, fragment, mbr, damaged):
+    bps = 512
+    if bits == 12:
+        total, spc, reserved, root_entries = 4 * 1024 * 1024 // bps, 4, 1, 224
+    elif bits == 16:
+        total, spc, reserved, root_entries = 16 * 1024 * 1024 // bps, 4, 4, 512
+    else:
+        total, spc, reserved, root_entries = 40 * 1024 * 1024 // bps, 1, 32, 0
+    fat32 = bits == 32
+    nfats = 2
+    root_secs = root_entries * 32 // bps
+    fatsz = 1
+    while True:
+        count = (total - reserved - nfats * fatsz - root_secs) // spc
+        need = ((count + 2) * 3 + 1) // 2 if bits == 12 else (count + 2) * bits // 8
+        if fatsz * bps >= need:
+            break
+        fatsz += 1
+    # The cluster count alone decides the FAT type
+    assert (count >= 65525) == fat32 and (count < 4085) == (bits == 12), count
+    csize = spc * bps
+    img = bytearray(total * bps)
+    eoc = 0x0FFFFFFF if fat32 else 0xFFFF
+    fat = [0] * (count + 2)
+    fat[0] = 0x0FFFFFF8 if fat32 else 0xFFF8
+    fat[1] = eoc
+    heap = (reserved + nfats * fatsz + root_secs) * bps
+    alloc = Alloc(count, fragment)
+    expected = Expected()
+    metadata = []  # (offset, length) of the tables and directories
+    mtime = epoch_ns(TIME)
+    outside = count + 10
+
+    def offset(c):
+        return heap + (c - 2) * csize
+
+    def write_chain(data, contiguous=False):
+        if not data:
+            return []
+        n = (len(data) + csize - 1) // csize
+        clusters = alloc.take(n, contiguous)
+        for i, c in enumerate(clusters):
+            fat[c] = clusters[i + 1] if i + 1 < n else eoc
+            chunk = data[i * csize:(i + 1) * csize]
+            img[offset(c):offset(c) + len(chunk)] = chunk
+        return clusters
+
+    serial = [0]
+
+    def short_name(isdir):
+        serial[0] += 1
+        return (("F%06d" % serial[0]).ljust(8) + ("" if isdir else "BIN").ljust(3)).encode()
+
+    def long_name(name, name11):
+        u = name.encode("utf-16-le")
+        units = [u[i:i + 2] for i in range(0, len(u), 2)]
+        if len(units) % 13:
+            units.append(b"\0\0")
+        while len(units) % 13:
+            units.append(b"\xff\xff")
+        n = len(units) // 13
+        checksum = short_name_checksum(name11)
+        entries = []
+        for k in range(n, 0, -1):
+            seg = units[(k - 1) * 13:k * 13]
+            e = bytearray(32)
+            e[0] = k | (0x40 if k == n else 0)
+            e[1:11] = b"".join(seg[0:5])
+            e[11] = 0x0F
+            e[13] = checksum
+            e[14:26] = b"".join(seg[5:11])
+            e[28:32] = b"".join(seg[11:13])
+            entries.append(bytes(e))
+        return entries
+
+    def short_entry(name11, attr, cluster, size):
+        e = bytearray(32)
+        e[0:11] = name11
+        e[11] = attr
+        d, t = dos_date_time(TIME)
+        struct.pack_into("<HHHHHHHI", e, 14, t, d, d, (cluster >> 16) if fat32 else 0, t, d, cluster & 0xFFFF, size)
+        return bytes(e)
+
+    def named(name, attr, cluster, size, deleted=False):
+        name11 = short_name(attr & 0x10)
+        entries = long_name(name, name11) + [short_entry(name11, attr, cluster, size)]
+        return [b"\xe5" + e[1:] for e in entries] if deleted else entries
+
+    dirs = directories(tree())
+    dir_cluster = {}
+
+    def build(dp, parent_cluster):
+        entries = []
+        if dp:
+            entries.append(short_entry(b".          ", 0x10, dir_cluster[dp], 0))
+            entries.append(short_entry(b"..         ", 0x10, parent_cluster, 0))
+        else:
+            entries.append(short_entry(b"TESTVOL    ", 0x08, 0, 0))
+        for kind, name, payload in dirs[dp]:
+            if kind == "dir":
+                c = alloc.take(1)[0]
+                fat[c] = eoc
+                dir_cluster[payload] = c
+                entries += named(name, 0x10, c, 0)
+                continue
+            full = join(dp, name)
+            clusters = write_chain(payload)
+            entries += named(name, 0x20, clusters[0] if clusters else 0, len(payload))
+            if damaged and full == DAMAGED_FILE:
+                fat[clusters[0]] = 0
+                expected.error(full, payload[:csize], mtime,
+                               "Cluster chain ends %d bytes early" % (len(payload) - csize))
+            else:
+                expected.file(full, payload, mtime)
+        if dp in ("", "docs"):
+            # Deleted: the clusters are free but nothing reused them
+            name = "deleted secret %s.pdf" % (dp or "root")
+            data = content(12345)
+            clusters = write_chain(data, contiguous=True)
+            for c in clusters:
+                fat[c] = 0
+            entries += named(name, 0x20, clusters[0], len(data), True)
+            expected.file(join(dp, name), data, mtime, deleted=True)
+            # Deleted, and a live file now holds its clusters
+            data = content(3000)
+            first = write_chain(data, contiguous=True)[0]
+            entries.append(b"\xe5" + short_entry(short_name(False), 0x20, first, len(data))[1:])
+            entries += named("reuser.bin", 0x20, first, len(data))
+            expected.file(join(dp, "reuser.bin"), data, mtime)
+        if damaged and dp == "":
+            # A directory whose chain links out of the volume (read as
+            # ending there), a file and a deleted file starting outside it
+            c = alloc.take(1)[0]
+            fat[c] = outside
+            entries += named("broken", 0x10, c, 0)
+            entries += named("nowhere.bin", 0x20, outside, 100)
+            expected.error("nowhere.bin", b"", mtime, "No data clusters for nowhere.bin")
+            entries += named("bogus.pdf", 0x20, outside, 5000, True)
+        if damaged and dp == "docs/sub/deep":
+            entries += named("loop", 0x10, dir_cluster["docs"], 0)
+        blob = b"".join(entries)
+        for kind, name, payload in dirs[dp]:
+            if kind == "dir":
+                build(payload, dir_cluster[dp] if dp else 0)
+        if dp == "" and not fat32:
+            assert len(blob) <= root_entries * 32
+            off = (reserved + nfats * fatsz) * bps
+            img[off:off + len(blob)] = blob
+            metadata.append((off, len(blob)))
+            return
+        n = max(1, (len(blob) + csize - 1) // csize)
+        clusters = [dir_cluster[dp]] + alloc.take(n - 1)
+        for i, c in enumerate(clusters):
+            fat[c] = clusters[i + 1] if i + 1 < n else eoc
+            chunk = blob[i * csize:(i + 1) * csize]
+            img[offset(c):offset(c) + len(chunk)] = chunk
+            metadata.append((offset(c), csize))
+
+    if fat32:
+        dir_cluster[""] = alloc.take(1)[0]
+        fat[dir_cluster[""]] = eoc
+    build("", 0)
+
+    b = bytearray(512)
+    b[0:3] = b"\xEB\x58\x90"
+    b[3:11] = b"MSWIN4.1"
+    small = total <= 0xFFFF and not fat32
+    struct.pack_into("<HBHBHHBH", b, 11, bps, spc, reserved, nfats, root_entries, total if small else 0, 0xF8,
+                     0 if fat32 else fatsz)
+    struct.pack_into("<HHII", b, 24, 63, 255, 0, 0 if small else total)
+    if fat32:
+        struct.pack_into("<IHHI", b, 36, fatsz, 0, 0, dir_cluster[""])
+        b[82:90] = b"FAT32   "
+    else:
+        b[54:62] = b"FAT%d   " % bits
+    b[510:512] = b"\x55\xAA"
+    img[0:512] = b
+    if bits == 12:
+        table = bytearray((len(fat) * 3 + 1) // 2 + 1)
+        for c, v in enumerate(fat):
+            v &= 0xFFF
+            o = c + c // 2
+            if c & 1:
+                table[o] |= (v << 4) & 0xF0
+                table[o + 1] = v >> 4
+            else:
+                table[o] = v & 0xFF
+                table[o + 1] |= v >> 8
+    else:
+        table = b"".join(struct.pack("<I" if fat32 else "<H", v) for v in fat)
+    for k in range(nfats):
+        off = (reserved + k * fatsz) * bps
+        img[off:off + len(table)] = table
+        metadata.append((off, in_use(fat) * bits // 8 + 2))
+    finish(path, img, expected, metadata, mbr, 0x0C if fat32 else 0x06)
+
+
+# ---------------------------------------------------------------- exFAT
+
+def make_exfat(path, fragment, mbr, damaged):
+    bps = 512
+    spc_shift = 3  # 4 KiB clusters
+    csize = bps << spc_shift
+    total = 64 * 1024 * 1024 // bps
+    fat_off = 128
+    fat_len = ((total // (1 << spc_shift) + 2) * 4 + bps - 1) // bps
+    heap_off = ((fat_off + fat_len + (1 << spc_shift) - 1) >> spc_shift) << spc_shift
+    count = (total - heap_off) >> spc_shift
+    img = bytearray(total * bps)
+    eoc = 0xFFFFFFFF
+    fat = [0] * (count + 2)
+    fat[0] = 0xFFFFFFF8
+    fat[1] = eoc
+    bitmap = bytearray((count + 7) // 8)
+    alloc = Alloc(count, fragment)
+    expected = Expected()
+    metadata = []  # (offset, length) of the tables and directories
+    outside = count + 10
+
+    def offset(c):
+        return heap_off * bps + (c - 2) * csize
+
+    def mark(c, used=True):
+        if used:
+            bitmap[(c - 2) // 8] |= 1 << ((c - 2) % 8)
+        else:
+            bitmap[(c - 2) // 8] &= ~(1 << ((c - 2) % 8))
+
+    def write_data(data, no_chain):
+        """Returns the first cluster, all clusters and whether the FAT was left out."""
+        if not data:
+            return 0, [], True
+        n = (len(data) + csize - 1) // csize
+        clusters = alloc.take(n, contiguous=no_chain)
+        for i, c in enumerate(clusters):
+            mark(c)
+            if not no_chain:
+                fat[c] = clusters[i + 1] if i + 1 < n else eoc
+            chunk = data[i * csize:(i + 1) * csize]
+            img[offset(c):offset(c) + len(chunk)] = chunk
+        return clusters[0], clusters, no_chain
+
+    # Allocation bitmap, up-case table, then the root directory
+    bitmap_clusters = alloc.take((len(bitmap) + csize - 1) // csize, contiguous=True)
+    upcase = alloc.take(1, contiguous=True)[0]
+    for i, c in enumerate(bitmap_clusters):
+        mark(c)
+        fat[c] = bitmap_clusters[i + 1] if i + 1 < len(bitmap_clusters) else eoc
+    mark(upcase)
+    fat[upcase] = eoc
+    root = alloc.take(1)[0]
+    mark(root)
+    fat[root] = eoc
+
+    def stamp(t):
+        y, mo, d, h, mi, s = t
+        return ((y - 1980) << 25) | (mo << 21) | (d << 16) | (h << 11) | (mi << 5) | (s // 2)
+
+    def checksum(data):
+        s = 0
+        for i, b in enumerate(data):
+            if i not in (2, 3):
+                s = ((0x8000 if s & 1 else 0) + (s >> 1) + b) & 0xFFFF
+        return s
+
+    # Stamped 13:45:30.37 at UTC+2
+    utc_offset = 0x80 | 8
+    mtime = epoch_ns(TIME) + 370 * 10**6 - 2 * 3600 * 10**9
+
+    def entry_set(name, attr, first, size, no_chain, deleted=False):
+        u = name.encode("utf-16-le")
+        units = len(u) // 2
+        parts = (units + 14) // 15
+        f = bytearray(32)
+        f[0] = 0x85
+        f[1] = 1 + parts
+        struct.pack_into("<H", f, 4, attr)
+        struct.pack_into("<III", f, 8, stamp(TIME), stamp(TIME), stamp(TIME))
+        f[21] = 37
+        f[22] = f[23] = f[24] = utc_offset
+        s = bytearray(32)
+        s[0] = 0xC0
+        s[1] = 0x01 | (0x02 if no_chain else 0)
+        s[3] = units
+        struct.pack_into("<QIIQ", s, 8, size, 0, first, size)
+        names = []
+        for k in range(parts):
+            n = bytearray(32)
+            n[0] = 0xC1
+            seg = u[k * 30:(k + 1) * 30]
+            n[2:2 + len(seg)] = seg
+            names.append(bytes(n))
+        blob = bytearray(bytes(f) + bytes(s) + b"".join(names))
+        struct.pack_into("<H", blob, 2, checksum(blob))
+        if deleted:
+            for k in range(0, len(blob), 32):
+                blob[k] &= 0x7F
+        return bytes(blob)
+
+    dirs = directories(tree())
+    dir_cluster = {"": root}
+    alternate = [False]
+
+    def build(dp):
+        entries = []
+        if dp == "":
+            e = bytearray(32)
+            e[0] = 0x81
+            struct.pack_into("<IQ", e, 20, bitmap_clusters[0], len(bitmap))
+            entries.append(bytes(e))
+            e = bytearray(32)
+            e[0] = 0x82
+            struct.pack_into("<IQ", e, 20, upcase, 16)
+            entries.append(bytes(e))
+            e = bytearray(32)
+            e[0] = 0x83
+            e[1] = 4
+            e[2:10] = "TEST".encode("utf-16-le")
+            entries.append(bytes(e))
+        subdirs = []
+        for kind, name, payload in dirs[dp]:
+            if kind == "dir":
+                c = alloc.take(1)[0]
+                mark(c)
+                fat[c] = eoc
+                dir_cluster[payload] = c
+                subdirs.append(payload)
+                entries.append(entry_set(name, 0x10, c, csize, False))
+                continue
+            full = join(dp, name)
+            # Every other file is stored without a FAT chain
+            alternate[0] = not alternate[0]
+            cut = damaged and full == DAMAGED_FILE
+            first, clusters, no_chain = write_data(payload, alternate[0] and not cut)
+            entries.append(entry_set(name, 0x20, first, len(payload), no_chain))
+            if cut:
+                fat[clusters[0]] = 0
+                expected.error(full, payload[:csize], mtime,
+                               "Cluster chain ends %d bytes early" % (len(payload) - csize))
+            else:
+                expected.file(full, payload, mtime)
+        if dp in ("", "docs"):
+            # Deleted: the clusters are free but nothing reused them
+            name = "deleted secret %s.pdf" % (dp or "root")
+            data = content(12345)
+            first, clusters, _ = write_data(data, True)
+            for c in clusters:
+                mark(c, False)
+            entries.append(entry_set(name, 0x20, first, len(data), True, deleted=True))
+            expected.file(join(dp, name), data, mtime, deleted=True)
+            # Deleted, and a live file now holds its clusters
+            data = content(3000)
+            first, _, _ = write_data(data, True)
+            entries.append(entry_set("gone.bin", 0x20, first, len(data), True, deleted=True))
+            entries.append(entry_set("reuser.bin", 0x20, first, len(data), True))
+            expected.file(join(dp, "reuser.bin"), data, mtime)
+        if damaged and dp == "":
+            # A directory running off the end of the volume (unreadable),
+            # a file and a deleted file starting outside it
+            entries.append(entry_set("broken", 0x10, count + 1, 2 * csize, True))
+            entries.append(entry_set("nowhere.bin", 0x20, outside, 100, True))
+            expected.error("nowhere.bin", b"", mtime, "No data clusters for nowhere.bin")
+            entries.append(entry_set("bogus.pdf", 0x20, outside, 5000, True, deleted=True))
+        if damaged and dp == "docs/sub/deep":
+            entries.append(entry_set("loop", 0x10, dir_cluster["docs"], csize, False))
+        blob = b"".join(entries)
+        n = max(1, (len(blob) + csize - 1) // csize)
+        clusters = [dir_cluster[dp]] + alloc.take(n - 1)
+        for i, c in enumerate(clusters):
+            mark(c)
+            fat[c] = clusters[i + 1] if i + 1 < n else eoc
+            chunk = blob[i * csize:(i + 1) * csize]
+            img[offset(c):offset(c) + len(chunk)] = chunk
+            metadata.append((offset(c), csize))
+        for sub in subdirs:
+            build(sub)
+
+    build("")
+
+    b = bytearray(512)
+    b[0:3] = b"\xEB\x76\x90"
+    b[3:11] = b"EXFAT   "
+    struct.pack_into("<QQIIIIII", b, 64, 0, total, fat_off, fat_len, heap_off, count, root, 0x1234)
+    struct.pack_into("<HH", b, 104, 0x100, 0)
+    b[108] = 9
+    b[109] = spc_shift
+    b[110] = 1
+    b[510:512] = b"\x55\xAA"
+    img[0:512] = b
+    table = b"".join(struct.pack("<I", v) for v in fat)
+    img[fat_off * bps:fat_off * bps + len(table)] = table
+    img[offset(bitmap_clusters[0]):offset(bitmap_clusters[0]) + len(bitmap)] = bitmap
+    metadata += [(fat_off * bps, in_use(fat) * 4), (offset(bitmap_clusters[0]), len(bitmap))]
+    finish(path, img, expected, metadata, mbr, 0x07)
+
+
+def main():
+    if len(sys.argv) < 3 or sys.argv[1] not in ("fat12", "fat16", "fat32", "exfat"):
+        sys.exit("usage: mkfatimage.py fat12|fat16|fat32|exfat <image> [frag] [mbr] [damaged]")
+    kind, path, flags = sys.argv[1], sys.argv[2], sys.argv[3:]
+    fragment, mbr, damaged = "frag" in flags, "mbr" in flags, "damaged" in flags
+    if kind == "exfat":
+        make_exfat(path, fragment, mbr, damaged)
+    else:
+        make_fat(path, int(kind[3:]), fragment, mbr, damaged)
+
+
+if __name__ == "__main__":
+    main()
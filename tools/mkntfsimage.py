@@ -0,0 +1,363 @@
+#!/usr/bin/env python3
+# Builds an NTFS image holding a known tree, for tools/check-volumes.sh.
+#
+#   mkntfsimage.py <image> [nolist] [gpt] [frag] [damaged] [oversized]
+#
+# The tree has resident, non-resident, sparse and partly initialised
+# streams, alternate data streams, a file split over an extension record,
+# hard links, DOS names, orphans, a deleted record, a compressed stream and
+# a torn record. $MFT itself is in two runs, found through an attribute
+# list unless nolist is given. gpt puts the volume in a GPT partition, frag
+# scatters files' clusters and damaged adds streams whose runs are short or
+# leave the volume, a directory loop, an overrun attribute and an
+# extension record of no valid base. oversized gives $MFT half the volume
+# for its size but keeps its runs, for a reader to refuse.
+# Writes <image>.expected, the lines volumecheck prints for the image, and
+# <image>.metadata, the "offset length" extents of its boot sector and MFT
+# records.
+import calendar
+import struct
+import sys
+import random
+
+rnd = random.Random(11)
+BPS, CLUSTER, RECORD = 512, 4096, 1024
+TOTAL_CLUSTERS = 16384
+MFT_RECORDS = 64
+MFT_RUNS = [(16, 8), (3000, 8)]
+ROOT = 5
+TIME = (2022, 3, 4, 5, 6, 7)
+FILETIME = calendar.timegm(TIME + (0, 0, 0)) * 10**7 + 116444736000000000 + 1234567
+MTIME_NS = (FILETIME - 116444736000000000) * 100
+
+
+def content(n):
+    return bytes(rnd.getrandbits(8) for _ in range(n))
+
+
+def fnv(data):
+    h = 0xcbf29ce484222325
+    for b in data:
+        h ^= b
+        h = (h * 0x100000001b3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+
+def align8(n):
+    return (n + 7) & ~7
+
+
+class Image:
+    def __init__(self, fragment):
+        self.data = bytearray(TOTAL_CLUSTERS * CLUSTER)
+        self.used = [False] * TOTAL_CLUSTERS
+        for c in range(100):
+            self.used[c] = True
+        for lcn, n in MFT_RUNS:
+            for c in range(lcn, lcn + n):
+                self.used[c] = True
+        self.cursor = 100
+        self.fragment = fragment
+        self.records = {}
+        self.sequence = {}
+        self.expected = []
+
+    def alloc(self, n):
+        """A list of (lcn, count) runs covering n clusters."""
+        runs = []
+        c = self.cursor
+        while n > 0:
+            while self.used[c]:
+                c += 1
+            start, k = c, 0
+            while k < min(n, 2 if self.fragment else n) and not self.used[c]:
+                self.used[c] = True
+                c += 1
+                k += 1
+            runs.append((start, k))
+            n -= k
+            if self.fragment:
+                c += 3
+        self.cursor = c
+        return runs
+
+    def write(self, runs, data):
+        off = 0
+        for lcn, n in runs:
+            if lcn is not None:
+                chunk = data[off:off + n * CLUSTER]
+                self.data[lcn * CLUSTER:lcn * CLUSTER + len(chunk)] = chunk
+            off += n * CLUSTER
+
+    def seq(self, number):
+        return self.sequence.get(number, number if number < 16 else number + 100)
+
+    def put(self, number, attrs, flags=1, seq=None, base=0):
+        """Writes an MFT record; flags 1 is in use, 3 an in-use directory."""
+        seq = self.seq(number) if seq is None else seq
+        self.sequence[number] = seq
+        body = b"".join(attrs)
+        r = bytearray(RECORD)
+        r[0:4] = b"FILE"
+        used = 0x38 + len(body) + 8
+        assert used <= RECORD, (number, used)
+        struct.pack_into("<HHQHHHHIIQHHI", r, 4, 0x30, 3, 0, seq, 1, 0x38, flags, used, RECORD, base, 7, 0, number)
+        r[0x38:0x38 + len(body)] = body
+        struct.pack_into("<II", r, 0x38 + len(body), 0xFFFFFFFF, 0)
+        # Update sequence array: each sector's last two bytes move to the
+        # array and are replaced by the update sequence number
+        usn = 0x0042
+        struct.pack_into("<HHH", r, 0x30, usn, struct.unpack_from("<H", r, 510)[0], struct.unpack_from("<H", r, 1022)[0])
+        struct.pack_into("<H", r, 510, usn)
+        struct.pack_into("<H", r, 1022, usn)
+        self.records[number] = r
+
+    def expect(self, path, data):
+        self.expected.append("%s|%d|%016x|0|%d" % (path, len(data), fnv(data), MTIME_NS))
+
+    def expect_error(self, path, error):
+        self.expected.append("%s|0|%016x|0|%d ERR %s" % (path, fnv(b""), MTIME_NS, error))
+
+
+def record_offset(number):
+    """Where an MFT record lands in the $MFT runs."""
+    off = number * RECORD
+    for lcn, n in MFT_RUNS:
+        if off < n * CLUSTER:
+            return lcn * CLUSTER + off
+        off -= n * CLUSTER
+    raise Exception("record %d is past the $MFT" % number)
+
+
+def signed(v, n):
+    return (v & ((1 << (8 * n)) - 1)).to_bytes(n, "little")
+
+
+def encode_runs(runs):
+    out = b""
+    prev = 0
+    for lcn, length in runs:
+        lb = (length.bit_length() + 7) // 8 or 1
+        if lcn is None:
+            out += bytes([lb]) + length.to_bytes(lb, "little")
+            continue
+        delta = lcn - prev
+        ob = 1
+        while not -(1 << (8 * ob - 1)) <= delta < (1 << (8 * ob - 1)):
+            ob += 1
+        out += bytes([(ob << 4) | lb]) + length.to_bytes(lb, "little") + signed(delta, ob)
+        prev = lcn
+    return out + b"\0"
+
+
+def resident(atype, value, name=""):
+    nm = name.encode("utf-16-le")
+    value_offset = align8(24 + len(nm))
+    total = align8(value_offset + len(value))
+    a = bytearray(total)
+    struct.pack_into("<IIBBHHH", a, 0, atype, total, 0, len(name), 24, 0, 0)
+    struct.pack_into("<IHBB", a, 16, len(value), value_offset, 0, 0)
+    a[24:24 + len(nm)] = nm
+    a[value_offset:value_offset + len(value)] = value
+    return bytes(a)
+
+
+def nonresident(atype, runs, start_vcn, size, valid=None, name="", flags=0, unit=0, allocated=None):
+    nm = name.encode("utf-16-le")
+    rb = encode_runs(runs)
+    runs_offset = align8(64 + len(nm))
+    total = align8(runs_offset + len(rb))
+    clusters = sum(n for _, n in runs)
+    a = bytearray(total)
+    struct.pack_into("<IIBBHHH", a, 0, atype, total, 1, len(name), 64, flags, 0)
+    struct.pack_into("<QQHHIQQQ", a, 16, start_vcn, start_vcn + clusters - 1, runs_offset, unit, 0,
+                     clusters * CLUSTER if allocated is None else allocated, size, size if valid is None else valid)
+    a[64:64 + len(nm)] = nm
+    a[runs_offset:runs_offset + len(rb)] = rb
+    return bytes(a)
+
+
+def std_info():
+    return resident(0x10, struct.pack("<QQQQI", FILETIME - 999, FILETIME, FILETIME, FILETIME, 0x20) + bytes(28))
+
+
+def file_name(parent, parent_seq, name, namespace=1):
+    u = name.encode("utf-16-le")
+    v = struct.pack("<QQQQQQQIIBB", parent | (parent_seq << 48), FILETIME, FILETIME, FILETIME, FILETIME,
+                    0, 0, 0, 0, len(u) // 2, namespace) + u
+    return resident(0x30, v)
+
+
+def build(img, use_list, damaged, oversized):
+    def fn(parent, name, namespace=1):
+        return file_name(parent, img.seq(parent), name, namespace)
+
+    def data(payload, name="", valid=None):
+        if len(payload) <= 300 and valid is None:
+            return resident(0x80, payload, name)
+        n = (len(payload) + CLUSTER - 1) // CLUSTER
+        runs = img.alloc(n)
+        img.write(runs, payload if valid is None else payload[:valid] + content(n * CLUSTER - valid))
+        return nonresident(0x80, runs, 0, len(payload), valid, name)
+
+    # Metafiles; record 0's extension keeps its sequence number (1) in the
+    # base reference, as on real volumes
+    mft_size = TOTAL_CLUSTERS // 2 * CLUSTER if oversized else MFT_RECORDS * RECORD
+    if use_list:
+        def entry(atype, vcn, ref, seq):
+            e = bytearray(32)
+            struct.pack_into("<IHBBQQH", e, 0, atype, 32, 0, 26, vcn, ref | (seq << 48), 0)
+            return bytes(e)
+        attribute_list = entry(0x10, 0, 0, 1) + entry(0x30, 0, 0, 1) + entry(0x80, 0, 0, 1) + entry(0x80, 8, 15, 15)
+        img.put(0, [std_info(), resident(0x20, attribute_list), file_name(ROOT, ROOT, "$MFT"),
+                    nonresident(0x80, [MFT_RUNS[0]], 0, mft_size, allocated=mft_size)], seq=1)
+        img.put(15, [nonresident(0x80, [MFT_RUNS[1]], 8, 0)], base=1 << 48)
+    else:
+        img.put(0, [std_info(), file_name(ROOT, ROOT, "$MFT"), nonresident(0x80, MFT_RUNS, 0, mft_size)], seq=1)
+    names = ["$MFT", "$MFTMirr", "$LogFile", "$Volume", "$AttrDef", ".", "$Bitmap", "$Boot", "$BadClus",
+             "$Secure", "$UpCase", "$Extend"]
+    for i in range(1, 12):
+        directory = i in (ROOT, 11)
+        attrs = [std_info(), file_name(ROOT, ROOT, names[i])]
+        if not directory:
+            attrs.append(resident(0x80, b"metafile %d" % i))
+        img.put(i, attrs, flags=3 if directory else 1)
+
+    img.put(16, [std_info(), fn(ROOT, "docs")], flags=3)
+    d = b"hello from a resident file\n"
+    img.put(17, [std_info(), fn(ROOT, "README.TXT", 2), fn(ROOT, "readme.txt", 1), resident(0x80, d)])
+    img.expect("readme.txt", d)
+    d = content(200000)
+    if damaged:
+        # The size claims more than the runs map
+        attr = bytearray(data(d))
+        struct.pack_into("<Q", attr, 48, 10 * len(d))
+        img.put(18, [std_info(), fn(16, "big.bin"), bytes(attr)])
+        img.expect_error("docs/big.bin", "Bad data runs")
+    else:
+        img.put(18, [std_info(), fn(16, "big.bin"), data(d)])
+        img.expect("docs/big.bin", d)
+    # Sparse: a cluster of data, three unallocated, then the rest
+    d1, d2 = content(CLUSTER), content(CLUSTER - 100)
+    r1, r2 = img.alloc(1), img.alloc(1)
+    img.write(r1, d1)
+    img.write(r2, d2)
+    img.put(19, [std_info(), fn(ROOT, "sparse.vhd"),
+                 nonresident(0x80, r1 + [(None, 3)] + r2, 0, 5 * CLUSTER - 100, flags=0x8000)])
+    img.expect("sparse.vhd", d1 + bytes(3 * CLUSTER) + d2)
+    main, zone, payload = b"main stream", b"[ZoneTransfer]\r\nZoneId=3\r\n", content(10000)
+    img.put(20, [std_info(), fn(ROOT, "ads.txt"), resident(0x80, main), resident(0x80, zone, "Zone.Identifier"),
+                 data(payload, "payload")])
+    img.expect("ads.txt", main)
+    img.expect("ads.txt:Zone.Identifier", zone)
+    img.expect("ads.txt:payload", payload)
+    # Only the first 3000 bytes were ever written
+    d = content(5000)
+    img.put(21, [std_info(), fn(ROOT, "unicode 文件 ü.dat"), data(d, valid=3000)])
+    img.expect("unicode 文件 ü.dat", d[:3000] + bytes(2000))
+    img.put(22, [std_info(), fn(16, "deep")], flags=3)
+    img.put(23, [std_info(), fn(22, "er")], flags=3)
+    # The second half of the runs is in an extension record
+    d = content(5 * CLUSTER - 7)
+    ra, rb = img.alloc(2), img.alloc(3)
+    img.write(ra, d[:2 * CLUSTER])
+    img.write(rb, d[2 * CLUSTER:])
+    img.put(25, [nonresident(0x80, rb, 2, 0)], base=24 | (img.seq(24) << 48))
+    img.put(24, [std_info(), fn(23, "x.exe"), nonresident(0x80, ra, 0, len(d), allocated=5 * CLUSTER)])
+    img.expect("docs/deep/er/x.exe", d)
+    d = b"orphaned"
+    img.put(26, [std_info(), file_name(40, 140, "lost.doc"), resident(0x80, d)])
+    img.expect("$OrphanFiles/lost.doc", d)
+    d = b"stale parent"
+    img.put(27, [std_info(), file_name(16, 999, "stale.doc"), resident(0x80, d)])
+    img.expect("$OrphanFiles/stale.doc", d)
+    img.put(28, [std_info(), fn(16, "deleted.doc"), resident(0x80, b"gone")], flags=0)
+    img.put(29, [std_info(), fn(16, "packed.cmp"), nonresident(0x80, img.alloc(1), 0, 3000, flags=0x0001, unit=4)])
+    img.expect_error("docs/packed.cmp", "Compressed NTFS streams are not supported")
+    img.put(30, [std_info(), fn(11, "$UsnJrnl"), resident(0x80, b"journal", "$J")])
+    d = b"stream on a directory"
+    img.put(31, [std_info(), fn(ROOT, "emptydir"), resident(0x80, d, "dirstream")], flags=3)
+    img.expect("emptydir:dirstream", d)
+    img.put(32, [std_info(), fn(ROOT, "many")], flags=3)
+    for i in range(20):
+        d = content(rnd.choice([0, 50, 280, 700, 9000, 33000]))
+        img.put(33 + i, [std_info(), fn(32, "f%02d.bin" % i), data(d)])
+        img.expect("many/f%02d.bin" % i, d)
+    d = b"hard linked"
+    img.put(53, [std_info(), fn(16, "link-a.txt"), fn(ROOT, "link-b.txt"), resident(0x80, d)])
+    img.expect("docs/link-a.txt", d)
+    # Torn mid-write: the fixup does not match, so the record is skipped
+    img.put(54, [std_info(), fn(ROOT, "torn.txt"), resident(0x80, b"torn")])
+    img.records[54][510] ^= 0xFF
+
+    if damaged:
+        # Runs past the end of the volume
+        img.put(55, [std_info(), fn(ROOT, "far.bin"), nonresident(0x80, [(TOTAL_CLUSTERS - 1, 4)], 0, 3 * CLUSTER)])
+        img.expect_error("far.bin", "Bad data runs")
+        # Two directories, each the other's parent
+        img.put(56, [std_info(), fn(57, "loop-a")], flags=3)
+        img.put(57, [std_info(), fn(56, "loop-b")], flags=3)
+        d = b"trapped"
+        img.put(58, [std_info(), fn(56, "trapped.txt"), resident(0x80, d)])
+        img.expect("$OrphanFiles/loop-b/loop-a/trapped.txt", d)
+        # A value running past its attribute
+        attr = bytearray(resident(0x80, b"overrun"))
+        struct.pack_into("<I", attr, 16, 0x10000)
+        img.put(59, [std_info(), fn(ROOT, "overrun.txt"), bytes(attr)])
+        # An extension record for a base outside the MFT
+        img.put(60, [resident(0x80, b"stray", "stray")], base=5000 | (1 << 48))
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: mkntfsimage.py <image> [nolist] [gpt] [frag] [damaged] [oversized]")
+    path, flags = sys.argv[1], sys.argv[2:]
+    img = Image("frag" in flags)
+    build(img, "nolist" not in flags, "damaged" in flags, "oversized" in flags)
+
+    mft = bytearray(MFT_RECORDS * RECORD)
+    for n, r in img.records.items():
+        mft[n * RECORD:(n + 1) * RECORD] = r
+    img.write(MFT_RUNS, mft)
+
+    b = bytearray(512)
+    b[0:3] = b"\xEB\x52\x90"
+    b[3:11] = b"NTFS    "
+    struct.pack_into("<HB", b, 11, BPS, CLUSTER // BPS)
+    b[21] = 0xF8
+    struct.pack_into("<QQQ", b, 40, TOTAL_CLUSTERS * CLUSTER // BPS - 1, MFT_RUNS[0][0], 2)
+    b[64] = 0xF6  # 1 KiB records
+    b[68] = 1
+    b[510:512] = b"\x55\xAA"
+    out = img.data
+    out[0:512] = b
+
+    start = 0
+    if "gpt" in flags:
+        start = 2048 * 512
+        pre = bytearray(start)
+        pre[446:462] = struct.pack("<B3sB3sII", 0, b"\0\0\0", 0xEE, b"\0\0\0", 1, 0xFFFFFFFF)
+        pre[510:512] = b"\x55\xAA"
+        header = bytearray(512)
+        header[0:8] = b"EFI PART"
+        struct.pack_into("<QII", header, 72, 2, 128, 128)
+        pre[512:1024] = header
+        e = bytearray(128)
+        e[0:16] = bytes(range(1, 17))
+        struct.pack_into("<QQ", e, 32, 2048, 2048 + len(out) // 512 - 1)
+        pre[1024:1152] = e
+        out = pre + out + bytes(64 * 512)
+
+    with open(path, "wb") as f:
+        f.write(out)
+    with open(path + ".expected", "w") as f:
+        for line in sorted(img.expected):
+            f.write(line + "\n")
+    with open(path + ".metadata", "w") as f:
+        f.write("%d 512\n" % start)
+        for n in sorted(img.records):
+            f.write("%d %d\n" % (start + record_offset(n), RECORD))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,202 @@
+// File read pipeline benchmark: workers reading their own files against
+// AsyncFileReader's io_uring and pread-thread backends.
+//
+//   readbench <directory> [workers] [queue-depth] [rounds]
+//
+// Reads every regular file below the directory the way a quick scan does:
+// blocking reads with each of the workers taking the next file, then the
+// same files through AsyncFileReader with the workers only consuming
+// chunks. The page cache is dropped before each pass (drop_caches when run
+// as root, else POSIX_FADV_DONTNEED on every file), the passes take turns
+// each round and the best time of each is kept.
+
+#include "../core/scan/AsyncFileReader.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <ftw.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const size_t kReadBytes = 1 << 20;
+
+double seconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Root only; false when each file has to be dropped by itself
+bool dropPageCache()
+{
+    sync();
+    FILE *f = fopen("/proc/sys/vm/drop_caches", "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fputs("1\n", f) >= 0;
+    return fclose(f) == 0 && ok;
+}
+
+void dropFiles(const std::vector<std::string> &files)
+{
+    if (dropPageCache()) {
+        return;
+    }
+    for (const std::string &path : files) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+}
+
+std::vector<std::string> listFiles(const std::string &root)
+{
+    static std::vector<std::string> *out;
+    std::vector<std::string> files;
+    out = &files;
+    nftw(root.c_str(), [](const char *path, const struct stat *st, int type, struct FTW *) {
+        if (type == FTW_F && S_ISREG(st->st_mode)) {
+            out->push_back(path);
+        }
+        return 0;
+    }, 64, FTW_PHYS);
+    return files;
+}
+
+// Stands in for hashing: touches one word per cache line
+uint64_t consume(const uint8_t *data, size_t length)
+{
+    uint64_t acc = 0;
+    for (size_t i = 0; i < length; i += 64) {
+        acc += data[i];
+    }
+    return acc;
+}
+
+uint64_t blocking(const std::vector<std::string> &files, int workers)
+{
+    std::atomic<size_t> nextFile{0};
+    std::atomic<uint64_t> bytes{0};
+    std::vector<std::thread> threads;
+    for (int w = 0; w < workers; ++w) {
+        threads.emplace_back([&]() {
+            std::vector<uint8_t> buffer(kReadBytes);
+            uint64_t acc = 0;
+            for (size_t i; (i = nextFile++) < files.size();) {
+                int fd = open(files[i].c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    continue;
+                }
+                ssize_t n;
+                while ((n = read(fd, buffer.data(), buffer.size())) > 0) {
+                    acc += consume(buffer.data(), size_t(n));
+                    bytes += uint64_t(n);
+                }
+                close(fd);
+            }
+            if (acc == 1) {
+                fputc(' ', stderr);
+            }
+        });
+    }
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    return bytes;
+}
+
+uint64_t pipelined(const std::vector<std::string> &files, int workers, int depth, AsyncFileReader::Backend backend,
+                   AsyncFileReader::Backend *used)
+{
+    AsyncFileReader::Options options;
+    options.backend = backend;
+    options.queueDepth = depth;
+    AsyncFileReader reader(options);
+    std::string error;
+    if (!reader.start(&error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 0;
+    }
+    *used = reader.backend();
+
+    std::atomic<uint64_t> bytes{0};
+    std::thread producer([&]() {
+        for (const std::string &path : files) {
+            reader.add(path);
+        }
+        reader.finishAdding();
+    });
+    std::vector<std::thread> threads;
+    for (int w = 0; w < workers; ++w) {
+        threads.emplace_back([&]() {
+            uint64_t acc = 0;
+            while (AsyncFileReader::File *file = reader.next()) {
+                AsyncFileReader::Chunk chunk;
+                while (reader.read(file, &chunk)) {
+                    acc += consume(chunk.data, chunk.length);
+                    bytes += chunk.length;
+                }
+                reader.release(file);
+            }
+            if (acc == 1) {
+                fputc(' ', stderr);
+            }
+        });
+    }
+    producer.join();
+    for (std::thread &t : threads) {
+        t.join();
+    }
+    return bytes;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <directory> [workers] [queue-depth] [rounds]\n", argv[0]);
+        return 2;
+    }
+    std::vector<std::string> files = listFiles(argv[1]);
+    int workers = argc > 2 ? std::max(1, atoi(argv[2])) : int(std::max(1u, std::thread::hardware_concurrency()));
+    int depth = argc > 3 ? std::max(1, atoi(argv[3])) : 32;
+    int rounds = argc > 4 ? std::max(1, atoi(argv[4])) : 3;
+
+    double best[3] = {1e9, 1e9, 1e9};
+    uint64_t bytes[3] = {0, 0, 0};
+    AsyncFileReader::Backend used[2] = {AsyncFileReader::IoUring, AsyncFileReader::ThreadPool};
+    for (int round = 0; round < rounds; ++round) {
+        dropFiles(files);
+        auto start = std::chrono::steady_clock::now();
+        bytes[0] = blocking(files, workers);
+        best[0] = std::min(best[0], seconds(start));
+
+        for (int b = 0; b < 2; ++b) {
+            dropFiles(files);
+            start = std::chrono::steady_clock::now();
+            AsyncFileReader::Backend backend = b == 0 ? AsyncFileReader::Auto : AsyncFileReader::ThreadPool;
+            bytes[b + 1] = pipelined(files, workers, depth, backend, &used[b]);
+            best[b + 1] = std::min(best[b + 1], seconds(start));
+        }
+    }
+
+    printf("%zu files, %d workers, queue depth %d\n", files.size(), workers, depth);
+    const char *names[3] = {"blocking reads", AsyncFileReader::backendName(used[0]),
+                            AsyncFileReader::backendName(used[1])};
+    for (int i = 0; i < 3; ++i) {
+        printf("%-16s %8.1f MiB %8.1f MB/s %9.0f files/s\n", names[i], bytes[i] / 1048576.0, bytes[i] / 1e6 / best[i],
+               files.size() / best[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+// Rule engine check: compiles rules and runs them over generated inputs,
+// for ctest.
+//
+//   rulecheck [random rounds]
+//
+// Fixed cases cover jump bounds, arithmetic overflow, the offsets kept per
+// string and inputs that once took exponential time; random ones compare #s
+// for hex strings with jumps against a brute-force match. Prints one line
+// per failure and exits 1 if any.
+
+#include "../core/scan/RuleSet.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+int failures = 0;
+
+// Names of the rules that hold, in id order, then "[limit]" if the scanner
+// dropped offsets; fed in chunks of chunkSize
+std::string run(const RuleSet &rules, const std::string &data, size_t chunkSize)
+{
+    RuleSet::Scanner scanner(rules);
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+    for (size_t offset = 0; offset < data.size(); offset += chunkSize) {
+        scanner.feed(bytes + offset, std::min(chunkSize, data.size() - offset));
+    }
+    std::string names;
+    for (uint32_t rule : scanner.finish()) {
+        names += (names.empty() ? "" : " ") + rules.ruleName(rule);
+    }
+    if (scanner.limitReached()) {
+        names += names.empty() ? "[limit]" : " [limit]";
+    }
+    return names;
+}
+
+void expect(const std::string &name, const std::string &source, const std::string &data, const std::string &matched)
+{
+    RuleSet rules;
+    std::string error;
+    if (!rules.compile(source, &error)) {
+        printf("FAIL: %s: %s\n", name.c_str(), error.c_str());
+        ++failures;
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (size_t chunkSize : {size_t(7), size_t(64 * 1024)}) {
+        std::string got = run(rules, data, chunkSize);
+        if (got != matched) {
+            printf("FAIL: %s (chunks of %zu): matched \"%s\", expected \"%s\"\n", name.c_str(), chunkSize,
+                   got.c_str(), matched.c_str());
+            ++failures;
+            return;
+        }
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    printf("ok: %s (%lld ms)\n", name.c_str(), static_cast<long long>(ms.count()));
+}
+
+std::string rule(const std::string &name, const std::string &strings, const std::string &condition)
+{
+    return "rule " + name + " {\n strings:\n" + strings + "\n condition:\n " + condition + "\n}\n";
+}
+
+// A hex string of literal pieces separated by [low-high] jumps
+struct Pattern {
+    std::vector<std::string> pieces;
+    std::vector<uint32_t> low;   // jump before piece k, k >= 1
+    std::vector<uint32_t> high;
+
+    std::string hex() const
+    {
+        static const char digits[] = "0123456789ABCDEF";
+        std::string out;
+        for (size_t k = 0; k < pieces.size(); ++k) {
+            if (k > 0) {
+                out += " [" + std::to_string(low[k]) + "-" + std::to_string(high[k]) + "]";
+            }
+            for (unsigned char c : pieces[k]) {
+                out += std::string(" ") + digits[c >> 4] + digits[c & 15];
+            }
+        }
+        return "{" + out + " }";
+    }
+
+    bool matchFrom(const std::string &data, size_t k, size_t position) const
+    {
+        if (data.compare(position, pieces[k].size(), pieces[k]) != 0) {
+            return false;
+        }
+        if (k + 1 == pieces.size()) {
+            return true;
+        }
+        size_t end = position + pieces[k].size();
+        for (size_t next = end + low[k + 1]; next <= end + high[k + 1] && next < data.size(); ++next) {
+            if (matchFrom(data, k + 1, next)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t count(const std::string &data) const
+    {
+        size_t n = 0;
+        for (size_t p = 0; p < data.size(); ++p) {
+            n += matchFrom(data, 0, p) ? 1 : 0;
+        }
+        return n;
+    }
+};
+
+void fixedCases()
+{
+    const std::string jumps = rule("jumps", "  $a = { 41 42 [2-3] 43 }", "$a");
+    expect("jump too short", jumps, "xxAB.Cxx", "");
+    expect("jump at low bound", jumps, "xxAB..Cxx", "jumps");
+    expect("jump at high bound", jumps, "xxAB...Cxx", "jumps");
+    expect("jump too long", jumps, "xxAB....Cxx", "");
+
+    const std::string offsets = rule("offsets", "  $a = { 41 [1-4] 42 [0-1] 43 }", "#a == 2 and @a[1] == 3 and @a[2] == 20");
+    expect("chain offsets", offsets, "xxxA..BCxxxxxxxxxxxxA.BxCxxA...B", "offsets");
+
+    // Results outside int64 are undefined, and undefined stays so under "not"
+    const std::string min = "(-922337203685477580 * 10 - 8)";
+    const std::string arithmetic =
+        rule("sum", "", "filesize + 999999999999999999 * 10 > 0")
+        + rule("product", "", "filesize * 999999999999999999 * 999999999999999999 != 0")
+        + rule("difference", "", "not (" + min + " - filesize < 0)")
+        + rule("quotient", "", "not (" + min + " \\ -1 > 0)")
+        + rule("remainder", "", "not (" + min + " % -1 == 0)")
+        + rule("negation", "", "not (-" + min + " > 0)")
+        + rule("sane", "", "filesize * 2 - 1 == 9 and filesize \\ 2 == 2 and -filesize % 3 == -2 and 1MB == 1048576");
+    expect("arithmetic overflow", arithmetic, "12345", "sane");
+
+    // Counts stay exact past the offsets kept; reading offsets past them is
+    // reported, since the verdict may be wrong
+    const std::string many = std::string(20000, 'A');
+    expect("counted past the limit", rule("counted", "  $a = \"A\"", "#a == 20000 and $a"), many, "counted");
+    expect("offsets past the limit", rule("offsets", "  $a = \"A\"", "@a[20000] == 19999"), many, "[limit]");
+    expect("jumps past the limit", rule("jumps", "  $a = { 41 [0-1] 41 }", "#a == 19999"), many, "[limit]");
+
+    // Every A is a candidate start and every pair of jumps overlaps, so
+    // trying each path took exponential time
+    const std::string blowup =
+        rule("blowup", "  $a = { 41 41 [0-100000] 41 41 [0-100000] 41 41 [0-100000] 42 42 }", "$a");
+    expect("4 KB of A", blowup, std::string(4096, 'A'), "");
+    expect("40 KB of A", blowup, std::string(40960, 'A'), "[limit]");
+    expect("40 KB of A then BB", blowup, std::string(40960, 'A') + "BB", "blowup [limit]");
+}
+
+void randomCases(int rounds)
+{
+    std::mt19937_64 rng(1);
+    for (int round = 0; round < rounds; ++round) {
+        std::string data(64 + rng() % 512, 'A');
+        for (char &c : data) {
+            c = "AB"[rng() % 4 == 0];
+        }
+        Pattern pattern;
+        size_t pieces = 2 + rng() % 3;
+        for (size_t k = 0; k < pieces; ++k) {
+            std::string piece(1 + rng() % 2, 'A');
+            for (char &c : piece) {
+                c = "AB"[rng() % 2];
+            }
+            uint32_t low = uint32_t(rng() % 6);
+            pattern.pieces.push_back(piece);
+            pattern.low.push_back(low);
+            pattern.high.push_back(low + uint32_t(rng() % 8));
+        }
+        size_t n = pattern.count(data);
+        expect("random " + std::to_string(round) + " (" + std::to_string(n) + " hits)",
+               rule("random", "  $a = " + pattern.hex(), "#a == " + std::to_string(n)), data, "random");
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    fixedCases();
+    randomCases(rounds);
+    if (failures != 0) {
+        printf("%d rule check(s) failed\n", failures);
+        return 1;
+    }
+    printf("All rule checks passed\n");
+    return 0;
+}
@@ -0,0 +1,116 @@
+// Signature matcher benchmark: per-core scan rate against pattern-set size.
+//
+//   sigbench [megabytes] [pattern counts...]
+//
+// Generates random patterns (8-32 bytes, about a fifth with a wildcard gap)
+// and a random buffer with a few planted occurrences, then reports compile
+// time, automaton size and single-threaded throughput for each set size.
+
+#include "../core/scan/SignatureMatcher.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string randomPattern(std::mt19937_64 &rng)
+{
+    static const char digits[] = "0123456789abcdef";
+    size_t length = 8 + rng() % 25;
+    size_t gap = rng() % 5 == 0 ? 1 + rng() % (length / 2) : length;
+    std::string hex;
+    for (size_t i = 0; i < length; ++i) {
+        if (i == gap) {
+            hex += "??";
+            continue;
+        }
+        uint8_t b = uint8_t(rng());
+        hex += digits[b >> 4];
+        hex += digits[b & 15];
+    }
+    return hex;
+}
+
+void plant(const std::string &hex, uint8_t *at, std::mt19937_64 &rng)
+{
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        if (hex[i] == '?') {
+            at[i / 2] = uint8_t(rng());
+        } else {
+            at[i / 2] = uint8_t(std::stoi(hex.substr(i, 2), nullptr, 16));
+        }
+    }
+}
+
+double seconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t megabytes = argc > 1 ? size_t(atoi(argv[1])) : 256;
+    std::vector<size_t> counts;
+    for (int i = 2; i < argc; ++i) {
+        counts.push_back(size_t(atoi(argv[i])));
+    }
+    if (counts.empty()) {
+        counts = {1000, 10000, 100000};
+    }
+
+    std::mt19937_64 rng(42);
+    std::vector<uint8_t> buffer(megabytes << 20);
+    for (size_t i = 0; i + 8 <= buffer.size(); i += 8) {
+        uint64_t v = rng();
+        memcpy(&buffer[i], &v, 8);
+    }
+
+    printf("%-9s %-10s %-6s %-9s %-9s %-7s %-8s %-10s %-8s %s\n",
+           "patterns", "compile_ms", "mode", "states", "mem_MiB", "first", "pairs", "prefilter", "matches", "MB/s");
+    for (size_t count : counts) {
+        SignatureMatcher matcher;
+        std::vector<std::string> hexes;
+        for (size_t i = 0; i < count; ++i) {
+            hexes.push_back(randomPattern(rng));
+            std::string error;
+            if (matcher.add("sig" + std::to_string(i), hexes.back(), &error) < 0) {
+                fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        std::string error;
+        if (!matcher.compile(&error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        double compileMs = seconds(start) * 1000;
+
+        std::vector<uint8_t> data = buffer;
+        for (size_t i = 0; i < 64; ++i) {
+            plant(hexes[rng() % hexes.size()], &data[rng() % (data.size() - 64)], rng);
+        }
+
+        // Scanned the way the engine does it: 1 MiB chunks through a stream
+        std::vector<SignatureMatcher::Match> matches;
+        SignatureStream stream(matcher);
+        start = std::chrono::steady_clock::now();
+        for (size_t offset = 0; offset < data.size(); offset += 1 << 20) {
+            size_t length = std::min<size_t>(1 << 20, data.size() - offset);
+            stream.feed(data.data() + offset, length, matches);
+        }
+        double elapsed = seconds(start);
+
+        SignatureMatcher::Stats s = matcher.stats();
+        printf("%-9zu %-10.1f %-6.6s %-9zu %-9.1f %-7zu %-8.3f %-10s %-8zu %.0f\n",
+               count, compileMs, s.mode, s.states, s.memoryBytes / 1048576.0, s.firstBytes,
+               s.pairDensity, s.prefilter, matches.size(), double(data.size()) / 1e6 / elapsed);
+    }
+    return 0;
+}
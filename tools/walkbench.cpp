@@ -0,0 +1,111 @@
+// Directory enumeration benchmark: DirectoryWalker against a serial walk.
+//
+//   walkbench <directory> [threads] [rounds]
+//
+// Lists every regular file below the directory with nftw (one thread,
+// readdir and a stat per entry, as QDirIterator does) and with
+// DirectoryWalker at 1, 2, 4 ... threads. Run as root, each pass starts
+// with dentries and inodes dropped (drop_caches 3), which is what a
+// freshly plugged drive looks like; otherwise every pass but the first
+// walks a warm cache. The passes take turns each round and the best time
+// of each is kept.
+
+#include "../core/scan/DirectoryWalker.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ftw.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+double seconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+bool dropCaches()
+{
+    sync();
+    FILE *f = fopen("/proc/sys/vm/drop_caches", "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = fputs("3\n", f) >= 0;
+    return fclose(f) == 0 && ok;
+}
+
+uint64_t serial(const std::string &root)
+{
+    static uint64_t files;
+    files = 0;
+    nftw(root.c_str(), [](const char *, const struct stat *st, int type, struct FTW *) {
+        if (type == FTW_F && S_ISREG(st->st_mode)) {
+            ++files;
+        }
+        return 0;
+    }, 64, FTW_PHYS);
+    return files;
+}
+
+uint64_t parallel(const std::string &root, int threads)
+{
+    DirectoryWalker::Options options;
+    options.threads = threads;
+    DirectoryWalker walker(options);
+    std::atomic<uint64_t> files{0};
+    walker.walk(root, [&files](std::vector<DirectoryWalker::Entry> &batch) {
+        files += batch.size();
+        return true;
+    });
+    return files;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <directory> [threads] [rounds]\n", argv[0]);
+        return 2;
+    }
+    std::string root = argv[1];
+    int maxThreads = argc > 2 ? std::max(1, atoi(argv[2])) : 8;
+    int rounds = argc > 3 ? std::max(1, atoi(argv[3])) : 3;
+
+    std::vector<int> threads;
+    for (int t = 1; t <= maxThreads; t *= 2) {
+        threads.push_back(t);
+    }
+    std::vector<double> best(threads.size() + 1, 1e9);
+    std::vector<uint64_t> files(threads.size() + 1, 0);
+    bool cold = true;
+    for (int round = 0; round < rounds; ++round) {
+        cold = dropCaches() && cold;
+        auto start = std::chrono::steady_clock::now();
+        files[0] = serial(root);
+        best[0] = std::min(best[0], seconds(start));
+        for (size_t i = 0; i < threads.size(); ++i) {
+            dropCaches();
+            start = std::chrono::steady_clock::now();
+            files[i + 1] = parallel(root, threads[i]);
+            best[i + 1] = std::min(best[i + 1], seconds(start));
+        }
+    }
+
+    printf("%s cache\n", cold ? "cold" : "warm");
+    printf("%-22s %8llu files %8.3f s %10.0f files/s\n", "nftw, 1 thread", static_cast<unsigned long long>(files[0]),
+           best[0], files[0] / best[0]);
+    for (size_t i = 0; i < threads.size(); ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "walker, %d thread%s", threads[i], threads[i] == 1 ? "" : "s");
+        printf("%-22s %8llu files %8.3f s %10.0f files/s\n", name, static_cast<unsigned long long>(files[i + 1]),
+               best[i + 1], files[i + 1] / best[i + 1]);
+    }
+    return 0;
+}